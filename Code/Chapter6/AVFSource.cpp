@@ -1,1327 +1,2336 @@
-#include "stdafx.h"
-#include "AVFSource.h"
-
-
-//
-// Create an instance of the AVFSource object
-//
-HRESULT AVFSource::CreateInstance(AVFSource** ppAVFSource)
-{
-    HRESULT hr = S_OK;
-    AVFSource* pAVFSource = NULL;
-
-    do
-    {
-        BREAK_ON_NULL (ppAVFSource, E_POINTER);
-
-        // create an instance of the object
-        AVFSource* pAVFSource = new (std::nothrow) AVFSource(&hr);
-        BREAK_ON_NULL(pAVFSource, E_OUTOFMEMORY);        
-        BREAK_ON_FAIL(hr);
-
-        // Set the out pointer.
-        *ppAVFSource = pAVFSource;
-    }
-    while(false);
-
-    if (FAILED(hr) && pAVFSource != NULL)
-    {
-        delete pAVFSource;
-    }
-
-    return hr;
-}
-
-
-
-//
-// Standard IUnknown interface implementation
-//
-ULONG AVFSource::AddRef()
-{
-    return InterlockedIncrement(&m_cRef);
-}
-
-ULONG AVFSource::Release()
-{
-    ULONG refCount = InterlockedDecrement(&m_cRef);
-    if (refCount == 0)
-    {
-        delete this;
-    }
-    
-    return refCount;
-}
-
-HRESULT AVFSource::QueryInterface(REFIID riid, void** ppv)
-{
-    HRESULT hr = S_OK;
-
-    if (ppv == NULL)
-    {
-        return E_POINTER;
-    }
-
-    if (riid == IID_IUnknown)
-    {
-        *ppv = static_cast<IUnknown*>(static_cast<IMFMediaEventGenerator*>(this));
-    }
-    else if (riid == IID_IMFMediaEventGenerator)
-    {
-        *ppv = static_cast<IMFMediaEventGenerator*>(this);
-    }
-    else if (riid == IID_IMFMediaSource)
-    {
-        *ppv = static_cast<IMFMediaSource*>(this);
-    }
-    else if (riid == IID_IMFAsyncCallback)
-    {
-        *ppv = static_cast<IMFAsyncCallback*>(this);
-    }
-    else
-    {
-        *ppv = NULL;
-        hr = E_NOINTERFACE;
-    }
-
-    if(SUCCEEDED(hr))
-        AddRef();
-
-    return hr;
-}
-
-
-
-//
-//  IMFMediaEventGenerator interface implementation
-//
-////////////////////////////////////////////////////////////////////////
-
-
-//
-// Begin processing an event from the event queue asynchronously
-//
-HRESULT AVFSource::BeginGetEvent(
-            IMFAsyncCallback* pCallback,    // callback of the object interested in events
-            IUnknown* punkState)            // some custom state object returned with event
-{
-    HRESULT hr = S_OK;
-    CComPtr<IMFMediaEventQueue> pLocQueue = m_pEventQueue;
-    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-    do
-    {
-        // make sure the source is not shut down
-        hr = CheckShutdown();
-        BREAK_ON_FAIL(hr);
-
-        // get the next event from the event queue
-        hr = pLocQueue->BeginGetEvent(pCallback, punkState);
-    }
-    while(false);
-
-    return hr;
-}
-
-//
-// Complete asynchronous event processing
-//
-HRESULT AVFSource::EndGetEvent(
-            IMFAsyncResult* pResult,    // result of an asynchronous operation
-            IMFMediaEvent** ppEvent)    // event extracted from the queue
-{
-    HRESULT hr = S_OK;
-    CComPtr<IMFMediaEventQueue> pLocQueue = m_pEventQueue;
-    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-    do
-    {
-        // make sure the source is not shut down
-        hr = CheckShutdown();
-        BREAK_ON_FAIL(hr);
-
-        hr = pLocQueue->EndGetEvent(pResult, ppEvent);
-        BREAK_ON_FAIL(hr);
-    }
-    while(false);
-
-    return hr;
-}
-
-
-//
-// Synchronously retrieve the next event from the event queue
-//
-HRESULT AVFSource::GetEvent(
-            DWORD dwFlags,              // flag with the event behavior
-            IMFMediaEvent** ppEvent)    // event extracted from the queue
-{
-    HRESULT hr = S_OK;
-    CComPtr<IMFMediaEventQueue> pLocQueue = m_pEventQueue;
-
-    do
-    {
-        // Check whether the source is shut down but do it in a separate locked section-
-        // GetEvent() may block, and we don't want to hold the critical section during
-        // that time.
-        {
-            CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-            hr = CheckShutdown();
-            BREAK_ON_FAIL(hr);
-        }
-
-        // Get the event from the queue - note, may block!
-        hr = pLocQueue->GetEvent(dwFlags, ppEvent);
-        BREAK_ON_FAIL(hr);
-    }
-    while(false);
-
-    return hr;
-}
-
-//
-// Store the event in the internal event queue of the source
-//
-HRESULT AVFSource::QueueEvent(
-            MediaEventType met,             // media event type
-            REFGUID guidExtendedType,       // GUID_NULL for standard events or an extension GUID
-            HRESULT hrStatus,               // status of the operation
-            const PROPVARIANT* pvValue)     // a VARIANT with some event value or NULL
-{
-    HRESULT hr = S_OK;
-    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-    do
-    {
-        // make sure the source is not shut down
-        hr = CheckShutdown();
-        BREAK_ON_FAIL(hr);
-
-        // queue the passed in event on the internal event queue
-        hr = m_pEventQueue->QueueEventParamVar(met, guidExtendedType, hrStatus, pvValue);
-        BREAK_ON_FAIL(hr);
-    }
-    while(false);
-
-    return hr;
-}
-
-
-
-
-
-/////////////////////////////////////////////////////////////////////////
-// IMFAsyncCallback implementation
-/////////////////////////////////////////////////////////////////////////
-
-//
-// Get the behavior information (duration, etc.) of the asynchronous callback operation - 
-// not implemented.
-//
-HRESULT AVFSource::GetParameters(DWORD*, DWORD*)
-{
-    return E_NOTIMPL;
-}
-
-
-// 
-// Do an asynchronous task - execute a queued command (operation).
-//
-HRESULT AVFSource::Invoke(IMFAsyncResult* pResult)
-{
-    HRESULT hr = S_OK;
-    CComPtr<IMFAsyncResult> pAsyncResult = pResult;
-    CComPtr<IMFAsyncResult> pCallerResult;
-    CComPtr<ISourceOperation> pCommand;
-    CComPtr<IUnknown> pState;
-
-    do
-    {
-        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-        // Get the state object associated with this asynchronous call
-        hr = pAsyncResult->GetState(&pState);
-        BREAK_ON_FAIL(hr);
-
-        // QI the IUnknown state variable for the ISourceOperation interface
-        hr = pState->QueryInterface(IID_ISourceOperation, (void**)&pCommand);
-        BREAK_ON_FAIL(hr);
-
-        // Make sure the source is not shut down - if the source is shut down, just exit
-        hr = CheckShutdown();
-        BREAK_ON_FAIL(hr);
-
-        // figure out what the requested command is, and then dispatch it to one of the 
-        // internal handler objects
-        switch (pCommand->Type())
-        {
-            case SourceOperationOpen:
-                hr = InternalOpen(pCommand);
-                break;
-            case SourceOperationStart:
-                hr = InternalStart(pCommand);
-                break;
-            case SourceOperationStop:
-                hr = InternalStop();
-                break;
-            case SourceOperationPause:
-                hr = InternalPause();
-                break;
-            case SourceOperationStreamNeedData:
-                hr = InternalRequestSample();
-                break;
-            case SourceOperationEndOfStream:
-                hr = InternalEndOfStream();
-                break;
-        }
-    }
-    while(false);
-
-    return hr;
-}
-
-
-
-
-
-
-//////////////////////////////////////////////////////////////////////////////////////////
-//
-//  IMFMediaSource interface implementation
-//
-/////////////////////////////////////////////////////////////////////////////////////////
-
-
-
-//
-// Get a descriptor object for the current presentation
-//
-HRESULT AVFSource::CreatePresentationDescriptor(IMFPresentationDescriptor** ppPresentationDescriptor)
-{
-    HRESULT hr = S_OK;
-    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-    do
-    {
-        // sanity check parameters and internal variables
-        BREAK_ON_NULL (ppPresentationDescriptor, E_POINTER);
-        BREAK_ON_NULL (m_pPresentationDescriptor, MF_E_NOT_INITIALIZED);
-
-        // make sure the source is not shut down
-        hr = CheckShutdown();
-        BREAK_ON_FAIL(hr);
-
-        // create a copy of the stored presentation descriptor
-        hr = m_pPresentationDescriptor->Clone(ppPresentationDescriptor);
-        BREAK_ON_FAIL(hr);
-    }
-    while(false);
-
-    return hr;
-}
-
-//
-// Get the characteristics and capabilities of the MF source 
-// 
-HRESULT AVFSource::GetCharacteristics(DWORD* pdwCharacteristics)
-{
-    HRESULT hr = S_OK;
-    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-    do
-    {
-        // sanity check the passed in parameter
-        BREAK_ON_NULL (pdwCharacteristics, E_POINTER);
-
-        // make sure the source is not shut down
-        hr = CheckShutdown();
-        BREAK_ON_FAIL(hr);
-
-        // Indicate that the source can pause and supports seeking
-        *pdwCharacteristics = MFMEDIASOURCE_CAN_PAUSE | MFMEDIASOURCE_CAN_SEEK;
-    }
-    while(false);
-
-    return hr;
-}
-
-//
-//  Start playback at the specified time
-//
-HRESULT AVFSource::Start(IMFPresentationDescriptor* pPresentationDescriptor,
-            const GUID* pguidTimeFormat,            // format of the following time variable
-            const PROPVARIANT* pvarStartPosition)   // stream time where to start playback
-{
-    HRESULT hr = S_OK;
-    bool isSeek = false;
-    CComPtr<ISourceOperation> pOperation;
-
-    do
-    {
-        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-        BREAK_ON_NULL (pvarStartPosition, E_INVALIDARG);
-        BREAK_ON_NULL (pPresentationDescriptor, E_INVALIDARG);
-
-        // The IMFMediaSource::Start() function can support various time formats for input,
-        // but this implementation supports only the default version - time indicated in 
-        // 100-ns units
-        if ((pguidTimeFormat != NULL) && (*pguidTimeFormat != GUID_NULL))
-        {
-            hr = MF_E_UNSUPPORTED_TIME_FORMAT;
-            break;
-        }
-
-        // make sure we have the start time in the pvarStartPosition PROPVARIANT structure
-        if ((pvarStartPosition->vt != VT_I8) && (pvarStartPosition->vt != VT_EMPTY))
-        {
-            hr = MF_E_UNSUPPORTED_TIME_FORMAT;
-            break;
-        }
-
-        // make sure the source is not shut down
-        hr = CheckShutdown();
-        BREAK_ON_FAIL(hr);
-
-        // make sure the source is initialized
-        hr = IsInitialized();
-        BREAK_ON_FAIL(hr);
-
-        // figure out whether the caller is trying to seek or to just start playback
-        if (pvarStartPosition->vt == VT_I8)
-        {
-            if (m_state != SourceStateStopped)
-            {
-                isSeek = true;
-            }
-        }
-
-        // create the new command that will tell us to start playback
-        pOperation = new (std::nothrow) SourceOperation(
-            SourceOperationStart,                   // store command type - start command
-            pPresentationDescriptor);               // store presentation descriptor param
-        BREAK_ON_NULL(pOperation, E_OUTOFMEMORY);
-
-        // set the internal information in the new command
-        hr = pOperation->SetData(*pvarStartPosition, isSeek);
-        BREAK_ON_FAIL(hr);
-
-        // queue the start command work item
-        hr = MFPutWorkItem(
-                MFASYNC_CALLBACK_QUEUE_STANDARD,        // work queue to use
-                this,                                   // IMFAsyncCallback object to call
-                static_cast<IUnknown*>(pOperation));    // state variable - the command
-        BREAK_ON_FAIL(hr);
-    }
-    while(false);
-
-    return hr;
-}
-
-
-//
-// Pause the source
-//
-HRESULT AVFSource::Pause()
-{
-    HRESULT hr = S_OK;
-    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-    CComPtr<ISourceOperation> pOperation;
-
-    do
-    {
-        // make sure the source is not shut down
-        hr = CheckShutdown();
-        BREAK_ON_FAIL(hr);
-
-        // create a new SourceOperationType command
-        pOperation = new (std::nothrow) SourceOperation(SourceOperationPause);
-        BREAK_ON_NULL (pOperation, E_OUTOFMEMORY);
-
-        // put the command on the work queue
-        hr = MFPutWorkItem(
-                MFASYNC_CALLBACK_QUEUE_STANDARD,        // work queue to use
-                this,                                   // IMFAsyncCallback object to call
-                static_cast<IUnknown*>(pOperation));    // state variable - the command
-        BREAK_ON_FAIL(hr);
-    }
-    while(false);
-
-    return hr;
-}
-
-
-//
-// Stop playback
-//
-HRESULT AVFSource::Stop()
-{
-    HRESULT hr = S_OK;
-    CComPtr<ISourceOperation> pOperation;
-
-    do
-    {
-        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-        // make sure the source is not shut down
-        hr = CheckShutdown();
-        BREAK_ON_FAIL(hr);
-
-        // make sure the source is initialized
-        hr = IsInitialized();
-        BREAK_ON_FAIL(hr);
-
-        // create a new SourceOperationType command
-        pOperation = new (std::nothrow) SourceOperation(SourceOperationStop);
-        BREAK_ON_NULL (pOperation, E_OUTOFMEMORY);
-
-        // put the command on the work queue
-        hr = MFPutWorkItem(MFASYNC_CALLBACK_QUEUE_STANDARD, this, static_cast<IUnknown*>(pOperation));
-        BREAK_ON_FAIL(hr);
-    }
-    while(false);
-
-    return hr;
-}
-
-
-
-
-//
-//  Shutdown the source
-//
-HRESULT AVFSource::Shutdown()
-{
-    HRESULT hr = S_OK;
-
-    do
-    {
-        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-        // make sure the source is not shut down
-        hr = CheckShutdown();
-        BREAK_ON_FAIL(hr);
-
-        // go through every underlying stream and send a shutdown command to it
-        for (DWORD x = 0; x < m_mediaStreams.size(); x++)
-        {
-            AVFStream* pStream = NULL;
-
-            pStream = m_mediaStreams[x];
-            BREAK_ON_FAIL(hr);
-            BREAK_ON_NULL(pStream, E_UNEXPECTED);
-
-            pStream->Shutdown();
-            pStream->Release();
-        }
-        BREAK_ON_FAIL(hr);
-
-        // shut down the event queue
-        if (m_pEventQueue)
-        {
-            m_pEventQueue->Shutdown();
-        }
-
-        // clear the vector of streams
-        EXCEPTION_TO_HR( m_mediaStreams.clear() );
-
-        // delete the AVI file parser object
-        if (m_pAVIFileParser)
-        {
-            delete m_pAVIFileParser;
-            m_pAVIFileParser = NULL;
-        }
-
-        // set the internal state variable to indicate that the source is shut down
-        m_state = SourceStateShutdown;
-    }
-    while(false);
-
-    return hr;
-}
-
-
-
-
-
-
-
-
-
-/////////////////////////////////////////////////////////////////////////
-// Public helper methods
-/////////////////////////////////////////////////////////////////////////
-
-//
-// Begin the asynchronous open operation
-//
-HRESULT AVFSource::BeginOpen(LPCWSTR pwszURL, IMFAsyncCallback* pCallback, IUnknown* pUnkState)
-{
-    HRESULT hr = S_OK;
-    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-    CComPtr<IMFAsyncResult> pResult;
-    CComPtr<ISourceOperation> pOperation;
-
-    do
-    {
-        // Pack the needed arguments into an AsyncResult object
-        hr = MFCreateAsyncResult(NULL, pCallback, pUnkState, &pResult);
-        BREAK_ON_FAIL(hr);
-
-        // create a new SourceOperation object with the Open command
-        pOperation = new (std::nothrow) SourceOperation(SourceOperationOpen, pwszURL, pResult);
-        BREAK_ON_NULL (pOperation, E_OUTOFMEMORY);
-
-        // Submit the request into the background thread
-        hr = MFPutWorkItem(MFASYNC_CALLBACK_QUEUE_STANDARD, this, pOperation);
-        BREAK_ON_FAIL(hr);
-    }
-    while(false);
-
-    return hr;
-}
-
-
-//
-// End the asynchronous open operation
-//
-HRESULT AVFSource::EndOpen(IMFAsyncResult* pAsyncResult)
-{
-    HRESULT hr = S_OK;
-
-    do
-    {
-        BREAK_ON_NULL (pAsyncResult, E_POINTER);
-
-        hr = pAsyncResult->GetStatus();
-    }
-    while(false);
-
-    return hr;
-}
-
-
-//
-// Return an error if the source is shut down, and S_OK otherwise
-//
-HRESULT AVFSource::CheckShutdown() const
-{
-    if (m_state == SourceStateShutdown)
-    {
-        return MF_E_SHUTDOWN;
-    }
-    else
-    {
-        return S_OK;
-    }
-}
-
-// 
-// Return a failure if the source is not initialized
-//
-HRESULT AVFSource::IsInitialized() const
-{
-    if (m_state == SourceStateOpening || m_state == SourceStateUninitialized)
-    {
-        return MF_E_NOT_INITIALIZED;
-    }
-    else
-    {
-        return S_OK;
-    }
-}
-
-
-
-
-
-
-
-
-
-
-
-/////////////////////////////////////////////////////////////////////////
-// Private helper methods
-/////////////////////////////////////////////////////////////////////////
-
-
-
-//
-// Helper function that schedules the passed-in command on the work queue
-//
-HRESULT AVFSource::SendOperation(SourceOperationType operationType)
-{
-    HRESULT hr = S_OK;
-    CComPtr<ISourceOperation> pOperation;
-
-    do
-    {
-        // create a new SourceOperationType command
-        pOperation = new (std::nothrow) SourceOperation(operationType);
-        BREAK_ON_NULL (pOperation, E_OUTOFMEMORY);
-
-        // queue the command on the queue
-        hr = MFPutWorkItem(MFASYNC_CALLBACK_QUEUE_STANDARD, this, static_cast<IUnknown*>(pOperation));
-        BREAK_ON_FAIL(hr);
-    }
-    while(false);
-
-    return hr;
-}
-
-
-//
-// Initialize the underlying AVFFileParser, and open the file in the operation object.
-//
-HRESULT AVFSource::InternalOpen(ISourceOperation* pOp)
-{
-    HRESULT hr = S_OK;
-    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-    WCHAR* pUrl = NULL;
-    CComPtr<ISourceOperation> pOperation = pOp;
-    CComPtr<IMFAsyncResult> pCallerResult;
-    
-    do
-    {
-        BREAK_ON_NULL(pOperation, E_UNEXPECTED);
-
-        // Get the async result that will be sent once the open operation is complete.
-        hr = pOperation->GetCallerAsyncResult(&pCallerResult);
-        BREAK_ON_FAIL(hr);
-        BREAK_ON_NULL(pCallerResult, E_UNEXPECTED);
-
-        // get the file URL from the operation
-        pUrl = pOperation->GetUrl();
-        BREAK_ON_NULL(pUrl, E_UNEXPECTED);
-
-        // Create the AVI parser
-        hr = AVIFileParser::CreateInstance(pUrl, &m_pAVIFileParser);
-        BREAK_ON_FAIL(hr);
-
-        // parse the file header and instantiate the individual stream objects
-        hr = ParseHeader();
-    }
-    while(false);
-
-    // return the result whether we succeeded or failed
-    if(pCallerResult != NULL)
-    {
-        // Store the result of the initialization operation in the caller result.
-        pCallerResult->SetStatus(hr);
-
-        // Notify the caller of the BeginOpen() method that the open is complete.
-        MFInvokeCallback(pCallerResult);
-    }
-
-    return hr;
-}
-
-
-//
-// Start playback or seek to the specified location.
-//
-HRESULT AVFSource::InternalStart(ISourceOperation* pCommand)
-{
-    HRESULT hr = S_OK;
-    CComPtr<IMFPresentationDescriptor> pPresentationDescriptor;
-    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-    do
-    {
-        // get the presentation descriptor from the start operation
-        hr = pCommand->GetPresentationDescriptor(&pPresentationDescriptor);
-        BREAK_ON_FAIL(hr);
-
-        // activate the streams associated with the presentation descriptor
-        hr = SelectStreams(pPresentationDescriptor, pCommand->GetData(), 
-            pCommand->IsSeek());
-        BREAK_ON_FAIL(hr);
-
-        // set the start position in the file
-        hr = m_pAVIFileParser->SetOffset(pCommand->GetData());
-        BREAK_ON_FAIL(hr);
-
-        // update the internal state variable
-        m_state = SourceStateStarted;
-
-        // we have just started - which means that none of the streams have hit the
-        // end of stream indicator yet.  Once all of the streams have ended, the source
-        // will stop.
-        m_pendingEndOfStream = 0;
-        
-        // if we got here, then everything succeed.  If this was a seek request, queue the 
-        // result of the seek command.  If this is a start request, queue the result of the
-        // start command.
-        if (pCommand->IsSeek())
-        {
-            hr = m_pEventQueue->QueueEventParamVar(
-                        MESourceSeeked,                // seek result
-                        GUID_NULL,                     // no extended event data
-                        S_OK,                          // succeeded
-                        &pCommand->GetData());         // operation object
-        }
-        else
-        {
-            hr = m_pEventQueue->QueueEventParamVar(
-                        MESourceStarted,               // start result
-                        GUID_NULL,                     // no extended event data
-                        S_OK,                          // succeeded
-                        &pCommand->GetData());         // operation object
-        }
-    }
-    while(false);
-
-    // if we failed, fire an event indicating status of the operation - there is no need to fire
-    // status if start succeeded, since that would have been handled above in the while loop
-    if (FAILED(hr))
-    {
-        m_pEventQueue->QueueEventParamVar(MESourceStarted, GUID_NULL, hr, NULL);
-    }
-
-    return hr;
-}
-
-
-
-//
-// Internal implementation of the stop command - needed to asynchronously handle stop
-//
-HRESULT AVFSource::InternalStop(void)
-{
-    HRESULT hr = S_OK;
-    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-    do
-    {
-        // go through every stream, and if it is active, send a stop command to it
-        for (DWORD x = 0; x < m_mediaStreams.size(); x++)
-        {
-            AVFStream* pStream = NULL;
-            
-            pStream = m_mediaStreams[x];
-            BREAK_ON_FAIL(hr);
-            BREAK_ON_NULL(pStream, E_UNEXPECTED);
-
-            if (pStream->IsActive())
-            {
-                hr = pStream->Stop();
-                BREAK_ON_FAIL(hr);
-            }
-        }
-        BREAK_ON_FAIL(hr);
-
-        // update the internal state variable
-        m_state = SourceStateStopped;
-    }
-    while(false);
-
-    // fire an event indicating status of the operation
-    m_pEventQueue->QueueEventParamVar(MESourceStopped, GUID_NULL, hr, NULL);
-
-    return hr;
-}
-
-
-//
-// Internal implementation of the pause command - needed to asynchronously handle pause
-//
-HRESULT AVFSource::InternalPause(void)
-{
-    HRESULT hr = S_OK;
-    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-    do
-    {
-        // if the source is not started, it cannot be paused
-        if (m_state != SourceStateStarted)
-        {
-            hr = MF_E_INVALID_STATE_TRANSITION;
-            break;
-        }
-
-        // go through every stream, and if it is active, send a pause command to it
-        for (DWORD x = 0; x < m_mediaStreams.size(); x++)
-        {
-            AVFStream* pStream = NULL;
-            
-            pStream = m_mediaStreams[x];
-            BREAK_ON_FAIL(hr);
-            BREAK_ON_NULL(pStream, E_UNEXPECTED);
-
-            if (pStream->IsActive())
-            {
-                hr = pStream->Pause();
-                BREAK_ON_FAIL(hr);
-            }
-        }
-        BREAK_ON_FAIL(hr);
-
-        // update the internal state variable
-        m_state = SourceStatePaused;
-    }
-    while(false);
-
-    // fire an event indicating status of the operation
-    m_pEventQueue->QueueEventParamVar(MESourcePaused, GUID_NULL, hr, NULL);
-
-    return hr;
-}
-
-
-//
-// Handle the request sample command - pull out a sample of the right type from the underlying
-// AVI file parser, and send it to the stream
-//
-HRESULT AVFSource::InternalRequestSample(void)
-{
-    bool needMoreData = false;
-    HRESULT hr = S_OK;
-
-    do
-    {
-        needMoreData = false;
-
-        // go through each of the streams, figure out if they need data, pull out a sample 
-        // from the underlying AVI file parser, and deliver it to the right stream
-        for (DWORD x = 0; x < m_mediaStreams.size(); x++)
-        {
-            AVFStream* pStream = NULL;
-            
-            pStream = m_mediaStreams[x];
-            BREAK_ON_FAIL(hr);
-            BREAK_ON_NULL(pStream, E_UNEXPECTED);
-
-            // if the current stream needs more data, process its requests
-            if (pStream->NeedsData())
-            {
-                // store a flag indicating that somebody did need data
-                needMoreData = true;
-
-                // call a function to send a sample to the stream
-                hr = SendSampleToStream(pStream);
-                BREAK_ON_FAIL(hr);
-            }
-        }
-
-        BREAK_ON_FAIL(hr);
-
-        // loop while some stream needs more data - stop only once none of the streams are
-        // requesting more samples
-    } 
-    while (needMoreData);
-
-    if(FAILED(hr))
-    {
-        QueueEvent(MEError, GUID_NULL, hr, NULL);
-    }
-
-    return hr;
-}
-
-
-//
-// Load a sample of the right type from the parser and send it to the passed-in stream
-//
-HRESULT AVFSource::SendSampleToStream(AVFStream* pStream)
-{
-    HRESULT hr = S_OK;
-    CComPtr<IMFSample> pSample;
-
-    do
-    {
-        // if this is a video stream, then get a video sample from the AVI file parser
-        // if this is an audio stream, get an audio sample
-        if (pStream->IsVideoStream())
-        {                        
-            // get a video sample from the underlying AVI parser
-            hr = m_pAVIFileParser->GetNextVideoSample(&pSample);
-            BREAK_ON_FAIL(hr);
-
-            // deliver the video sample
-            hr = pStream->DeliverSample(pSample);
-            BREAK_ON_FAIL(hr);
-
-            // if this is the end of the video stream, tell the stream that there
-            // are no more samples
-            if (m_pAVIFileParser->IsVideoEndOfStream())
-            {
-                hr = pStream->EndOfStream();
-                BREAK_ON_FAIL(hr);
-            }
-        }
-        else if (pStream->IsAudioStream())
-        {
-            // get a audio sample from the underlying AVI parser
-            hr = m_pAVIFileParser->GetNextAudioSample(&pSample);
-            BREAK_ON_FAIL(hr);
-
-            // deliver the audio sample
-            hr = pStream->DeliverSample(pSample);
-            BREAK_ON_FAIL(hr);
-
-            // if this is the end of the audio stream, tell the stream that there
-            // are no more samples
-            if (m_pAVIFileParser->IsAudioEndOfStream())
-            {
-                hr = pStream->EndOfStream();
-                BREAK_ON_FAIL(hr);
-            }
-        }
-    }
-    while(false);
-
-    return hr;
-}
-
-
-
-//
-// Handle an end of stream event
-//
-HRESULT AVFSource::InternalEndOfStream(void)
-{
-    HRESULT hr = S_OK;
-
-    // increment the counter which indicates how many streams have signaled their end
-    m_pendingEndOfStream++;
-
-    // if all of the streams have ended, fire an MEEndOfPresentation event
-    if (m_pendingEndOfStream == m_mediaStreams.size())
-    {
-        hr = m_pEventQueue->QueueEventParamVar(MEEndOfPresentation, GUID_NULL, S_OK, NULL);
-    }
-
-    return hr;
-}
-
-
-
-//
-// Parse the file header of the current file
-//
-HRESULT AVFSource::ParseHeader(void)
-{
-    HRESULT hr = S_OK;
-
-    do
-    {
-        // Sanity checks against input arguments.
-        BREAK_ON_NULL (m_pAVIFileParser, E_UNEXPECTED);
-
-        // Parse the AVI file header.
-        hr = m_pAVIFileParser->ParseHeader();
-        BREAK_ON_FAIL(hr);
-
-        // Create the individual streams from the presentation descriptor
-        hr = InternalCreatePresentationDescriptor();
-        BREAK_ON_FAIL(hr);
-    }
-    while(false);
-
-    // if the header was successfully parsed, and if the streams have been created,
-    // update the internal state variables
-    if (SUCCEEDED(hr))
-    {
-        m_state = SourceStateStopped;
-    }
-
-    return hr;
-}
-
-
-
-//
-// Activate the streams exposed by the source
-//
-HRESULT AVFSource::SelectStreams(IMFPresentationDescriptor *pPresentationDescriptor, const PROPVARIANT varStart, bool isSeek)
-{
-    HRESULT hr = S_OK;
-    BOOL selected = FALSE;
-    bool wasSelected = false;
-    DWORD streamId = 0;
-
-    CComPtr<IMFStreamDescriptor> pStreamDescriptor;
-    CComPtr<IUnknown> pUnkStream;
-
-    do
-    {
-        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-        
-        for (DWORD x = 0; x < m_mediaStreams.size(); x++)
-        {
-            AVFStream* pStream = NULL;
-            
-            pStream = m_mediaStreams[x];
-            BREAK_ON_FAIL(hr);
-            BREAK_ON_NULL(pStream, E_UNEXPECTED);
-
-            pStreamDescriptor = NULL;
-
-            // get a stream descriptor for the current stream from the presentation descriptor 
-            hr = pPresentationDescriptor->GetStreamDescriptorByIndex(x, &selected, &pStreamDescriptor);
-            BREAK_ON_FAIL(hr);
-
-            // get the stream ID from the stream descriptor
-            hr = pStreamDescriptor->GetStreamIdentifier(&streamId);
-            BREAK_ON_FAIL(hr);
-
-            if (pStream == NULL)
-            {
-                hr = E_INVALIDARG;
-                break;
-            }
-
-            // figure out if the current stream was already selected - IE if it was active
-            wasSelected = pStream->IsActive();
-
-            // activate the stream
-            pStream->Activate(selected == TRUE);
-
-            // get the IUnknown pointer for the AVFStream object
-            pUnkStream = pStream;
-            
-            // if the stream was selected queue the an event with the result of the operation
-            if (selected)
-            {
-                // if the stream was already selected, something must have been updated - fire the
-                // MEUpdatedStream event
-                if (wasSelected)
-                {
-                    hr = m_pEventQueue->QueueEventParamUnk(
-                                MEUpdatedStream,              // event - the stream was updated
-                                GUID_NULL,                    // basic event - no extension GUID
-                                hr,                           // result of the operation
-                                pUnkStream);                 // pointer to the stream
-                }
-                else
-                {
-                    hr = m_pEventQueue->QueueEventParamUnk(
-                                MENewStream,                  // the new stream was activated
-                                GUID_NULL,                    // basic event - no extension GUID
-                                hr,                           // result of the operation
-                                pUnkStream);                 // pointer to the stream
-                }
-
-                // start playing the stream
-                hr = pStream->Start(varStart, isSeek);
-                BREAK_ON_FAIL(hr);
-            }
-        }
-    }
-    while(false);
-
-    return hr;
-}
-
-
-
-//
-// Create the presentation descriptor object
-//
-HRESULT AVFSource::InternalCreatePresentationDescriptor(void)
-{
-    HRESULT hr = S_OK;
-    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
-
-    IMFStreamDescriptor* streamDescriptors[2];
-
-    do
-    {
-        BREAK_ON_NULL (m_pAVIFileParser, E_POINTER);
-
-        // make sure this is a supported file format
-        if (!m_pAVIFileParser->IsSupportedFormat())
-        {
-            hr = MF_E_INVALID_FORMAT;
-            break;
-        }
-
-        // create a video stream descriptor if there is video in the file
-        hr = CreateVideoStream(&(streamDescriptors[m_mediaStreams.size()]));
-        BREAK_ON_FAIL(hr);
-
-        // create an audio stream descriptor if there is audio in the file
-        hr = CreateAudioStream(&(streamDescriptors[m_mediaStreams.size()]));
-        BREAK_ON_FAIL(hr);
-
-        // if we got here, we have successfully created at a stream descriptor for the audio 
-        // stream (if there is one), and a video stream (if the file has video).  Now create
-        // the presentation descriptor which will hold the stream descriptors.
-        hr = MFCreatePresentationDescriptor(
-                    (DWORD)m_mediaStreams.size(),   // number of streams created
-                    streamDescriptors,              // array of stream descriptors
-                    &m_pPresentationDescriptor);   // get the presentation descriptor
-        BREAK_ON_FAIL(hr);
-
-
-        // activate all of the streams in the beginning - that's their default state
-        for (DWORD i = 0; i < m_mediaStreams.size(); i++)
-        {
-            hr = m_pPresentationDescriptor->SelectStream(i);
-            BREAK_ON_FAIL(hr);
-        }
-        BREAK_ON_FAIL(hr);
-
-        // get the duration of the file from the AVI file parser
-        LONGLONG fileDuration = m_pAVIFileParser->Duration();
-
-        // set the file duration on the presentation descriptor - length of the file
-        // in 100-ns units
-        hr = m_pPresentationDescriptor->SetUINT64(MF_PD_DURATION, (UINT64)(fileDuration));
-    }
-    while(false);
-
-    // all of the stream descriptors have now been stored in the presentation descriptor -
-    // therefore release all of the stream descriptor pointers we have left over
-    for (DWORD i = 0; i < m_mediaStreams.size(); i++)
-    {
-        SafeRelease(streamDescriptors[i]);
-    }
-
-    return hr;
-}
-
-
-//
-// Create the video stream and return the corresponding stream descriptor
-//
-HRESULT AVFSource::CreateVideoStream(IMFStreamDescriptor** ppStreamDescriptor)
-{
-    HRESULT hr = S_OK;
-
-    IMFMediaType* pMediaType = NULL;
-    AVFStream* pAVFStream = NULL;
-
-    do
-    {
-        // if the file has a video stream, create an AVFStream object and a stream 
-        // descriptor for it
-        if (m_pAVIFileParser->HasVideo())
-        {
-            CComPtr<IMFMediaTypeHandler> pHandler;
-
-            // get the media type for the video stream
-            hr = m_pAVIFileParser->GetVideoMediaType(&pMediaType);
-            BREAK_ON_FAIL(hr);
-
-            // create the stream descriptor
-            hr = MFCreateStreamDescriptor(
-                        (DWORD)m_mediaStreams.size()+1,// stream ID
-                        1,                             // number of media types
-                        &pMediaType,                   // media type for the stream
-                        ppStreamDescriptor);           // get the descriptor
-            BREAK_ON_FAIL(hr);
-
-            // get a media type handler for the stream
-            hr = (*ppStreamDescriptor)->GetMediaTypeHandler(&pHandler);
-            BREAK_ON_FAIL(hr);
-
-            // set current type of the stream visible to source users
-            hr = pHandler->SetCurrentMediaType(pMediaType);
-            BREAK_ON_FAIL(hr);
-
-            // Create AVFStream object that is implementing the IMFMediaStream interface
-            hr = AVFStream::CreateInstance(&pAVFStream, this, *ppStreamDescriptor);
-            BREAK_ON_FAIL(hr);
-
-            // tell the AVFStream object that it's a video stream
-            pAVFStream->SetVideoStream();
-            
-            // store the stream in a vector for later reuse
-            EXCEPTION_TO_HR( m_mediaStreams.push_back(pAVFStream) );
-        }
-    }
-    while(false);
-
-    SafeRelease(pMediaType);
-
-    return hr;
-}
-
-
-
-//
-// Create the audio stream and return the corresponding stream descriptor
-//
-HRESULT AVFSource::CreateAudioStream(IMFStreamDescriptor** ppStreamDescriptor)
-{
-    HRESULT hr = S_OK;
-
-    IMFMediaType* pMediaType = NULL;
-    AVFStream* pAVFStream = NULL;
-
-    do
-    {
-        // if the file has an audio stream, create a stream descriptor for an audio stream 
-        // and store it in the presentation descriptor
-        if (m_pAVIFileParser->HasAudio())
-        {
-            CComPtr<IMFMediaTypeHandler> pHandler;
-
-            // get the media type for the stream from the AVI file parser
-            hr = m_pAVIFileParser->GetAudioMediaType(&pMediaType);
-            BREAK_ON_FAIL(hr);
-
-            // create the stream descriptor
-            hr = MFCreateStreamDescriptor(
-                        (DWORD)m_mediaStreams.size()+1,  // stream ID
-                        1,                               // number of media types
-                        &pMediaType,                     // media type for the stream
-                        ppStreamDescriptor);             // get the descriptor
-            BREAK_ON_FAIL(hr);
-
-            // get a media type handler for the stream 
-            hr = (*ppStreamDescriptor)->GetMediaTypeHandler(&pHandler);
-            BREAK_ON_FAIL(hr);
-
-            // set current type of the stream visible to source users
-            hr = pHandler->SetCurrentMediaType(pMediaType);
-            BREAK_ON_FAIL(hr);
-
-            // Create our Audio IMFMediaStream.
-            hr = AVFStream::CreateInstance(&pAVFStream, this, (*ppStreamDescriptor));
-            BREAK_ON_FAIL(hr);
-
-            // set the current media type for the stream
-            pAVFStream->SetAudioStream();
-            
-            // store the stream in a vector for later reuse
-            EXCEPTION_TO_HR( m_mediaStreams.push_back(pAVFStream) );
-        }
-    }
-    while(false);
-
-    SafeRelease(pMediaType);
-
-    return hr;
-}
-
-
-
-//
-// Constructor
-//
-AVFSource::AVFSource(HRESULT* pHr) : 
-    m_cRef(1),
-    m_pAVIFileParser(NULL),
-    m_state(SourceStateUninitialized),
-    m_pendingEndOfStream(0)
-{
-    // Initialize the event queue that will execute all of the source's
-    // IMFEventGenerator duties.
-    *pHr = MFCreateEventQueue(&m_pEventQueue);
-}
-
-//
-// Destructor
-//
-AVFSource::~AVFSource()
-{
-    if (NULL != m_pAVIFileParser)
-    {
-        delete m_pAVIFileParser;
-        m_pAVIFileParser = NULL;
-    }
+#include "stdafx.h"
+#include "AVFSource.h"
+
+
+//
+// Create an instance of the AVFSource object
+//
+HRESULT AVFSource::CreateInstance(AVFSource** ppAVFSource)
+{
+    HRESULT hr = S_OK;
+    AVFSource* pAVFSource = NULL;
+
+    do
+    {
+        BREAK_ON_NULL (ppAVFSource, E_POINTER);
+
+        // create an instance of the object
+        AVFSource* pAVFSource = new (std::nothrow) AVFSource(&hr);
+        BREAK_ON_NULL(pAVFSource, E_OUTOFMEMORY);        
+        BREAK_ON_FAIL(hr);
+
+        // Set the out pointer.
+        *ppAVFSource = pAVFSource;
+    }
+    while(false);
+
+    if (FAILED(hr) && pAVFSource != NULL)
+    {
+        delete pAVFSource;
+    }
+
+    return hr;
+}
+
+
+
+//
+// Standard IUnknown interface implementation
+//
+ULONG AVFSource::AddRef()
+{
+    return InterlockedIncrement(&m_cRef);
+}
+
+ULONG AVFSource::Release()
+{
+    ULONG refCount = InterlockedDecrement(&m_cRef);
+    if (refCount == 0)
+    {
+        delete this;
+    }
+    
+    return refCount;
+}
+
+HRESULT AVFSource::QueryInterface(REFIID riid, void** ppv)
+{
+    HRESULT hr = S_OK;
+
+    if (ppv == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (riid == IID_IUnknown)
+    {
+        *ppv = static_cast<IUnknown*>(static_cast<IMFMediaEventGenerator*>(this));
+    }
+    else if (riid == IID_IMFMediaEventGenerator)
+    {
+        *ppv = static_cast<IMFMediaEventGenerator*>(this);
+    }
+    else if (riid == IID_IMFMediaSource)
+    {
+        *ppv = static_cast<IMFMediaSource*>(this);
+    }
+    else if (riid == IID_IMFAsyncCallback)
+    {
+        *ppv = static_cast<IMFAsyncCallback*>(this);
+    }
+    else if (riid == IID_IMFGetService)
+    {
+        *ppv = static_cast<IMFGetService*>(this);
+    }
+    else if (riid == IID_IMFRateSupport)
+    {
+        *ppv = static_cast<IMFRateSupport*>(this);
+    }
+    else if (riid == IID_IMFRateControl)
+    {
+        *ppv = static_cast<IMFRateControl*>(this);
+    }
+    else if (riid == IID_IAVFSourceStatistics)
+    {
+        *ppv = static_cast<IAVFSourceStatistics*>(this);
+    }
+    else
+    {
+        *ppv = NULL;
+        hr = E_NOINTERFACE;
+    }
+
+    if(SUCCEEDED(hr))
+        AddRef();
+
+    return hr;
+}
+
+
+
+//
+//  IMFMediaEventGenerator interface implementation
+//
+////////////////////////////////////////////////////////////////////////
+
+
+//
+// Begin processing an event from the event queue asynchronously
+//
+HRESULT AVFSource::BeginGetEvent(
+            IMFAsyncCallback* pCallback,    // callback of the object interested in events
+            IUnknown* punkState)            // some custom state object returned with event
+{
+    HRESULT hr = S_OK;
+    CComPtr<IMFMediaEventQueue> pLocQueue = m_pEventQueue;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    do
+    {
+        // make sure the source is not shut down
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        // get the next event from the event queue
+        hr = pLocQueue->BeginGetEvent(pCallback, punkState);
+    }
+    while(false);
+
+    return hr;
+}
+
+//
+// Complete asynchronous event processing
+//
+HRESULT AVFSource::EndGetEvent(
+            IMFAsyncResult* pResult,    // result of an asynchronous operation
+            IMFMediaEvent** ppEvent)    // event extracted from the queue
+{
+    HRESULT hr = S_OK;
+    CComPtr<IMFMediaEventQueue> pLocQueue = m_pEventQueue;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    do
+    {
+        // make sure the source is not shut down
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        hr = pLocQueue->EndGetEvent(pResult, ppEvent);
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Synchronously retrieve the next event from the event queue
+//
+HRESULT AVFSource::GetEvent(
+            DWORD dwFlags,              // flag with the event behavior
+            IMFMediaEvent** ppEvent)    // event extracted from the queue
+{
+    HRESULT hr = S_OK;
+    CComPtr<IMFMediaEventQueue> pLocQueue = m_pEventQueue;
+
+    do
+    {
+        // Check whether the source is shut down but do it in a separate locked section-
+        // GetEvent() may block, and we don't want to hold the critical section during
+        // that time.
+        {
+            CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+            hr = CheckShutdown();
+            BREAK_ON_FAIL(hr);
+        }
+
+        // Get the event from the queue - note, may block!
+        hr = pLocQueue->GetEvent(dwFlags, ppEvent);
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+//
+// Store the event in the internal event queue of the source
+//
+HRESULT AVFSource::QueueEvent(
+            MediaEventType met,             // media event type
+            REFGUID guidExtendedType,       // GUID_NULL for standard events or an extension GUID
+            HRESULT hrStatus,               // status of the operation
+            const PROPVARIANT* pvValue)     // a VARIANT with some event value or NULL
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    do
+    {
+        // make sure the source is not shut down
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        // queue the passed in event on the internal event queue
+        hr = m_pEventQueue->QueueEventParamVar(met, guidExtendedType, hrStatus, pvValue);
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////
+// IMFAsyncCallback implementation
+/////////////////////////////////////////////////////////////////////////
+
+//
+// Get the behavior information (duration, etc.) of the asynchronous callback operation - 
+// not implemented.
+//
+HRESULT AVFSource::GetParameters(DWORD*, DWORD*)
+{
+    return E_NOTIMPL;
+}
+
+
+// 
+// Do an asynchronous task - execute a queued command (operation).
+//
+HRESULT AVFSource::Invoke(IMFAsyncResult* pResult)
+{
+    HRESULT hr = S_OK;
+    CComPtr<IMFAsyncResult> pAsyncResult = pResult;
+    CComPtr<IMFAsyncResult> pCallerResult;
+    CComPtr<ISourceOperation> pCommand;
+    CComPtr<IUnknown> pState;
+
+    do
+    {
+        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+        // Get the state object associated with this asynchronous call
+        hr = pAsyncResult->GetState(&pState);
+        BREAK_ON_FAIL(hr);
+
+        // QI the IUnknown state variable for the ISourceOperation interface
+        hr = pState->QueryInterface(IID_ISourceOperation, (void**)&pCommand);
+        BREAK_ON_FAIL(hr);
+
+        // allow the streams to queue a new request for data - any stream that asks for
+        // data from now on is either served by this pass or by the next request.  The tail
+        // poll is a request for data as well, but it fires on its own timer while the
+        // queued request may still be waiting, so it must leave the flag alone.
+        if (pCommand == m_pNeedDataOperation)
+        {
+            InterlockedExchange(&m_needDataPending, 0);
+        }
+
+        // the timed request for data is no longer pending once it fires
+        if (pCommand == m_pTailPollOperation)
+        {
+            m_tailPollScheduled = false;
+        }
+
+        if (pCommand == m_pStatisticsDumpOperation)
+        {
+            m_statisticsDumpScheduled = false;
+        }
+
+        // Make sure the source is not shut down - if the source is shut down, just exit
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        // figure out what the requested command is, and then dispatch it to one of the 
+        // internal handler objects
+        switch (pCommand->Type())
+        {
+            case SourceOperationOpen:
+                hr = InternalOpen(pCommand);
+                break;
+            case SourceOperationOpenLoaded:
+                hr = InternalOpenLoaded(pCommand, pAsyncResult);
+                break;
+            case SourceOperationStart:
+                hr = InternalStart(pCommand);
+                break;
+            case SourceOperationStop:
+                hr = InternalStop();
+                break;
+            case SourceOperationPause:
+                hr = InternalPause();
+                break;
+            case SourceOperationStreamNeedData:
+                hr = InternalRequestSample();
+                break;
+            case SourceOperationEndOfStream:
+                hr = InternalEndOfStream();
+                break;
+            case SourceOperationDumpStatistics:
+                hr = InternalDumpStatistics();
+                break;
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+//  IMFMediaSource interface implementation
+//
+/////////////////////////////////////////////////////////////////////////////////////////
+
+
+
+//
+// Get a descriptor object for the current presentation
+//
+HRESULT AVFSource::CreatePresentationDescriptor(IMFPresentationDescriptor** ppPresentationDescriptor)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    do
+    {
+        // sanity check parameters and internal variables
+        BREAK_ON_NULL (ppPresentationDescriptor, E_POINTER);
+        BREAK_ON_NULL (m_pPresentationDescriptor, MF_E_NOT_INITIALIZED);
+
+        // make sure the source is not shut down
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        // create a copy of the stored presentation descriptor
+        hr = m_pPresentationDescriptor->Clone(ppPresentationDescriptor);
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+//
+// Get the characteristics and capabilities of the MF source 
+// 
+HRESULT AVFSource::GetCharacteristics(DWORD* pdwCharacteristics)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    do
+    {
+        // sanity check the passed in parameter
+        BREAK_ON_NULL (pdwCharacteristics, E_POINTER);
+
+        // make sure the source is not shut down
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        // Indicate that the source can pause and supports seeking
+        *pdwCharacteristics = AVF_SOURCE_CHARACTERISTICS;
+    }
+    while(false);
+
+    return hr;
+}
+
+//
+//  Start playback at the specified time
+//
+HRESULT AVFSource::Start(IMFPresentationDescriptor* pPresentationDescriptor,
+            const GUID* pguidTimeFormat,            // format of the following time variable
+            const PROPVARIANT* pvarStartPosition)   // stream time where to start playback
+{
+    HRESULT hr = S_OK;
+    bool isSeek = false;
+    CComPtr<ISourceOperation> pOperation;
+
+    do
+    {
+        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+        BREAK_ON_NULL (pvarStartPosition, E_INVALIDARG);
+        BREAK_ON_NULL (pPresentationDescriptor, E_INVALIDARG);
+
+        // The IMFMediaSource::Start() function can support various time formats for input,
+        // but this implementation supports only the default version - time indicated in 
+        // 100-ns units
+        if ((pguidTimeFormat != NULL) && (*pguidTimeFormat != GUID_NULL))
+        {
+            hr = MF_E_UNSUPPORTED_TIME_FORMAT;
+            break;
+        }
+
+        // make sure we have the start time in the pvarStartPosition PROPVARIANT structure
+        if ((pvarStartPosition->vt != VT_I8) && (pvarStartPosition->vt != VT_EMPTY))
+        {
+            hr = MF_E_UNSUPPORTED_TIME_FORMAT;
+            break;
+        }
+
+        // make sure the source is not shut down
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        // make sure the source is initialized
+        hr = IsInitialized();
+        BREAK_ON_FAIL(hr);
+
+        // figure out whether the caller is trying to seek or to just start playback
+        if (pvarStartPosition->vt == VT_I8)
+        {
+            if (m_state != SourceStateStopped)
+            {
+                isSeek = true;
+            }
+        }
+
+        // create the new command that will tell us to start playback
+        pOperation = new (std::nothrow) SourceOperation(
+            SourceOperationStart,                   // store command type - start command
+            pPresentationDescriptor);               // store presentation descriptor param
+        BREAK_ON_NULL(pOperation, E_OUTOFMEMORY);
+
+        // set the internal information in the new command
+        hr = pOperation->SetData(*pvarStartPosition, isSeek);
+        BREAK_ON_FAIL(hr);
+
+        // queue the start command work item
+        hr = MFPutWorkItem(
+                MFASYNC_CALLBACK_QUEUE_STANDARD,        // work queue to use
+                this,                                   // IMFAsyncCallback object to call
+                static_cast<IUnknown*>(pOperation));    // state variable - the command
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Pause the source
+//
+HRESULT AVFSource::Pause()
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+    CComPtr<ISourceOperation> pOperation;
+
+    do
+    {
+        // make sure the source is not shut down
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        // create a new SourceOperationType command
+        pOperation = new (std::nothrow) SourceOperation(SourceOperationPause);
+        BREAK_ON_NULL (pOperation, E_OUTOFMEMORY);
+
+        // put the command on the work queue
+        hr = MFPutWorkItem(
+                MFASYNC_CALLBACK_QUEUE_STANDARD,        // work queue to use
+                this,                                   // IMFAsyncCallback object to call
+                static_cast<IUnknown*>(pOperation));    // state variable - the command
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Stop playback
+//
+HRESULT AVFSource::Stop()
+{
+    HRESULT hr = S_OK;
+    CComPtr<ISourceOperation> pOperation;
+
+    do
+    {
+        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+        // make sure the source is not shut down
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        // make sure the source is initialized
+        hr = IsInitialized();
+        BREAK_ON_FAIL(hr);
+
+        // create a new SourceOperationType command
+        pOperation = new (std::nothrow) SourceOperation(SourceOperationStop);
+        BREAK_ON_NULL (pOperation, E_OUTOFMEMORY);
+
+        // put the command on the work queue
+        hr = MFPutWorkItem(MFASYNC_CALLBACK_QUEUE_STANDARD, this, static_cast<IUnknown*>(pOperation));
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+
+
+//
+//  Shutdown the source
+//
+HRESULT AVFSource::Shutdown()
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+        // make sure the source is not shut down
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        // go through every underlying stream and send a shutdown command to it
+        for (DWORD x = 0; x < m_mediaStreams.size(); x++)
+        {
+            AVFStream* pStream = NULL;
+
+            pStream = m_mediaStreams[x];
+            BREAK_ON_FAIL(hr);
+            BREAK_ON_NULL(pStream, E_UNEXPECTED);
+
+            pStream->Shutdown();
+            pStream->Release();
+        }
+        BREAK_ON_FAIL(hr);
+
+        // shut down the event queue
+        if (m_pEventQueue)
+        {
+            m_pEventQueue->Shutdown();
+        }
+
+        // clear the vector of streams
+        EXCEPTION_TO_HR( m_mediaStreams.clear() );
+
+        // don't wait for the timer of a pending poll of the file tail
+        if (m_tailPollScheduled)
+        {
+            MFCancelWorkItem(m_tailPollKey);
+            m_tailPollScheduled = false;
+        }
+
+        if (m_statisticsDumpScheduled)
+        {
+            MFCancelWorkItem(m_statisticsDumpKey);
+            m_statisticsDumpScheduled = false;
+        }
+
+        // stop a load of the byte stream that is still in progress - the read that is under
+        // way completes on its own, and the loader lets go of the byte stream then
+        if (m_pByteStreamLoader)
+        {
+            m_pByteStreamLoader->Shutdown();
+            SafeRelease(m_pByteStreamLoader);
+        }
+
+        // stop reading ahead - the prefetcher must be done with the parser before the
+        // parser is deleted
+        if (m_pPrefetcher)
+        {
+            m_pPrefetcher->Shutdown();
+            SafeRelease(m_pPrefetcher);
+        }
+
+        // delete the AVI file parser object
+        if (m_pAVIFileParser)
+        {
+            delete m_pAVIFileParser;
+            m_pAVIFileParser = NULL;
+        }
+
+        // set the internal state variable to indicate that the source is shut down
+        m_state = SourceStateShutdown;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+
+
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+//  IMFGetService, IMFRateSupport and IMFRateControl interface implementation
+//
+/////////////////////////////////////////////////////////////////////////////////////////
+
+//
+// Get one of the services exposed by the source - only the rate control service is
+// supported
+//
+HRESULT AVFSource::GetService(REFGUID guidService, REFIID riid, LPVOID* ppvObject)
+{
+    if (ppvObject == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (guidService != MF_RATE_CONTROL_SERVICE)
+    {
+        *ppvObject = NULL;
+        return MF_E_UNSUPPORTED_SERVICE;
+    }
+
+    return QueryInterface(riid, ppvObject);
+}
+
+
+//
+// Get the slowest supported playback rate - the source can deliver single samples, so 
+// scrubbing at rate 0 is supported.  Reverse playback is not supported.
+//
+HRESULT AVFSource::GetSlowestRate(MFRATE_DIRECTION eDirection, BOOL fThin, float* pflRate)
+{
+    if (pflRate == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (eDirection == MFRATE_REVERSE)
+    {
+        return MF_E_REVERSE_UNSUPPORTED;
+    }
+
+    *pflRate = 0.0f;
+
+    return S_OK;
+}
+
+
+//
+// Get the fastest supported playback rate.  Without thinning the source decodes every frame,
+// so it only goes up to the thinning rate - faster rates need keyframe-only playback.
+//
+HRESULT AVFSource::GetFastestRate(MFRATE_DIRECTION eDirection, BOOL fThin, float* pflRate)
+{
+    if (pflRate == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (eDirection == MFRATE_REVERSE)
+    {
+        return MF_E_REVERSE_UNSUPPORTED;
+    }
+
+    *pflRate = fThin ? AVF_MAX_PLAYBACK_RATE : m_thinningRate;
+
+    return S_OK;
+}
+
+
+//
+// Check whether the specified playback rate is supported, and get the closest rate that is
+//
+HRESULT AVFSource::IsRateSupported(BOOL fThin, float flRate, float* pflNearestSupportedRate)
+{
+    HRESULT hr = S_OK;
+    float nearestRate = flRate;
+    float fastestRate = fThin ? AVF_MAX_PLAYBACK_RATE : m_thinningRate;
+
+    if (flRate < 0)
+    {
+        hr = MF_E_REVERSE_UNSUPPORTED;
+        nearestRate = 0.0f;
+    }
+    else if (flRate > fastestRate)
+    {
+        hr = MF_E_UNSUPPORTED_RATE;
+        nearestRate = fastestRate;
+    }
+
+    if (pflNearestSupportedRate != NULL)
+    {
+        *pflNearestSupportedRate = nearestRate;
+    }
+
+    return hr;
+}
+
+
+//
+// Set the playback rate.  The presentation clock runs at the new rate, and the time stamps
+// of the samples stay in presentation time.  If thinning is requested, the source switches
+// to sending only the video keyframes - rates above the thinning rate are rejected without
+// it.
+//
+HRESULT AVFSource::SetRate(BOOL fThin, float flRate)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+    PROPVARIANT var;
+
+    do
+    {
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        hr = IsRateSupported(fThin, flRate, NULL);
+        BREAK_ON_FAIL(hr);
+
+        // switch between normal and keyframe-only playback if needed - the streams and the
+        // parser are only set up once the file has been opened
+        bool thinned = (fThin == TRUE);
+        if (thinned != m_thinned && m_pAVIFileParser != NULL)
+        {
+            hr = SetThinning(thinned);
+            BREAK_ON_FAIL(hr);
+        }
+
+        m_rate = flRate;
+        m_rateThin = fThin;
+
+        // tell the pipeline that the rate has changed
+        PropVariantInit(&var);
+        var.vt = VT_R4;
+        var.fltVal = flRate;
+
+        hr = m_pEventQueue->QueueEventParamVar(MESourceRateChanged, GUID_NULL, S_OK, &var);
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Get the current playback rate
+//
+HRESULT AVFSource::GetRate(BOOL* pfThin, float* pflRate)
+{
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    if (pflRate == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (pfThin != NULL)
+    {
+        *pfThin = m_rateThin;
+    }
+
+    *pflRate = m_rate;
+
+    return CheckShutdown();
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+//  IAVFSourceStatistics interface implementation
+//
+/////////////////////////////////////////////////////////////////////////////////////////
+
+//
+// Get the number of streams for which statistics are collected
+//
+HRESULT AVFSource::GetStreamCount(DWORD* pcStreams)
+{
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    if (pcStreams == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *pcStreams = (DWORD)m_mediaStreams.size();
+
+    return CheckShutdown();
+}
+
+
+//
+// Get the delivery statistics of the specified stream, together with the read statistics
+// of the track of the file that it delivers
+//
+HRESULT AVFSource::GetStreamStatistics(DWORD index, AVFStreamStatistics* pStatistics)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    do
+    {
+        BREAK_ON_NULL (pStatistics, E_POINTER);
+
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        if (index >= m_mediaStreams.size())
+        {
+            hr = E_INVALIDARG;
+            break;
+        }
+
+        AVFStream* pStream = m_mediaStreams[index];
+        BREAK_ON_NULL(pStream, E_UNEXPECTED);
+
+        pStream->GetDeliveryStatistics(pStatistics);
+
+        m_pAVIFileParser->GetReadStatistics(pStream->GetTrack(), &pStatistics->parserRead, 
+            &pStatistics->bytesRead);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Start collecting all of the statistics from scratch
+//
+HRESULT AVFSource::ResetStatistics(void)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    do
+    {
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+
+        for (DWORD x = 0; x < m_mediaStreams.size(); x++)
+        {
+            m_mediaStreams[x]->ResetDeliveryStatistics();
+        }
+
+        if (m_pAVIFileParser != NULL)
+        {
+            m_pAVIFileParser->ResetReadStatistics();
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+
+
+/////////////////////////////////////////////////////////////////////////
+// Public helper methods
+/////////////////////////////////////////////////////////////////////////
+
+//
+// Begin the asynchronous open operation.  If a byte stream is passed in, the file is read
+// through it - the URL is then optional, and is only used to find a local copy of the file.
+//
+HRESULT AVFSource::BeginOpen(LPCWSTR pwszURL, IMFByteStream* pByteStream, 
+    IMFAsyncCallback* pCallback, IUnknown* pUnkState)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+    CComPtr<IMFAsyncResult> pResult;
+    CComPtr<ISourceOperation> pOperation;
+
+    do
+    {
+        if (pwszURL == NULL && pByteStream == NULL)
+        {
+            hr = E_INVALIDARG;
+            break;
+        }
+
+        m_pByteStream = pByteStream;
+
+        // Pack the needed arguments into an AsyncResult object
+        hr = MFCreateAsyncResult(NULL, pCallback, pUnkState, &pResult);
+        BREAK_ON_FAIL(hr);
+
+        // create a new SourceOperation object with the Open command
+        pOperation = new (std::nothrow) SourceOperation(SourceOperationOpen, pwszURL, pResult);
+        BREAK_ON_NULL (pOperation, E_OUTOFMEMORY);
+
+        // Submit the request into the background thread
+        hr = MFPutWorkItem(MFASYNC_CALLBACK_QUEUE_STANDARD, this, pOperation);
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// End the asynchronous open operation
+//
+HRESULT AVFSource::EndOpen(IMFAsyncResult* pAsyncResult)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        BREAK_ON_NULL (pAsyncResult, E_POINTER);
+
+        hr = pAsyncResult->GetStatus();
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Read the optional configuration properties passed to the byte stream handler.  Must be
+// called before the source is opened.
+//
+HRESULT AVFSource::SetConfiguration(IPropertyStore* pConfig)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+    PropVariantGeneric value;
+
+    do
+    {
+        // no configuration - just use the defaults
+        BREAK_ON_NULL(pConfig, S_OK);
+
+        // check whether the caller wants the samples to be read ahead of time
+        hr = pConfig->GetValue(AVFPKEY_PrefetchEnabled, &value);
+        BREAK_ON_FAIL(hr);
+
+        if(value.vt == VT_BOOL)
+        {
+            m_prefetchEnabled = (value.boolVal != VARIANT_FALSE);
+        }
+        PropVariantClear(&value);
+
+        // get the number of bytes that may be buffered for each stream
+        hr = pConfig->GetValue(AVFPKEY_PrefetchBufferBytes, &value);
+        BREAK_ON_FAIL(hr);
+
+        if(value.vt == VT_UI4 && value.ulVal > 0)
+        {
+            m_prefetchBufferBytes = value.ulVal;
+        }
+        PropVariantClear(&value);
+
+        // check whether the chunks should be read in the order in which they are stored
+        hr = pConfig->GetValue(AVFPKEY_FileOrderReading, &value);
+        BREAK_ON_FAIL(hr);
+
+        if(value.vt == VT_BOOL)
+        {
+            m_fileOrderReading = (value.boolVal != VARIANT_FALSE);
+        }
+        PropVariantClear(&value);
+
+        // get the number of audio chunks that should be delivered in each sample
+        hr = pConfig->GetValue(AVFPKEY_AudioChunksPerSample, &value);
+        BREAK_ON_FAIL(hr);
+
+        if(value.vt == VT_UI4 && value.ulVal > 0)
+        {
+            m_audioChunksPerSample = value.ulVal;
+        }
+        PropVariantClear(&value);
+
+        // check whether the file index should be cached between opens
+        hr = pConfig->GetValue(AVFPKEY_IndexCacheEnabled, &value);
+        BREAK_ON_FAIL(hr);
+
+        if(value.vt == VT_BOOL)
+        {
+            m_indexCacheEnabled = (value.boolVal != VARIANT_FALSE);
+        }
+        PropVariantClear(&value);
+
+        // get the playback rate above which only the keyframes are delivered
+        hr = pConfig->GetValue(AVFPKEY_ThinningRate, &value);
+        BREAK_ON_FAIL(hr);
+
+        if(value.vt == VT_R4 && value.fltVal > 0)
+        {
+            m_thinningRate = value.fltVal;
+        }
+        PropVariantClear(&value);
+
+        // check whether the file is still being recorded and should be followed
+        hr = pConfig->GetValue(AVFPKEY_TailFollow, &value);
+        BREAK_ON_FAIL(hr);
+
+        if(value.vt == VT_BOOL)
+        {
+            m_tailFollow = (value.boolVal != VARIANT_FALSE);
+        }
+        PropVariantClear(&value);
+
+        // get the time without new data after which a followed file is considered complete
+        hr = pConfig->GetValue(AVFPKEY_TailIdleTimeout, &value);
+        BREAK_ON_FAIL(hr);
+
+        if(value.vt == VT_UI4)
+        {
+            m_tailIdleTimeout = value.ulVal;
+        }
+        PropVariantClear(&value);
+
+        // get the interval at which the stream statistics are written out
+        hr = pConfig->GetValue(AVFPKEY_StatisticsDumpInterval, &value);
+        BREAK_ON_FAIL(hr);
+
+        if(value.vt == VT_UI4)
+        {
+            m_statisticsDumpInterval = value.ulVal;
+        }
+        PropVariantClear(&value);
+
+        // get the memory limit of a byte stream that has to be loaded into memory
+        hr = pConfig->GetValue(AVFPKEY_ByteStreamMaxMemory, &value);
+        BREAK_ON_FAIL(hr);
+
+        if(value.vt == VT_UI8 && value.uhVal.QuadPart > 0)
+        {
+            m_byteStreamMaxMemory = value.uhVal.QuadPart;
+        }
+        PropVariantClear(&value);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Return an error if the source is shut down, and S_OK otherwise
+//
+HRESULT AVFSource::CheckShutdown() const
+{
+    if (m_state == SourceStateShutdown)
+    {
+        return MF_E_SHUTDOWN;
+    }
+    else
+    {
+        return S_OK;
+    }
+}
+
+// 
+// Return a failure if the source is not initialized
+//
+HRESULT AVFSource::IsInitialized() const
+{
+    if (m_state == SourceStateOpening || m_state == SourceStateUninitialized)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+    else
+    {
+        return S_OK;
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////
+// Private helper methods
+/////////////////////////////////////////////////////////////////////////
+
+
+
+//
+// Switch between normal and keyframe-only (thinned) playback.  While thinned, the audio
+// streams are not fed and the audio data is not read at all - they get MEStreamTick events
+// instead, and end together with the video.  The parser moves the audio back in sync with
+// the video when normal playback resumes.
+//
+HRESULT AVFSource::SetThinning(bool thinned)
+{
+    HRESULT hr = S_OK;
+
+    PROPVARIANT var;
+
+    do
+    {
+        // every selected stream reports the change of the mode before its next sample
+        PropVariantInit(&var);
+        var.vt = VT_INT;
+        var.intVal = thinned ? TRUE : FALSE;
+
+        for (DWORD x = 0; x < m_mediaStreams.size(); x++)
+        {
+            if (m_mediaStreams[x]->IsAudioStream())
+            {
+                m_mediaStreams[x]->SetThinned(thinned);
+            }
+
+            if (m_mediaStreams[x]->IsActive())
+            {
+                hr = m_mediaStreams[x]->QueueEvent(MEStreamThinMode, GUID_NULL, S_OK, &var);
+                BREAK_ON_FAIL(hr);
+            }
+        }
+        BREAK_ON_FAIL(hr);
+
+        // change the mode of the parser - through the prefetcher if the samples are read
+        // ahead of time, so that its audio buffers are dropped as well
+        if (m_pPrefetcher != NULL)
+        {
+            hr = m_pPrefetcher->SetKeyframesOnly(thinned);
+            BREAK_ON_FAIL(hr);
+        }
+        else
+        {
+            m_pAVIFileParser->SetKeyframesOnly(thinned);
+        }
+
+        m_thinned = thinned;
+
+        // the audio streams may have been waiting for data the whole time - wake them up
+        if (!thinned && m_state == SourceStateStarted)
+        {
+            hr = SendOperation(SourceOperationStreamNeedData);
+            BREAK_ON_FAIL(hr);
+        }
+
+        // the video may have ended already
+        if (thinned)
+        {
+            hr = EndThinnedStreams();
+            BREAK_ON_FAIL(hr);
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Tell the selected streams that are skipped during thinned playback that there is no data
+// for them up to the specified time, so that the pipeline does not wait for their samples
+//
+HRESULT AVFSource::SendStreamTicks(LONGLONG time)
+{
+    HRESULT hr = S_OK;
+    PROPVARIANT var;
+
+    PropVariantInit(&var);
+    var.vt = VT_I8;
+    var.hVal.QuadPart = time;
+
+    for (DWORD x = 0; x < m_mediaStreams.size(); x++)
+    {
+        AVFStream* pStream = m_mediaStreams[x];
+
+        if (pStream->IsActive() && pStream->IsAudioStream() && !pStream->IsEndOfStream())
+        {
+            hr = pStream->QueueEvent(MEStreamTick, GUID_NULL, S_OK, &var);
+            BREAK_ON_FAIL(hr);
+        }
+    }
+
+    return hr;
+}
+
+
+//
+// During thinned playback the streams skipped by the thinning never reach the end of their
+// data on their own - end them once all of the selected video streams have ended, so that
+// the end of the presentation is signaled
+//
+HRESULT AVFSource::EndThinnedStreams(void)
+{
+    HRESULT hr = S_OK;
+    bool videoSelected = false;
+
+    for (DWORD x = 0; x < m_mediaStreams.size(); x++)
+    {
+        AVFStream* pStream = m_mediaStreams[x];
+
+        if (pStream->IsActive() && pStream->IsVideoStream())
+        {
+            // some video is still playing
+            if (!pStream->IsEndOfStream())
+            {
+                return S_OK;
+            }
+
+            videoSelected = true;
+        }
+    }
+
+    // without video there is nothing to end the skipped streams with
+    if (!videoSelected)
+    {
+        return S_OK;
+    }
+
+    for (DWORD x = 0; x < m_mediaStreams.size(); x++)
+    {
+        AVFStream* pStream = m_mediaStreams[x];
+
+        if (pStream->IsActive() && pStream->IsAudioStream() && !pStream->IsEndOfStream())
+        {
+            hr = pStream->EndOfStream();
+            BREAK_ON_FAIL(hr);
+        }
+    }
+
+    return hr;
+}
+
+
+
+//
+// Helper function that schedules the passed-in stream command on the work queue.  The
+// stream commands carry no data, so the same preallocated operation object is posted every
+// time.  Requests for data are coalesced - the sample loop serves all of the streams that
+// need data, so if a request is already queued, there is no need to queue another one.
+//
+HRESULT AVFSource::SendOperation(SourceOperationType operationType)
+{
+    HRESULT hr = S_OK;
+    ISourceOperation* pOperation = NULL;
+
+    do
+    {
+        if (operationType == SourceOperationStreamNeedData)
+        {
+            // a request is already waiting on the work queue - it will serve this stream
+            // as well
+            if (InterlockedCompareExchange(&m_needDataPending, 1, 0) != 0)
+            {
+                break;
+            }
+
+            pOperation = m_pNeedDataOperation;
+        }
+        else if (operationType == SourceOperationEndOfStream)
+        {
+            pOperation = m_pEndOfStreamOperation;
+        }
+        BREAK_ON_NULL (pOperation, E_UNEXPECTED);
+
+        // queue the command on the queue
+        hr = MFPutWorkItem(MFASYNC_CALLBACK_QUEUE_STANDARD, this, static_cast<IUnknown*>(pOperation));
+
+        // if the request could not be queued, let the next one try again
+        if (FAILED(hr) && operationType == SourceOperationStreamNeedData)
+        {
+            InterlockedExchange(&m_needDataPending, 0);
+        }
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Schedule a request for data that fires after the tail poll interval, unless one is
+// already scheduled.  Used when the streams caught up with a file that is still being
+// recorded - the work queue timer wakes the source up again without blocking a thread.
+//
+HRESULT AVFSource::ScheduleTailPoll(void)
+{
+    HRESULT hr = S_OK;
+
+    if (!m_tailPollScheduled)
+    {
+        // a negative timeout is a relative time in milliseconds
+        hr = MFScheduleWorkItem(this, static_cast<IUnknown*>(m_pTailPollOperation), 
+            -(INT64)AVF_TAIL_POLL_INTERVAL, &m_tailPollKey);
+
+        if (SUCCEEDED(hr))
+        {
+            m_tailPollScheduled = true;
+        }
+    }
+
+    return hr;
+}
+
+
+//
+// Store the duration of a followed file in the presentation descriptor once it has grown.
+// The presentation descriptors handed out by CreatePresentationDescriptor() are copies that
+// keep the old duration, so the change is announced with MESourceCharacteristicsChanged -
+// an application that shows the duration gets a new presentation descriptor when it sees
+// the event.  The characteristics themselves stay the same.
+//
+HRESULT AVFSource::UpdateDuration(void)
+{
+    HRESULT hr = S_OK;
+    CComPtr<IMFMediaEvent> pEvent;
+    UINT64 duration = (UINT64)m_pAVIFileParser->Duration();
+
+    do
+    {
+        if (MFGetAttributeUINT64(m_pPresentationDescriptor, MF_PD_DURATION, 0) == duration)
+        {
+            break;
+        }
+
+        hr = m_pPresentationDescriptor->SetUINT64(MF_PD_DURATION, duration);
+        BREAK_ON_FAIL(hr);
+
+        hr = MFCreateMediaEvent(MESourceCharacteristicsChanged, GUID_NULL, S_OK, NULL,
+            &pEvent);
+        BREAK_ON_FAIL(hr);
+
+        hr = pEvent->SetUINT32(MF_EVENT_SOURCE_CHARACTERISTICS_OLD,
+            AVF_SOURCE_CHARACTERISTICS);
+        BREAK_ON_FAIL(hr);
+
+        hr = pEvent->SetUINT32(MF_EVENT_SOURCE_CHARACTERISTICS, AVF_SOURCE_CHARACTERISTICS);
+        BREAK_ON_FAIL(hr);
+
+        hr = m_pEventQueue->QueueEvent(pEvent);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Schedule the next dump of the stream statistics, unless one is already scheduled or the
+// statistics are not dumped at all
+//
+HRESULT AVFSource::ScheduleStatisticsDump(void)
+{
+    HRESULT hr = S_OK;
+
+    if (m_statisticsDumpInterval > 0 && !m_statisticsDumpScheduled)
+    {
+        hr = MFScheduleWorkItem(this, static_cast<IUnknown*>(m_pStatisticsDumpOperation), 
+            -(INT64)m_statisticsDumpInterval, &m_statisticsDumpKey);
+
+        if (SUCCEEDED(hr))
+        {
+            m_statisticsDumpScheduled = true;
+        }
+    }
+
+    return hr;
+}
+
+
+//
+// Write the statistics of every stream to the debugger output as a single line per stream,
+// and schedule the next dump
+//
+HRESULT AVFSource::InternalDumpStatistics(void)
+{
+    HRESULT hr = S_OK;
+    AVFStreamStatistics statistics;
+    WCHAR line[512];
+
+    for (DWORD x = 0; x < m_mediaStreams.size(); x++)
+    {
+        hr = GetStreamStatistics(x, &statistics);
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        swprintf_s(line, _countof(line), 
+            L"AVFSource stream %u: requested %I64d delivered %I64d starved %I64d "
+            L"read %I64d bytes | delivery us p50 %I64d p99 %I64d max %I64d | "
+            L"read us p50 %I64d p99 %I64d max %I64d | depth p50 %I64d max %I64d\n",
+            statistics.streamId, statistics.samplesRequested, statistics.samplesDelivered,
+            statistics.starvationEvents, statistics.bytesRead,
+            statistics.requestToDelivery.Percentile(50), 
+            statistics.requestToDelivery.Percentile(99),
+            statistics.requestToDelivery.maximum,
+            statistics.parserRead.Percentile(50), statistics.parserRead.Percentile(99),
+            statistics.parserRead.maximum,
+            statistics.queueDepth.Percentile(50), statistics.queueDepth.maximum);
+
+        OutputDebugStringW(line);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = ScheduleStatisticsDump();
+    }
+
+    return hr;
+}
+
+
+//
+// Initialize the underlying AVFFileParser, and open the file in the operation object.
+//
+HRESULT AVFSource::InternalOpen(ISourceOperation* pOp)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+    WCHAR* pUrl = NULL;
+    AviReader* pReader = NULL;
+    bool inPlace = true;
+    CComPtr<ISourceOperation> pOperation = pOp;
+    CComPtr<ISourceOperation> pLoadedOperation;
+    CComPtr<IMFAsyncResult> pCallerResult;
+    
+    do
+    {
+        BREAK_ON_NULL(pOperation, E_UNEXPECTED);
+
+        // Get the async result that will be sent once the open operation is complete.
+        hr = pOperation->GetCallerAsyncResult(&pCallerResult);
+        BREAK_ON_FAIL(hr);
+        BREAK_ON_NULL(pCallerResult, E_UNEXPECTED);
+
+        // get the file URL from the operation
+        pUrl = pOperation->GetUrl();
+
+        // without a byte stream from the byte stream handler, the file is opened by its URL
+        if (m_pByteStream == NULL)
+        {
+            BREAK_ON_NULL(pUrl, E_UNEXPECTED);
+
+            hr = CompleteOpen(pUrl, NULL);
+            break;
+        }
+
+        hr = AviByteStreamReader::CanReadInPlace(m_pByteStream, &inPlace);
+        BREAK_ON_FAIL(hr);
+
+        // read the file through the byte stream
+        if (inPlace)
+        {
+            hr = AviByteStreamReader::CreateReader(m_pByteStream, &pReader);
+            BREAK_ON_FAIL(hr);
+
+            hr = CompleteOpen(pUrl, pReader);
+            break;
+        }
+
+        // the byte stream has to be loaded into memory first - every read completion issues
+        // the next read, and the last one sends the operation that continues the open in
+        // InternalOpenLoaded(), so no thread waits for the data
+        pLoadedOperation = new (std::nothrow) SourceOperation(SourceOperationOpenLoaded, pUrl,
+            pCallerResult);
+        BREAK_ON_NULL(pLoadedOperation, E_OUTOFMEMORY);
+
+        hr = AviByteStreamLoader::CreateInstance(m_pByteStream, m_byteStreamMaxMemory,
+            &m_pByteStreamLoader);
+        BREAK_ON_FAIL(hr);
+
+        hr = m_pByteStreamLoader->BeginLoad(this, pLoadedOperation);
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    // the reader or the loader holds its own reference to the byte stream
+    m_pByteStream = NULL;
+
+    // the caller is notified once the byte stream is loaded
+    if (SUCCEEDED(hr) && !inPlace)
+    {
+        return hr;
+    }
+
+    SafeRelease(m_pByteStreamLoader);
+
+    // return the result whether we succeeded or failed
+    if(pCallerResult != NULL)
+    {
+        // Store the result of the initialization operation in the caller result.
+        pCallerResult->SetStatus(hr);
+
+        // Notify the caller of the BeginOpen() method that the open is complete.
+        MFInvokeCallback(pCallerResult);
+    }
+
+    return hr;
+}
+
+
+//
+// Continue the open once the byte stream that could not be read in place is loaded into
+// memory - or the load failed
+//
+HRESULT AVFSource::InternalOpenLoaded(ISourceOperation* pOp, IMFAsyncResult* pResult)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+    AviReader* pReader = NULL;
+    CComPtr<ISourceOperation> pOperation = pOp;
+    CComPtr<IMFAsyncResult> pCallerResult;
+
+    do
+    {
+        BREAK_ON_NULL(pOperation, E_UNEXPECTED);
+
+        hr = pOperation->GetCallerAsyncResult(&pCallerResult);
+        BREAK_ON_FAIL(hr);
+        BREAK_ON_NULL(pCallerResult, E_UNEXPECTED);
+
+        // the source may have been shut down while the byte stream was loaded
+        hr = CheckShutdown();
+        BREAK_ON_FAIL(hr);
+        BREAK_ON_NULL(m_pByteStreamLoader, E_UNEXPECTED);
+
+        // get the memory reader - or the error that stopped the load, such as a stream
+        // that does not fit into the memory limit
+        hr = m_pByteStreamLoader->EndLoad(pResult, &pReader);
+        BREAK_ON_FAIL(hr);
+
+        hr = CompleteOpen(pOperation->GetUrl(), pReader);
+    }
+    while(false);
+
+    SafeRelease(m_pByteStreamLoader);
+
+    if(pCallerResult != NULL)
+    {
+        pCallerResult->SetStatus(hr);
+        MFInvokeCallback(pCallerResult);
+    }
+
+    return hr;
+}
+
+
+//
+// Create the parser for the file, and parse its header - the parser takes ownership of the
+// reader.  Without a reader, the parser opens the file by its URL.
+//
+HRESULT AVFSource::CompleteOpen(WCHAR* pUrl, AviReader* pReader)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        // Create the AVI parser - it takes ownership of the reader
+        hr = AVIFileParser::CreateInstance(pUrl, pReader, &m_pAVIFileParser);
+        BREAK_ON_FAIL(hr);
+
+        // let the parser load the index from the cache file instead of parsing the file
+        m_pAVIFileParser->SetIndexCacheEnabled(m_indexCacheEnabled);
+
+        // let the parser pick up data appended to a file that is still being recorded
+        m_pAVIFileParser->SetTailFollow(m_tailFollow, m_tailIdleTimeout);
+
+        // parse the file header and instantiate the individual stream objects
+        hr = ParseHeader();
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Start playback or seek to the specified location.
+//
+HRESULT AVFSource::InternalStart(ISourceOperation* pCommand)
+{
+    HRESULT hr = S_OK;
+    CComPtr<IMFPresentationDescriptor> pPresentationDescriptor;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    do
+    {
+        // get the presentation descriptor from the start operation
+        hr = pCommand->GetPresentationDescriptor(&pPresentationDescriptor);
+        BREAK_ON_FAIL(hr);
+
+        // activate the streams associated with the presentation descriptor
+        hr = SelectStreams(pPresentationDescriptor, pCommand->GetData(), 
+            pCommand->IsSeek());
+        BREAK_ON_FAIL(hr);
+
+        // set the start position in the file - if the samples are read ahead of time, the
+        // prefetcher drops whatever it buffered before the seek
+        if (m_pPrefetcher != NULL)
+        {
+            hr = m_pPrefetcher->SetOffset(pCommand->GetData());
+        }
+        else
+        {
+            hr = m_pAVIFileParser->SetOffset(pCommand->GetData());
+        }
+        BREAK_ON_FAIL(hr);
+
+        // update the internal state variable
+        m_state = SourceStateStarted;
+
+        // start writing out the stream statistics, if that was requested
+        hr = ScheduleStatisticsDump();
+        BREAK_ON_FAIL(hr);
+
+        // we have just started - which means that none of the streams have hit the
+        // end of stream indicator yet.  Once all of the streams have ended, the source
+        // will stop.
+        m_pendingEndOfStream = 0;
+        
+        // if we got here, then everything succeed.  If this was a seek request, queue the 
+        // result of the seek command.  If this is a start request, queue the result of the
+        // start command.
+        if (pCommand->IsSeek())
+        {
+            hr = m_pEventQueue->QueueEventParamVar(
+                        MESourceSeeked,                // seek result
+                        GUID_NULL,                     // no extended event data
+                        S_OK,                          // succeeded
+                        &pCommand->GetData());         // operation object
+        }
+        else
+        {
+            hr = m_pEventQueue->QueueEventParamVar(
+                        MESourceStarted,               // start result
+                        GUID_NULL,                     // no extended event data
+                        S_OK,                          // succeeded
+                        &pCommand->GetData());         // operation object
+        }
+    }
+    while(false);
+
+    // if we failed, fire an event indicating status of the operation - there is no need to fire
+    // status if start succeeded, since that would have been handled above in the while loop
+    if (FAILED(hr))
+    {
+        m_pEventQueue->QueueEventParamVar(MESourceStarted, GUID_NULL, hr, NULL);
+    }
+
+    return hr;
+}
+
+
+
+//
+// Internal implementation of the stop command - needed to asynchronously handle stop
+//
+HRESULT AVFSource::InternalStop(void)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    do
+    {
+        // go through every stream, and if it is active, send a stop command to it
+        for (DWORD x = 0; x < m_mediaStreams.size(); x++)
+        {
+            AVFStream* pStream = NULL;
+            
+            pStream = m_mediaStreams[x];
+            BREAK_ON_FAIL(hr);
+            BREAK_ON_NULL(pStream, E_UNEXPECTED);
+
+            if (pStream->IsActive())
+            {
+                hr = pStream->Stop();
+                BREAK_ON_FAIL(hr);
+            }
+        }
+        BREAK_ON_FAIL(hr);
+
+        // update the internal state variable
+        m_state = SourceStateStopped;
+    }
+    while(false);
+
+    // fire an event indicating status of the operation
+    m_pEventQueue->QueueEventParamVar(MESourceStopped, GUID_NULL, hr, NULL);
+
+    return hr;
+}
+
+
+//
+// Internal implementation of the pause command - needed to asynchronously handle pause
+//
+HRESULT AVFSource::InternalPause(void)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    do
+    {
+        // if the source is not started, it cannot be paused
+        if (m_state != SourceStateStarted)
+        {
+            hr = MF_E_INVALID_STATE_TRANSITION;
+            break;
+        }
+
+        // go through every stream, and if it is active, send a pause command to it
+        for (DWORD x = 0; x < m_mediaStreams.size(); x++)
+        {
+            AVFStream* pStream = NULL;
+            
+            pStream = m_mediaStreams[x];
+            BREAK_ON_FAIL(hr);
+            BREAK_ON_NULL(pStream, E_UNEXPECTED);
+
+            if (pStream->IsActive())
+            {
+                hr = pStream->Pause();
+                BREAK_ON_FAIL(hr);
+            }
+        }
+        BREAK_ON_FAIL(hr);
+
+        // update the internal state variable
+        m_state = SourceStatePaused;
+    }
+    while(false);
+
+    // fire an event indicating status of the operation
+    m_pEventQueue->QueueEventParamVar(MESourcePaused, GUID_NULL, hr, NULL);
+
+    return hr;
+}
+
+
+//
+// Handle the request sample command - pull out a sample of the right type from the underlying
+// AVI file parser, and send it to the stream
+//
+HRESULT AVFSource::InternalRequestSample(void)
+{
+    bool needMoreData = false;
+    HRESULT hr = S_OK;
+
+    do
+    {
+        needMoreData = false;
+
+        // go through each of the streams, figure out if they need data, pull out a sample 
+        // from the underlying AVI file parser, and deliver it to the right stream
+        for (DWORD x = 0; x < m_mediaStreams.size(); x++)
+        {
+            AVFStream* pStream = NULL;
+            
+            pStream = m_mediaStreams[x];
+            BREAK_ON_FAIL(hr);
+            BREAK_ON_NULL(pStream, E_UNEXPECTED);
+
+            // if the current stream needs more data, process its requests
+            if (pStream->NeedsData())
+            {
+                // call a function to send a sample to the stream
+                hr = SendSampleToStream(pStream);
+
+                // the sample is not there yet.  Either the prefetcher is still reading it,
+                // and posts a new request for data once it is done, or the stream caught
+                // up with the writer of a file that is still being recorded - look for new
+                // data again after a while instead of spinning.
+                if (hr == E_PENDING)
+                {
+                    hr = m_tailFollow ? ScheduleTailPoll() : S_OK;
+                    BREAK_ON_FAIL(hr);
+                    continue;
+                }
+                BREAK_ON_FAIL(hr);
+
+                // store a flag indicating that somebody did need data
+                needMoreData = true;
+            }
+        }
+
+        BREAK_ON_FAIL(hr);
+
+        // loop while some stream needs more data - stop only once none of the streams are
+        // requesting more samples
+    } 
+    while (needMoreData);
+
+    // the duration of a followed file grows as new data is discovered
+    if (SUCCEEDED(hr) && m_tailFollow)
+    {
+        hr = UpdateDuration();
+    }
+
+    if(FAILED(hr))
+    {
+        QueueEvent(MEError, GUID_NULL, hr, NULL);
+    }
+
+    return hr;
+}
+
+
+//
+// Load a sample of the right type from the parser and send it to the passed-in stream
+//
+HRESULT AVFSource::SendSampleToStream(AVFStream* pStream)
+{
+    HRESULT hr = S_OK;
+    CComPtr<IMFSample> pSample;
+    bool endOfStream = false;
+
+    do
+    {
+        // get the next sample for the stream - either from the read-ahead buffers or 
+        // directly from the file
+        hr = GetNextSample(pStream, &pSample, &endOfStream);
+
+        // a followed file stopped growing after the last sample of the stream was sent -
+        // there is nothing left to deliver, just end the stream
+        if (hr == MF_E_END_OF_STREAM)
+        {
+            hr = pStream->EndOfStream();
+            break;
+        }
+        BREAK_ON_FAIL(hr);
+
+        // deliver the sample
+        hr = pStream->DeliverSample(pSample);
+        BREAK_ON_FAIL(hr);
+
+        // the streams skipped during thinned playback have no data up to this keyframe
+        if (m_thinned && pStream->IsVideoStream())
+        {
+            LONGLONG sampleTime = 0;
+
+            if (SUCCEEDED(pSample->GetSampleTime(&sampleTime)))
+            {
+                hr = SendStreamTicks(sampleTime);
+                BREAK_ON_FAIL(hr);
+            }
+        }
+
+        // if this is the end of the stream, tell the stream that there are no more samples
+        if (endOfStream)
+        {
+            hr = pStream->EndOfStream();
+            BREAK_ON_FAIL(hr);
+        }
+    }
+    while(false);
+
+    // the end of the video also ends the streams skipped during thinned playback
+    if (SUCCEEDED(hr) && m_thinned && pStream->IsVideoStream() && pStream->IsEndOfStream())
+    {
+        hr = EndThinnedStreams();
+    }
+
+    return hr;
+}
+
+
+//
+// Get the next sample for the passed-in stream, and figure out whether it is the last
+// sample of that stream
+//
+HRESULT AVFSource::GetNextSample(AVFStream* pStream, IMFSample** ppSample, bool* pEndOfStream)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        *pEndOfStream = false;
+
+        // if the samples are read ahead of time, just pull the next one out of memory
+        if (m_pPrefetcher != NULL)
+        {
+            hr = m_pPrefetcher->GetNextSample(pStream->GetTrack(), ppSample, pEndOfStream);
+            break;
+        }
+
+        // get the next sample of the track delivered by the stream from the AVI parser
+        hr = m_pAVIFileParser->GetNextSample(pStream->GetTrack(), ppSample);
+        BREAK_ON_FAIL(hr);
+
+        *pEndOfStream = m_pAVIFileParser->IsEndOfStream(pStream->GetTrack());
+    }
+    while(false);
+
+    return hr;
+}
+
+
+
+//
+// Handle an end of stream event
+//
+HRESULT AVFSource::InternalEndOfStream(void)
+{
+    HRESULT hr = S_OK;
+
+    // increment the counter which indicates how many streams have signaled their end
+    m_pendingEndOfStream++;
+
+    // if all of the selected streams have ended, fire an MEEndOfPresentation event
+    if (m_pendingEndOfStream == m_activeStreams)
+    {
+        hr = m_pEventQueue->QueueEventParamVar(MEEndOfPresentation, GUID_NULL, S_OK, NULL);
+    }
+
+    return hr;
+}
+
+
+
+//
+// Parse the file header of the current file
+//
+HRESULT AVFSource::ParseHeader(void)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        // Sanity checks against input arguments.
+        BREAK_ON_NULL (m_pAVIFileParser, E_UNEXPECTED);
+
+        // Parse the AVI file header.
+        hr = m_pAVIFileParser->ParseHeader();
+        BREAK_ON_FAIL(hr);
+
+        m_pAVIFileParser->SetFileOrderReading(m_fileOrderReading);
+        m_pAVIFileParser->SetAudioChunksPerSample(m_audioChunksPerSample);
+
+        // Create the individual streams from the presentation descriptor
+        hr = InternalCreatePresentationDescriptor();
+        BREAK_ON_FAIL(hr);
+
+        // if requested, create the prefetcher that will read the samples ahead of time -
+        // it starts reading once the source is started, and posts a request for data to
+        // the source whenever a sample that a stream is waiting for has been read
+        if (m_prefetchEnabled)
+        {
+            hr = SamplePrefetcher::CreateInstance(m_pAVIFileParser, m_prefetchBufferBytes,
+                this, m_pSampleReadyOperation, &m_pPrefetcher);
+            BREAK_ON_FAIL(hr);
+        }
+    }
+    while(false);
+
+    // if the header was successfully parsed, and if the streams have been created,
+    // update the internal state variables
+    if (SUCCEEDED(hr))
+    {
+        m_state = SourceStateStopped;
+    }
+
+    return hr;
+}
+
+
+
+//
+// Activate the streams exposed by the source
+//
+HRESULT AVFSource::SelectStreams(IMFPresentationDescriptor *pPresentationDescriptor, const PROPVARIANT varStart, bool isSeek)
+{
+    HRESULT hr = S_OK;
+    BOOL selected = FALSE;
+    bool wasSelected = false;
+    DWORD streamId = 0;
+
+    CComPtr<IMFStreamDescriptor> pStreamDescriptor;
+    CComPtr<IUnknown> pUnkStream;
+
+    do
+    {
+        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+        // count the selected streams again - the end of the presentation is reached when
+        // all of them have sent their end of stream
+        m_activeStreams = 0;
+        
+        for (DWORD x = 0; x < m_mediaStreams.size(); x++)
+        {
+            AVFStream* pStream = NULL;
+            
+            pStream = m_mediaStreams[x];
+            BREAK_ON_FAIL(hr);
+            BREAK_ON_NULL(pStream, E_UNEXPECTED);
+
+            pStreamDescriptor = NULL;
+
+            // get a stream descriptor for the current stream from the presentation descriptor 
+            hr = pPresentationDescriptor->GetStreamDescriptorByIndex(x, &selected, &pStreamDescriptor);
+            BREAK_ON_FAIL(hr);
+
+            // get the stream ID from the stream descriptor
+            hr = pStreamDescriptor->GetStreamIdentifier(&streamId);
+            BREAK_ON_FAIL(hr);
+
+            if (pStream == NULL)
+            {
+                hr = E_INVALIDARG;
+                break;
+            }
+
+            // figure out if the current stream was already selected - IE if it was active
+            wasSelected = pStream->IsActive();
+
+            // activate the stream
+            pStream->Activate(selected == TRUE);
+
+            // the data of the tracks nobody will ask for is skipped - neither the prefetcher
+            // nor the parser read ahead the chunks of a deselected track
+            if (m_pPrefetcher != NULL)
+            {
+                hr = m_pPrefetcher->ActivateTrack(pStream->GetTrack(), selected == TRUE);
+                BREAK_ON_FAIL(hr);
+            }
+            else
+            {
+                m_pAVIFileParser->ActivateTrack(pStream->GetTrack(), selected == TRUE);
+            }
+
+            if (selected)
+            {
+                m_activeStreams++;
+            }
+
+            // get the IUnknown pointer for the AVFStream object
+            pUnkStream = pStream;
+            
+            // if the stream was selected queue the an event with the result of the operation
+            if (selected)
+            {
+                // if the stream was already selected, something must have been updated - fire the
+                // MEUpdatedStream event
+                if (wasSelected)
+                {
+                    hr = m_pEventQueue->QueueEventParamUnk(
+                                MEUpdatedStream,              // event - the stream was updated
+                                GUID_NULL,                    // basic event - no extension GUID
+                                hr,                           // result of the operation
+                                pUnkStream);                 // pointer to the stream
+                }
+                else
+                {
+                    hr = m_pEventQueue->QueueEventParamUnk(
+                                MENewStream,                  // the new stream was activated
+                                GUID_NULL,                    // basic event - no extension GUID
+                                hr,                           // result of the operation
+                                pUnkStream);                 // pointer to the stream
+                }
+
+                // start playing the stream
+                hr = pStream->Start(varStart, isSeek);
+                BREAK_ON_FAIL(hr);
+            }
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+
+//
+// Create the presentation descriptor object
+//
+HRESULT AVFSource::InternalCreatePresentationDescriptor(void)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    IMFStreamDescriptor** streamDescriptors = NULL;
+    DWORD trackCount = 0;
+    bool videoSelected = false;
+    bool audioSelected = false;
+
+    do
+    {
+        BREAK_ON_NULL (m_pAVIFileParser, E_POINTER);
+
+        // make sure this is a supported file format
+        if (!m_pAVIFileParser->IsSupportedFormat())
+        {
+            hr = MF_E_INVALID_FORMAT;
+            break;
+        }
+
+        trackCount = m_pAVIFileParser->TrackCount();
+        if (trackCount == 0)
+        {
+            hr = MF_E_INVALID_FILE_FORMAT;
+            break;
+        }
+
+        streamDescriptors = new (std::nothrow) IMFStreamDescriptor*[trackCount];
+        BREAK_ON_NULL (streamDescriptors, E_OUTOFMEMORY);
+        ZeroMemory(streamDescriptors, trackCount * sizeof(IMFStreamDescriptor*));
+
+        // create a stream and a stream descriptor for every audio and video track in the file
+        for (DWORD track = 0; track < trackCount; track++)
+        {
+            hr = CreateTrackStream(track, &(streamDescriptors[track]));
+            BREAK_ON_FAIL(hr);
+        }
+        BREAK_ON_FAIL(hr);
+
+        // if we got here, we have successfully created a stream descriptor for each of the
+        // tracks.  Now create the presentation descriptor which will hold the stream 
+        // descriptors.
+        hr = MFCreatePresentationDescriptor(
+                    (DWORD)m_mediaStreams.size(),   // number of streams created
+                    streamDescriptors,              // array of stream descriptors
+                    &m_pPresentationDescriptor);   // get the presentation descriptor
+        BREAK_ON_FAIL(hr);
+
+
+        // activate the first video and the first audio track in the beginning - that's their
+        // default state.  The alternate tracks are exposed to the application, which can
+        // select them instead.
+        for (DWORD i = 0; i < m_mediaStreams.size(); i++)
+        {
+            bool& typeSelected = m_mediaStreams[i]->IsVideoStream() ? videoSelected : audioSelected;
+
+            if (typeSelected)
+            {
+                hr = m_pPresentationDescriptor->DeselectStream(i);
+            }
+            else
+            {
+                hr = m_pPresentationDescriptor->SelectStream(i);
+                typeSelected = true;
+            }
+            BREAK_ON_FAIL(hr);
+        }
+        BREAK_ON_FAIL(hr);
+
+        // get the duration of the file from the AVI file parser
+        LONGLONG fileDuration = m_pAVIFileParser->Duration();
+
+        // set the file duration on the presentation descriptor - length of the file
+        // in 100-ns units
+        hr = m_pPresentationDescriptor->SetUINT64(MF_PD_DURATION, (UINT64)(fileDuration));
+    }
+    while(false);
+
+    // all of the stream descriptors have now been stored in the presentation descriptor -
+    // therefore release all of the stream descriptor pointers we have left over
+    if (streamDescriptors != NULL)
+    {
+        for (DWORD i = 0; i < trackCount; i++)
+        {
+            SafeRelease(streamDescriptors[i]);
+        }
+
+        delete [] streamDescriptors;
+    }
+
+    return hr;
+}
+
+
+//
+// Create the stream for the specified track of the file and return the corresponding stream
+// descriptor
+//
+HRESULT AVFSource::CreateTrackStream(DWORD track, IMFStreamDescriptor** ppStreamDescriptor)
+{
+    HRESULT hr = S_OK;
+
+    IMFMediaType* pMediaType = NULL;
+    AVFStream* pAVFStream = NULL;
+    CComPtr<IMFMediaTypeHandler> pHandler;
+
+    do
+    {
+        // get the media type of the track from the AVI file parser
+        hr = m_pAVIFileParser->GetMediaType(track, &pMediaType);
+        BREAK_ON_FAIL(hr);
+
+        // create the stream descriptor
+        hr = MFCreateStreamDescriptor(
+                    (DWORD)m_mediaStreams.size()+1,  // stream ID
+                    1,                               // number of media types
+                    &pMediaType,                     // media type for the stream
+                    ppStreamDescriptor);             // get the descriptor
+        BREAK_ON_FAIL(hr);
+
+        // get a media type handler for the stream 
+        hr = (*ppStreamDescriptor)->GetMediaTypeHandler(&pHandler);
+        BREAK_ON_FAIL(hr);
+
+        // set current type of the stream visible to source users
+        hr = pHandler->SetCurrentMediaType(pMediaType);
+        BREAK_ON_FAIL(hr);
+
+        // if the stream header specifies the language of the track, store it in the
+        // descriptor so that the application can pick between the alternate tracks
+        WORD language = m_pAVIFileParser->GetTrackLanguage(track);
+        if (language != 0)
+        {
+            WCHAR localeName[LOCALE_NAME_MAX_LENGTH];
+
+            if (LCIDToLocaleName(MAKELCID(language, SORT_DEFAULT), localeName, 
+                    LOCALE_NAME_MAX_LENGTH, 0) > 0)
+            {
+                hr = (*ppStreamDescriptor)->SetString(MF_SD_LANGUAGE, localeName);
+                BREAK_ON_FAIL(hr);
+            }
+        }
+
+        // Create AVFStream object that is implementing the IMFMediaStream interface
+        hr = AVFStream::CreateInstance(&pAVFStream, this, *ppStreamDescriptor);
+        BREAK_ON_FAIL(hr);
+
+        // tell the AVFStream object which track it delivers
+        pAVFStream->SetTrack(track, m_pAVIFileParser->IsVideoTrack(track));
+        
+        // store the stream in a vector for later reuse
+        EXCEPTION_TO_HR( m_mediaStreams.push_back(pAVFStream) );
+    }
+    while(false);
+
+    SafeRelease(pMediaType);
+
+    return hr;
+}
+
+
+
+//
+// Constructor
+//
+AVFSource::AVFSource(HRESULT* pHr) : 
+    m_cRef(1),
+    m_pAVIFileParser(NULL),
+    m_pByteStreamLoader(NULL),
+    m_byteStreamMaxMemory(BYTE_STREAM_DEFAULT_MAX_MEMORY),
+    m_pPrefetcher(NULL),
+    m_prefetchEnabled(false),
+    m_prefetchBufferBytes(PREFETCH_DEFAULT_BUFFER_BYTES),
+    m_fileOrderReading(false),
+    m_audioChunksPerSample(1),
+    m_indexCacheEnabled(false),
+    m_rate(1.0f),
+    m_rateThin(FALSE),
+    m_thinningRate(AVF_DEFAULT_THINNING_RATE),
+    m_thinned(false),
+    m_tailFollow(false),
+    m_tailIdleTimeout(0),
+    m_tailPollKey(0),
+    m_tailPollScheduled(false),
+    m_statisticsDumpInterval(0),
+    m_statisticsDumpKey(0),
+    m_statisticsDumpScheduled(false),
+    m_state(SourceStateUninitialized),
+    m_pendingEndOfStream(0),
+    m_activeStreams(0),
+    m_needDataPending(0)
+{
+    // Initialize the event queue that will execute all of the source's
+    // IMFEventGenerator duties.
+    *pHr = MFCreateEventQueue(&m_pEventQueue);
+
+    // create the operation objects reused for every command sent by the streams
+    if (SUCCEEDED(*pHr))
+    {
+        m_pNeedDataOperation = new (std::nothrow) SourceOperation(SourceOperationStreamNeedData);
+        m_pEndOfStreamOperation = new (std::nothrow) SourceOperation(SourceOperationEndOfStream);
+        m_pTailPollOperation = new (std::nothrow) SourceOperation(SourceOperationStreamNeedData);
+        m_pSampleReadyOperation = 
+            new (std::nothrow) SourceOperation(SourceOperationStreamNeedData);
+        m_pStatisticsDumpOperation = 
+            new (std::nothrow) SourceOperation(SourceOperationDumpStatistics);
+
+        if (m_pNeedDataOperation == NULL || m_pEndOfStreamOperation == NULL || 
+            m_pTailPollOperation == NULL || m_pSampleReadyOperation == NULL ||
+            m_pStatisticsDumpOperation == NULL)
+        {
+            *pHr = E_OUTOFMEMORY;
+        }
+    }
+}
+
+//
+// Destructor
+//
+AVFSource::~AVFSource()
+{
+    SafeRelease(m_pByteStreamLoader);
+
+    if (NULL != m_pPrefetcher)
+    {
+        m_pPrefetcher->Shutdown();
+        SafeRelease(m_pPrefetcher);
+    }
+
+    if (NULL != m_pAVIFileParser)
+    {
+        delete m_pAVIFileParser;
+        m_pAVIFileParser = NULL;
+    }
 }
\ No newline at end of file
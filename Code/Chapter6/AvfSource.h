@@ -1,112 +1,218 @@
-#pragma once
-
-#include <atlbase.h>
-#include <Mfobjects.h>
-#include <mfidl.h>
-
-#include "AviFileParser.h"
-#include "SourceOperation.h"
-#include "AvfStream.h"
-
-#include "Common.h"
-
-#include <vector>
-using namespace std;
-
-// forward declaration of the class implementing the IMFMediaStream for the AVF file. 
-class AVFStream;
-
-//
-// Main source class.
-//
-class AVFSource : public IMFMediaSource,
-                  public IMFAsyncCallback
-{
-    public:
-        static HRESULT CreateInstance(AVFSource **ppAVFSource);
-       
-        // IUnknown interface implementation
-        virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject);
-        virtual ULONG STDMETHODCALLTYPE AddRef(void);
-        virtual ULONG STDMETHODCALLTYPE Release(void);
-
-        //
-        // IMFMediaEventGenerator interface implementation
-        STDMETHODIMP BeginGetEvent(IMFAsyncCallback* pCallback,IUnknown* punkState);
-        STDMETHODIMP EndGetEvent(IMFAsyncResult* pResult, IMFMediaEvent** ppEvent);
-        STDMETHODIMP GetEvent(DWORD dwFlags, IMFMediaEvent** ppEvent);
-        STDMETHODIMP QueueEvent(MediaEventType met, REFGUID guidExtendedType, 
-            HRESULT hrStatus, const PROPVARIANT* pvValue);
-
-        //
-        // IMFMediaSource interface implementation
-        STDMETHODIMP CreatePresentationDescriptor(
-            IMFPresentationDescriptor** ppPresDescriptor);
-        STDMETHODIMP GetCharacteristics(DWORD* pdwCharacteristics);
-        STDMETHODIMP Start(IMFPresentationDescriptor* pPresentationDescriptor,
-            const GUID* pguidTimeFormat,
-            const PROPVARIANT* pvarStartPosition);
-        STDMETHODIMP Stop(void);
-        STDMETHODIMP Pause(void);
-        STDMETHODIMP Shutdown(void);
-
-        //
-        // IMFAsyncCallback interface implementation
-        STDMETHODIMP GetParameters(DWORD *pdwFlags, DWORD *pdwQueue);
-        STDMETHODIMP Invoke(IMFAsyncResult* pAsyncResult);
-
-        //
-        // Helper methods called by the bytestream handler.
-        HRESULT BeginOpen(LPCWSTR pwszURL, IMFAsyncCallback *pCallback, 
-            IUnknown *pUnkState);
-        HRESULT EndOpen(IMFAsyncResult *pResult);
-        
-        HRESULT CheckShutdown(void) const;          // Check if AVSource is shutting down.
-        HRESULT IsInitialized(void) const;          // Check if AVSource is initialized
-
-
-    private:
-        AVFSource(HRESULT* pHr);
-
-        // file handling methods used to parse the file and initialize the objects
-        HRESULT ParseHeader(void);
-        HRESULT InternalCreatePresentationDescriptor(void);
-        HRESULT CreateVideoStream(IMFStreamDescriptor** pStreamDescriptor);
-        HRESULT CreateAudioStream(IMFStreamDescriptor** pStreamDescriptor);
-        
-        HRESULT SendOperation(SourceOperationType operationType);
-        
-        // internal asynchronous event handler methods
-        HRESULT InternalOpen(ISourceOperation* pCommand);
-        HRESULT InternalStart(ISourceOperation* pCommand);
-        HRESULT InternalStop(void);
-        HRESULT InternalPause(void);
-        HRESULT InternalRequestSample(void);
-        HRESULT InternalEndOfStream(void);
-
-        HRESULT SendSampleToStream(AVFStream* pStream);
-
-        HRESULT SelectStreams(IMFPresentationDescriptor *pPresentationDescriptor, const 
-            PROPVARIANT varStart, bool isSeek);
-
-        ~AVFSource(void);
-
-        friend class AVFStream;
-
-    private:
-        volatile long m_cRef;                       // reference count
-        
-        size_t m_pendingEndOfStream;
-        AVIFileParser* m_pAVIFileParser;
-        CComAutoCriticalSection m_critSec;          // critical section
-
-        CComPtr<IMFMediaEventQueue> m_pEventQueue;
-        CComPtr<IMFPresentationDescriptor> m_pPresentationDescriptor;
-
-        // an STL vector with media stream pointers
-        vector<AVFStream*> m_mediaStreams;
-        
-        // current state of the source
-        SourceState m_state;
-};
-
+#pragma once
+
+#include <atlbase.h>
+#include <Mfobjects.h>
+#include <mfidl.h>
+
+#include "AviFileParser.h"
+#include "SourceOperation.h"
+#include "AvfStream.h"
+#include "SamplePrefetcher.h"
+#include "AviByteStreamReader.h"
+
+#include "Common.h"
+
+#include <vector>
+using namespace std;
+
+// default fastest playback rate without thinning - faster rates need keyframe-only playback
+#define AVF_DEFAULT_THINNING_RATE   4.0f
+
+// fastest supported playback rate, with thinning
+#define AVF_MAX_PLAYBACK_RATE       128.0f
+
+// how often a stream that caught up with a file that is still being recorded looks for new
+// data, in milliseconds
+#define AVF_TAIL_POLL_INTERVAL      100
+
+// characteristics of the source reported by GetCharacteristics()
+#define AVF_SOURCE_CHARACTERISTICS  (MFMEDIASOURCE_CAN_PAUSE | MFMEDIASOURCE_CAN_SEEK)
+
+// forward declaration of the class implementing the IMFMediaStream for the AVF file. 
+class AVFStream;
+
+//
+// Main source class.
+//
+class AVFSource : public IMFMediaSource,
+                  public IMFAsyncCallback,
+                  public IMFGetService,
+                  public IMFRateSupport,
+                  public IMFRateControl,
+                  public IAVFSourceStatistics
+{
+    public:
+        static HRESULT CreateInstance(AVFSource **ppAVFSource);
+       
+        // IUnknown interface implementation
+        virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject);
+        virtual ULONG STDMETHODCALLTYPE AddRef(void);
+        virtual ULONG STDMETHODCALLTYPE Release(void);
+
+        //
+        // IMFMediaEventGenerator interface implementation
+        STDMETHODIMP BeginGetEvent(IMFAsyncCallback* pCallback,IUnknown* punkState);
+        STDMETHODIMP EndGetEvent(IMFAsyncResult* pResult, IMFMediaEvent** ppEvent);
+        STDMETHODIMP GetEvent(DWORD dwFlags, IMFMediaEvent** ppEvent);
+        STDMETHODIMP QueueEvent(MediaEventType met, REFGUID guidExtendedType, 
+            HRESULT hrStatus, const PROPVARIANT* pvValue);
+
+        //
+        // IMFMediaSource interface implementation
+        STDMETHODIMP CreatePresentationDescriptor(
+            IMFPresentationDescriptor** ppPresDescriptor);
+        STDMETHODIMP GetCharacteristics(DWORD* pdwCharacteristics);
+        STDMETHODIMP Start(IMFPresentationDescriptor* pPresentationDescriptor,
+            const GUID* pguidTimeFormat,
+            const PROPVARIANT* pvarStartPosition);
+        STDMETHODIMP Stop(void);
+        STDMETHODIMP Pause(void);
+        STDMETHODIMP Shutdown(void);
+
+        //
+        // IMFAsyncCallback interface implementation
+        STDMETHODIMP GetParameters(DWORD *pdwFlags, DWORD *pdwQueue);
+        STDMETHODIMP Invoke(IMFAsyncResult* pAsyncResult);
+
+        //
+        // IMFGetService interface implementation
+        STDMETHODIMP GetService(REFGUID guidService, REFIID riid, LPVOID* ppvObject);
+
+        //
+        // IMFRateSupport interface implementation
+        STDMETHODIMP GetSlowestRate(MFRATE_DIRECTION eDirection, BOOL fThin, float* pflRate);
+        STDMETHODIMP GetFastestRate(MFRATE_DIRECTION eDirection, BOOL fThin, float* pflRate);
+        STDMETHODIMP IsRateSupported(BOOL fThin, float flRate, float* pflNearestSupportedRate);
+
+        //
+        // IMFRateControl interface implementation
+        STDMETHODIMP SetRate(BOOL fThin, float flRate);
+        STDMETHODIMP GetRate(BOOL* pfThin, float* pflRate);
+
+        //
+        // IAVFSourceStatistics interface implementation
+        STDMETHODIMP GetStreamCount(DWORD* pcStreams);
+        STDMETHODIMP GetStreamStatistics(DWORD index, AVFStreamStatistics* pStatistics);
+        STDMETHODIMP ResetStatistics(void);
+
+        //
+        // Helper methods called by the bytestream handler.
+        HRESULT BeginOpen(LPCWSTR pwszURL, IMFByteStream* pByteStream, 
+            IMFAsyncCallback *pCallback, IUnknown *pUnkState);
+        HRESULT EndOpen(IMFAsyncResult *pResult);
+        HRESULT SetConfiguration(IPropertyStore* pConfig);
+        
+        HRESULT CheckShutdown(void) const;          // Check if AVSource is shutting down.
+        HRESULT IsInitialized(void) const;          // Check if AVSource is initialized
+
+
+    private:
+        AVFSource(HRESULT* pHr);
+
+        // file handling methods used to parse the file and initialize the objects
+        HRESULT ParseHeader(void);
+        HRESULT InternalCreatePresentationDescriptor(void);
+        HRESULT CreateTrackStream(DWORD track, IMFStreamDescriptor** ppStreamDescriptor);
+        
+        HRESULT SendOperation(SourceOperationType operationType);
+        
+        // internal asynchronous event handler methods
+        HRESULT InternalOpen(ISourceOperation* pCommand);
+        HRESULT InternalOpenLoaded(ISourceOperation* pCommand, IMFAsyncResult* pResult);
+        HRESULT CompleteOpen(WCHAR* pUrl, AviReader* pReader);
+        HRESULT InternalStart(ISourceOperation* pCommand);
+        HRESULT InternalStop(void);
+        HRESULT InternalPause(void);
+        HRESULT InternalRequestSample(void);
+        HRESULT InternalEndOfStream(void);
+
+        HRESULT SendSampleToStream(AVFStream* pStream);
+        HRESULT GetNextSample(AVFStream* pStream, IMFSample** ppSample, bool* pEndOfStream);
+
+        HRESULT SelectStreams(IMFPresentationDescriptor *pPresentationDescriptor, const 
+            PROPVARIANT varStart, bool isSeek);
+        HRESULT SetThinning(bool thinned);
+        HRESULT SendStreamTicks(LONGLONG time);
+        HRESULT EndThinnedStreams(void);
+        HRESULT ScheduleTailPoll(void);
+        HRESULT UpdateDuration(void);
+        HRESULT ScheduleStatisticsDump(void);
+        HRESULT InternalDumpStatistics(void);
+
+        ~AVFSource(void);
+
+        friend class AVFStream;
+
+    private:
+        volatile long m_cRef;                       // reference count
+        
+        size_t m_pendingEndOfStream;
+        size_t m_activeStreams;                     // number of selected streams
+        AVIFileParser* m_pAVIFileParser;
+
+        // byte stream the file is read from - held only until the source is opened
+        CComPtr<IMFByteStream> m_pByteStream;
+
+        // loads a byte stream that cannot be read in place into memory during the open
+        AviByteStreamLoader* m_pByteStreamLoader;
+        ULONGLONG m_byteStreamMaxMemory;
+        CComAutoCriticalSection m_critSec;          // critical section
+
+        // optional read-ahead stage between the parser and the streams
+        SamplePrefetcher* m_pPrefetcher;
+        bool m_prefetchEnabled;
+        DWORD m_prefetchBufferBytes;
+
+        // read the chunks of all streams in file order
+        bool m_fileOrderReading;
+
+        // number of audio chunks packed into each audio sample
+        DWORD m_audioChunksPerSample;
+
+        // load and store the file index in a sidecar cache file
+        bool m_indexCacheEnabled;
+
+        // current playback rate - thinned playback sends only the video keyframes, and is
+        // needed above the thinning rate
+        float m_rate;
+        BOOL m_rateThin;
+        float m_thinningRate;
+        bool m_thinned;
+
+        // follow a file that is still being recorded
+        bool m_tailFollow;
+        DWORD m_tailIdleTimeout;
+
+        CComPtr<IMFMediaEventQueue> m_pEventQueue;
+
+        // operations sent by the streams - they carry no data, so they are reused
+        CComPtr<ISourceOperation> m_pNeedDataOperation;
+        CComPtr<ISourceOperation> m_pEndOfStreamOperation;
+
+        // a request for data is waiting on the work queue
+        volatile LONG m_needDataPending;
+
+        // timed request for data used to poll the tail of a growing file
+        CComPtr<ISourceOperation> m_pTailPollOperation;
+        MFWORKITEM_KEY m_tailPollKey;
+        bool m_tailPollScheduled;
+
+        // request for data posted by the prefetcher when a sample that was not read yet
+        // arrives
+        CComPtr<ISourceOperation> m_pSampleReadyOperation;
+
+        // timed operation that writes the stream statistics to the debugger output
+        DWORD m_statisticsDumpInterval;
+        CComPtr<ISourceOperation> m_pStatisticsDumpOperation;
+        MFWORKITEM_KEY m_statisticsDumpKey;
+        bool m_statisticsDumpScheduled;
+
+        CComPtr<IMFPresentationDescriptor> m_pPresentationDescriptor;
+
+        // an STL vector with media stream pointers
+        vector<AVFStream*> m_mediaStreams;
+        
+        // current state of the source
+        SourceState m_state;
+};
+
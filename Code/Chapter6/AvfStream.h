@@ -1,83 +1,118 @@
-#pragma once
-
-#include <atlbase.h>
-#include <atlcoll.h>
-
-#include <Mferror.h>
-#include <mfapi.h>
-
-#include "Common.h"
-
-#define SAMPLE_BUFFER_SIZE 2
-
-class AVFSource;
-
-class AVFStream : public IMFMediaStream
-{
-    public:
-        static HRESULT CreateInstance(AVFStream** ppMediaStream, AVFSource *pMediaSource, 
-            IMFStreamDescriptor *pStreamDescriptor);
-
-        //
-        // IMFMediaEventGenerator interface implementation
-        STDMETHODIMP BeginGetEvent(IMFAsyncCallback* pCallback,IUnknown* punkState);
-        STDMETHODIMP EndGetEvent(IMFAsyncResult* pResult, IMFMediaEvent** ppEvent);
-        STDMETHODIMP GetEvent(DWORD dwFlags, IMFMediaEvent** ppEvent);
-        STDMETHODIMP QueueEvent(MediaEventType met, REFGUID guidExtendedType, 
-            HRESULT hrStatus, const PROPVARIANT* pvValue);
-
-        //
-        // IMFMediaStream interface implementation
-        STDMETHODIMP GetMediaSource(IMFMediaSource** ppMediaSource);
-        STDMETHODIMP GetStreamDescriptor(IMFStreamDescriptor** ppStreamDescriptor);
-        STDMETHODIMP RequestSample(IUnknown* pToken);
-
-        //
-        // IUnknown interface implementation
-        virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject);
-        virtual ULONG STDMETHODCALLTYPE AddRef(void);
-        virtual ULONG STDMETHODCALLTYPE Release(void);
-
-        //
-        // Helper functions used by AVFSource
-        HRESULT DeliverSample(IMFSample *pSample);
-        void Activate(bool active);
-        HRESULT Start(const PROPVARIANT& varStart, bool isSeek);
-        HRESULT Pause(void);
-        HRESULT Stop(void);
-        HRESULT EndOfStream();
-        bool IsActive(void) const { return m_active; }
-        HRESULT Shutdown();
-        void SetVideoStream(void) { m_isVideo = true; m_isAudio = false; }
-        void SetAudioStream(void) { m_isVideo = false; m_isAudio = true; }
-        bool IsVideoStream(void) const { return m_isVideo; }
-        bool IsAudioStream(void) const { return m_isAudio; }
-        bool NeedsData(void);
-
-    private:
-        AVFStream(void);
-        HRESULT Init(AVFSource *pMediaSource, IMFStreamDescriptor *pStreamDescriptor);
-        HRESULT CheckShutdown(void);
-        HRESULT DispatchSamples(void);
-        HRESULT SendSamplesOut(void);
-        ~AVFStream(void);
-
-    private:
-        volatile long m_cRef;
-        AVFSource* m_pMediaSource;
-        bool m_active;
-        bool m_endOfStream;
-        bool m_isVideo;
-        bool m_isAudio;
-        SourceState m_state;
-
-        volatile int m_nSamplesRequested;
-
-        CComAutoCriticalSection m_critSec;          // critical section
-
-        CComPtr<IMFStreamDescriptor> m_pStreamDescriptor;
-        CComPtr<IMFMediaEventQueue>  m_pEventQueue;
-        CInterfaceList<IMFSample> m_pSampleList;
-        CInterfaceList<IUnknown, &IID_IUnknown> m_pTokenList;
-};
-
+#pragma once
+
+#include <atlbase.h>
+
+#include <Mferror.h>
+#include <mfapi.h>
+
+#include "Common.h"
+#include "SpscRing.h"
+#include "StreamStatistics.h"
+
+#define SAMPLE_BUFFER_SIZE 2
+
+// capacity of the sample and token rings of each stream - must be a power of two
+#define STREAM_RING_CAPACITY 64
+
+
+// contention counters of the sample and token rings of a stream
+struct StreamQueueStatistics
+{
+    LONG dispatchPasses;        // passes that sent samples out of the rings
+    LONG dispatchHandoffs;      // dispatch requests left to the thread already dispatching
+    LONG controlWaits;          // yields of start/stop/shutdown waiting for a dispatch pass
+    LONG ringFull;              // samples or tokens rejected because their ring was full
+};
+
+class AVFSource;
+
+class AVFStream : public IMFMediaStream
+{
+    public:
+        static HRESULT CreateInstance(AVFStream** ppMediaStream, AVFSource *pMediaSource, 
+            IMFStreamDescriptor *pStreamDescriptor);
+
+        //
+        // IMFMediaEventGenerator interface implementation
+        STDMETHODIMP BeginGetEvent(IMFAsyncCallback* pCallback,IUnknown* punkState);
+        STDMETHODIMP EndGetEvent(IMFAsyncResult* pResult, IMFMediaEvent** ppEvent);
+        STDMETHODIMP GetEvent(DWORD dwFlags, IMFMediaEvent** ppEvent);
+        STDMETHODIMP QueueEvent(MediaEventType met, REFGUID guidExtendedType, 
+            HRESULT hrStatus, const PROPVARIANT* pvValue);
+
+        //
+        // IMFMediaStream interface implementation
+        STDMETHODIMP GetMediaSource(IMFMediaSource** ppMediaSource);
+        STDMETHODIMP GetStreamDescriptor(IMFStreamDescriptor** ppStreamDescriptor);
+        STDMETHODIMP RequestSample(IUnknown* pToken);
+
+        //
+        // IUnknown interface implementation
+        virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject);
+        virtual ULONG STDMETHODCALLTYPE AddRef(void);
+        virtual ULONG STDMETHODCALLTYPE Release(void);
+
+        //
+        // Helper functions used by AVFSource
+        HRESULT DeliverSample(IMFSample *pSample);
+        void Activate(bool active);
+        HRESULT Start(const PROPVARIANT& varStart, bool isSeek);
+        HRESULT Pause(void);
+        HRESULT Stop(void);
+        HRESULT EndOfStream();
+        bool IsEndOfStream(void) const { return m_endOfStream; }
+        bool IsActive(void) const { return m_active; }
+        HRESULT Shutdown();
+        void SetTrack(DWORD track, bool isVideo) { m_track = track; m_isVideo = isVideo; }
+        DWORD GetTrack(void) const { return m_track; }
+        bool IsVideoStream(void) const { return m_isVideo; }
+        bool IsAudioStream(void) const { return !m_isVideo; }
+        void SetThinned(bool thinned) { m_thinned = thinned; }
+        bool NeedsData(void);
+        void GetQueueStatistics(StreamQueueStatistics* pStatistics);
+        void GetDeliveryStatistics(AVFStreamStatistics* pStatistics);
+        void ResetDeliveryStatistics(void);
+
+    private:
+        AVFStream(void);
+        HRESULT Init(AVFSource *pMediaSource, IMFStreamDescriptor *pStreamDescriptor);
+        HRESULT CheckShutdown(void);
+        HRESULT DispatchSamples(void);
+        HRESULT DispatchPass(void);
+        HRESULT SendSamplesOut(void);
+        void AcquireDispatch(void);
+        void ReleaseDispatch(void);
+        void FlushRings(void);
+        ~AVFStream(void);
+
+    private:
+        volatile long m_cRef;
+        AVFSource* m_pMediaSource;
+        volatile bool m_active;
+        volatile bool m_endOfStream;
+        volatile bool m_thinned;            // the stream is not fed during thinned playback
+        DWORD m_track;                      // track of the AVI file parser delivered by the stream
+        bool m_isVideo;
+        volatile SourceState m_state;
+
+        CComAutoCriticalSection m_critSec;          // serializes the state changes
+
+        CComPtr<IMFStreamDescriptor> m_pStreamDescriptor;
+        CComPtr<IMFMediaEventQueue>  m_pEventQueue;
+
+        // The samples are pushed by the source worker, and the tokens by the caller of
+        // RequestSample.  Both rings are drained by whichever thread owns the dispatch flag,
+        // so every ring has one producer and one consumer and needs no lock.  Every token
+        // in the ring stands for one requested sample, and carries the time of the request.
+        SpscRing<IMFSample, STREAM_RING_CAPACITY> m_sampleRing;
+        SpscRing<IUnknown, STREAM_RING_CAPACITY> m_tokenRing;
+
+        volatile LONG m_dispatching;                // 1 while a thread drains the rings
+        volatile LONG m_dispatchRequested;          // another dispatch pass is needed
+        StreamQueueStatistics m_statistics;
+
+        // request counters and latency histograms - the read statistics are kept by the
+        // parser, since the samples may be read ahead of the requests
+        AVFStreamStatistics m_deliveryStatistics;
+};
+
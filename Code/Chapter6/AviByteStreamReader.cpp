@@ -0,0 +1,461 @@
+#include "StdAfx.h"
+#include "AviByteStreamReader.h"
+
+
+//
+// Check whether the byte stream can be read in place - it has to be readable, able to seek,
+// and know its length.  The other byte streams have to be loaded into memory first.
+//
+HRESULT AviByteStreamReader::CanReadInPlace(IMFByteStream* pByteStream, bool* pInPlace)
+{
+    HRESULT hr = S_OK;
+    DWORD capabilities = 0;
+    QWORD length = 0;
+
+    do
+    {
+        BREAK_ON_NULL(pByteStream, E_POINTER);
+        BREAK_ON_NULL(pInPlace, E_POINTER);
+
+        hr = pByteStream->GetCapabilities(&capabilities);
+        BREAK_ON_FAIL(hr);
+
+        if((capabilities & MFBYTESTREAM_IS_READABLE) == 0)
+        {
+            hr = E_ACCESSDENIED;
+            break;
+        }
+
+        *pInPlace = false;
+
+        if((capabilities & MFBYTESTREAM_IS_SEEKABLE) == 0)
+        {
+            break;
+        }
+
+        // the length of some network streams is not known up front
+        hr = pByteStream->GetLength(&length);
+        if(FAILED(hr) || length == (QWORD)-1)
+        {
+            hr = S_OK;
+            break;
+        }
+
+        *pInPlace = true;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Create a reader for a byte stream that can be read in place
+//
+HRESULT AviByteStreamReader::CreateReader(IMFByteStream* pByteStream, AviReader** ppReader)
+{
+    HRESULT hr = S_OK;
+    AviByteStreamReader* pReader = NULL;
+    bool inPlace = false;
+
+    do
+    {
+        BREAK_ON_NULL(ppReader, E_POINTER);
+
+        hr = CanReadInPlace(pByteStream, &inPlace);
+        BREAK_ON_FAIL(hr);
+
+        if(!inPlace)
+        {
+            hr = MF_E_BYTESTREAM_NOT_SEEKABLE;
+            break;
+        }
+
+        pReader = new (std::nothrow) AviByteStreamReader(pByteStream);
+        BREAK_ON_NULL(pReader, E_OUTOFMEMORY);
+
+        *ppReader = pReader;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+AviByteStreamReader::AviByteStreamReader(IMFByteStream* pByteStream) :
+    m_pByteStream(pByteStream)
+{
+}
+
+
+//
+// Read data at the specified offset - the byte stream only reads at its current position,
+// so the position and the read are done under the same lock
+//
+HRESULT AviByteStreamReader::ReadAt(ULONGLONG offset, BYTE* pBuffer, DWORD cbToRead,
+    DWORD* pcbRead)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+    DWORD totalRead = 0;
+
+    do
+    {
+        BREAK_ON_NULL(pBuffer, E_POINTER);
+        BREAK_ON_NULL(pcbRead, E_POINTER);
+
+        hr = m_pByteStream->SetCurrentPosition(offset);
+        BREAK_ON_FAIL(hr);
+
+        // a byte stream may return fewer bytes than requested - loop until we get all of
+        // the data or hit the end of the stream
+        while(totalRead < cbToRead)
+        {
+            ULONG cbRead = 0;
+
+            hr = m_pByteStream->Read(pBuffer + totalRead, cbToRead - totalRead, &cbRead);
+            BREAK_ON_FAIL(hr);
+
+            // zero bytes means that we reached the end of the stream
+            if(cbRead == 0)
+            {
+                break;
+            }
+
+            totalRead += cbRead;
+        }
+        BREAK_ON_FAIL(hr);
+
+        *pcbRead = totalRead;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Get the length of the byte stream
+//
+HRESULT AviByteStreamReader::GetSize(ULONGLONG* pSize)
+{
+    HRESULT hr = S_OK;
+    QWORD length = 0;
+
+    do
+    {
+        BREAK_ON_NULL(pSize, E_POINTER);
+
+        hr = m_pByteStream->GetLength(&length);
+        BREAK_ON_FAIL(hr);
+
+        if(length == (QWORD)-1)
+        {
+            hr = MF_E_BYTESTREAM_UNKNOWN_LENGTH;
+            break;
+        }
+
+        *pSize = length;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+
+
+//
+// Create a loader for the specified byte stream - maxBytes limits the memory that holds
+// the data, 0 is the default limit
+//
+HRESULT AviByteStreamLoader::CreateInstance(IMFByteStream* pByteStream, ULONGLONG maxBytes,
+    AviByteStreamLoader** ppLoader)
+{
+    HRESULT hr = S_OK;
+    AviByteStreamLoader* pLoader = NULL;
+
+    do
+    {
+        BREAK_ON_NULL(pByteStream, E_POINTER);
+        BREAK_ON_NULL(ppLoader, E_POINTER);
+
+        pLoader = new (std::nothrow) AviByteStreamLoader(pByteStream);
+        BREAK_ON_NULL(pLoader, E_OUTOFMEMORY);
+
+        hr = pLoader->Init((maxBytes == 0) ? BYTE_STREAM_DEFAULT_MAX_MEMORY : maxBytes);
+        BREAK_ON_FAIL(hr);
+
+        *ppLoader = pLoader;
+    }
+    while(false);
+
+    if(FAILED(hr))
+    {
+        SafeRelease(pLoader);
+    }
+
+    return hr;
+}
+
+
+AviByteStreamLoader::AviByteStreamLoader(IMFByteStream* pByteStream) :
+    m_cRef(1),
+    m_shutdown(false),
+    m_readPending(false),
+    m_pByteStream(pByteStream),
+    m_pReader(NULL),
+    m_pBlock(NULL)
+{
+}
+
+
+AviByteStreamLoader::~AviByteStreamLoader(void)
+{
+    if(m_pReader != NULL)
+    {
+        delete m_pReader;
+    }
+
+    delete [] m_pBlock;
+}
+
+
+//
+// Allocate the memory reader that collects the data, and the buffer of the reads
+//
+HRESULT AviByteStreamLoader::Init(ULONGLONG maxBytes)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        hr = AviMemoryReader::CreateInstance(NULL, 0, &m_pReader);
+        BREAK_ON_FAIL(hr);
+
+        m_pReader->SetMaxSize(maxBytes);
+
+        m_pBlock = new (std::nothrow) BYTE[BYTE_STREAM_LOAD_BLOCK_SIZE];
+        BREAK_ON_NULL(m_pBlock, E_OUTOFMEMORY);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// IUnknown interface implementation
+//
+ULONG AviByteStreamLoader::AddRef()
+{
+    return InterlockedIncrement(&m_cRef);
+}
+
+ULONG AviByteStreamLoader::Release()
+{
+    ULONG refCount = InterlockedDecrement(&m_cRef);
+    if (refCount == 0)
+    {
+        delete this;
+    }
+
+    return refCount;
+}
+
+HRESULT AviByteStreamLoader::QueryInterface(REFIID riid, void** ppv)
+{
+    HRESULT hr = S_OK;
+
+    if (ppv == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (riid == IID_IUnknown)
+    {
+        *ppv = static_cast<IUnknown*>(this);
+    }
+    else if (riid == IID_IMFAsyncCallback)
+    {
+        *ppv = static_cast<IMFAsyncCallback*>(this);
+    }
+    else
+    {
+        *ppv = NULL;
+        hr = E_NOINTERFACE;
+    }
+
+    if(SUCCEEDED(hr))
+        AddRef();
+
+    return hr;
+}
+
+
+//
+// Get the behavior information (duration, etc.) of the asynchronous callback operation -
+// not implemented.
+//
+HRESULT AviByteStreamLoader::GetParameters(DWORD*, DWORD*)
+{
+    return E_NOTIMPL;
+}
+
+
+//
+// Start loading the byte stream - the callback is invoked once the whole stream is in
+// memory, or the load failed
+//
+HRESULT AviByteStreamLoader::BeginLoad(IMFAsyncCallback* pCallback, IUnknown* pState)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    do
+    {
+        BREAK_ON_NULL(pCallback, E_POINTER);
+
+        if(m_shutdown)
+        {
+            hr = MF_E_SHUTDOWN;
+            break;
+        }
+
+        if(m_pCallerResult != NULL)
+        {
+            hr = MF_E_INVALIDREQUEST;
+            break;
+        }
+
+        hr = MFCreateAsyncResult(NULL, pCallback, pState, &m_pCallerResult);
+        BREAK_ON_FAIL(hr);
+
+        hr = ReadNextBlock();
+        if(FAILED(hr))
+        {
+            m_pCallerResult = NULL;
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Get the result of the load, and the memory reader holding the stream if it succeeded
+//
+HRESULT AviByteStreamLoader::EndLoad(IMFAsyncResult* pResult, AviReader** ppReader)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        BREAK_ON_NULL(pResult, E_POINTER);
+        BREAK_ON_NULL(ppReader, E_POINTER);
+
+        hr = pResult->GetStatus();
+        BREAK_ON_FAIL(hr);
+
+        BREAK_ON_NULL(m_pReader, E_UNEXPECTED);
+
+        *ppReader = m_pReader;
+        m_pReader = NULL;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Stop the load.  A read that is in progress is the last one - the byte stream is released
+// as soon as no read uses it, and the caller of BeginLoad() gets MF_E_SHUTDOWN.
+//
+void AviByteStreamLoader::Shutdown(void)
+{
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    m_shutdown = true;
+
+    if(!m_readPending)
+    {
+        m_pByteStream = NULL;
+    }
+}
+
+
+//
+// A read issued by ReadNextBlock() has completed - keep its data and issue the next read,
+// unless the load was shut down in the meantime.  Once the stream ends, or the load fails,
+// tell the caller of BeginLoad().
+//
+HRESULT AviByteStreamLoader::Invoke(IMFAsyncResult* pResult)
+{
+    HRESULT hr = S_OK;
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+    ULONG cbRead = 0;
+    bool done = false;
+
+    m_readPending = false;
+
+    do
+    {
+        hr = m_pByteStream->EndRead(pResult, &cbRead);
+        BREAK_ON_FAIL(hr);
+
+        if(m_shutdown)
+        {
+            hr = MF_E_SHUTDOWN;
+            break;
+        }
+
+        // zero bytes means that we reached the end of the stream
+        if(cbRead == 0)
+        {
+            done = true;
+            break;
+        }
+
+        // fails with AVI_E_TOO_LARGE once the stream does not fit into the memory limit
+        hr = m_pReader->Append(m_pBlock, cbRead);
+        BREAK_ON_FAIL(hr);
+
+        hr = ReadNextBlock();
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    if(FAILED(hr) || done)
+    {
+        // the data is in memory, or will never be - the byte stream is not needed any more
+        m_pByteStream = NULL;
+
+        m_pCallerResult->SetStatus(hr);
+        MFInvokeCallback(m_pCallerResult);
+        m_pCallerResult = NULL;
+    }
+
+    return S_OK;
+}
+
+
+//
+// Issue the read of the next block at the current position of the byte stream.  The read
+// is marked as pending first, since its completion may run before BeginRead() returns.
+//
+HRESULT AviByteStreamLoader::ReadNextBlock(void)
+{
+    HRESULT hr = S_OK;
+
+    m_readPending = true;
+
+    hr = m_pByteStream->BeginRead(m_pBlock, BYTE_STREAM_LOAD_BLOCK_SIZE, this, NULL);
+    if(FAILED(hr))
+    {
+        m_readPending = false;
+    }
+
+    return hr;
+}
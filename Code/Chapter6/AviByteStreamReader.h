@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atlbase.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <Mferror.h>
+
+#include "AviReader.h"
+
+
+// number of bytes read at a time while a byte stream is loaded into memory
+#define BYTE_STREAM_LOAD_BLOCK_SIZE     (1024 * 1024)
+
+// default limit of the memory used to hold a byte stream that cannot be read in place
+#define BYTE_STREAM_DEFAULT_MAX_MEMORY  (512ULL * 1024 * 1024)
+
+
+//
+// AviReader implementation that reads the file through the IMFByteStream passed to the
+// byte stream handler, so that the source can play data that is not a local file - for
+// example a stream held in memory.  The byte stream has to be able to seek, and to know its
+// length - the other byte streams are loaded into memory with AviByteStreamLoader.  The
+// reads use the synchronous IMFByteStream::Read(), which blocks the calling thread the way
+// ReadFile() does for a local file.
+//
+class AviByteStreamReader : public AviReader
+{
+    public:
+        static HRESULT CanReadInPlace(IMFByteStream* pByteStream, bool* pInPlace);
+        static HRESULT CreateReader(IMFByteStream* pByteStream, AviReader** ppReader);
+
+        // AviReader interface implementation
+        HRESULT ReadAt(ULONGLONG offset, BYTE* pBuffer, DWORD cbToRead, DWORD* pcbRead);
+        HRESULT GetSize(ULONGLONG* pSize);
+
+    protected:
+        AviByteStreamReader(IMFByteStream* pByteStream);
+
+    private:
+        // the byte stream has a single current position - only one read at a time
+        CComAutoCriticalSection m_critSec;
+        CComPtr<IMFByteStream> m_pByteStream;
+};
+
+
+//
+// Loads a byte stream that cannot be read in place - one that cannot seek, such as a pipe,
+// or one whose length is not known up front - into memory, from its current position to
+// its end.  Every read is issued with IMFByteStream::BeginRead(), and its completion issues
+// the next one, so no thread waits for the data.  Once the end of the stream is reached, or
+// the load fails, the callback passed to BeginLoad() is invoked, and EndLoad() hands out
+// the memory reader.  The load fails with AVI_E_TOO_LARGE once the stream goes past the
+// memory limit, and with MF_E_SHUTDOWN once Shutdown() stops it.
+//
+class AviByteStreamLoader : public IMFAsyncCallback
+{
+    public:
+        static HRESULT CreateInstance(IMFByteStream* pByteStream, ULONGLONG maxBytes,
+            AviByteStreamLoader** ppLoader);
+
+        HRESULT BeginLoad(IMFAsyncCallback* pCallback, IUnknown* pState);
+        HRESULT EndLoad(IMFAsyncResult* pResult, AviReader** ppReader);
+        void Shutdown(void);
+
+        // IUnknown interface implementation
+        virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject);
+        virtual ULONG STDMETHODCALLTYPE AddRef(void);
+        virtual ULONG STDMETHODCALLTYPE Release(void);
+
+        // IMFAsyncCallback interface implementation
+        STDMETHODIMP GetParameters(DWORD* pdwFlags, DWORD* pdwQueue);
+        STDMETHODIMP Invoke(IMFAsyncResult* pResult);
+
+    private:
+        AviByteStreamLoader(IMFByteStream* pByteStream);
+        ~AviByteStreamLoader(void);
+        HRESULT Init(ULONGLONG maxBytes);
+        HRESULT ReadNextBlock(void);
+
+        volatile long m_cRef;
+
+        // the read completions run on a work queue thread, while Shutdown() is called by
+        // the source
+        CComAutoCriticalSection m_critSec;
+        bool m_shutdown;
+        bool m_readPending;                         // a read was issued and has not completed
+
+        CComPtr<IMFByteStream> m_pByteStream;       // released once no read needs it
+        AviMemoryReader* m_pReader;                 // the data loaded so far
+        BYTE* m_pBlock;                             // buffer of the read in progress
+
+        // result passed to the caller of BeginLoad() once the load is over
+        CComPtr<IMFAsyncResult> m_pCallerResult;
+};
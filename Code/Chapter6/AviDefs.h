@@ -0,0 +1,313 @@
+#pragma once
+
+//
+// On-disk AVI/RIFF structures and helper definitions shared by the native AVI parsing
+// code.  Everything in this file (and in the AviReader/AviDemuxer classes that use it)
+// is deliberately independent of Media Foundation so that the parsing and index code
+// can be compiled and exercised outside of the source DLL.
+//
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else
+
+#include <stdint.h>
+#include <wchar.h>
+
+typedef int32_t     HRESULT;
+typedef int32_t     LONG;
+typedef uint8_t     BYTE;
+typedef uint16_t    WORD;
+typedef uint32_t    DWORD;
+typedef int64_t     LONGLONG;
+typedef uint64_t    ULONGLONG;
+typedef wchar_t     WCHAR;
+
+#define S_OK                    ((HRESULT)0L)
+#define S_FALSE                 ((HRESULT)1L)
+#define E_NOTIMPL               ((HRESULT)0x80004001L)
+#define E_POINTER               ((HRESULT)0x80004003L)
+#define E_FAIL                  ((HRESULT)0x80004005L)
+#define E_UNEXPECTED            ((HRESULT)0x8000FFFFL)
+#define E_OUTOFMEMORY           ((HRESULT)0x8007000EL)
+#define E_INVALIDARG            ((HRESULT)0x80070057L)
+
+#define SEVERITY_ERROR          1
+#define FACILITY_ITF            4
+#define MAKE_HRESULT(sev,fac,code) \
+    ((HRESULT) (((uint32_t)(sev)<<31) | ((uint32_t)(fac)<<16) | ((uint32_t)(code))) )
+
+#define SUCCEEDED(hr)           (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)              (((HRESULT)(hr)) < 0)
+
+#endif
+
+
+#ifndef BREAK_ON_FAIL
+#define BREAK_ON_FAIL(value)            if(FAILED(value)) break;
+#endif
+
+#ifndef BREAK_ON_NULL
+#define BREAK_ON_NULL(value, newHr)     if(value == NULL) { hr = newHr; break; }
+#endif
+
+
+// errors reported by the native AVI parser
+#define AVI_E_INVALID_FORMAT    MAKE_HRESULT(SEVERITY_ERROR, FACILITY_ITF, 0x0A01)
+#define AVI_E_END_OF_FILE       MAKE_HRESULT(SEVERITY_ERROR, FACILITY_ITF, 0x0A02)
+#define AVI_E_TOO_LARGE         MAKE_HRESULT(SEVERITY_ERROR, FACILITY_ITF, 0x0A03)
+
+
+// build a FourCC code out of four characters
+#define AVI_FOURCC(a, b, c, d) \
+    ((DWORD)(BYTE)(a) | ((DWORD)(BYTE)(b) << 8) | ((DWORD)(BYTE)(c) << 16) | ((DWORD)(BYTE)(d) << 24))
+
+const DWORD AVI_FCC_RIFF = AVI_FOURCC('R', 'I', 'F', 'F');
+const DWORD AVI_FCC_AVI  = AVI_FOURCC('A', 'V', 'I', ' ');
+const DWORD AVI_FCC_LIST = AVI_FOURCC('L', 'I', 'S', 'T');
+const DWORD AVI_FCC_JUNK = AVI_FOURCC('J', 'U', 'N', 'K');
+const DWORD AVI_FCC_HDRL = AVI_FOURCC('h', 'd', 'r', 'l');
+const DWORD AVI_FCC_AVIH = AVI_FOURCC('a', 'v', 'i', 'h');
+const DWORD AVI_FCC_STRL = AVI_FOURCC('s', 't', 'r', 'l');
+const DWORD AVI_FCC_STRH = AVI_FOURCC('s', 't', 'r', 'h');
+const DWORD AVI_FCC_STRF = AVI_FOURCC('s', 't', 'r', 'f');
+const DWORD AVI_FCC_MOVI = AVI_FOURCC('m', 'o', 'v', 'i');
+const DWORD AVI_FCC_REC  = AVI_FOURCC('r', 'e', 'c', ' ');
+const DWORD AVI_FCC_IDX1 = AVI_FOURCC('i', 'd', 'x', '1');
+
+// OpenDML (AVI 2.0) extensions
+const DWORD AVI_FCC_AVIX = AVI_FOURCC('A', 'V', 'I', 'X');
+const DWORD AVI_FCC_INDX = AVI_FOURCC('i', 'n', 'd', 'x');
+const DWORD AVI_FCC_ODML = AVI_FOURCC('o', 'd', 'm', 'l');
+const DWORD AVI_FCC_DMLH = AVI_FOURCC('d', 'm', 'l', 'h');
+
+// stream types stored in AviStreamHeader::fccType
+const DWORD AVI_FCC_VIDS = AVI_FOURCC('v', 'i', 'd', 's');
+const DWORD AVI_FCC_AUDS = AVI_FOURCC('a', 'u', 'd', 's');
+
+// flags stored in the idx1 index entries
+const DWORD AVI_INDEX_KEYFRAME = 0x00000010;
+const DWORD AVI_INDEX_LIST     = 0x00000001;
+
+// index types stored in the OpenDML 'indx' and 'ix##' chunks
+const BYTE AVI_INDEX_OF_INDEXES = 0x00;
+const BYTE AVI_INDEX_OF_CHUNKS  = 0x01;
+
+// bit set in the size of an OpenDML standard index entry for chunks that are not keyframes
+const DWORD AVI_INDEX_DELTA_FRAME = 0x80000000;
+
+// value used to indicate that a stream is not present
+const DWORD AVI_NO_STREAM = 0xFFFFFFFF;
+
+// identification of the index cache files
+const DWORD AVI_INDEX_CACHE_MAGIC   = AVI_FOURCC('A', 'V', 'F', 'I');
+const DWORD AVI_INDEX_CACHE_VERSION = 3;
+
+
+#pragma pack(push, 1)
+
+// header of every RIFF chunk
+struct AviChunkHeader
+{
+    DWORD fcc;
+    DWORD cb;
+};
+
+// contents of the 'avih' chunk
+struct AviMainHeader
+{
+    DWORD dwMicroSecPerFrame;
+    DWORD dwMaxBytesPerSec;
+    DWORD dwPaddingGranularity;
+    DWORD dwFlags;
+    DWORD dwTotalFrames;
+    DWORD dwInitialFrames;
+    DWORD dwStreams;
+    DWORD dwSuggestedBufferSize;
+    DWORD dwWidth;
+    DWORD dwHeight;
+    DWORD dwReserved[4];
+};
+
+// contents of the 'strh' chunk
+struct AviStreamHeader
+{
+    DWORD fccType;
+    DWORD fccHandler;
+    DWORD dwFlags;
+    WORD wPriority;
+    WORD wLanguage;
+    DWORD dwInitialFrames;
+    DWORD dwScale;
+    DWORD dwRate;
+    DWORD dwStart;
+    DWORD dwLength;
+    DWORD dwSuggestedBufferSize;
+    DWORD dwQuality;
+    DWORD dwSampleSize;
+    struct
+    {
+        short left;
+        short top;
+        short right;
+        short bottom;
+    } rcFrame;
+};
+
+// a single entry of the legacy 'idx1' index
+struct AviOldIndexEntry
+{
+    DWORD dwChunkId;
+    DWORD dwFlags;
+    DWORD dwOffset;
+    DWORD dwSize;
+};
+
+// header shared by the OpenDML super index ('indx') and standard index ('ix##') chunks
+struct AviIndexHeader
+{
+    WORD wLongsPerEntry;
+    BYTE bIndexSubType;
+    BYTE bIndexType;
+    DWORD nEntriesInUse;
+    DWORD dwChunkId;
+};
+
+// header of an OpenDML super index - the index entries follow it
+struct AviSuperIndexHeader
+{
+    AviIndexHeader header;
+    DWORD dwReserved[3];
+};
+
+// a single entry of an OpenDML super index, pointing at a standard index chunk
+struct AviSuperIndexEntry
+{
+    ULONGLONG qwOffset;         // file offset of the 'ix##' chunk header
+    DWORD dwSize;               // size of the 'ix##' chunk, including the chunk header
+    DWORD dwDuration;           // number of stream ticks covered by the standard index
+};
+
+// header of an OpenDML standard index - the index entries follow it
+struct AviStandardIndexHeader
+{
+    AviIndexHeader header;
+    ULONGLONG qwBaseOffset;     // base for the offsets stored in the entries
+    DWORD dwReserved;
+};
+
+
+// beginning of the BITMAPINFOHEADER structure stored in the 'strf' chunk of video streams
+struct AviVideoFormat
+{
+    DWORD biSize;
+    LONG biWidth;
+    LONG biHeight;
+    WORD biPlanes;
+    WORD biBitCount;
+    DWORD biCompression;
+};
+
+// beginning of the WAVEFORMATEX structure stored in the 'strf' chunk of audio streams
+struct AviAudioFormat
+{
+    WORD wFormatTag;
+    WORD nChannels;
+    DWORD nSamplesPerSec;
+    DWORD nAvgBytesPerSec;
+    WORD nBlockAlign;
+};
+
+// header of an index cache file - the cache holds the parsed headers and the sample index
+// of an AVI file, so that the file does not have to be parsed again the next time it is
+// opened.  The header is followed by one AviIndexCacheStream for every stream, and then by
+// the AviMovieList entries.
+struct AviIndexCacheHeader
+{
+    DWORD dwMagic;              // AVI_INDEX_CACHE_MAGIC
+    DWORD dwVersion;            // AVI_INDEX_CACHE_VERSION
+    ULONGLONG qwFileSize;       // size of the AVI file the cache was built for
+    ULONGLONG qwFileTime;       // last write time of the AVI file the cache was built for
+    DWORD dwStreams;            // number of streams in the file
+    DWORD dwMovieLists;         // number of 'movi' lists in the file
+    AviMainHeader mainHeader;   // contents of the 'avih' chunk
+    DWORD dwOpenDmlTotalFrames; // frame count from the OpenDML 'dmlh' chunk, or 0
+    DWORD dwIndexStored;        // 1 if the sample index was read from the indexes of the file
+};
+
+// per-stream part of an index cache file - followed by the format block, padded to a
+// multiple of 8 bytes, the AviIndexEntry array, and the AviKeyframe array of the stream
+struct AviIndexCacheStream
+{
+    AviStreamHeader header;     // contents of the 'strh' chunk
+    DWORD cbFormat;             // size of the contents of the 'strf' chunk
+    DWORD dwReserved;           // keeps the tables that follow 8 byte aligned
+    ULONGLONG qwIndexEntries;   // number of entries in the sample index
+    ULONGLONG qwKeyframes;      // number of entries in the keyframe table
+    ULONGLONG qwTotalBytes;     // sum of the sizes of all data chunks
+};
+
+#pragma pack(pop)
+
+
+//
+// Get the value of a hexadecimal digit of a chunk ID, or 0xFF if the character is not one
+//
+inline BYTE AviHexDigitValue(BYTE digit)
+{
+    if(digit >= '0' && digit <= '9')
+    {
+        return digit - '0';
+    }
+
+    if(digit >= 'A' && digit <= 'F')
+    {
+        return digit - 'A' + 10;
+    }
+
+    if(digit >= 'a' && digit <= 'f')
+    {
+        return digit - 'a' + 10;
+    }
+
+    return 0xFF;
+}
+
+
+//
+// Calculate value * multiplier / divisor without overflowing in the multiplication, as long
+// as the result itself fits - both operands are split into a quotient and a remainder of the
+// divisor, so that no intermediate product exceeds 64 bits.  Portable replacement for
+// MFllMulDiv(), rounding down.
+//
+inline ULONGLONG AviMulDiv(ULONGLONG value, ULONGLONG multiplier, DWORD divisor)
+{
+    ULONGLONG valueQuotient = value / divisor;
+    ULONGLONG valueRemainder = value % divisor;
+    ULONGLONG multiplierQuotient = multiplier / divisor;
+    ULONGLONG multiplierRemainder = multiplier % divisor;
+
+    return value * multiplierQuotient + valueQuotient * multiplierRemainder +
+        valueRemainder * multiplierRemainder / divisor;
+}
+
+
+//
+// Extract the stream number from a chunk ID such as '00dc' or '01wb' - returns
+// AVI_NO_STREAM if the chunk ID does not start with two digits.  The stream number is
+// stored in hexadecimal, so the eleventh stream has chunks such as '0Adc'.
+//
+inline DWORD AviStreamFromChunkId(DWORD chunkId)
+{
+    BYTE high = AviHexDigitValue((BYTE)(chunkId & 0xFF));
+    BYTE low = AviHexDigitValue((BYTE)((chunkId >> 8) & 0xFF));
+
+    if(high == 0xFF || low == 0xFF)
+    {
+        return AVI_NO_STREAM;
+    }
+
+    return high * 16 + low;
+}
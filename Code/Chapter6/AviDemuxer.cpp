@@ -0,0 +1,2051 @@
+#include "AviDemuxer.h"
+#include "AviResync.h"
+
+#include <algorithm>
+#include <string.h>
+
+using namespace std;
+
+
+// number of idx1 entries read from the file at a time
+#define LEGACY_INDEX_BLOCK_ENTRIES  4096
+
+// number of idx1 entries between two checks of the chunk header that an entry points at
+#define LEGACY_INDEX_CHECK_INTERVAL 1024
+
+// number of DWORDs of OpenDML standard index entries read from the file at a time
+#define STANDARD_INDEX_BLOCK_DWORDS 8192
+
+// number of bytes of movie data searched at a time for the next intact chunk header
+#define RESYNC_BLOCK_SIZE           (1024 * 1024)
+
+
+//
+// Helper used to binary search the index of a stream by stream byte position
+//
+static bool CompareStreamBytes(ULONGLONG position, const AviIndexEntry& entry)
+{
+    return position < entry.streamBytes;
+}
+
+
+//
+// Helper used to binary search the keyframe table of a stream by presentation time
+//
+static bool CompareKeyframeTime(LONGLONG time, const AviKeyframe& keyframe)
+{
+    return time < keyframe.time;
+}
+
+
+AviDemuxer::AviDemuxer(AviReader* pReader) :
+    m_pReader(pReader),
+    m_fileSize(0),
+    m_openDmlTotalFrames(0),
+    m_extendedHeaderOffset(0),
+    m_legacyIndexOffset(0),
+    m_legacyIndexSize(0),
+    m_indexStored(false),
+    m_liveMode(false),
+    m_recordingComplete(false),
+    m_legacyIndexSeen(false),
+    m_indexFlagsChanged(false),
+    m_scanOffset(0),
+    m_lastRiffOffset(0)
+{
+    memset(&m_mainHeader, 0, sizeof(m_mainHeader));
+}
+
+
+AviDemuxer::~AviDemuxer(void)
+{
+}
+
+
+//
+// Walk the RIFF structure of the file, parse the headers, and build the sample index
+//
+HRESULT AviDemuxer::Parse(void)
+{
+    HRESULT hr = S_OK;
+
+    // the index containers throw if they run out of memory - convert that into an error
+    try
+    {
+        hr = ParseFile();
+    }
+    catch(...)
+    {
+        hr = E_OUTOFMEMORY;
+    }
+
+    return hr;
+}
+
+
+//
+// Live mode only - pick up the chunks that were appended to the file since the last time
+// it was walked, and find out whether the writer has finished the file.  pGrew is set to
+// true if any stream received new samples.
+//
+// The 'idx1' index alone does not end the recording - OpenDML writers add it when the
+// first RIFF chunk is closed, and continue with 'AVIX' RIFF chunks.  A file with super
+// indexes is complete once they point at a standard index in the last RIFF chunk, and the
+// 'dmlh' frame count of a file with video is filled in - some writers update the super
+// indexes at every new RIFF chunk, but all of them store the frame count only when they
+// finalize the file.  A file without super indexes cannot grow past its first RIFF chunk,
+// so 'idx1' does end it.  Writers that do neither are covered by the idle timeout of the
+// caller.
+//
+// The walk takes the keyframe flags of the chunks from the indexes it goes past.  Once the
+// file is complete, the standard indexes listed in its super indexes are read again, since
+// a writer may store a standard index ahead of the chunks it covers.
+//
+HRESULT AviDemuxer::Refresh(bool* pGrew)
+{
+    HRESULT hr = S_OK;
+    ULONGLONG fileSize = 0;
+    ULONGLONG finalIndexOffset = 0;
+    ULONGLONG finalIndexEnd = 0;
+    DWORD totalFrames = 0;
+    vector<size_t> indexSizes;
+
+    try
+    {
+        do
+        {
+            BREAK_ON_NULL(pGrew, E_POINTER);
+            BREAK_ON_NULL(m_pReader, E_UNEXPECTED);
+
+            *pGrew = false;
+
+            if(!IsGrowing())
+            {
+                break;
+            }
+
+            // read the super indexes before the size of the file - if they show that the
+            // writer finalized the file, all of its data is within the size read afterwards
+            hr = FindFinalStandardIndex(&finalIndexOffset, &finalIndexEnd);
+            BREAK_ON_FAIL(hr);
+
+            hr = m_pReader->GetSize(&fileSize);
+            BREAK_ON_FAIL(hr);
+
+            if(fileSize > m_fileSize)
+            {
+                m_fileSize = fileSize;
+
+                for(DWORD x = 0; x < m_streams.size(); x++)
+                {
+                    indexSizes.push_back(m_streams[x].index.size());
+                }
+
+                hr = ScanLiveData();
+                BREAK_ON_FAIL(hr);
+
+                // extend the keyframe tables with the new part of the index only, unless
+                // an index changed the flags of older chunks and the tables are rebuilt
+                for(DWORD x = 0; x < m_streams.size(); x++)
+                {
+                    if(m_streams[x].index.size() > indexSizes[x])
+                    {
+                        if(!m_indexFlagsChanged)
+                        {
+                            AddKeyframes(m_streams[x], indexSizes[x]);
+                        }
+
+                        *pGrew = true;
+                    }
+                }
+            }
+
+            if(m_superIndexChunks.empty())
+            {
+                m_recordingComplete = m_legacyIndexSeen;
+            }
+            else
+            {
+                // the standard index has to be in the data we have, or the walk would
+                // stop short of the end of a file that was truncated or is still copied
+                m_recordingComplete = (finalIndexOffset > m_lastRiffOffset &&
+                    finalIndexEnd <= m_fileSize);
+
+                if(m_recordingComplete && m_extendedHeaderOffset != 0 &&
+                    FindStream(AVI_FCC_VIDS, 0) != AVI_NO_STREAM)
+                {
+                    hr = ReadData(m_extendedHeaderOffset, (BYTE*)&totalFrames,
+                        sizeof(totalFrames));
+                    BREAK_ON_FAIL(hr);
+
+                    m_recordingComplete = (totalFrames != 0);
+                }
+
+                if(m_recordingComplete)
+                {
+                    hr = ApplyOpenDmlIndexFlags();
+                    BREAK_ON_FAIL(hr);
+                }
+            }
+
+            if(m_indexFlagsChanged)
+            {
+                BuildKeyframeTables();
+            }
+        }
+        while(false);
+    }
+    catch(...)
+    {
+        hr = E_OUTOFMEMORY;
+    }
+
+    return hr;
+}
+
+
+//
+// Parse only the headers of the file - the main header and the stream headers and
+// formats - without locating the movie data or building the sample index.  Used to get the
+// basic properties of a file as cheaply as possible.
+//
+HRESULT AviDemuxer::ParseHeaders(void)
+{
+    HRESULT hr = S_OK;
+    AviChunkHeader chunk;
+    DWORD formType = 0;
+    ULONGLONG offset = sizeof(AviChunkHeader) + sizeof(DWORD);
+    ULONGLONG riffEnd = 0;
+
+    try
+    {
+        do
+        {
+            BREAK_ON_NULL(m_pReader, E_UNEXPECTED);
+
+            hr = m_pReader->GetSize(&m_fileSize);
+            BREAK_ON_FAIL(hr);
+
+            hr = ReadChunkHeader(0, &chunk);
+            BREAK_ON_FAIL(hr);
+
+            hr = ReadData(sizeof(AviChunkHeader), (BYTE*)&formType, sizeof(formType));
+            BREAK_ON_FAIL(hr);
+
+            if(chunk.fcc != AVI_FCC_RIFF || formType != AVI_FCC_AVI)
+            {
+                hr = AVI_E_INVALID_FORMAT;
+                break;
+            }
+
+            riffEnd = sizeof(AviChunkHeader) + (ULONGLONG)chunk.cb;
+            if(chunk.cb == 0 || riffEnd > m_fileSize)
+            {
+                riffEnd = m_fileSize;
+            }
+
+            // the 'hdrl' list comes before the movie data - stop as soon as it is parsed
+            while(offset + sizeof(AviChunkHeader) + sizeof(DWORD) <= riffEnd && 
+                m_streams.empty())
+            {
+                DWORD listType = 0;
+                ULONGLONG dataOffset = offset + sizeof(AviChunkHeader);
+
+                hr = ReadChunkHeader(offset, &chunk);
+                BREAK_ON_FAIL(hr);
+
+                hr = ReadData(dataOffset, (BYTE*)&listType, sizeof(listType));
+                BREAK_ON_FAIL(hr);
+
+                if(chunk.fcc == AVI_FCC_LIST && listType == AVI_FCC_HDRL && 
+                    chunk.cb >= sizeof(DWORD))
+                {
+                    hr = ParseHeaderList(dataOffset + sizeof(DWORD), dataOffset + chunk.cb);
+                    BREAK_ON_FAIL(hr);
+                }
+                else if(chunk.fcc == AVI_FCC_LIST && listType == AVI_FCC_MOVI)
+                {
+                    break;
+                }
+
+                offset = dataOffset + chunk.cb + (chunk.cb & 1);
+            }
+            BREAK_ON_FAIL(hr);
+
+            if(m_streams.empty())
+            {
+                hr = AVI_E_INVALID_FORMAT;
+                break;
+            }
+        }
+        while(false);
+    }
+    catch(...)
+    {
+        hr = E_OUTOFMEMORY;
+    }
+
+    return hr;
+}
+
+
+//
+// Get the total number of frames in the file.  The main header only counts the frames in
+// the first RIFF chunk, so the OpenDML header is used if the file has one.
+//
+DWORD AviDemuxer::TotalFrames(void) const
+{
+    if(m_openDmlTotalFrames != 0)
+    {
+        return m_openDmlTotalFrames;
+    }
+
+    return m_mainHeader.dwTotalFrames;
+}
+
+
+//
+// Walk the RIFF chunks of the file and build the sample index
+//
+HRESULT AviDemuxer::ParseFile(void)
+{
+    HRESULT hr = S_OK;
+    AviChunkHeader chunk;
+    DWORD formType = 0;
+    ULONGLONG offset = 0;
+    ULONGLONG riffEnd = 0;
+
+    do
+    {
+        BREAK_ON_NULL(m_pReader, E_UNEXPECTED);
+
+        hr = m_pReader->GetSize(&m_fileSize);
+        BREAK_ON_FAIL(hr);
+
+        // The file starts with a RIFF chunk of the 'AVI ' form type.  OpenDML files larger
+        // than 1 GB continue with any number of RIFF chunks of the 'AVIX' form type, each
+        // holding another 'movi' list.
+        while(offset + sizeof(AviChunkHeader) + sizeof(DWORD) <= m_fileSize)
+        {
+            hr = ReadChunkHeader(offset, &chunk);
+            BREAK_ON_FAIL(hr);
+
+            hr = ReadData(offset + sizeof(AviChunkHeader), (BYTE*)&formType, sizeof(formType));
+            BREAK_ON_FAIL(hr);
+
+            if(chunk.fcc != AVI_FCC_RIFF ||
+                formType != (offset == 0 ? AVI_FCC_AVI : AVI_FCC_AVIX))
+            {
+                if(offset == 0)
+                {
+                    hr = AVI_E_INVALID_FORMAT;
+                }
+
+                // anything after the RIFF chunks is not ours to interpret
+                break;
+            }
+
+            // files that are still being written or were truncated may have a RIFF size
+            // that does not match the size of the file - never walk past the end of the data
+            riffEnd = offset + sizeof(AviChunkHeader) + chunk.cb;
+            if(chunk.cb == 0 || riffEnd > m_fileSize)
+            {
+                riffEnd = m_fileSize;
+            }
+
+            hr = ParseRiffChunk(offset + sizeof(AviChunkHeader) + sizeof(DWORD), riffEnd);
+            BREAK_ON_FAIL(hr);
+
+            offset = riffEnd + (riffEnd & 1);
+        }
+        BREAK_ON_FAIL(hr);
+
+        // we need at least one stream and the movie data to play anything
+        if(m_streams.empty() || m_movieLists.empty())
+        {
+            hr = AVI_E_INVALID_FORMAT;
+            break;
+        }
+
+        // The indexes of a file that is still being recorded are either missing or
+        // incomplete - walk the movie data and remember where the walk stopped, so that
+        // Refresh() can continue from there.
+        if(m_liveMode)
+        {
+            bool grew = false;
+
+            m_scanOffset = m_movieLists[0].offset + sizeof(DWORD);
+
+            hr = ScanLiveData();
+            BREAK_ON_FAIL(hr);
+
+            BuildKeyframeTables();
+
+            // pick up whatever was added in the meantime, and check whether the file is
+            // already complete
+            hr = Refresh(&grew);
+            break;
+        }
+
+        // Build the sample index.  The OpenDML super indexes cover every RIFF chunk of the
+        // file, while idx1 only covers the first one, so prefer them.  If neither is there
+        // or usable, walk the movie lists and discover the chunks directly.
+        hr = E_FAIL;
+        for(DWORD x = 0; x < m_streams.size(); x++)
+        {
+            if(!m_streams[x].superIndex.empty())
+            {
+                hr = ParseOpenDmlIndex();
+                break;
+            }
+        }
+
+        if(FAILED(hr) && m_legacyIndexOffset != 0)
+        {
+            ClearIndex();
+            hr = ParseLegacyIndex();
+        }
+
+        m_indexStored = SUCCEEDED(hr);
+
+        if(FAILED(hr))
+        {
+            ClearIndex();
+            hr = S_OK;
+
+            for(DWORD x = 0; x < m_movieLists.size() && SUCCEEDED(hr); x++)
+            {
+                hr = ScanMovieList(m_movieLists[x]);
+            }
+
+            // an idx1 index that failed its checks may still have the right flags for
+            // most of the chunks
+            if(SUCCEEDED(hr) && m_legacyIndexOffset != 0)
+            {
+                hr = ApplyLegacyIndexFlags(m_legacyIndexOffset, m_legacyIndexSize);
+            }
+        }
+        BREAK_ON_FAIL(hr);
+
+        // build the keyframe tables once, so that seeks do not need to walk the index
+        BuildKeyframeTables();
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Walk the chunks inside of a single RIFF chunk - only the header list, the movie list,
+// and the legacy index are interesting
+//
+HRESULT AviDemuxer::ParseRiffChunk(ULONGLONG offset, ULONGLONG end)
+{
+    HRESULT hr = S_OK;
+    AviChunkHeader chunk;
+
+    while(offset + sizeof(AviChunkHeader) <= end)
+    {
+        ULONGLONG dataOffset = offset + sizeof(AviChunkHeader);
+
+        hr = ReadChunkHeader(offset, &chunk);
+        BREAK_ON_FAIL(hr);
+
+        if(chunk.fcc == AVI_FCC_LIST && dataOffset + sizeof(DWORD) <= end)
+        {
+            DWORD listType = 0;
+
+            hr = ReadData(dataOffset, (BYTE*)&listType, sizeof(listType));
+            BREAK_ON_FAIL(hr);
+
+            // the headers are only stored in the first RIFF chunk
+            if(listType == AVI_FCC_HDRL && m_streams.empty() && chunk.cb >= sizeof(DWORD))
+            {
+                hr = ParseHeaderList(dataOffset + sizeof(DWORD), dataOffset + chunk.cb);
+                BREAK_ON_FAIL(hr);
+            }
+            else if(listType == AVI_FCC_MOVI)
+            {
+                AviMovieList movieList;
+
+                // a movie list with a zero size has not been finalized yet - it extends to
+                // the end of the file, and nothing after it can be trusted
+                movieList.offset = dataOffset;
+                movieList.end = (chunk.cb == 0) ? end : dataOffset + chunk.cb;
+
+                // the movie list may have been truncated
+                if(movieList.end > end)
+                {
+                    movieList.end = end;
+                }
+
+                m_movieLists.push_back(movieList);
+
+                if(chunk.cb == 0)
+                {
+                    break;
+                }
+            }
+        }
+        else if(chunk.fcc == AVI_FCC_IDX1 && m_movieLists.size() == 1)
+        {
+            m_legacyIndexOffset = dataOffset;
+            m_legacyIndexSize = chunk.cb;
+        }
+
+        // chunks are padded to an even number of bytes
+        offset = dataOffset + chunk.cb + (chunk.cb & 1);
+    }
+
+    return hr;
+}
+
+
+//
+// Get the information about the stream with the specified number
+//
+const AviStream* AviDemuxer::GetStream(DWORD stream) const
+{
+    if(stream >= m_streams.size())
+    {
+        return NULL;
+    }
+
+    return &m_streams[stream];
+}
+
+
+//
+// Find the number of the n-th stream of the specified type ('vids' or 'auds') - returns
+// AVI_NO_STREAM if there is no such stream
+//
+DWORD AviDemuxer::FindStream(DWORD fccType, DWORD n) const
+{
+    for(DWORD x = 0; x < m_streams.size(); x++)
+    {
+        if(m_streams[x].header.fccType == fccType)
+        {
+            if(n == 0)
+            {
+                return x;
+            }
+
+            n--;
+        }
+    }
+
+    return AVI_NO_STREAM;
+}
+
+
+//
+// Read exactly cbData bytes from the specified offset in the file
+//
+HRESULT AviDemuxer::ReadData(ULONGLONG offset, BYTE* pBuffer, DWORD cbData)
+{
+    HRESULT hr = S_OK;
+    DWORD cbRead = 0;
+
+    do
+    {
+        hr = m_pReader->ReadAt(offset, pBuffer, cbData, &cbRead);
+        BREAK_ON_FAIL(hr);
+
+        if(cbRead < cbData)
+        {
+            hr = AVI_E_END_OF_FILE;
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Read the stream payload starting at the specified byte position in the stream.  The
+// read may span several chunks - this is how block aligned audio is pulled out of the
+// file.
+//
+HRESULT AviDemuxer::ReadStreamBytes(DWORD stream, ULONGLONG position, BYTE* pBuffer,
+    DWORD cbToRead, DWORD* pcbRead)
+{
+    HRESULT hr = S_OK;
+    DWORD totalRead = 0;
+
+    do
+    {
+        BREAK_ON_NULL(pBuffer, E_POINTER);
+        BREAK_ON_NULL(pcbRead, E_POINTER);
+
+        if(stream >= m_streams.size())
+        {
+            hr = E_INVALIDARG;
+            break;
+        }
+
+        const vector<AviIndexEntry>& index = m_streams[stream].index;
+
+        // find the chunk that holds the first byte, and keep reading from consecutive
+        // chunks until the buffer is full or we run out of data
+        for(size_t x = FindIndexEntry(stream, position);
+            x < index.size() && totalRead < cbToRead; x++)
+        {
+            const AviIndexEntry& entry = index[x];
+            ULONGLONG chunkPosition = position + totalRead - entry.streamBytes;
+            DWORD cbChunk = 0;
+
+            if(chunkPosition >= entry.size)
+            {
+                continue;
+            }
+
+            cbChunk = entry.size - (DWORD)chunkPosition;
+            if(cbChunk > cbToRead - totalRead)
+            {
+                cbChunk = cbToRead - totalRead;
+            }
+
+            hr = ReadData(entry.offset + chunkPosition, pBuffer + totalRead, cbChunk);
+            BREAK_ON_FAIL(hr);
+
+            totalRead += cbChunk;
+        }
+
+        *pcbRead = totalRead;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Binary search the index of the stream for the chunk that contains the specified stream
+// byte position
+//
+size_t AviDemuxer::FindIndexEntry(DWORD stream, ULONGLONG position) const
+{
+    const vector<AviIndexEntry>& index = m_streams[stream].index;
+
+    vector<AviIndexEntry>::const_iterator it =
+        upper_bound(index.begin(), index.end(), position, CompareStreamBytes);
+
+    if(it == index.begin())
+    {
+        return 0;
+    }
+
+    return (size_t)(it - index.begin()) - 1;
+}
+
+
+//
+// Binary search the keyframe table of a video stream for the last keyframe at or before
+// the specified time.  If the time is before the first keyframe, the first keyframe is
+// returned.  Returns NULL if the stream has no keyframes.
+//
+const AviKeyframe* AviDemuxer::FindKeyframe(DWORD stream, LONGLONG time) const
+{
+    if(stream >= m_streams.size() || m_streams[stream].keyframes.empty())
+    {
+        return NULL;
+    }
+
+    const vector<AviKeyframe>& keyframes = m_streams[stream].keyframes;
+
+    vector<AviKeyframe>::const_iterator it =
+        upper_bound(keyframes.begin(), keyframes.end(), time, CompareKeyframeTime);
+
+    if(it == keyframes.begin())
+    {
+        return &keyframes[0];
+    }
+
+    return &*(it - 1);
+}
+
+
+//
+// Binary search the index of a stream for the last chunk that starts at or before the
+// specified time.  If the time is before the first chunk, the first chunk is returned.
+//
+size_t AviDemuxer::FindChunk(DWORD stream, LONGLONG time) const
+{
+    if(stream >= m_streams.size() || m_streams[stream].index.empty())
+    {
+        return 0;
+    }
+
+    const AviStream& aviStream = m_streams[stream];
+    size_t first = 0;
+    size_t last = aviStream.index.size();
+
+    // find the first chunk that starts after the time
+    while(first < last)
+    {
+        size_t middle = first + (last - first) / 2;
+
+        if(aviStream.ChunkTime(middle) <= time)
+        {
+            first = middle + 1;
+        }
+        else
+        {
+            last = middle;
+        }
+    }
+
+    return (first == 0) ? 0 : first - 1;
+}
+
+
+//
+// Helper used to append raw data to an index cache
+//
+static void AppendCacheData(vector<BYTE>* pCache, const void* pData, size_t cbData)
+{
+    if(cbData > 0)
+    {
+        pCache->insert(pCache->end(), (const BYTE*)pData, (const BYTE*)pData + cbData);
+    }
+}
+
+
+//
+// Serialize the parsed headers, the sample index, and the keyframe tables into an index
+// cache.  The cache is tagged with the size of the file and the passed-in last write time,
+// and is rejected by LoadIndex() if the file changes.
+//
+HRESULT AviDemuxer::SaveIndex(ULONGLONG fileTime, vector<BYTE>* pCache) const
+{
+    HRESULT hr = S_OK;
+    AviIndexCacheHeader header;
+
+    if(pCache == NULL)
+    {
+        return E_POINTER;
+    }
+
+    try
+    {
+        memset(&header, 0, sizeof(header));
+        header.dwMagic = AVI_INDEX_CACHE_MAGIC;
+        header.dwVersion = AVI_INDEX_CACHE_VERSION;
+        header.qwFileSize = m_fileSize;
+        header.qwFileTime = fileTime;
+        header.dwStreams = (DWORD)m_streams.size();
+        header.dwMovieLists = (DWORD)m_movieLists.size();
+        header.mainHeader = m_mainHeader;
+        header.dwOpenDmlTotalFrames = m_openDmlTotalFrames;
+        header.dwIndexStored = m_indexStored ? 1 : 0;
+
+        pCache->clear();
+        AppendCacheData(pCache, &header, sizeof(header));
+
+        for(DWORD x = 0; x < m_streams.size(); x++)
+        {
+            const AviStream& stream = m_streams[x];
+            AviIndexCacheStream streamHeader;
+            BYTE padding[8] = {};
+
+            memset(&streamHeader, 0, sizeof(streamHeader));
+            streamHeader.header = stream.header;
+            streamHeader.cbFormat = (DWORD)stream.format.size();
+            streamHeader.qwIndexEntries = stream.index.size();
+            streamHeader.qwKeyframes = stream.keyframes.size();
+            streamHeader.qwTotalBytes = stream.totalBytes;
+
+            AppendCacheData(pCache, &streamHeader, sizeof(streamHeader));
+
+            // keep the tables 8 byte aligned within the cache
+            if(!stream.format.empty())
+            {
+                AppendCacheData(pCache, &stream.format[0], stream.format.size());
+            }
+            AppendCacheData(pCache, padding, (8 - stream.format.size() % 8) % 8);
+
+            if(!stream.index.empty())
+            {
+                AppendCacheData(pCache, &stream.index[0], 
+                    stream.index.size() * sizeof(AviIndexEntry));
+            }
+
+            if(!stream.keyframes.empty())
+            {
+                AppendCacheData(pCache, &stream.keyframes[0], 
+                    stream.keyframes.size() * sizeof(AviKeyframe));
+            }
+        }
+
+        if(!m_movieLists.empty())
+        {
+            AppendCacheData(pCache, &m_movieLists[0], 
+                m_movieLists.size() * sizeof(AviMovieList));
+        }
+    }
+    catch(...)
+    {
+        hr = E_OUTOFMEMORY;
+    }
+
+    return hr;
+}
+
+
+//
+// Load the headers and the index of the file from an index cache instead of parsing the
+// file.  Fails with AVI_E_INVALID_FORMAT if the cache is damaged, or if it was built for
+// a different version of the file - in that case the file must be parsed with Parse().
+//
+HRESULT AviDemuxer::LoadIndex(ULONGLONG fileTime, const BYTE* pCache, size_t cbCache)
+{
+    HRESULT hr = S_OK;
+
+    try
+    {
+        hr = ReadIndexCache(fileTime, pCache, cbCache);
+    }
+    catch(...)
+    {
+        hr = E_OUTOFMEMORY;
+    }
+
+    // do not leave a partially loaded index behind - Parse() has to start from scratch
+    if(FAILED(hr))
+    {
+        memset(&m_mainHeader, 0, sizeof(m_mainHeader));
+        m_fileSize = 0;
+        m_openDmlTotalFrames = 0;
+        m_indexStored = false;
+        m_streams.clear();
+        m_movieLists.clear();
+    }
+
+    return hr;
+}
+
+
+//
+// Helper used to copy raw data out of an index cache - the cache may be at any address, so
+// its contents are never accessed in place
+//
+static void ReadCacheData(void* pData, const BYTE* pCache, size_t* pPosition, size_t cbData)
+{
+    if(cbData > 0)
+    {
+        memcpy(pData, pCache + *pPosition, cbData);
+        *pPosition += cbData;
+    }
+}
+
+
+//
+// Validate the index cache and copy its contents into the stream list
+//
+HRESULT AviDemuxer::ReadIndexCache(ULONGLONG fileTime, const BYTE* pCache, size_t cbCache)
+{
+    HRESULT hr = S_OK;
+    AviIndexCacheHeader header;
+    size_t position = 0;
+
+    do
+    {
+        BREAK_ON_NULL(pCache, E_POINTER);
+        BREAK_ON_NULL(m_pReader, E_UNEXPECTED);
+
+        hr = m_pReader->GetSize(&m_fileSize);
+        BREAK_ON_FAIL(hr);
+
+        if(cbCache < sizeof(header))
+        {
+            hr = AVI_E_INVALID_FORMAT;
+            break;
+        }
+
+        ReadCacheData(&header, pCache, &position, sizeof(header));
+
+        // make sure that the cache belongs to this exact version of the file
+        if(header.dwMagic != AVI_INDEX_CACHE_MAGIC ||
+            header.dwVersion != AVI_INDEX_CACHE_VERSION ||
+            header.qwFileSize != m_fileSize ||
+            header.qwFileTime != fileTime ||
+            header.dwStreams == 0 || header.dwMovieLists == 0)
+        {
+            hr = AVI_E_INVALID_FORMAT;
+            break;
+        }
+
+        m_mainHeader = header.mainHeader;
+        m_openDmlTotalFrames = header.dwOpenDmlTotalFrames;
+        m_indexStored = (header.dwIndexStored != 0);
+        m_streams.clear();
+        m_streams.resize(header.dwStreams);
+
+        for(DWORD x = 0; x < header.dwStreams; x++)
+        {
+            AviStream& stream = m_streams[x];
+            AviIndexCacheStream streamHeader;
+            ULONGLONG cbTables = 0;
+
+            if(cbCache - position < sizeof(streamHeader))
+            {
+                hr = AVI_E_INVALID_FORMAT;
+                break;
+            }
+
+            ReadCacheData(&streamHeader, pCache, &position, sizeof(streamHeader));
+
+            // check that the tables of the stream fit into the cache before touching them
+            cbTables = streamHeader.cbFormat + (8 - streamHeader.cbFormat % 8) % 8 +
+                streamHeader.qwIndexEntries * sizeof(AviIndexEntry) +
+                streamHeader.qwKeyframes * sizeof(AviKeyframe);
+            if(streamHeader.qwIndexEntries > cbCache || streamHeader.qwKeyframes > cbCache ||
+                cbTables > cbCache - position)
+            {
+                hr = AVI_E_INVALID_FORMAT;
+                break;
+            }
+
+            stream.header = streamHeader.header;
+            stream.totalBytes = streamHeader.qwTotalBytes;
+
+            stream.format.assign(pCache + position, pCache + position + streamHeader.cbFormat);
+            position += streamHeader.cbFormat + (8 - streamHeader.cbFormat % 8) % 8;
+
+            stream.index.resize((size_t)streamHeader.qwIndexEntries);
+            ReadCacheData(stream.index.empty() ? NULL : &stream.index[0], pCache, &position,
+                stream.index.size() * sizeof(AviIndexEntry));
+
+            stream.keyframes.resize((size_t)streamHeader.qwKeyframes);
+            ReadCacheData(stream.keyframes.empty() ? NULL : &stream.keyframes[0], pCache,
+                &position, stream.keyframes.size() * sizeof(AviKeyframe));
+        }
+        BREAK_ON_FAIL(hr);
+
+        if((cbCache - position) / sizeof(AviMovieList) < header.dwMovieLists)
+        {
+            hr = AVI_E_INVALID_FORMAT;
+            break;
+        }
+
+        m_movieLists.resize(header.dwMovieLists);
+        ReadCacheData(&m_movieLists[0], pCache, &position,
+            m_movieLists.size() * sizeof(AviMovieList));
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Read the header of the chunk located at the specified offset
+//
+HRESULT AviDemuxer::ReadChunkHeader(ULONGLONG offset, AviChunkHeader* pHeader)
+{
+    return ReadData(offset, (BYTE*)pHeader, sizeof(AviChunkHeader));
+}
+
+
+//
+// Parse the contents of the 'hdrl' list - the main AVI header and the stream lists
+//
+HRESULT AviDemuxer::ParseHeaderList(ULONGLONG offset, ULONGLONG end)
+{
+    HRESULT hr = S_OK;
+    AviChunkHeader chunk;
+
+    while(offset + sizeof(AviChunkHeader) <= end)
+    {
+        ULONGLONG dataOffset = offset + sizeof(AviChunkHeader);
+
+        hr = ReadChunkHeader(offset, &chunk);
+        BREAK_ON_FAIL(hr);
+
+        if(chunk.fcc == AVI_FCC_AVIH)
+        {
+            hr = ReadData(dataOffset, (BYTE*)&m_mainHeader,
+                chunk.cb < sizeof(m_mainHeader) ? chunk.cb : sizeof(m_mainHeader));
+            BREAK_ON_FAIL(hr);
+        }
+        else if(chunk.fcc == AVI_FCC_LIST && chunk.cb >= sizeof(DWORD))
+        {
+            DWORD listType = 0;
+
+            hr = ReadData(dataOffset, (BYTE*)&listType, sizeof(listType));
+            BREAK_ON_FAIL(hr);
+
+            if(listType == AVI_FCC_STRL)
+            {
+                hr = ParseStreamList(dataOffset + sizeof(DWORD), dataOffset + chunk.cb);
+                BREAK_ON_FAIL(hr);
+            }
+            else if(listType == AVI_FCC_ODML)
+            {
+                hr = ParseOpenDmlHeader(dataOffset + sizeof(DWORD), dataOffset + chunk.cb);
+                BREAK_ON_FAIL(hr);
+            }
+        }
+
+        offset = dataOffset + chunk.cb + (chunk.cb & 1);
+    }
+
+    return hr;
+}
+
+
+//
+// Parse a 'strl' list describing a single stream
+//
+HRESULT AviDemuxer::ParseStreamList(ULONGLONG offset, ULONGLONG end)
+{
+    HRESULT hr = S_OK;
+    AviChunkHeader chunk;
+    AviStream stream;
+
+    memset(&stream.header, 0, sizeof(stream.header));
+    stream.totalBytes = 0;
+
+    while(offset + sizeof(AviChunkHeader) <= end)
+    {
+        ULONGLONG dataOffset = offset + sizeof(AviChunkHeader);
+
+        hr = ReadChunkHeader(offset, &chunk);
+        BREAK_ON_FAIL(hr);
+
+        if(chunk.fcc == AVI_FCC_STRH)
+        {
+            // older files have a shorter stream header without the frame rectangle
+            hr = ReadData(dataOffset, (BYTE*)&stream.header,
+                chunk.cb < sizeof(stream.header) ? chunk.cb : sizeof(stream.header));
+            BREAK_ON_FAIL(hr);
+        }
+        else if(chunk.fcc == AVI_FCC_STRF && chunk.cb > 0)
+        {
+            stream.format.resize(chunk.cb);
+
+            hr = ReadData(dataOffset, &stream.format[0], chunk.cb);
+            BREAK_ON_FAIL(hr);
+        }
+        else if(chunk.fcc == AVI_FCC_INDX)
+        {
+            // the OpenDML index is optional - if it is damaged, we will fall back on idx1
+            // or on a walk of the movie lists
+            if(FAILED(ParseSuperIndex(&stream, offset, chunk.cb)))
+            {
+                stream.superIndex.clear();
+            }
+        }
+
+        offset = dataOffset + chunk.cb + (chunk.cb & 1);
+    }
+
+    // streams without a rate would cause a division by zero whenever we calculate
+    // time stamps - the stream still needs to be stored since the chunk IDs refer to the
+    // streams by position, so just give it a harmless rate
+    if(stream.header.dwRate == 0 || stream.header.dwScale == 0)
+    {
+        stream.header.dwRate = 1;
+        stream.header.dwScale = 1;
+    }
+
+    if(SUCCEEDED(hr))
+    {
+        m_streams.push_back(stream);
+    }
+
+    return hr;
+}
+
+
+//
+// Parse the OpenDML extended header list - the 'dmlh' chunk holds the number of frames in
+// the whole file, including the frames stored in the 'AVIX' RIFF chunks
+//
+HRESULT AviDemuxer::ParseOpenDmlHeader(ULONGLONG offset, ULONGLONG end)
+{
+    HRESULT hr = S_OK;
+    AviChunkHeader chunk;
+
+    while(offset + sizeof(AviChunkHeader) <= end)
+    {
+        ULONGLONG dataOffset = offset + sizeof(AviChunkHeader);
+
+        hr = ReadChunkHeader(offset, &chunk);
+        BREAK_ON_FAIL(hr);
+
+        if(chunk.fcc == AVI_FCC_DMLH && chunk.cb >= sizeof(DWORD))
+        {
+            hr = ReadData(dataOffset, (BYTE*)&m_openDmlTotalFrames, sizeof(DWORD));
+            BREAK_ON_FAIL(hr);
+
+            m_extendedHeaderOffset = dataOffset;
+        }
+
+        offset = dataOffset + chunk.cb + (chunk.cb & 1);
+    }
+
+    return hr;
+}
+
+
+//
+// Parse the OpenDML 'indx' chunk of a stream.  Normally this is a super index that
+// points at the 'ix##' standard index chunks spread across the file, but small files may
+// store a standard index directly in the 'indx' chunk.
+//
+HRESULT AviDemuxer::ParseSuperIndex(AviStream* pStream, ULONGLONG offset, DWORD cbIndex)
+{
+    HRESULT hr = S_OK;
+    AviSuperIndexHeader indexHeader;
+    ULONGLONG dataOffset = offset + sizeof(AviChunkHeader);
+
+    do
+    {
+        if(cbIndex < sizeof(indexHeader))
+        {
+            hr = AVI_E_INVALID_FORMAT;
+            break;
+        }
+
+        hr = ReadData(dataOffset, (BYTE*)&indexHeader, sizeof(indexHeader));
+        BREAK_ON_FAIL(hr);
+
+        if(indexHeader.header.bIndexType == AVI_INDEX_OF_CHUNKS)
+        {
+            // treat the chunk as the only standard index of the stream
+            AviSuperIndexEntry entry;
+
+            entry.qwOffset = offset;
+            entry.dwSize = cbIndex + sizeof(AviChunkHeader);
+            entry.dwDuration = 0;
+
+            pStream->superIndex.push_back(entry);
+            break;
+        }
+
+        if(indexHeader.header.bIndexType != AVI_INDEX_OF_INDEXES ||
+            indexHeader.header.wLongsPerEntry != sizeof(AviSuperIndexEntry) / sizeof(DWORD))
+        {
+            hr = AVI_E_INVALID_FORMAT;
+            break;
+        }
+
+        // remember where the super index is - while the file is recorded, its entries are
+        // filled in only when the writer finalizes the file
+        AviSuperIndexEntry location;
+
+        location.qwOffset = dataOffset;
+        location.dwSize = cbIndex;
+        location.dwDuration = 0;
+
+        m_superIndexChunks.push_back(location);
+
+        // the chunk is usually allocated with room for more entries than are in use
+        DWORD entryCount = indexHeader.header.nEntriesInUse;
+        if(entryCount > (cbIndex - sizeof(indexHeader)) / sizeof(AviSuperIndexEntry))
+        {
+            hr = AVI_E_INVALID_FORMAT;
+            break;
+        }
+
+        if(entryCount == 0)
+        {
+            break;
+        }
+
+        pStream->superIndex.resize(entryCount);
+
+        hr = ReadData(dataOffset + sizeof(indexHeader), (BYTE*)&pStream->superIndex[0],
+            entryCount * sizeof(AviSuperIndexEntry));
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Build the sample index out of the OpenDML standard indexes of every stream
+//
+HRESULT AviDemuxer::ParseOpenDmlIndex(void)
+{
+    HRESULT hr = S_OK;
+    bool foundEntries = false;
+
+    for(DWORD x = 0; x < m_streams.size() && SUCCEEDED(hr); x++)
+    {
+        const vector<AviSuperIndexEntry>& superIndex = m_streams[x].superIndex;
+
+        for(size_t y = 0; y < superIndex.size(); y++)
+        {
+            // a standard index that is past the end of a truncated file is not an error -
+            // the file just ends there
+            if(superIndex[y].qwOffset + superIndex[y].dwSize > m_fileSize)
+            {
+                break;
+            }
+
+            hr = ParseStandardIndex(x, superIndex[y].qwOffset, superIndex[y].dwSize, false);
+            BREAK_ON_FAIL(hr);
+        }
+
+        foundEntries = foundEntries || !m_streams[x].index.empty();
+    }
+
+    // an index without any entries is as good as no index at all
+    if(SUCCEEDED(hr) && !foundEntries)
+    {
+        hr = AVI_E_INVALID_FORMAT;
+    }
+
+    return hr;
+}
+
+
+//
+// Add the entries of a single OpenDML standard index chunk to the index of a stream.  With
+// flagsOnly, the entries only set the flags of the chunks that a walk of the movie data has
+// already put into the index.
+//
+HRESULT AviDemuxer::ParseStandardIndex(DWORD stream, ULONGLONG offset, DWORD cbIndex,
+    bool flagsOnly)
+{
+    HRESULT hr = S_OK;
+    AviChunkHeader chunk;
+    AviStandardIndexHeader indexHeader;
+    vector<DWORD> block;
+
+    do
+    {
+        hr = ReadChunkHeader(offset, &chunk);
+        BREAK_ON_FAIL(hr);
+
+        if(chunk.cb < sizeof(indexHeader) || chunk.cb + sizeof(AviChunkHeader) > cbIndex)
+        {
+            hr = AVI_E_INVALID_FORMAT;
+            break;
+        }
+
+        hr = ReadData(offset + sizeof(AviChunkHeader), (BYTE*)&indexHeader, sizeof(indexHeader));
+        BREAK_ON_FAIL(hr);
+
+        // each entry holds the offset and size of a chunk - field indexes add the offset of
+        // the second field, which we do not need
+        DWORD longsPerEntry = indexHeader.header.wLongsPerEntry;
+        if(indexHeader.header.bIndexType != AVI_INDEX_OF_CHUNKS ||
+            (flagsOnly && AviStreamFromChunkId(indexHeader.header.dwChunkId) != stream) ||
+            (longsPerEntry != 2 && longsPerEntry != 3) ||
+            indexHeader.header.nEntriesInUse > (chunk.cb - sizeof(indexHeader)) /
+                (longsPerEntry * sizeof(DWORD)))
+        {
+            hr = AVI_E_INVALID_FORMAT;
+            break;
+        }
+
+        DWORD blockEntries = STANDARD_INDEX_BLOCK_DWORDS / longsPerEntry;
+        ULONGLONG entriesOffset = offset + sizeof(AviChunkHeader) + sizeof(indexHeader);
+
+        block.resize(blockEntries * longsPerEntry);
+
+        for(DWORD first = 0; first < indexHeader.header.nEntriesInUse; first += blockEntries)
+        {
+            DWORD count = indexHeader.header.nEntriesInUse - first;
+            if(count > blockEntries)
+            {
+                count = blockEntries;
+            }
+
+            hr = ReadData(entriesOffset + (ULONGLONG)first * longsPerEntry * sizeof(DWORD),
+                (BYTE*)&block[0], count * longsPerEntry * sizeof(DWORD));
+            BREAK_ON_FAIL(hr);
+
+            for(DWORD x = 0; x < count; x++)
+            {
+                // the offsets point at the chunk data, not at the chunk header, and the top
+                // bit of the size marks delta frames
+                ULONGLONG dataOffset = indexHeader.qwBaseOffset + block[x * longsPerEntry];
+                DWORD size = block[x * longsPerEntry + 1];
+                DWORD flags = (size & AVI_INDEX_DELTA_FRAME) ? 0 : AVI_INDEX_KEYFRAME;
+
+                size &= ~AVI_INDEX_DELTA_FRAME;
+
+                // the file may have been truncated - ignore the chunks that are not there
+                if(dataOffset + size > m_fileSize)
+                {
+                    continue;
+                }
+
+                if(flagsOnly)
+                {
+                    SetIndexFlags(stream, dataOffset, size, flags);
+                }
+                else
+                {
+                    AddIndexEntry(stream, dataOffset, size, flags);
+                }
+            }
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Build the sample index out of the legacy 'idx1' chunk.  The index is only used if every
+// entry points inside the first 'movi' list, and the chunk headers at a sample of the
+// entries match them - a damaged index fails, and the caller walks the movie list instead.
+//
+HRESULT AviDemuxer::ParseLegacyIndex(void)
+{
+    HRESULT hr = S_OK;
+    vector<AviOldIndexEntry> block(LEGACY_INDEX_BLOCK_ENTRIES);
+    DWORD entryCount = m_legacyIndexSize / sizeof(AviOldIndexEntry);
+    const AviMovieList& movieList = m_movieLists[0];
+    ULONGLONG baseOffset = 0;
+    bool baseOffsetKnown = false;
+    DWORD entriesUsed = 0;
+    AviOldIndexEntry lastEntry;
+    ULONGLONG lastChunkOffset = 0;
+    bool movieListTruncated = (movieList.end >= m_fileSize);
+
+    memset(&lastEntry, 0, sizeof(lastEntry));
+
+    // reserve space for the video frames up front to avoid reallocations
+    for(DWORD x = 0; x < m_streams.size(); x++)
+    {
+        if(m_streams[x].IsVideo())
+        {
+            m_streams[x].index.reserve(m_streams[x].header.dwLength);
+        }
+    }
+
+    for(DWORD first = 0; first < entryCount && SUCCEEDED(hr); first += LEGACY_INDEX_BLOCK_ENTRIES)
+    {
+        DWORD count = entryCount - first;
+        if(count > LEGACY_INDEX_BLOCK_ENTRIES)
+        {
+            count = LEGACY_INDEX_BLOCK_ENTRIES;
+        }
+
+        hr = ReadData(m_legacyIndexOffset + (ULONGLONG)first * sizeof(AviOldIndexEntry),
+            (BYTE*)&block[0], count * sizeof(AviOldIndexEntry));
+        BREAK_ON_FAIL(hr);
+
+        for(DWORD x = 0; x < count; x++)
+        {
+            const AviOldIndexEntry& entry = block[x];
+            DWORD stream = AviStreamFromChunkId(entry.dwChunkId);
+
+            // skip the 'rec ' list entries and anything that does not belong to a stream
+            if((entry.dwFlags & AVI_INDEX_LIST) != 0 || stream >= m_streams.size())
+            {
+                continue;
+            }
+
+            // The idx1 offsets normally point at the chunk header relative to the 'movi'
+            // FourCC, but some writers store absolute file offsets.  Figure out which one
+            // this file uses by checking where the first chunk header actually is.
+            if(!baseOffsetKnown)
+            {
+                if(IsLegacyIndexChunk(entry, movieList.offset + entry.dwOffset))
+                {
+                    baseOffset = movieList.offset;
+                }
+                else if(IsLegacyIndexChunk(entry, entry.dwOffset))
+                {
+                    baseOffset = 0;
+                }
+                else
+                {
+                    hr = AVI_E_INVALID_FORMAT;
+                    break;
+                }
+
+                baseOffsetKnown = true;
+            }
+
+            ULONGLONG chunkOffset = baseOffset + entry.dwOffset;
+            ULONGLONG dataOffset = chunkOffset + sizeof(AviChunkHeader);
+
+            // the file may have been truncated inside the movie list - ignore the chunks
+            // that are not there
+            if(movieListTruncated && dataOffset + entry.dwSize > m_fileSize)
+            {
+                continue;
+            }
+
+            // the chunk has to be inside the movie list, and every so often its header has
+            // to be where the entry says it is
+            if(chunkOffset < movieList.offset + sizeof(DWORD) ||
+                dataOffset + entry.dwSize > movieList.end ||
+                (entriesUsed % LEGACY_INDEX_CHECK_INTERVAL == 0 &&
+                    !IsLegacyIndexChunk(entry, chunkOffset)))
+            {
+                hr = AVI_E_INVALID_FORMAT;
+                break;
+            }
+
+            AddIndexEntry(stream, dataOffset, entry.dwSize, entry.dwFlags);
+
+            entriesUsed++;
+            lastEntry = entry;
+            lastChunkOffset = chunkOffset;
+        }
+    }
+
+    // an index without any entries is as good as no index at all, and an index that was
+    // cut short or is out of step with the file ends at the wrong chunk
+    if(SUCCEEDED(hr) && (entriesUsed == 0 || !IsLegacyIndexChunk(lastEntry, lastChunkOffset)))
+    {
+        hr = AVI_E_INVALID_FORMAT;
+    }
+
+    return hr;
+}
+
+
+//
+// Check whether the chunk header at the specified offset matches an idx1 entry
+//
+bool AviDemuxer::IsLegacyIndexChunk(const AviOldIndexEntry& entry, ULONGLONG offset)
+{
+    AviChunkHeader chunk;
+
+    if(FAILED(ReadChunkHeader(offset, &chunk)))
+    {
+        return false;
+    }
+
+    return (chunk.fcc == entry.dwChunkId && chunk.cb == entry.dwSize);
+}
+
+
+//
+// Build the sample index by walking the chunks of a 'movi' list.  This is used when the
+// file does not have a usable index.  The chunks do not say whether they are keyframes, so
+// they get the flags of WalkedChunkFlags() until an 'ix##' standard index that the walk
+// goes past shows the real ones.  If a chunk header is damaged, the walk searches for the
+// next intact header and continues from there.
+//
+HRESULT AviDemuxer::ScanMovieList(const AviMovieList& movieList)
+{
+    HRESULT hr = S_OK;
+    AviChunkHeader chunk;
+    ULONGLONG offset = movieList.offset + sizeof(DWORD);
+
+    while(offset + sizeof(AviChunkHeader) <= movieList.end)
+    {
+        ULONGLONG dataOffset = offset + sizeof(AviChunkHeader);
+
+        hr = ReadChunkHeader(offset, &chunk);
+        BREAK_ON_FAIL(hr);
+
+        // Resynchronize after a damaged header.  A chunk that was cut off by the end of
+        // the file looks the same - in that case the search just runs to the end of the
+        // data and finds nothing.
+        if(!IsValidChunk(chunk, offset, movieList.end))
+        {
+            hr = FindNextChunk(offset + 1, movieList.end, &offset);
+            BREAK_ON_FAIL(hr);
+
+            continue;
+        }
+
+        // descend into the 'rec ' lists that group interleaved chunks
+        if(chunk.fcc == AVI_FCC_LIST)
+        {
+            offset = dataOffset + sizeof(DWORD);
+            continue;
+        }
+
+        DWORD stream = AviStreamFromChunkId(chunk.fcc);
+        if(stream < m_streams.size())
+        {
+            AddIndexEntry(stream, dataOffset, chunk.cb, WalkedChunkFlags(stream));
+        }
+        else
+        {
+            hr = ApplyIndexChunkFlags(chunk, offset);
+            BREAK_ON_FAIL(hr);
+        }
+
+        offset = dataOffset + chunk.cb + (chunk.cb & 1);
+    }
+
+    return hr;
+}
+
+
+//
+// Search the movie data between offset and end for the next intact chunk header.  The
+// data is read in large blocks, and each block is searched for the FourCCs of data chunks
+// and lists with the vectorized scanner.  Each candidate it finds is then checked with
+// IsResyncPoint().  pNextOffset receives the offset of the header, or end if there is none.
+//
+HRESULT AviDemuxer::FindNextChunk(ULONGLONG offset, ULONGLONG end, ULONGLONG* pNextOffset)
+{
+    HRESULT hr = S_OK;
+
+    *pNextOffset = end;
+
+    if(m_resyncBlock.empty())
+    {
+        m_resyncBlock.resize(RESYNC_BLOCK_SIZE);
+    }
+
+    while(offset + sizeof(AviChunkHeader) <= end && *pNextOffset == end)
+    {
+        DWORD cbBlock = (DWORD)min((ULONGLONG)RESYNC_BLOCK_SIZE, end - offset);
+        size_t position = 0;
+
+        hr = ReadData(offset, &m_resyncBlock[0], cbBlock);
+        BREAK_ON_FAIL(hr);
+
+        while(position < cbBlock)
+        {
+            bool isResyncPoint = false;
+
+            position += AviFindChunkCandidate(&m_resyncBlock[position], cbBlock - position);
+            if(position >= cbBlock)
+            {
+                break;
+            }
+
+            hr = IsResyncPoint(offset + position, end, &isResyncPoint);
+            BREAK_ON_FAIL(hr);
+
+            if(isResyncPoint)
+            {
+                *pNextOffset = offset + position;
+                break;
+            }
+
+            position++;
+        }
+        BREAK_ON_FAIL(hr);
+
+        if(offset + cbBlock >= end)
+        {
+            break;
+        }
+
+        // the blocks overlap by less than a FourCC, so that a FourCC that straddles the
+        // boundary of two blocks is found in the second one
+        offset += cbBlock - (sizeof(DWORD) - 1);
+    }
+
+    return hr;
+}
+
+
+//
+// Check whether the movie data can be resumed at a candidate chunk header found by the
+// scanner.  The header itself must be valid, and since the payload of a chunk may contain
+// anything, including what looks like a header, it must also be followed by another valid
+// header or by the end of the movie data.
+//
+HRESULT AviDemuxer::IsResyncPoint(ULONGLONG offset, ULONGLONG end, bool* pIsResyncPoint)
+{
+    HRESULT hr = S_OK;
+    AviChunkHeader chunk;
+    ULONGLONG nextOffset = 0;
+
+    do
+    {
+        *pIsResyncPoint = false;
+
+        hr = ReadChunkHeader(offset, &chunk);
+        BREAK_ON_FAIL(hr);
+
+        if(!IsValidChunk(chunk, offset, end))
+        {
+            break;
+        }
+
+        // the first chunk of a list follows the list type
+        if(chunk.fcc == AVI_FCC_LIST)
+        {
+            nextOffset = offset + sizeof(AviChunkHeader) + sizeof(DWORD);
+        }
+        else
+        {
+            nextOffset = offset + sizeof(AviChunkHeader) + chunk.cb + (chunk.cb & 1);
+        }
+
+        if(nextOffset + sizeof(AviChunkHeader) > end)
+        {
+            *pIsResyncPoint = true;
+            break;
+        }
+
+        hr = ReadChunkHeader(nextOffset, &chunk);
+        BREAK_ON_FAIL(hr);
+
+        *pIsResyncPoint = IsValidChunk(chunk, nextOffset, end);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Check whether a chunk header found while walking the movie data is intact - the chunk
+// must be one that belongs in a 'movi' list, and it must fit into the list
+//
+bool AviDemuxer::IsValidChunk(const AviChunkHeader& chunk, ULONGLONG offset, 
+    ULONGLONG end) const
+{
+    ULONGLONG chunkEnd = offset + sizeof(AviChunkHeader) + chunk.cb;
+
+    if(chunkEnd > end)
+    {
+        return false;
+    }
+
+    // 'rec ' lists, padding, and OpenDML standard indexes ('ix##')
+    if(chunk.fcc == AVI_FCC_LIST)
+    {
+        return chunk.cb >= sizeof(DWORD);
+    }
+
+    if(chunk.fcc == AVI_FCC_JUNK || (chunk.fcc & 0xFFFF) == ('i' | ('x' << 8)))
+    {
+        return true;
+    }
+
+    // data chunks of the streams described in the header
+    return (AviStreamFromChunkId(chunk.fcc) < m_streams.size());
+}
+
+
+//
+// Live mode only - walk the chunks that follow the point where the previous walk stopped.
+// The sizes of the RIFF chunks and 'movi' lists are not final while the file is recorded,
+// so they are ignored: the walk descends into every 'AVIX' RIFF chunk and 'movi' or 'rec '
+// list it meets, skips any other list or chunk, and stops at the first chunk that has not
+// been completely written yet.  As with ScanMovieList(), the flags of the chunks come from
+// the 'ix##' and 'idx1' indexes that the walk goes past.
+//
+HRESULT AviDemuxer::ScanLiveData(void)
+{
+    HRESULT hr = S_OK;
+    AviChunkHeader chunk;
+
+    while(m_scanOffset + sizeof(AviChunkHeader) <= m_fileSize)
+    {
+        ULONGLONG dataOffset = m_scanOffset + sizeof(AviChunkHeader);
+
+        hr = ReadChunkHeader(m_scanOffset, &chunk);
+        BREAK_ON_FAIL(hr);
+
+        if(chunk.fcc == AVI_FCC_RIFF || chunk.fcc == AVI_FCC_LIST)
+        {
+            DWORD listType = 0;
+
+            if(dataOffset + sizeof(DWORD) > m_fileSize)
+            {
+                break;
+            }
+
+            hr = ReadData(dataOffset, (BYTE*)&listType, sizeof(listType));
+            BREAK_ON_FAIL(hr);
+
+            if(listType == AVI_FCC_AVIX || listType == AVI_FCC_MOVI || listType == AVI_FCC_REC)
+            {
+                if(chunk.fcc == AVI_FCC_RIFF)
+                {
+                    m_lastRiffOffset = m_scanOffset;
+                }
+
+                m_scanOffset = dataOffset + sizeof(DWORD);
+                continue;
+            }
+        }
+        else if(chunk.fcc == AVI_FCC_IDX1)
+        {
+            m_legacyIndexSeen = true;
+        }
+
+        // stop at a chunk that is still being written
+        if(dataOffset + chunk.cb > m_fileSize)
+        {
+            break;
+        }
+
+        DWORD stream = AviStreamFromChunkId(chunk.fcc);
+        if(stream < m_streams.size())
+        {
+            AddIndexEntry(stream, dataOffset, chunk.cb, WalkedChunkFlags(stream));
+        }
+        else
+        {
+            hr = ApplyIndexChunkFlags(chunk, m_scanOffset);
+            BREAK_ON_FAIL(hr);
+        }
+
+        m_scanOffset = dataOffset + chunk.cb + (chunk.cb & 1);
+    }
+
+    return hr;
+}
+
+
+//
+// Live mode only - read the super indexes of the streams again, and find the standard index
+// that is the furthest into the file.  Returns the offset and the end of its chunk, or 0 if
+// the super indexes are still empty.
+//
+HRESULT AviDemuxer::FindFinalStandardIndex(ULONGLONG* pOffset, ULONGLONG* pEnd)
+{
+    HRESULT hr = S_OK;
+
+    *pOffset = 0;
+    *pEnd = 0;
+
+    for(size_t x = 0; x < m_superIndexChunks.size(); x++)
+    {
+        const AviSuperIndexEntry& location = m_superIndexChunks[x];
+        AviSuperIndexHeader indexHeader;
+        AviSuperIndexEntry entry;
+
+        hr = ReadData(location.qwOffset, (BYTE*)&indexHeader, sizeof(indexHeader));
+        BREAK_ON_FAIL(hr);
+
+        DWORD entryCount = indexHeader.header.nEntriesInUse;
+        if(indexHeader.header.bIndexType != AVI_INDEX_OF_INDEXES || entryCount == 0 ||
+            entryCount > (location.dwSize - sizeof(indexHeader)) / sizeof(AviSuperIndexEntry))
+        {
+            continue;
+        }
+
+        hr = ReadData(location.qwOffset + sizeof(indexHeader) +
+            (entryCount - 1) * sizeof(AviSuperIndexEntry), (BYTE*)&entry, sizeof(entry));
+        BREAK_ON_FAIL(hr);
+
+        if(entry.qwOffset > *pOffset)
+        {
+            *pOffset = entry.qwOffset;
+            *pEnd = entry.qwOffset + entry.dwSize;
+        }
+    }
+
+    return hr;
+}
+
+
+//
+// Live mode only - set the flags of the walked chunks from every standard index listed in
+// the super indexes of a complete file
+//
+HRESULT AviDemuxer::ApplyOpenDmlIndexFlags(void)
+{
+    HRESULT hr = S_OK;
+    vector<AviSuperIndexEntry> entries;
+
+    for(size_t x = 0; x < m_superIndexChunks.size(); x++)
+    {
+        const AviSuperIndexEntry& location = m_superIndexChunks[x];
+        AviSuperIndexHeader indexHeader;
+
+        hr = ReadData(location.qwOffset, (BYTE*)&indexHeader, sizeof(indexHeader));
+        BREAK_ON_FAIL(hr);
+
+        DWORD stream = AviStreamFromChunkId(indexHeader.header.dwChunkId);
+        DWORD entryCount = indexHeader.header.nEntriesInUse;
+        if(indexHeader.header.bIndexType != AVI_INDEX_OF_INDEXES || entryCount == 0 ||
+            entryCount > (location.dwSize - sizeof(indexHeader)) / sizeof(AviSuperIndexEntry) ||
+            stream >= m_streams.size())
+        {
+            continue;
+        }
+
+        entries.resize(entryCount);
+
+        hr = ReadData(location.qwOffset + sizeof(indexHeader), (BYTE*)&entries[0],
+            entryCount * sizeof(AviSuperIndexEntry));
+        BREAK_ON_FAIL(hr);
+
+        for(size_t y = 0; y < entries.size(); y++)
+        {
+            if(entries[y].qwOffset + entries[y].dwSize > m_fileSize)
+            {
+                continue;
+            }
+
+            // a damaged standard index just leaves the flags as they are
+            hr = ParseStandardIndex(stream, entries[y].qwOffset, entries[y].dwSize, true);
+            if(hr == AVI_E_INVALID_FORMAT)
+            {
+                hr = S_OK;
+            }
+            BREAK_ON_FAIL(hr);
+        }
+        BREAK_ON_FAIL(hr);
+    }
+
+    return hr;
+}
+
+
+//
+// Set the flags of the walked chunks from an index chunk that a walk of the movie data went
+// past - an 'ix##' standard index, or 'idx1'.  Any other chunk is ignored, and so is an
+// index that turns out to be damaged.
+//
+HRESULT AviDemuxer::ApplyIndexChunkFlags(const AviChunkHeader& chunk, ULONGLONG offset)
+{
+    HRESULT hr = S_OK;
+    DWORD stream = AviStreamFromChunkId(chunk.fcc >> 16);
+
+    if(chunk.fcc == AVI_FCC_IDX1)
+    {
+        hr = ApplyLegacyIndexFlags(offset + sizeof(AviChunkHeader), chunk.cb);
+    }
+    else if((chunk.fcc & 0xFFFF) == ('i' | ('x' << 8)) && stream < m_streams.size())
+    {
+        hr = ParseStandardIndex(stream, offset, chunk.cb + sizeof(AviChunkHeader), true);
+    }
+
+    if(hr == AVI_E_INVALID_FORMAT)
+    {
+        hr = S_OK;
+    }
+
+    return hr;
+}
+
+
+//
+// Set the flags of the walked chunks from the entries of an 'idx1' index.  As in
+// ParseLegacyIndex(), the first entry shows whether the offsets are relative to the first
+// 'movi' list or to the file.  Entries that do not match a walked chunk are ignored, so a
+// damaged index can only leave flags as they are.
+//
+HRESULT AviDemuxer::ApplyLegacyIndexFlags(ULONGLONG offset, DWORD cbIndex)
+{
+    HRESULT hr = S_OK;
+    vector<AviOldIndexEntry> block(LEGACY_INDEX_BLOCK_ENTRIES);
+    DWORD entryCount = cbIndex / sizeof(AviOldIndexEntry);
+    ULONGLONG baseOffset = 0;
+    bool baseOffsetKnown = false;
+    bool matches = true;
+
+    // the file may have been truncated inside the index
+    if(offset + (ULONGLONG)entryCount * sizeof(AviOldIndexEntry) > m_fileSize)
+    {
+        entryCount = (offset < m_fileSize) ?
+            (DWORD)((m_fileSize - offset) / sizeof(AviOldIndexEntry)) : 0;
+    }
+
+    for(DWORD first = 0; first < entryCount && SUCCEEDED(hr) && matches;
+        first += LEGACY_INDEX_BLOCK_ENTRIES)
+    {
+        DWORD count = entryCount - first;
+        if(count > LEGACY_INDEX_BLOCK_ENTRIES)
+        {
+            count = LEGACY_INDEX_BLOCK_ENTRIES;
+        }
+
+        hr = ReadData(offset + (ULONGLONG)first * sizeof(AviOldIndexEntry),
+            (BYTE*)&block[0], count * sizeof(AviOldIndexEntry));
+        BREAK_ON_FAIL(hr);
+
+        for(DWORD x = 0; x < count; x++)
+        {
+            const AviOldIndexEntry& entry = block[x];
+            DWORD stream = AviStreamFromChunkId(entry.dwChunkId);
+
+            if((entry.dwFlags & AVI_INDEX_LIST) != 0 || stream >= m_streams.size())
+            {
+                continue;
+            }
+
+            if(!baseOffsetKnown)
+            {
+                ULONGLONG relativeOffset = m_movieLists[0].offset + entry.dwOffset +
+                    sizeof(AviChunkHeader);
+
+                if(FindIndexEntryAt(stream, relativeOffset) < m_streams[stream].index.size())
+                {
+                    baseOffset = m_movieLists[0].offset;
+                }
+                else if(FindIndexEntryAt(stream, entry.dwOffset + sizeof(AviChunkHeader)) <
+                    m_streams[stream].index.size())
+                {
+                    baseOffset = 0;
+                }
+                else
+                {
+                    // the index does not describe the chunks that the walk found
+                    matches = false;
+                    break;
+                }
+
+                baseOffsetKnown = true;
+            }
+
+            SetIndexFlags(stream, baseOffset + entry.dwOffset + sizeof(AviChunkHeader),
+                entry.dwSize, entry.dwFlags);
+        }
+    }
+
+    return hr;
+}
+
+
+//
+// Flags of a chunk found by walking the movie data.  The walk cannot tell the keyframes of
+// a video stream from its delta frames - only the first frame of the stream is known to be
+// a keyframe, until an index shows the flags of the others.  The chunks of the other
+// streams can all be decoded on their own.
+//
+DWORD AviDemuxer::WalkedChunkFlags(DWORD stream) const
+{
+    const AviStream& aviStream = m_streams[stream];
+
+    if(aviStream.IsVideo() && !aviStream.index.empty())
+    {
+        return 0;
+    }
+
+    return AVI_INDEX_KEYFRAME;
+}
+
+
+//
+// Find the entry of the chunk with the payload at the specified file offset in the index of
+// a stream - returns the size of the index if there is none.  The entries of a walked
+// index are in file order.
+//
+size_t AviDemuxer::FindIndexEntryAt(DWORD stream, ULONGLONG offset) const
+{
+    const vector<AviIndexEntry>& index = m_streams[stream].index;
+    size_t low = 0;
+    size_t high = index.size();
+
+    while(low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+
+        if(index[middle].offset < offset)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    if(low == index.size() || index[low].offset != offset)
+    {
+        return index.size();
+    }
+
+    return low;
+}
+
+
+//
+// Set the flags of a walked chunk from an index entry - the chunk has to match the entry in
+// location and size.  A change of the keyframes of a video stream marks its keyframe table
+// as out of date.
+//
+void AviDemuxer::SetIndexFlags(DWORD stream, ULONGLONG offset, DWORD size, DWORD flags)
+{
+    AviStream& aviStream = m_streams[stream];
+    size_t entry = FindIndexEntryAt(stream, offset);
+
+    if(entry == aviStream.index.size() || aviStream.index[entry].size != size)
+    {
+        return;
+    }
+
+    if(aviStream.IsVideo() &&
+        ((aviStream.index[entry].flags ^ flags) & AVI_INDEX_KEYFRAME) != 0)
+    {
+        m_indexFlagsChanged = true;
+    }
+
+    aviStream.index[entry].flags = flags;
+}
+
+
+//
+// Add a chunk to the end of the index of the specified stream
+//
+void AviDemuxer::AddIndexEntry(DWORD stream, ULONGLONG offset, DWORD size, DWORD flags)
+{
+    AviStream& aviStream = m_streams[stream];
+    AviIndexEntry entry;
+
+    entry.offset = offset;
+    entry.streamBytes = aviStream.totalBytes;
+    entry.size = size;
+    entry.flags = flags;
+
+    aviStream.index.push_back(entry);
+    aviStream.totalBytes += size;
+}
+
+
+//
+// Drop any index entries built so far
+//
+void AviDemuxer::ClearIndex(void)
+{
+    for(DWORD x = 0; x < m_streams.size(); x++)
+    {
+        m_streams[x].index.clear();
+        m_streams[x].totalBytes = 0;
+    }
+}
+
+
+//
+// Build the keyframe table of every video stream out of the sample index
+//
+void AviDemuxer::BuildKeyframeTables(void)
+{
+    for(DWORD x = 0; x < m_streams.size(); x++)
+    {
+        m_streams[x].keyframes.clear();
+
+        AddKeyframes(m_streams[x], 0);
+    }
+
+    m_indexFlagsChanged = false;
+}
+
+
+//
+// Add the keyframes among the index entries starting at firstEntry to the keyframe table
+// of a video stream
+//
+void AviDemuxer::AddKeyframes(AviStream& stream, size_t firstEntry)
+{
+    if(!stream.IsVideo())
+    {
+        return;
+    }
+
+    for(size_t y = firstEntry; y < stream.index.size(); y++)
+    {
+        if((stream.index[y].flags & AVI_INDEX_KEYFRAME) != 0)
+        {
+            AviKeyframe keyframe;
+
+            keyframe.time = stream.SampleTime(y);
+            keyframe.offset = stream.index[y].offset;
+            keyframe.sample = y;
+
+            stream.keyframes.push_back(keyframe);
+        }
+    }
+}
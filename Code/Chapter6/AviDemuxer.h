@@ -0,0 +1,170 @@
+#pragma once
+
+#include "AviDefs.h"
+#include "AviReader.h"
+
+#include <vector>
+
+
+// A single entry in the sample index of a stream
+struct AviIndexEntry
+{
+    ULONGLONG offset;           // file offset of the chunk payload
+    ULONGLONG streamBytes;      // number of stream bytes stored in the preceding chunks
+    DWORD size;                 // size of the chunk payload
+    DWORD flags;                // AVI_INDEX_* flags of the chunk
+};
+
+
+// A single entry in the keyframe table of a video stream
+struct AviKeyframe
+{
+    LONGLONG time;              // presentation time of the frame in 100 ns units
+    ULONGLONG offset;           // file offset of the chunk payload
+    ULONGLONG sample;           // number of the frame in the stream index
+};
+
+
+// Information about one of the streams stored in the AVI file
+struct AviStream
+{
+    AviStreamHeader header;                 // contents of the 'strh' chunk
+    std::vector<BYTE> format;               // contents of the 'strf' chunk
+    std::vector<AviIndexEntry> index;       // one entry per data chunk of the stream
+    std::vector<AviSuperIndexEntry> superIndex; // OpenDML 'indx' entries, if present
+    std::vector<AviKeyframe> keyframes;     // keyframes of a video stream, in index order
+    ULONGLONG totalBytes;                   // sum of the sizes of all data chunks
+
+    bool IsVideo(void) const    { return header.fccType == AVI_FCC_VIDS; };
+    bool IsAudio(void) const    { return header.fccType == AVI_FCC_AUDS; };
+
+    // presentation time of the specified frame of a video stream in 100 ns units - the plain
+    // product of the frame number, dwScale and 10^7 overflows for long files with large rates
+    LONGLONG SampleTime(ULONGLONG sample) const
+    {
+        return (LONGLONG)AviMulDiv(header.dwStart + sample,
+            (ULONGLONG)header.dwScale * 10000000, header.dwRate);
+    };
+
+    // presentation time of the start of the specified data chunk in 100 ns units - streams
+    // with a fixed sample size count their samples in bytes, the rest store one sample (for
+    // example a VBR audio frame) per chunk
+    LONGLONG ChunkTime(ULONGLONG chunk) const
+    {
+        if(header.dwSampleSize == 0)
+        {
+            return SampleTime(chunk);
+        }
+
+        ULONGLONG bytes = (chunk < index.size()) ? index[(size_t)chunk].streamBytes : totalBytes;
+        return SampleTime(bytes / header.dwSampleSize);
+    };
+};
+
+
+// Location of the data of one 'movi' list - OpenDML files have one in every RIFF chunk
+struct AviMovieList
+{
+    ULONGLONG offset;           // offset of the 'movi' list type FourCC
+    ULONGLONG end;              // offset of the first byte past the list
+};
+
+
+//
+// Native RIFF/AVI chunk walker.  Parses the 'hdrl' header list, locates the 'movi' lists
+// of the 'AVI ' and any OpenDML 'AVIX' RIFF chunks, and builds a per-stream sample index
+// from the OpenDML super indexes, from 'idx1', or by walking the 'movi' lists if the file
+// has no usable index.  The walk skips over damaged chunk headers by searching for the next
+// intact one, so the intact parts of damaged and truncated files can still be played, and
+// takes the keyframe flags from whatever index chunks it goes past.
+//
+// In live mode the file is assumed to still be recorded by another process.  The sample
+// index is then always built by walking the movie data, and Refresh() picks up the chunks
+// appended since the previous walk until the writer finalizes the file.
+//
+class AviDemuxer
+{
+    public:
+        AviDemuxer(AviReader* pReader);
+        ~AviDemuxer(void);
+
+        HRESULT Parse(void);
+        HRESULT ParseHeaders(void);
+        HRESULT Refresh(bool* pGrew);
+
+        void SetLiveMode(bool liveMode)                 { m_liveMode = liveMode; };
+        bool IsGrowing(void) const  { return m_liveMode && !m_recordingComplete; };
+
+        DWORD StreamCount(void) const                   { return (DWORD)m_streams.size(); };
+        const AviStream* GetStream(DWORD stream) const;
+        DWORD FindStream(DWORD fccType, DWORD n) const;
+        const AviMainHeader& MainHeader(void) const     { return m_mainHeader; };
+        DWORD TotalFrames(void) const;
+        bool IsIndexStored(void) const                  { return m_indexStored; };
+
+        HRESULT ReadData(ULONGLONG offset, BYTE* pBuffer, DWORD cbData);
+        HRESULT ReadStreamBytes(DWORD stream, ULONGLONG position, BYTE* pBuffer,
+            DWORD cbToRead, DWORD* pcbRead);
+        size_t FindIndexEntry(DWORD stream, ULONGLONG position) const;
+        const AviKeyframe* FindKeyframe(DWORD stream, LONGLONG time) const;
+        size_t FindChunk(DWORD stream, LONGLONG time) const;
+
+        HRESULT SaveIndex(ULONGLONG fileTime, std::vector<BYTE>* pCache) const;
+        HRESULT LoadIndex(ULONGLONG fileTime, const BYTE* pCache, size_t cbCache);
+
+    private:
+        HRESULT ParseFile(void);
+        HRESULT ReadIndexCache(ULONGLONG fileTime, const BYTE* pCache, size_t cbCache);
+        HRESULT ParseRiffChunk(ULONGLONG offset, ULONGLONG end);
+        HRESULT ReadChunkHeader(ULONGLONG offset, AviChunkHeader* pHeader);
+        HRESULT ParseHeaderList(ULONGLONG offset, ULONGLONG end);
+        HRESULT ParseStreamList(ULONGLONG offset, ULONGLONG end);
+        HRESULT ParseOpenDmlHeader(ULONGLONG offset, ULONGLONG end);
+        HRESULT ParseSuperIndex(AviStream* pStream, ULONGLONG offset, DWORD cbIndex);
+        HRESULT ParseOpenDmlIndex(void);
+        HRESULT ParseStandardIndex(DWORD stream, ULONGLONG offset, DWORD cbIndex,
+            bool flagsOnly);
+        HRESULT ParseLegacyIndex(void);
+        bool IsLegacyIndexChunk(const AviOldIndexEntry& entry, ULONGLONG offset);
+        HRESULT ScanMovieList(const AviMovieList& movieList);
+        HRESULT FindNextChunk(ULONGLONG offset, ULONGLONG end, ULONGLONG* pNextOffset);
+        HRESULT IsResyncPoint(ULONGLONG offset, ULONGLONG end, bool* pIsResyncPoint);
+        bool IsValidChunk(const AviChunkHeader& chunk, ULONGLONG offset, ULONGLONG end) const;
+        HRESULT ScanLiveData(void);
+        HRESULT FindFinalStandardIndex(ULONGLONG* pOffset, ULONGLONG* pEnd);
+        HRESULT ApplyOpenDmlIndexFlags(void);
+        HRESULT ApplyIndexChunkFlags(const AviChunkHeader& chunk, ULONGLONG offset);
+        HRESULT ApplyLegacyIndexFlags(ULONGLONG offset, DWORD cbIndex);
+        DWORD WalkedChunkFlags(DWORD stream) const;
+        size_t FindIndexEntryAt(DWORD stream, ULONGLONG offset) const;
+        void SetIndexFlags(DWORD stream, ULONGLONG offset, DWORD size, DWORD flags);
+        void AddIndexEntry(DWORD stream, ULONGLONG offset, DWORD size, DWORD flags);
+        void ClearIndex(void);
+        void BuildKeyframeTables(void);
+        void AddKeyframes(AviStream& stream, size_t firstEntry);
+
+        AviReader* m_pReader;
+        ULONGLONG m_fileSize;
+
+        AviMainHeader m_mainHeader;
+        DWORD m_openDmlTotalFrames;     // frame count from the OpenDML 'dmlh' chunk, or 0
+        ULONGLONG m_extendedHeaderOffset;   // offset of the 'dmlh' payload, or 0
+        std::vector<AviStream> m_streams;
+
+        std::vector<AviMovieList> m_movieLists;
+        ULONGLONG m_legacyIndexOffset;  // offset of the 'idx1' payload, or 0
+        DWORD m_legacyIndexSize;        // size of the 'idx1' payload
+        bool m_indexStored;             // the sample index came from 'idx1' or OpenDML indexes
+
+        std::vector<BYTE> m_resyncBlock;    // movie data searched for the next chunk header
+
+        bool m_liveMode;                // the file may still be growing
+        bool m_recordingComplete;       // live mode only - the writer has closed the file
+        bool m_legacyIndexSeen;         // live mode only - the walk went past 'idx1'
+        bool m_indexFlagsChanged;       // the keyframe tables miss flags set by an index
+        ULONGLONG m_scanOffset;         // live mode only - next chunk header to examine
+        ULONGLONG m_lastRiffOffset;     // live mode only - last RIFF chunk found by the walk
+
+        // location (payload offset) and size of every 'indx' super index chunk
+        std::vector<AviSuperIndexEntry> m_superIndexChunks;
+};
@@ -1,747 +1,1283 @@
-#include "StdAfx.h"
-#include "AviFileParser.h"
-
-//
-// Create a new instance of the AVI file parser for the specified file
-//
-HRESULT AVIFileParser::CreateInstance(const WCHAR* url, AVIFileParser **ppParser)
-{
-    HRESULT hr = S_OK;
-    AVIFileParser* pParser = NULL;
-
-    do
-    {
-        BREAK_ON_NULL (ppParser, E_POINTER);
-
-        DWORD pathCount = MAX_PATH;
-        wchar_t temp[MAX_PATH];
-
-        // if it's necessary, convert the URL into an MS-DOS format path - if not, just 
-        // copy the path to the temp string
-        if(PathIsURL(url))
-        {
-            // convert a URL-style path to an MS-DOS style path string
-            hr = PathCreateFromUrl(url, temp, &pathCount, 0);
-            BREAK_ON_FAIL(hr);
-        }
-        else
-        {
-            wcscpy_s(temp, MAX_PATH, url);
-        }
-
-        // handle a case where the file either doesn't exist or is inaccessable
-        if (!PathFileExists(temp))
-        {
-            hr = HRESULT_FROM_WIN32(GetLastError());
-            break;
-        }
-
-        // create a new parser
-        pParser = new (std::nothrow) AVIFileParser(temp);
-        BREAK_ON_NULL (pParser, E_OUTOFMEMORY);
-
-        // initialize the parser
-        hr = pParser->Init();
-        BREAK_ON_FAIL(hr);
-
-        *ppParser = pParser;
-    }
-    while(false);
-
-
-    if (FAILED(hr) && pParser != NULL)
-    {
-        delete pParser;
-    }
-
-    return hr;
-}
-
-AVIFileParser::AVIFileParser(const WCHAR* url) : m_pAviFile(NULL),
-                                                   m_pVideoStream(NULL),
-                                                   m_pAudioStream(NULL),
-                                                   m_currentVideoSample(0),
-                                                   m_currentAudioSample(0),
-                                                   m_duration(0),
-                                                   m_audioSampleTime(0),
-                                                   m_url(NULL),
-                                                   m_nextKeyframe(0)
-{
-    // allocate a space for and store the path passed in
-    if(url != NULL && wcslen(url) > 0)
-    {
-        m_url = new (std::nothrow) WCHAR[wcslen(url) + 1];
-        wcscpy_s(m_url, wcslen(url) + 1, url);
-    }
-
-    // zero out internal structures
-    ZeroMemory(&m_aviInfo, sizeof(m_aviInfo));
-    ZeroMemory(&m_videoStreamInfo, sizeof(m_videoStreamInfo));
-    ZeroMemory(&m_audioStreamInfo, sizeof(m_audioStreamInfo));
-    ZeroMemory(&m_videoFormat, sizeof(m_videoFormat));
-    ZeroMemory(&m_audioFormat, sizeof(m_audioFormat));
-
-    // initialize the AVI file library
-    AVIFileInit();
-}
-
-//
-// Initialize the parser and open the AVI file
-//
-HRESULT AVIFileParser::Init()
-{
-    HRESULT hr = S_OK;
-
-    if (m_url == NULL || wcslen(m_url) == 0)
-    {
-        return E_FAIL;
-    }
-
-    // use the AVIFileOpen function to create an IAVIFile object
-    hr = AVIFileOpen(&m_pAviFile, m_url, OF_READ, NULL);
-
-    return hr;
-}
-
-//
-// Parse the AVI file header
-//
-HRESULT AVIFileParser::ParseHeader()
-{
-    HRESULT hr = S_OK;
-
-    do
-    {
-        // open the AVI file and read the header information
-        AVIFileInfo(m_pAviFile, &m_aviInfo, sizeof(m_aviInfo));
-        
-        // open the audio & video streams and build up an index of AVI file chunks
-        AVIFileGetStream(m_pAviFile, &m_pVideoStream, streamtypeVIDEO, 0);
-        AVIFileGetStream(m_pAviFile, &m_pAudioStream, streamtypeAUDIO, 0);
-
-        // parse the video stream information and construct the video media type
-        hr = ParseVideoStreamHeader();
-        BREAK_ON_FAIL(hr);
-
-        // parse audio stream information and construct the audio media type
-        hr = ParseAudioStreamHeader();
-        BREAK_ON_FAIL(hr);
-    }
-    while(false);
-
-    return hr;
-}
-
-
-//
-// Parse the video stream header and construct the video media type
-//
-HRESULT AVIFileParser::ParseVideoStreamHeader(void)
-{
-    HRESULT hr = S_OK;
-    LONG tempFormatSize = 0;
-    BYTE* tempFormatBuffer = NULL;
-    LONG cbUserData = 0;
-    BYTE* pUserData = NULL;
-
-    do
-    {
-        // just return success if there is no video stream - this may happen if there is only
-        // audio in the AVI file
-        BREAK_ON_NULL(m_pVideoStream, S_OK);
-
-        // get an information structure describing the stream
-        hr = m_pVideoStream->Info(&m_videoStreamInfo, sizeof(m_videoStreamInfo));
-        BREAK_ON_FAIL(hr);
-
-        // get first video sample number
-        m_currentVideoSample = m_videoStreamInfo.dwStart;
-
-        // get the size of the format structure for the stream - pass in NULL as the buffer            
-        hr = m_pVideoStream->ReadFormat(0, NULL, &tempFormatSize);
-        BREAK_ON_FAIL(hr);
-
-        // allocate some space for the format block
-        tempFormatBuffer = new (std::nothrow) BYTE[tempFormatSize];
-
-        // read the data into the allocated byte array
-        hr = m_pVideoStream->ReadFormat(0, tempFormatBuffer, &tempFormatSize);
-        BREAK_ON_FAIL(hr);
-
-        // copy information from the temp format buffer into the BITMAPINFOHEADER structure
-        // for later use
-        memcpy_s(&m_videoFormat, sizeof(m_videoFormat), tempFormatBuffer, 
-            min(sizeof(m_videoFormat), tempFormatSize));
-
-        // figure out how much user data we have
-        if(tempFormatSize > sizeof(m_videoFormat))
-        {
-            cbUserData = tempFormatSize - sizeof(m_videoFormat);
-            pUserData = tempFormatBuffer + cbUserData;
-        }
-
-        // use a helper function to create the actual video media type
-        hr = CreateVideoMediaType(pUserData, cbUserData);
-        BREAK_ON_FAIL(hr);
-
-        // calculate the file duration by looking at the number of video samples, and 
-        // the duration of each sample.  The frames per second rate is calculated by
-        // dividing dwRate by dwScale.  Then we take the number of samples from dwLength,
-        // and divide that by the number of frames per second, to get the total number of
-        // seconds.
-        double nSeconds = (double)m_videoStreamInfo.dwLength / ((double)m_videoStreamInfo.dwRate / m_videoStreamInfo.dwScale);
-
-        // The duration is stored in 100 nanosecond units - therefore multiply the number
-        // of seconds by 10^7.
-        m_duration = (LONGLONG)( nSeconds * 10000000);
-
-
-        // Find the location of the first keyframe
-        m_nextKeyframe = m_pVideoStream->FindSample(0, FIND_KEY);
-    }
-    while(false);
-
-    // delete the temporary buffer if it has been allocated
-    if(tempFormatBuffer != NULL)
-    {
-        delete tempFormatBuffer;
-    }
-
-    return hr;
-}
-
-
-//
-// Parse the audio stream header and construct the audio media type
-//
-HRESULT AVIFileParser::ParseAudioStreamHeader(void)
-{
-    HRESULT hr = S_OK;
-    LONG tempFormatSize = 0;
-    BYTE* tempFormatBuffer = NULL;
-    LONG cbUserData = 0;
-    BYTE* pUserData = NULL;
-
-    do
-    {
-        // just return success if there is no audio stream - this may happen if there is only
-        // video in the AVI file
-        BREAK_ON_NULL(m_pAudioStream, S_OK);
-
-        // get an information structure describing the stream
-        hr = m_pAudioStream->Info(&m_audioStreamInfo, sizeof(m_audioStreamInfo));
-        BREAK_ON_FAIL(hr);
-
-        // get first audio sample number
-        m_currentAudioSample = m_audioStreamInfo.dwStart;
-
-        // first find out how large a buffer we need to allocate for the audio 
-        // format structure - pass in NULL as the buffer
-        hr = m_pAudioStream->ReadFormat(0, NULL, &tempFormatSize);
-        if(hr != AVIERR_BUFFERTOOSMALL)
-        {
-            BREAK_ON_FAIL(hr);
-        }
-
-        // allocate the audio format structure
-        tempFormatBuffer = new (std::nothrow) BYTE[tempFormatSize];
-
-        // get the actual format buffer
-        hr = m_pAudioStream->ReadFormat(0, tempFormatBuffer, &tempFormatSize);
-        BREAK_ON_FAIL(hr);
-
-        // copy information from the temp format buffer into the WAVEFORMATEX object for later
-        memcpy_s(&m_audioFormat, sizeof(m_audioFormat), tempFormatBuffer, 
-            min(sizeof(m_audioFormat), tempFormatSize));
-
-        if(tempFormatSize > sizeof(m_audioFormat))
-        {
-            cbUserData = tempFormatSize - sizeof(m_audioFormat);
-            pUserData = tempFormatBuffer + cbUserData;
-        }            
-
-        // construct the actual media type out of the cached m_audioFormat structure, as well
-        // as any additional data that may be present in the audio info structure
-        //hr = CreateAudioMediaType(pUserData, cbUserData);
-        hr = CreateAudioMediaType(tempFormatBuffer, tempFormatSize);
-        BREAK_ON_FAIL(hr);
-    }
-    while(false);
-
-    // delete the temporary buffer if it has been allocated
-    if(tempFormatBuffer != NULL)
-    {
-        delete tempFormatBuffer;
-    }
-
-    return hr;
-}
-
-
-
-//
-// Get a copy of the video media type
-//
-HRESULT AVIFileParser::GetVideoMediaType(IMFMediaType** ppMediaType)
-{
-    HRESULT hr = S_OK;
-
-    do
-    {
-        BREAK_ON_NULL(ppMediaType, E_POINTER);
-        BREAK_ON_NULL(m_pVideoType, E_UNEXPECTED);
-
-        hr = m_pVideoType.CopyTo(ppMediaType);
-    }
-    while(false);
-
-    return hr;
-}
-
-
-//
-// Get a copy of the audio media type
-//
-HRESULT AVIFileParser::GetAudioMediaType(IMFMediaType** ppMediaType)
-{
-    HRESULT hr = S_OK;
-
-    do
-    {
-        BREAK_ON_NULL(ppMediaType, E_POINTER);
-        BREAK_ON_NULL(m_pVideoType, E_UNEXPECTED);
-    
-        hr = m_pAudioType.CopyTo(ppMediaType);
-    }
-    while(false);
-
-    return hr;
-}
-
-
-//
-//  Get the next video sample from the underlying AVI file
-//
-HRESULT AVIFileParser::GetNextVideoSample(IMFSample** ppSample)
-{
-    HRESULT hr = S_OK;
-
-    long bufferSize = 0;
-    BYTE* pBuffer = NULL;
-    LONGLONG sampleTime = 0;
-    CComPtr<IMFMediaBuffer> pMediaBuffer;
-    CComPtr<IMFSample> pSample;
-
-    do
-    {
-        BREAK_ON_NULL (ppSample, E_POINTER);
-        BREAK_ON_NULL (m_pVideoStream, E_UNEXPECTED);
-
-        // figure out the required length of the stream by passing in NULL as the buffer
-        hr = m_pVideoStream->Read(m_currentVideoSample, 1, NULL, 0, &bufferSize, NULL);
-        BREAK_ON_FAIL(hr);
-
-        // create an IMFMediaBuffer object with the required size
-        hr = MFCreateMemoryBuffer(bufferSize, &pMediaBuffer);
-        BREAK_ON_FAIL(hr);
-
-        // lock the IMFMediaBuffer object to get a pointer to its underlyng buffer
-        hr = pMediaBuffer->Lock(&pBuffer, NULL, NULL);
-        BREAK_ON_FAIL(hr);
-
-        // read the data from the stream into the buffer
-        hr = m_pVideoStream->Read(
-                m_currentVideoSample,           // number of the sample to read
-                1,                              // the number of samples requested
-                pBuffer,                        // pointer to the buffer for the sample
-                bufferSize,                     // size of the sample buffer
-                &bufferSize,                    // pointer to the number of bytes actually read
-                NULL);                          // pointer to the number of samples read
-        BREAK_ON_FAIL(hr);
-
-        // unlock the IMFMediaBuffer
-        hr = pMediaBuffer->Unlock();
-        BREAK_ON_FAIL(hr);
-
-        // store the number of bytes read in the IMFMediaBuffer object
-        hr = pMediaBuffer->SetCurrentLength(bufferSize);
-        BREAK_ON_FAIL(hr);
-
-        // create the actual IMFSample object
-        hr = MFCreateSample(&pSample);
-        BREAK_ON_FAIL(hr);
-
-        // store the buffer in the sample
-        hr = pSample->AddBuffer(pMediaBuffer);
-        BREAK_ON_FAIL(hr);
-
-        // calculate and set the time when the sample is displayed relative to the beginning of
-        // the stream (time 0) - cast to LONGLONG vefore multiplication to avoid overflow
-        sampleTime = ((LONGLONG)AVIStreamSampleToTime(m_pVideoStream, m_currentVideoSample)) * 10000;
-        hr = pSample->SetSampleTime(sampleTime);
-        BREAK_ON_FAIL(hr);
-        
-        // If this frame is a keyframe that we previously found, put a flag in the sample to indicate that.
-        if(m_currentVideoSample == m_nextKeyframe)
-        {
-            hr = pSample->SetUINT32(MFSampleExtension_CleanPoint, 1);
-            BREAK_ON_FAIL(hr);
-
-            // since we found the current keyframe, find the index of the next one in the file
-            m_nextKeyframe = m_pVideoStream->FindSample(m_currentVideoSample+1, FIND_KEY | FIND_NEXT);
-        }
-
-        // detach the sample from the object and store it in the passed-in pointer
-        *ppSample = pSample.Detach();
-
-        // get the index of the next video sample in the stream
-        m_currentVideoSample = AVIStreamNextSample(m_pVideoStream, m_currentVideoSample);
-    }
-    while(false);
-
-    return hr;
-}
-
-
-//
-// Read the next audio sample from the AVI file
-//
-HRESULT AVIFileParser::GetNextAudioSample(IMFSample** ppSample)
-{
-    HRESULT hr = S_OK;
-
-    long numOfSamples = 0;
-    long bufferSize = 0;
-    BYTE* pBuffer = NULL;
-    LONGLONG duration = 0;
-    CComPtr<IMFMediaBuffer> pMediaBuffer;
-    CComPtr<IMFSample> pSample;
-
-    do
-    {
-        BREAK_ON_NULL (ppSample, E_POINTER);
-        BREAK_ON_NULL (m_pAudioStream, E_UNEXPECTED);
-
-        // One second buffer size aligned to format block - use enough buffer for 1 second
-        // of audio, and add some padding for the block alighnment
-        bufferSize = (m_audioFormat.nAvgBytesPerSec / 10) + m_audioFormat.nBlockAlign - 1;
-        
-        // adjust buffer size to fit an integer (whole) number of samples - no fractions
-        bufferSize -= bufferSize % m_audioFormat.nBlockAlign;
-
-        // Get the duration of the audio sample in 100 nanosecond units - use the average
-        // bytes per second and the buffer size to figure out how much audio data will be
-        // approximately in the buffer.
-        duration = ((LONGLONG)bufferSize * 10000000) / m_audioFormat.nAvgBytesPerSec;
-
-        // figure out the number of audio samples that will fit into each buffer
-        numOfSamples = bufferSize / m_audioFormat.nBlockAlign;
-
-        // create the IMFMediaBuffer object for the sample
-        hr = MFCreateMemoryBuffer(bufferSize, &pMediaBuffer);
-        BREAK_ON_FAIL(hr);
-
-        // lock the IMFMediaBuffer object to get the pointer to its internal buffer
-        hr = pMediaBuffer->Lock(&pBuffer, NULL, NULL);
-        BREAK_ON_FAIL(hr);
-
-        // Read the audio sample from the AVI file.  Note that since the default AVI file header parser
-        // on Windows is rather fragile, this function may return AVIERR_FILEREAD, stalling the reader.
-        // This error is not recoverable, and to fix it you would need to implement our own AVI file
-        // parser.
-        hr = m_pAudioStream->Read(
-                m_currentAudioSample,           // number of the sample to read
-                numOfSamples,                   // the number of samples requested
-                pBuffer,                        // pointer to the buffer for the sample
-                bufferSize,                     // size of the sample buffer
-                &bufferSize,                    // pointer to the number of bytes actually read
-                NULL);                          // pointer to the number of samples read
-        
-        // do not fail here in case we get AVIERR_FILEREAD error - this way the video will still flow
-        // without audio
-        //BREAK_ON_FAIL(hr);
-
-        // unlock the IMFMediaBuffer object
-        hr = pMediaBuffer->Unlock();
-        BREAK_ON_FAIL(hr);
-
-        // set the length of data in the buffer
-        hr = pMediaBuffer->SetCurrentLength(bufferSize);
-        BREAK_ON_FAIL(hr);
-
-        // create the actual sample
-        hr = MFCreateSample(&pSample);
-        BREAK_ON_FAIL(hr);
-
-        // add the IMFMediaBuffer that we just filled with data to the sample
-        hr = pSample->AddBuffer(pMediaBuffer);
-        BREAK_ON_FAIL(hr);
-
-        // set the time when the sample should be rendered
-        hr = pSample->SetSampleTime(m_audioSampleTime);
-        BREAK_ON_FAIL(hr);
-
-        // set the duration of the sample (how long it should be "displayed")
-        hr = pSample->SetSampleDuration(duration);
-        BREAK_ON_FAIL(hr);
-
-        // detach the sample so that we can return it
-        *ppSample = pSample.Detach();
-
-        // Figure out the next audio sample to display
-        m_currentAudioSample += numOfSamples;
-        
-        // figure out when the next sample should play
-        m_audioSampleTime += duration;
-    }
-    while(false);
-
-    return hr;
-}
-
-
-//
-// Create the video media type
-//
-HRESULT AVIFileParser::CreateVideoMediaType(BYTE* pUserData, DWORD dwUserData)
-{
-    HRESULT hr = S_OK;
-    CComPtr<IMFVideoMediaType> pType;
-
-    do
-    {
-        DWORD original4CC = m_videoFormat.biCompression;
-
-        // use a special case to handle custom 4CC types.  For example variations of the DivX
-        // decoder - DIV3 and DIVX - can be handled by MS decoders MP43 and MP4V.  Therefore
-        // modify the 4CC value to match the decoders that will handle the data
-        if(original4CC == 0x33564944)       // special case - "DIV3" handled by "MP43" decoder
-        {
-            m_videoFormat.biCompression = '34PM';
-        }
-        else if(original4CC == 0x44495658)  // special case - "DIVX" handled by "MP4V" decoder
-        {
-            m_videoFormat.biCompression = 'V4PM';
-        }
-        
-        // construct the media type from the 
-        hr = MFCreateVideoMediaTypeFromBitMapInfoHeaderEx(
-                    &m_videoFormat,                     // video info header to convert
-                    m_videoFormat.biSize,               // size of the header structure
-                    1,                                  // pixel aspect ratio X
-                    1,                                  // pixel aspect ratio Y
-                    MFVideoInterlace_Progressive,       // interlace mode 
-                    0,                                  // video flags
-                    m_videoStreamInfo.dwRate,           // FPS numerator
-                    m_videoStreamInfo.dwScale,          // FPS denominator
-                    m_videoStreamInfo.dwScale,          // max bitrate
-                    &pType);                           // result - out
-        BREAK_ON_FAIL(hr);
-
-        // store the original 4CC value
-        hr = pType->SetUINT32(MF_MT_ORIGINAL_4CC, original4CC);
-        BREAK_ON_FAIL(hr);
-
-        // if there is any extra video information data, store it in the media type
-        if(pUserData != NULL && dwUserData > 0)
-        {
-            hr = pType->SetBlob(MF_MT_USER_DATA, pUserData, dwUserData);
-            BREAK_ON_FAIL(hr);
-        }
-
-        m_pVideoType = pType;
-    }
-    while(false);
-
-    return hr;
-}
-
-HRESULT AVIFileParser::SetOffset(const PROPVARIANT& varStart)
-{
-    HRESULT hr = S_OK;
-
-    // VT_EMPTY mean current position, so mke sure that it is a seek.
-    if (varStart.vt == VT_I8)
-    {
-        m_currentAudioSample = (DWORD)((m_audioStreamInfo.dwLength * varStart.hVal.QuadPart) / m_duration);
-        m_audioSampleTime = varStart.hVal.QuadPart;
-    }
-
-    return hr;
-}
-
-
-//
-// Create the audio media type
-//
-HRESULT AVIFileParser::CreateAudioMediaType(BYTE* pData, DWORD dwDataSize)
-{
-    HRESULT hr = S_OK;
-    CComPtr<IMFMediaType> spType;
-    WAVEFORMATEX formatEx;
-    WAVEFORMATEX* pFormatEx = (WAVEFORMATEX*)pData;
-    DWORD dwStructureLength = dwDataSize;
-
-    do
-    {
-        // create the media type object
-        hr = MFCreateMediaType(&spType);
-        BREAK_ON_FAIL(hr);
-
-        // if this is not a real WAVEFORMATEX structure but a smaller object (WAVEFORMAT?),
-        // then copy it into a new WAVEFORMATEX structure, and fake it in order to make the
-        //  MFInitMediaTypeFromWaveFormatEx function happy
-        if(dwDataSize < sizeof(WAVEFORMATEX))
-        {
-            ZeroMemory(&formatEx, sizeof(WAVEFORMATEX));
-            memcpy_s(&formatEx, sizeof(WAVEFORMATEX), pData, dwDataSize);
-
-            pFormatEx = &formatEx;
-            dwStructureLength = sizeof(WAVEFORMATEX);
-        }
-
-        // use a library function to initialize an audio media type from a WAVEFORMATEX structure
-        hr = MFInitMediaTypeFromWaveFormatEx(spType, pFormatEx, dwStructureLength);
-        BREAK_ON_FAIL(hr);
-
-        // if we got here, then everything succeeded, set the internal pointer to the media type
-        m_pAudioType = spType; 
-    }
-    while(false);
-
-    return hr;
-}
-
-
-//
-// Create the audio media type
-//
-/*HRESULT AVIFileParser::CreateAudioMediaTypeFromWaveFormat(IMFMediaType* pType, BYTE* pWaveFormat, DWORD dwLength)
-{
-    HRESULT hr = S_OK;
-    CComPtr<IMFMediaType> spType;
-
-    do
-    {
-        // create the media type object
-        hr = MFCreateMediaType(&spType);
-        BREAK_ON_FAIL(hr);
-    
-        // set the major type on the media type
-        hr = spType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
-        BREAK_ON_FAIL(hr);
-
-        // decode the audio format id and store it as a subtype GUID - this function handles 
-        // only MP3 and PCM audio types.
-        if(m_audioFormat.wFormatTag == WAVE_FORMAT_MPEGLAYER3)
-        {
-            // MP3 subtype
-            hr = spType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_MP3);
-            BREAK_ON_FAIL(hr);
-        }
-        else
-        {
-            // uncompressed PCM subtype
-            hr = spType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM);
-            BREAK_ON_FAIL(hr);
-
-            // since this is an uncompressed audio format, samples are not dependent on each other
-            hr = spType->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE);
-            BREAK_ON_FAIL(hr);
-        }
-
-        // set the number of audio channels
-        hr = spType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, m_audioFormat.nChannels);
-        BREAK_ON_FAIL(hr);
-
-        // set the number of audio samples per second
-        hr = spType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, m_audioFormat.nSamplesPerSec);
-        BREAK_ON_FAIL(hr);
-
-        // set block alignment
-        hr = spType->SetUINT32(MF_MT_AUDIO_BLOCK_ALIGNMENT, m_audioFormat.nBlockAlign);
-        BREAK_ON_FAIL(hr);
-
-        // set average bytes per second
-        hr = spType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, m_audioFormat.nAvgBytesPerSec);
-        BREAK_ON_FAIL(hr);
-
-        // set number of bits in each sample
-        hr = spType->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, m_audioFormat.wBitsPerSample);
-        BREAK_ON_FAIL(hr);
-
-        // If there is additional data in the structure, then add it to the media type.
-        if(pUserData != NULL && dwUserData > 0)
-        {
-            hr = spType->SetBlob(MF_MT_USER_DATA, pUserData, dwUserData);
-            BREAK_ON_FAIL(hr);
-        }
-
-        // if we got here, then everything succeeded, set the internal pointer to the media type
-        m_pAudioType = spType;
-    }
-    while(false);
-
-    return hr;
-}     */
-
-
-
-
-AVIFileParser::~AVIFileParser(void)
-{
-    if (m_pVideoStream != NULL)
-    {
-        AVIStreamRelease(m_pVideoStream);
-    }
-
-    if (m_pAudioStream != NULL)
-    {    
-        AVIStreamRelease(m_pAudioStream);
-    }
-
-    if (m_pAviFile != NULL)
-    {
-        AVIFileRelease(m_pAviFile);
-    }
-
-    if(m_url != NULL)
-    {
-        delete m_url;
-    }
-
-    AVIFileExit();
-}
-
-
-
-//
-// Create and return a new property store describing the file
-//
-HRESULT AVIFileParser::GetPropertyStore(IPropertyStore** ppPropertyStore)
-{
-    HRESULT hr = S_OK;
-    CComPtr<IPropertyStore> pPropStore;
-    PROPVARIANT propValue;
-
-    do
-    {
-        BREAK_ON_NULL(ppPropertyStore, E_POINTER);
-        BREAK_ON_NULL(m_pAviFile, E_UNEXPECTED);
-
-        // create a new property store
-        hr = PSCreateMemoryPropertyStore(IID_IPropertyStore, (void**)&pPropStore);
-        BREAK_ON_FAIL(hr);
-
-        // set the duration property
-        InitPropVariantFromInt64(m_duration, &propValue);
-        hr = pPropStore->SetValue(PKEY_Media_Duration, propValue);
-        BREAK_ON_FAIL(hr);
-
-        // if we got here, everything succeeded - detach and return the property store
-        *ppPropertyStore = pPropStore.Detach();
-    }
-    while(false);
-
-    return hr;
-}
\ No newline at end of file
+#include "StdAfx.h"
+#include "AviFileParser.h"
+
+//
+// Create a new instance of the AVI file parser.  If a reader is passed in, the file is read
+// through it, and the parser takes ownership of the reader - otherwise the file is opened
+// by its URL.  Either way, if the URL refers to a local file, the parser may also map that
+// file into memory and keep the cache of its index next to it.
+//
+HRESULT AVIFileParser::CreateInstance(const WCHAR* url, AviReader* pReader, 
+    AVIFileParser **ppParser)
+{
+    HRESULT hr = S_OK;
+    AVIFileParser* pParser = NULL;
+    bool isLocalFile = false;
+
+    do
+    {
+        BREAK_ON_NULL (ppParser, E_POINTER);
+
+        DWORD pathCount = MAX_PATH;
+        wchar_t temp[MAX_PATH];
+
+        if(url != NULL)
+        {
+            // if it's necessary, convert the URL into an MS-DOS format path - if not, just 
+            // copy the path to the temp string
+            if(PathIsURL(url))
+            {
+                // convert a URL-style path to an MS-DOS style path string - this fails for
+                // URLs that do not point to a file
+                hr = PathCreateFromUrl(url, temp, &pathCount, 0);
+            }
+            else
+            {
+                wcscpy_s(temp, MAX_PATH, url);
+            }
+
+            isLocalFile = (SUCCEEDED(hr) && PathFileExists(temp));
+        }
+
+        // without a reader the file has to be opened by its path - handle a case where the
+        // file either doesn't exist or is inaccessable
+        if(pReader == NULL)
+        {
+            BREAK_ON_NULL (url, E_POINTER);
+
+            if(!isLocalFile)
+            {
+                hr = FAILED(hr) ? hr : HRESULT_FROM_WIN32(GetLastError());
+                break;
+            }
+        }
+
+        hr = S_OK;
+
+        // create a new parser
+        pParser = new (std::nothrow) AVIFileParser(isLocalFile ? temp : NULL);
+        BREAK_ON_NULL (pParser, E_OUTOFMEMORY);
+
+        // initialize the parser - from now on the parser owns the reader
+        hr = pParser->Init(pReader);
+        pReader = NULL;
+        BREAK_ON_FAIL(hr);
+
+        *ppParser = pParser;
+    }
+    while(false);
+
+
+    if (FAILED(hr) && pParser != NULL)
+    {
+        delete pParser;
+    }
+
+    if (pReader != NULL)
+    {
+        delete pReader;
+    }
+
+    return hr;
+}
+
+AVIFileParser::AVIFileParser(const WCHAR* url) : m_pReader(NULL),
+                                                   m_pDemuxer(NULL),
+                                                   m_pBufferPool(NULL),
+                                                   m_pMappedFile(NULL),
+                                                   m_audioChunksPerSample(1),
+                                                   m_indexCacheEnabled(false),
+                                                   m_duration(0),
+                                                   m_fileOrderReading(false),
+                                                   m_keyframesOnly(false),
+                                                   m_tailFollow(false),
+                                                   m_tailIdleTimeout(0),
+                                                   m_lastGrowthTime(0),
+                                                   m_tailTimedOut(false),
+                                                   m_url(NULL)
+{
+    // allocate a space for and store the path passed in
+    if(url != NULL && wcslen(url) > 0)
+    {
+        m_url = new (std::nothrow) WCHAR[wcslen(url) + 1];
+        wcscpy_s(m_url, wcslen(url) + 1, url);
+    }
+}
+
+//
+// Initialize the parser and open the AVI file, unless a reader for it was passed in
+//
+HRESULT AVIFileParser::Init(AviReader* pReader)
+{
+    HRESULT hr = S_OK;
+    AviFileReader* pFileReader = NULL;
+
+    do
+    {
+        if (pReader != NULL)
+        {
+            m_pReader = pReader;
+        }
+        else
+        {
+            if (m_url == NULL || wcslen(m_url) == 0)
+            {
+                hr = E_FAIL;
+                break;
+            }
+
+            // open the file for reading
+            hr = AviFileReader::CreateInstance(m_url, &pFileReader);
+            BREAK_ON_FAIL(hr);
+
+            m_pReader = pFileReader;
+        }
+
+        // create the RIFF chunk walker that will parse the file through the reader
+        m_pDemuxer = new (std::nothrow) AviDemuxer(m_pReader);
+        BREAK_ON_NULL(m_pDemuxer, E_OUTOFMEMORY);
+
+        // create the pool that will recycle the memory of the sample buffers
+        hr = MediaBufferPool::CreateInstance(&m_pBufferPool);
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+//
+// Parse the AVI file header
+//
+HRESULT AVIFileParser::ParseHeader()
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        // if the file was opened before, try to load its headers and index from the cache
+        // file - this fails if there is no cache, or if the file changed since then.  The
+        // index of a file that is still being recorded, or one without a local path, is
+        // never cached.
+        hr = E_FAIL;
+        if(m_indexCacheEnabled && !m_tailFollow && m_url != NULL)
+        {
+            hr = AviIndexCache::Load(m_url, m_pDemuxer);
+        }
+
+        if(FAILED(hr))
+        {
+            // walk the RIFF chunks of the file - read the header information and build up 
+            // an index of AVI file chunks
+            hr = m_pDemuxer->Parse();
+            if(hr == AVI_E_INVALID_FORMAT || hr == AVI_E_END_OF_FILE)
+            {
+                hr = MF_E_INVALID_FILE_FORMAT;
+            }
+            BREAK_ON_FAIL(hr);
+
+            // store the index for the next time the file is opened - the file can still be
+            // played if the cache cannot be written
+            if(m_indexCacheEnabled && !m_tailFollow && m_url != NULL)
+            {
+                AviIndexCache::Save(m_url, m_pDemuxer);
+            }
+        }
+        
+        // create a track for every audio and video stream in the file - other stream types,
+        // such as text or MIDI, are ignored
+        for(DWORD stream = 0; stream < m_pDemuxer->StreamCount(); stream++)
+        {
+            hr = AddTrack(stream);
+            BREAK_ON_FAIL(hr);
+        }
+        BREAK_ON_FAIL(hr);
+
+        UpdateDuration();
+
+        // the file has not stopped growing yet as far as we know
+        m_lastGrowthTime = GetTickCount();
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Compute the duration of the file - the duration of its longest track.  In OpenDML files
+// dwLength only counts the samples in the first RIFF chunk, so it is used only if there is
+// no index.
+//
+void AVIFileParser::UpdateDuration(void)
+{
+    for(DWORD track = 0; track < m_tracks.size(); track++)
+    {
+        const AviStream* pStream = m_tracks[track]->pStream;
+        LONGLONG duration = 0;
+
+        if(pStream->index.empty())
+        {
+            duration = pStream->SampleTime(pStream->header.dwLength);
+        }
+        else
+        {
+            duration = pStream->ChunkTime(pStream->index.size());
+        }
+
+        m_duration = max(m_duration, duration);
+    }
+}
+
+
+//
+// Enable or disable tail-follow mode for a file that is still being recorded.  Must be
+// called before the header is parsed.
+//
+void AVIFileParser::SetTailFollow(bool follow, DWORD idleTimeout)
+{
+    m_tailFollow = follow;
+    m_tailIdleTimeout = idleTimeout;
+
+    m_pDemuxer->SetLiveMode(follow);
+}
+
+
+//
+// Tail-follow mode only - look for chunks appended to the file since the last time it was
+// walked, and extend the duration if any were found.  If the file has not grown for longer
+// than the idle timeout, the writer is assumed to be gone, and the tracks end at the data
+// found so far.
+//
+HRESULT AVIFileParser::RefreshTail(void)
+{
+    HRESULT hr = S_OK;
+    bool grew = false;
+
+    do
+    {
+        hr = m_pDemuxer->Refresh(&grew);
+        BREAK_ON_FAIL(hr);
+
+        if(grew)
+        {
+            m_lastGrowthTime = GetTickCount();
+            UpdateDuration();
+        }
+        else if(m_tailIdleTimeout != 0 && 
+            GetTickCount() - m_lastGrowthTime >= m_tailIdleTimeout)
+        {
+            m_tailTimedOut = true;
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Create the track of the specified stream, and parse its stream header
+//
+HRESULT AVIFileParser::AddTrack(DWORD streamId)
+{
+    HRESULT hr = S_OK;
+    AviTrack* pTrack = NULL;
+    const AviStream* pStream = m_pDemuxer->GetStream(streamId);
+
+    do
+    {
+        BREAK_ON_NULL(pStream, E_UNEXPECTED);
+
+        // just return success for the streams that are not exposed
+        if(!pStream->IsVideo() && !pStream->IsAudio())
+        {
+            break;
+        }
+
+        pTrack = new (std::nothrow) AviTrack();
+        BREAK_ON_NULL(pTrack, E_OUTOFMEMORY);
+
+        pTrack->streamId = streamId;
+        pTrack->pStream = pStream;
+        pTrack->isVideo = pStream->IsVideo();
+        pTrack->active = true;
+        pTrack->zeroCopy = false;
+        pTrack->currentChunk = 0;
+        pTrack->discontinuity = false;
+        pTrack->readTime.Reset();
+        pTrack->bytesRead = 0;
+
+        if(pTrack->isVideo)
+        {
+            // parse the video stream information and construct the video media type
+            hr = ParseVideoStreamHeader(pTrack);
+        }
+        else
+        {
+            // parse audio stream information and construct the audio media type
+            hr = ParseAudioStreamHeader(pTrack);
+        }
+        BREAK_ON_FAIL(hr);
+
+        m_tracks.push_back(pTrack);
+        pTrack = NULL;
+    }
+    while(false);
+
+    if(pTrack != NULL)
+    {
+        delete pTrack;
+    }
+
+    return hr;
+}
+
+
+//
+// Parse the video stream header and construct the video media type
+//
+HRESULT AVIFileParser::ParseVideoStreamHeader(AviTrack* pTrack)
+{
+    HRESULT hr = S_OK;
+    DWORD tempFormatSize = 0;
+    BYTE* tempFormatBuffer = NULL;
+    DWORD cbUserData = 0;
+    BYTE* pUserData = NULL;
+    BITMAPINFOHEADER videoFormat;
+
+    do
+    {
+        ZeroMemory(&videoFormat, sizeof(videoFormat));
+
+        // the contents of the 'strf' chunk were loaded by the demuxer - the video format 
+        // block must contain at least the BITMAPINFOHEADER structure
+        tempFormatSize = (DWORD)pTrack->pStream->format.size();
+        if(tempFormatSize < sizeof(BITMAPINFOHEADER))
+        {
+            hr = MF_E_INVALID_FILE_FORMAT;
+            break;
+        }
+
+        tempFormatBuffer = (BYTE*)&pTrack->pStream->format[0];
+
+        // copy information from the temp format buffer into the BITMAPINFOHEADER structure
+        memcpy_s(&videoFormat, sizeof(videoFormat), tempFormatBuffer, 
+            min(sizeof(videoFormat), tempFormatSize));
+
+        // figure out how much user data we have
+        if(tempFormatSize > sizeof(videoFormat))
+        {
+            cbUserData = tempFormatSize - sizeof(videoFormat);
+            pUserData = tempFormatBuffer + sizeof(videoFormat);
+        }
+
+        // frames of uncompressed and intra-only video are large and are all delivered as they
+        // are stored in the file, so they are handed out straight from a memory mapping of
+        // the file instead of being copied into a separate buffer.  If the file cannot be
+        // mapped, or is not a local file, the samples are just read into pooled buffers.
+        if(IsIntraOnlyVideo(pTrack, videoFormat) && m_url != NULL)
+        {
+            if(m_pMappedFile == NULL && 
+                FAILED(MappedFile::CreateInstance(m_url, &m_pMappedFile)))
+            {
+                m_pMappedFile = NULL;
+            }
+
+            pTrack->zeroCopy = (m_pMappedFile != NULL);
+        }
+
+        // use a helper function to create the actual video media type
+        hr = CreateVideoMediaType(pTrack, &videoFormat, pUserData, cbUserData);
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Check whether every frame of the video stream is stored as a complete picture - either
+// the video is uncompressed, or the index stored in the file marks every frame as a
+// keyframe.  The flags of an index built by walking the movie data do not count, since the
+// walk does not know them for every frame.
+//
+bool AVIFileParser::IsIntraOnlyVideo(const AviTrack* pTrack, 
+    const BITMAPINFOHEADER& videoFormat) const
+{
+    if(videoFormat.biCompression == BI_RGB || videoFormat.biCompression == BI_BITFIELDS ||
+        videoFormat.biCompression == MAKEFOURCC('U', 'Y', 'V', 'Y') ||
+        videoFormat.biCompression == MAKEFOURCC('Y', 'U', 'Y', '2') ||
+        videoFormat.biCompression == MAKEFOURCC('v', '2', '1', '0') ||
+        videoFormat.biCompression == MAKEFOURCC('N', 'V', '1', '2') ||
+        videoFormat.biCompression == MAKEFOURCC('Y', 'V', '1', '2') ||
+        videoFormat.biCompression == MAKEFOURCC('I', '4', '2', '0'))
+    {
+        return true;
+    }
+
+    if(!m_pDemuxer->IsIndexStored() || pTrack->pStream->index.empty())
+    {
+        return false;
+    }
+
+    return (pTrack->pStream->keyframes.size() == pTrack->pStream->index.size());
+}
+
+
+//
+// Parse the audio stream header and construct the audio media type
+//
+HRESULT AVIFileParser::ParseAudioStreamHeader(AviTrack* pTrack)
+{
+    HRESULT hr = S_OK;
+    DWORD tempFormatSize = 0;
+    BYTE* tempFormatBuffer = NULL;
+    WAVEFORMATEX audioFormat;
+
+    do
+    {
+        ZeroMemory(&audioFormat, sizeof(audioFormat));
+
+        // the contents of the 'strf' chunk were loaded by the demuxer - the audio format 
+        // block must contain at least the WAVEFORMAT structure
+        tempFormatSize = (DWORD)pTrack->pStream->format.size();
+        if(tempFormatSize < sizeof(WAVEFORMAT))
+        {
+            hr = MF_E_INVALID_FILE_FORMAT;
+            break;
+        }
+
+        tempFormatBuffer = (BYTE*)&pTrack->pStream->format[0];
+
+        // copy information from the format buffer into the WAVEFORMATEX object
+        memcpy_s(&audioFormat, sizeof(audioFormat), tempFormatBuffer, 
+            min(sizeof(audioFormat), tempFormatSize));
+
+        // the rate and scale of the stream header are used to time stamp the audio chunks
+        if(audioFormat.nBlockAlign == 0 || audioFormat.nAvgBytesPerSec == 0 ||
+            pTrack->pStream->header.dwRate == 0 || pTrack->pStream->header.dwScale == 0)
+        {
+            hr = MF_E_INVALID_FILE_FORMAT;
+            break;
+        }
+
+        // start with the first chunk of audio data in the stream
+        SkipEmptyChunks(pTrack);
+
+        // construct the actual media type out of the format structure, as well as any 
+        // additional data that may be present in the audio info structure
+        hr = CreateAudioMediaType(pTrack, tempFormatBuffer, tempFormatSize);
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+
+//
+// Get a copy of the media type of the specified track
+//
+HRESULT AVIFileParser::GetMediaType(DWORD track, IMFMediaType** ppMediaType)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        BREAK_ON_NULL(ppMediaType, E_POINTER);
+
+        if(track >= m_tracks.size())
+        {
+            hr = E_INVALIDARG;
+            break;
+        }
+
+        BREAK_ON_NULL(m_tracks[track]->pMediaType, E_UNEXPECTED);
+
+        hr = m_tracks[track]->pMediaType.CopyTo(ppMediaType);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+//  Get the next sample of the specified track from the underlying AVI file
+//
+HRESULT AVIFileParser::GetNextSample(DWORD track, IMFSample** ppSample)
+{
+    if(track >= m_tracks.size())
+    {
+        return E_INVALIDARG;
+    }
+
+    // time every read of the track, and count the data that it returned
+    AviTrack* pTrack = m_tracks[track];
+    LONGLONG startTime = StatisticsTimestamp();
+
+    HRESULT hr = ReadNextSample(track, ppSample);
+
+    pTrack->readTime.Record(StatisticsTimestamp() - startTime);
+    if(SUCCEEDED(hr))
+    {
+        DWORD cbSample = 0;
+        if(SUCCEEDED((*ppSample)->GetTotalLength(&cbSample)))
+        {
+            InterlockedExchangeAdd64(&pTrack->bytesRead, cbSample);
+        }
+    }
+
+    return hr;
+}
+
+
+//
+// Read the next sample of the specified track - called through GetNextSample()
+//
+HRESULT AVIFileParser::ReadNextSample(DWORD track, IMFSample** ppSample)
+{
+    // a track of a file that is still being recorded may have caught up with the writer -
+    // look for new data first.  If there is none yet, return E_PENDING so that the caller
+    // asks again later, and if the file stopped growing, the track has ended.
+    AviTrack* pTrack = m_tracks[track];
+    if(pTrack->pendingSamples.empty() && IsDataExhausted(pTrack) && IsGrowing())
+    {
+        HRESULT hr = RefreshTail();
+        if(FAILED(hr))
+        {
+            return hr;
+        }
+
+        if(IsDataExhausted(pTrack))
+        {
+            return IsGrowing() ? E_PENDING : MF_E_END_OF_STREAM;
+        }
+    }
+
+    if(m_fileOrderReading)
+    {
+        return ReadInFileOrder(track, ppSample);
+    }
+
+    if(pTrack->isVideo)
+    {
+        return ReadVideoSample(pTrack, ppSample);
+    }
+
+    return ReadAudioSample(pTrack, ppSample);
+}
+
+
+//
+// Get the next sample of the specified track while reading the file strictly in file
+// order.  If the data of other tracks comes first in the file, their samples are read
+// and held until those tracks ask for them, so that the reads always move forward through
+// the 'movi' list instead of jumping back and forth between the streams.
+//
+HRESULT AVIFileParser::ReadInFileOrder(DWORD track, IMFSample** ppSample)
+{
+    HRESULT hr = S_OK;
+    AviTrack* pRequested = m_tracks[track];
+
+    do
+    {
+        BREAK_ON_NULL (ppSample, E_POINTER);
+
+        // if the sample was already read together with another track, just return it
+        if(!pRequested->pendingSamples.empty())
+        {
+            *ppSample = pRequested->pendingSamples.front();
+            pRequested->pendingSamples.pop_front();
+            break;
+        }
+
+        // read chunks in file order until we get a sample of the requested track
+        while(true)
+        {
+            CComPtr<IMFSample> pSample;
+            AviTrack* pNext = IsDataExhausted(pRequested) ? NULL : pRequested;
+
+            // read another track first if it is active, its next chunk is earlier in the
+            // file, and we are not already holding too many of its samples - the data of
+            // deselected tracks is skipped entirely
+            for(DWORD i = 0; i < m_tracks.size(); i++)
+            {
+                AviTrack* pTrack = m_tracks[i];
+
+                if(pTrack == pRequested || !pTrack->active || IsDataExhausted(pTrack) ||
+                    pTrack->pendingSamples.size() >= FILE_ORDER_MAX_PENDING_SAMPLES ||
+                    (m_keyframesOnly && !pTrack->isVideo))
+                {
+                    continue;
+                }
+
+                if(pNext == NULL || NextChunkOffset(pTrack) < NextChunkOffset(pNext))
+                {
+                    pNext = pTrack;
+                }
+            }
+
+            // the requested track has no data left - let the read below fail
+            if(pNext == NULL)
+            {
+                pNext = pRequested;
+            }
+
+            if(pNext->isVideo)
+            {
+                hr = ReadVideoSample(pNext, &pSample);
+            }
+            else
+            {
+                hr = ReadAudioSample(pNext, &pSample);
+            }
+            BREAK_ON_FAIL(hr);
+
+            if(pNext == pRequested)
+            {
+                *ppSample = pSample.Detach();
+                break;
+            }
+
+            // hold on to the sample of the other track until it is requested
+            pNext->pendingSamples.push_back(pSample.Detach());
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Move the position of an audio track past any empty chunks - some muxers write empty
+// audio chunks to keep the interleaving regular, and those would produce empty samples
+//
+void AVIFileParser::SkipEmptyChunks(AviTrack* pTrack)
+{
+    while(!IsDataExhausted(pTrack) && 
+        pTrack->pStream->index[(size_t)pTrack->currentChunk].size == 0)
+    {
+        pTrack->currentChunk++;
+    }
+}
+
+
+//
+// Release the samples of a track read ahead in file order - called on seek
+//
+void AVIFileParser::FlushPendingSamples(AviTrack* pTrack)
+{
+    while(!pTrack->pendingSamples.empty())
+    {
+        pTrack->pendingSamples.front()->Release();
+        pTrack->pendingSamples.pop_front();
+    }
+}
+
+
+//
+// Mark a track as selected or deselected - the data of a deselected track is never read
+// ahead in file order mode
+//
+void AVIFileParser::ActivateTrack(DWORD track, bool active)
+{
+    if(track >= m_tracks.size())
+    {
+        return;
+    }
+
+    m_tracks[track]->active = active;
+
+    // drop anything that was already read for a track that is no longer needed
+    if(!active)
+    {
+        FlushPendingSamples(m_tracks[track]);
+    }
+}
+
+
+//
+// Switch between normal playback and keyframe-only playback.  In keyframe-only mode each
+// video track moves from one keyframe straight to the next, and the audio tracks are not
+// read at all.  When normal playback resumes, the audio tracks are moved to the position
+// of the video, so that they continue in sync.
+//
+void AVIFileParser::SetKeyframesOnly(bool keyframesOnly)
+{
+    AviTrack* pMainVideo = MainVideoTrack();
+    LONGLONG videoTime = 0;
+
+    if(keyframesOnly == m_keyframesOnly)
+    {
+        return;
+    }
+
+    m_keyframesOnly = keyframesOnly;
+
+    if(pMainVideo != NULL && !IsDataExhausted(pMainVideo))
+    {
+        videoTime = pMainVideo->pStream->SampleTime(pMainVideo->currentChunk);
+    }
+
+    for(DWORD i = 0; i < m_tracks.size(); i++)
+    {
+        AviTrack* pTrack = m_tracks[i];
+
+        // samples read ahead in file order were read for the other mode
+        FlushPendingSamples(pTrack);
+
+        if(pTrack->isVideo)
+        {
+            // continue from the next keyframe
+            if(keyframesOnly && !IsDataExhausted(pTrack) && 
+                (pTrack->pStream->index[(size_t)pTrack->currentChunk].flags & 
+                    AVI_INDEX_KEYFRAME) == 0)
+            {
+                pTrack->currentChunk = NextKeyframe(pTrack, pTrack->currentChunk);
+            }
+
+            pTrack->discontinuity = true;
+        }
+        else if(!keyframesOnly && pMainVideo != NULL)
+        {
+            // the audio was not read while skipping - catch up with the video
+            pTrack->currentChunk = m_pDemuxer->FindChunk(pTrack->streamId, videoTime);
+            SkipEmptyChunks(pTrack);
+
+            pTrack->discontinuity = true;
+        }
+    }
+}
+
+
+//
+// Get the index entry of the first keyframe of a video track after the specified chunk, or
+// the size of the index if there is none.  If the index does not mark any keyframes every
+// frame is treated as one.
+//
+ULONGLONG AVIFileParser::NextKeyframe(const AviTrack* pTrack, ULONGLONG chunk) const
+{
+    const std::vector<AviKeyframe>& keyframes = pTrack->pStream->keyframes;
+    size_t low = 0;
+    size_t high = keyframes.size();
+
+    if(keyframes.empty())
+    {
+        return chunk + 1;
+    }
+
+    // binary search the keyframe table for the first keyframe past the chunk
+    while(low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+
+        if(keyframes[middle].sample <= chunk)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    if(low == keyframes.size())
+    {
+        return pTrack->pStream->index.size();
+    }
+
+    return keyframes[low].sample;
+}
+
+
+//
+// Get the video track that drives seeking - the first selected video track, or the first
+// video track if none is selected
+//
+AviTrack* AVIFileParser::MainVideoTrack(void) const
+{
+    AviTrack* pMainVideo = NULL;
+
+    for(DWORD i = 0; i < m_tracks.size(); i++)
+    {
+        if(m_tracks[i]->isVideo && (pMainVideo == NULL || 
+            (!pMainVideo->active && m_tracks[i]->active)))
+        {
+            pMainVideo = m_tracks[i];
+        }
+    }
+
+    return pMainVideo;
+}
+
+
+//
+//  Read the next video sample of the track from the file
+//
+HRESULT AVIFileParser::ReadVideoSample(AviTrack* pTrack, IMFSample** ppSample)
+{
+    HRESULT hr = S_OK;
+
+    DWORD bufferSize = 0;
+    BYTE* pBuffer = NULL;
+    LONGLONG sampleTime = 0;
+    ULONGLONG nextChunk = 0;
+    CComPtr<IMFMediaBuffer> pMediaBuffer;
+    CComPtr<IMFSample> pSample;
+
+    do
+    {
+        BREAK_ON_NULL (ppSample, E_POINTER);
+
+        if(IsDataExhausted(pTrack))
+        {
+            hr = E_UNEXPECTED;
+            break;
+        }
+
+        const AviStream* pStream = pTrack->pStream;
+
+        // in keyframe-only mode the frames up to the next keyframe are skipped, and the
+        // sample lasts until that keyframe is shown
+        nextChunk = pTrack->currentChunk + 1;
+        if(m_keyframesOnly)
+        {
+            nextChunk = NextKeyframe(pTrack, pTrack->currentChunk);
+        }
+
+        // the index entry of the sample holds the location and size of its data chunk
+        const AviIndexEntry& entry = pStream->index[(size_t)pTrack->currentChunk];
+        bufferSize = entry.size;
+
+        // if the track is served from the mapped file, get a buffer that points directly at
+        // the data of the chunk in the mapped view.  This fails if the chunk is past the end
+        // of the mapping, in which case the data is read from the file instead.
+        if(!pTrack->zeroCopy || 
+            FAILED(m_pMappedFile->GetBuffer(entry.offset, bufferSize, &pMediaBuffer)))
+        {
+            // get an IMFMediaBuffer object with the required size from the buffer pool
+            hr = m_pBufferPool->GetBuffer(bufferSize, &pMediaBuffer);
+            BREAK_ON_FAIL(hr);
+
+            // lock the IMFMediaBuffer object to get a pointer to its underlyng buffer
+            hr = pMediaBuffer->Lock(&pBuffer, NULL, NULL);
+            BREAK_ON_FAIL(hr);
+
+            // read the data of the chunk into the buffer
+            hr = m_pDemuxer->ReadData(entry.offset, pBuffer, bufferSize);
+
+            // unlock the IMFMediaBuffer even if the read failed
+            pMediaBuffer->Unlock();
+            BREAK_ON_FAIL(hr);
+
+            // store the number of bytes read in the IMFMediaBuffer object
+            hr = pMediaBuffer->SetCurrentLength(bufferSize);
+            BREAK_ON_FAIL(hr);
+        }
+
+        // create the actual IMFSample object
+        hr = MFCreateSample(&pSample);
+        BREAK_ON_FAIL(hr);
+
+        // store the buffer in the sample
+        hr = pSample->AddBuffer(pMediaBuffer);
+        BREAK_ON_FAIL(hr);
+
+        // calculate and set the time when the sample is displayed relative to the beginning of
+        // the stream (time 0) - the frame number is converted to seconds with dwScale/dwRate,
+        // and then to 100 nanosecond units.
+        sampleTime = pStream->SampleTime(pTrack->currentChunk);
+        hr = pSample->SetSampleTime(sampleTime);
+        BREAK_ON_FAIL(hr);
+
+        // set the duration of the frame
+        hr = pSample->SetSampleDuration(pStream->SampleTime(nextChunk) - sampleTime);
+        BREAK_ON_FAIL(hr);
+
+        // mark the first sample after a change of the playback mode
+        if(pTrack->discontinuity)
+        {
+            hr = pSample->SetUINT32(MFSampleExtension_Discontinuity, TRUE);
+            BREAK_ON_FAIL(hr);
+        }
+        
+        // If the index marks this frame as a keyframe, put a flag in the sample to indicate that.
+        if((entry.flags & AVI_INDEX_KEYFRAME) != 0)
+        {
+            hr = pSample->SetUINT32(MFSampleExtension_CleanPoint, 1);
+            BREAK_ON_FAIL(hr);
+        }
+
+        // detach the sample from the object and store it in the passed-in pointer
+        *ppSample = pSample.Detach();
+
+        // get the index of the next video sample in the stream
+        pTrack->currentChunk = nextChunk;
+        pTrack->discontinuity = false;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Read the next audio sample of the track from the AVI file.  Every sample is made up of
+// whole data chunks, so that compressed audio reaches the decoder in the packets in which
+// it was written, and each chunk is fetched with a single contiguous read.
+//
+HRESULT AVIFileParser::ReadAudioSample(AviTrack* pTrack, IMFSample** ppSample)
+{
+    HRESULT hr = S_OK;
+
+    ULONGLONG firstChunk = 0;
+    ULONGLONG endChunk = 0;
+    DWORD bufferSize = 0;
+    DWORD cbRead = 0;
+    BYTE* pBuffer = NULL;
+    LONGLONG sampleTime = 0;
+    CComPtr<IMFMediaBuffer> pMediaBuffer;
+    CComPtr<IMFSample> pSample;
+
+    do
+    {
+        BREAK_ON_NULL (ppSample, E_POINTER);
+
+        if(IsDataExhausted(pTrack))
+        {
+            hr = E_UNEXPECTED;
+            break;
+        }
+
+        const AviStream* pStream = pTrack->pStream;
+        const std::vector<AviIndexEntry>& index = pStream->index;
+
+        // figure out which chunks go into the sample, and how much data they hold
+        firstChunk = pTrack->currentChunk;
+        endChunk = firstChunk;
+        while(endChunk < index.size() && endChunk - firstChunk < m_audioChunksPerSample)
+        {
+            bufferSize += index[(size_t)endChunk].size;
+            endChunk++;
+        }
+
+        // get the IMFMediaBuffer object for the sample from the buffer pool
+        hr = m_pBufferPool->GetBuffer(bufferSize, &pMediaBuffer);
+        BREAK_ON_FAIL(hr);
+
+        // lock the IMFMediaBuffer object to get the pointer to its internal buffer
+        hr = pMediaBuffer->Lock(&pBuffer, NULL, NULL);
+        BREAK_ON_FAIL(hr);
+
+        // read the data of the chunks one after another into the buffer
+        for(ULONGLONG chunk = firstChunk; chunk < endChunk; chunk++)
+        {
+            const AviIndexEntry& entry = index[(size_t)chunk];
+
+            hr = m_pDemuxer->ReadData(entry.offset, pBuffer + cbRead, entry.size);
+            BREAK_ON_FAIL(hr);
+
+            cbRead += entry.size;
+        }
+
+        // unlock the IMFMediaBuffer object even if the read failed
+        pMediaBuffer->Unlock();
+        BREAK_ON_FAIL(hr);
+
+        // set the length of data in the buffer
+        hr = pMediaBuffer->SetCurrentLength(bufferSize);
+        BREAK_ON_FAIL(hr);
+
+        // create the actual sample
+        hr = MFCreateSample(&pSample);
+        BREAK_ON_FAIL(hr);
+
+        // add the IMFMediaBuffer that we just filled with data to the sample
+        hr = pSample->AddBuffer(pMediaBuffer);
+        BREAK_ON_FAIL(hr);
+
+        // set the time when the sample should be rendered - the time of the first chunk is
+        // computed from the stream header and the position of the chunk in the index
+        sampleTime = pStream->ChunkTime(firstChunk);
+        hr = pSample->SetSampleTime(sampleTime);
+        BREAK_ON_FAIL(hr);
+
+        // the sample lasts until the chunk that follows it starts
+        hr = pSample->SetSampleDuration(pStream->ChunkTime(endChunk) - sampleTime);
+        BREAK_ON_FAIL(hr);
+
+        // mark the first sample after the audio caught up with the video
+        if(pTrack->discontinuity)
+        {
+            hr = pSample->SetUINT32(MFSampleExtension_Discontinuity, TRUE);
+            BREAK_ON_FAIL(hr);
+        }
+
+        // detach the sample so that we can return it
+        *ppSample = pSample.Detach();
+
+        // move on to the next chunk that has any data in it
+        pTrack->currentChunk = endChunk;
+        pTrack->discontinuity = false;
+        SkipEmptyChunks(pTrack);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Create the video media type of the track
+//
+HRESULT AVIFileParser::CreateVideoMediaType(AviTrack* pTrack, BITMAPINFOHEADER* pVideoFormat,
+    BYTE* pUserData, DWORD dwUserData)
+{
+    HRESULT hr = S_OK;
+    CComPtr<IMFVideoMediaType> pType;
+
+    do
+    {
+        DWORD original4CC = pVideoFormat->biCompression;
+
+        // use a special case to handle custom 4CC types.  For example variations of the DivX
+        // decoder - DIV3 and DIVX - can be handled by MS decoders MP43 and MP4V.  Therefore
+        // modify the 4CC value to match the decoders that will handle the data
+        if(original4CC == 0x33564944)       // special case - "DIV3" handled by "MP43" decoder
+        {
+            pVideoFormat->biCompression = '34PM';
+        }
+        else if(original4CC == 0x44495658)  // special case - "DIVX" handled by "MP4V" decoder
+        {
+            pVideoFormat->biCompression = 'V4PM';
+        }
+        
+        // construct the media type from the 
+        hr = MFCreateVideoMediaTypeFromBitMapInfoHeaderEx(
+                    pVideoFormat,                       // video info header to convert
+                    pVideoFormat->biSize,               // size of the header structure
+                    1,                                  // pixel aspect ratio X
+                    1,                                  // pixel aspect ratio Y
+                    MFVideoInterlace_Progressive,       // interlace mode 
+                    0,                                  // video flags
+                    pTrack->pStream->header.dwRate,     // FPS numerator
+                    pTrack->pStream->header.dwScale,    // FPS denominator
+                    pTrack->pStream->header.dwScale,    // max bitrate
+                    &pType);                           // result - out
+        BREAK_ON_FAIL(hr);
+
+        // store the original 4CC value
+        hr = pType->SetUINT32(MF_MT_ORIGINAL_4CC, original4CC);
+        BREAK_ON_FAIL(hr);
+
+        // if there is any extra video information data, store it in the media type
+        if(pUserData != NULL && dwUserData > 0)
+        {
+            hr = pType->SetBlob(MF_MT_USER_DATA, pUserData, dwUserData);
+            BREAK_ON_FAIL(hr);
+        }
+
+        pTrack->pMediaType = pType;
+    }
+    while(false);
+
+    return hr;
+}
+
+//
+// Seek to the specified time.  The video is moved to the closest keyframe at or before the
+// requested time, and the other tracks are aligned to the timestamp of that keyframe, so
+// that all of the tracks restart from the same point.
+//
+HRESULT AVIFileParser::SetOffset(const PROPVARIANT& varStart)
+{
+    HRESULT hr = S_OK;
+    LONGLONG startTime = 0;
+    AviTrack* pMainVideo = NULL;
+
+    // VT_EMPTY mean current position, so mke sure that it is a seek.
+    if (varStart.vt == VT_I8)
+    {
+        startTime = varStart.hVal.QuadPart;
+
+        // samples read ahead in file order belong to the old position
+        for(DWORD i = 0; i < m_tracks.size(); i++)
+        {
+            FlushPendingSamples(m_tracks[i]);
+        }
+
+        // the keyframes of the first selected video track decide where playback resumes
+        pMainVideo = MainVideoTrack();
+
+        // binary search the keyframe table for the closest preceding keyframe
+        if(pMainVideo != NULL)
+        {
+            const AviKeyframe* pKeyframe = 
+                m_pDemuxer->FindKeyframe(pMainVideo->streamId, startTime);
+
+            if(pKeyframe != NULL)
+            {
+                pMainVideo->currentChunk = pKeyframe->sample;
+                startTime = pKeyframe->time;
+            }
+        }
+
+        for(DWORD i = 0; i < m_tracks.size(); i++)
+        {
+            AviTrack* pTrack = m_tracks[i];
+
+            if(pTrack == pMainVideo)
+            {
+                continue;
+            }
+
+            if(pTrack->isVideo)
+            {
+                // other video tracks restart from their own keyframe preceding that time
+                const AviKeyframe* pKeyframe = 
+                    m_pDemuxer->FindKeyframe(pTrack->streamId, startTime);
+
+                if(pKeyframe != NULL)
+                {
+                    pTrack->currentChunk = pKeyframe->sample;
+                }
+            }
+            else
+            {
+                // seek the audio track to the chunk that contains the start time - the audio
+                // is delivered in whole chunks, and their time stamps come from the index
+                pTrack->currentChunk = m_pDemuxer->FindChunk(pTrack->streamId, startTime);
+                SkipEmptyChunks(pTrack);
+            }
+        }
+    }
+
+    return hr;
+}
+
+
+//
+// Create the audio media type of the track
+//
+HRESULT AVIFileParser::CreateAudioMediaType(AviTrack* pTrack, BYTE* pData, DWORD dwDataSize)
+{
+    HRESULT hr = S_OK;
+    CComPtr<IMFMediaType> spType;
+    WAVEFORMATEX formatEx;
+    WAVEFORMATEX* pFormatEx = (WAVEFORMATEX*)pData;
+    DWORD dwStructureLength = dwDataSize;
+
+    do
+    {
+        // create the media type object
+        hr = MFCreateMediaType(&spType);
+        BREAK_ON_FAIL(hr);
+
+        // if this is not a real WAVEFORMATEX structure but a smaller object (WAVEFORMAT?),
+        // then copy it into a new WAVEFORMATEX structure, and fake it in order to make the
+        //  MFInitMediaTypeFromWaveFormatEx function happy
+        if(dwDataSize < sizeof(WAVEFORMATEX))
+        {
+            ZeroMemory(&formatEx, sizeof(WAVEFORMATEX));
+            memcpy_s(&formatEx, sizeof(WAVEFORMATEX), pData, dwDataSize);
+
+            pFormatEx = &formatEx;
+            dwStructureLength = sizeof(WAVEFORMATEX);
+        }
+
+        // use a library function to initialize an audio media type from a WAVEFORMATEX structure
+        hr = MFInitMediaTypeFromWaveFormatEx(spType, pFormatEx, dwStructureLength);
+        BREAK_ON_FAIL(hr);
+
+        // if we got here, then everything succeeded, set the media type of the track
+        pTrack->pMediaType = spType; 
+    }
+    while(false);
+
+    return hr;
+}
+
+
+AVIFileParser::~AVIFileParser(void)
+{
+    for(DWORD i = 0; i < m_tracks.size(); i++)
+    {
+        FlushPendingSamples(m_tracks[i]);
+        delete m_tracks[i];
+    }
+
+    if (m_pDemuxer != NULL)
+    {
+        delete m_pDemuxer;
+    }
+
+    if (m_pReader != NULL)
+    {
+        delete m_pReader;
+    }
+
+    // the mapping is reference counted as well - the views stay mapped until every buffer
+    // pointing into them has been released
+    if (m_pMappedFile != NULL)
+    {
+        m_pMappedFile->Release();
+    }
+
+    // the pool is reference counted - it stays alive until every buffer handed out by it
+    // has been released
+    if (m_pBufferPool != NULL)
+    {
+        m_pBufferPool->Release();
+    }
+
+    if(m_url != NULL)
+    {
+        delete m_url;
+    }
+}
+
+
+
+//
+// Get the number of sample buffers served from the pool and the number of buffers that
+// had to be allocated
+//
+void AVIFileParser::GetBufferPoolStatistics(BufferPoolStatistics* pStatistics)
+{
+    if (m_pBufferPool != NULL)
+    {
+        m_pBufferPool->GetStatistics(pStatistics);
+    }
+}
+
+
+//
+// Get the read time histogram and the number of bytes read for the specified track
+//
+void AVIFileParser::GetReadStatistics(DWORD track, LatencyHistogram* pReadTime,
+    LONGLONG* pBytesRead)
+{
+    if (track < m_tracks.size() && pReadTime != NULL && pBytesRead != NULL)
+    {
+        *pReadTime = m_tracks[track]->readTime;
+        *pBytesRead = m_tracks[track]->bytesRead;
+    }
+}
+
+
+//
+// Start collecting the read statistics of all tracks from scratch
+//
+void AVIFileParser::ResetReadStatistics(void)
+{
+    for (DWORD track = 0; track < m_tracks.size(); track++)
+    {
+        m_tracks[track]->readTime.Reset();
+        m_tracks[track]->bytesRead = 0;
+    }
+}
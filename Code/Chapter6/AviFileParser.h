@@ -1,71 +1,145 @@
-#pragma once
-
-#include <atlbase.h>
-#include <Vfw.h>
-#include <Shlwapi.h>
-
-#include <mfapi.h>
-#include <mfobjects.h>
-#include <mferror.h>
-#include <propkey.h>
-#include <propvarutil.h>
-
-
-// Parse the AVI file with the VFW interfaces.
-class AVIFileParser
-{
-    public:
-        static HRESULT CreateInstance(const WCHAR* url, AVIFileParser **ppParser);
-
-        HRESULT ParseHeader(void);
-        HRESULT GetVideoMediaType(IMFMediaType** ppMediaType);
-        HRESULT GetAudioMediaType(IMFMediaType** ppMediaType);
-        HRESULT GetNextVideoSample(IMFSample** ppSample);
-        HRESULT GetNextAudioSample(IMFSample** ppSample);
-        HRESULT SetOffset(const PROPVARIANT& varStart);
-
-        DWORD StreamCount(void) const           { return m_aviInfo.dwStreams; };
-        bool IsSupportedFormat(void) const      { return true; };
-        bool HasVideo(void) const               { return (m_pVideoStream != NULL); };
-        bool HasAudio(void) const               { return (m_pAudioStream != NULL); };
-        bool IsVideoEndOfStream(void) const     
-        { return (m_currentVideoSample >= m_videoStreamInfo.dwLength); };
-        bool IsAudioEndOfStream(void) const     
-        { return (m_currentAudioSample >= m_audioStreamInfo.dwLength); };
-        LONGLONG Duration(void) const           { return m_duration; };
-
-        ~AVIFileParser(void);
-
-        HRESULT GetPropertyStore(IPropertyStore** ppPropertyStore);
-
-    protected:
-        AVIFileParser(const WCHAR* url);
-        HRESULT Init();
-        HRESULT CreateVideoMediaType(BYTE* pUserData, DWORD dwUserData);
-        HRESULT CreateAudioMediaType(BYTE* pUserData, DWORD dwUserData);
-        HRESULT ParseVideoStreamHeader(void);
-        HRESULT ParseAudioStreamHeader(void);
-
-    private:
-        WCHAR* m_url;
-        AVIFILEINFO m_aviInfo;
-        AVISTREAMINFO m_videoStreamInfo;
-        AVISTREAMINFO m_audioStreamInfo;
-
-        BITMAPINFOHEADER m_videoFormat;
-        WAVEFORMATEX m_audioFormat;
-
-        IAVIFile* m_pAviFile;
-        IAVIStream* m_pVideoStream;
-        IAVIStream* m_pAudioStream;
-
-        DWORD m_currentVideoSample;
-        DWORD m_currentAudioSample;
-        LONGLONG m_audioSampleTime;
-        LONGLONG m_duration;
-
-        LONG m_nextKeyframe;
-
-        CComPtr<IMFMediaType> m_pVideoType;
-        CComPtr<IMFMediaType> m_pAudioType;
-};
\ No newline at end of file
+#pragma once
+
+#include <atlbase.h>
+#include <Shlwapi.h>
+#include <mmsystem.h>
+#include <mmreg.h>
+
+#include <mfapi.h>
+#include <mfobjects.h>
+#include <mferror.h>
+#include <propkey.h>
+#include <propvarutil.h>
+
+#include "AviReader.h"
+#include "AviDemuxer.h"
+#include "MediaBufferPool.h"
+#include "MappedFile.h"
+#include "AviIndexCache.h"
+#include "StreamStatistics.h"
+
+#include <deque>
+
+
+// maximum number of samples of one track held while reading the other tracks in file order
+#define FILE_ORDER_MAX_PENDING_SAMPLES      64
+
+
+// State of one of the audio or video tracks of the file
+struct AviTrack
+{
+    DWORD streamId;                         // number of the stream in the AVI file
+    const AviStream* pStream;               // headers and index built by the demuxer
+    bool isVideo;                           // video track if true, audio track otherwise
+    bool active;                            // the track is selected, and its data is read
+    bool zeroCopy;                          // frames are handed out from the mapped file
+    ULONGLONG currentChunk;                 // index entry of the next chunk to read
+    bool discontinuity;                     // the next sample follows a gap in the track
+    CComPtr<IMFMediaType> pMediaType;       // media type of the samples of the track
+    std::deque<IMFSample*> pendingSamples;  // samples read ahead in file order mode
+    LatencyHistogram readTime;              // time taken by each GetNextSample() call
+    LONGLONG bytesRead;                     // sample data returned for the track
+};
+
+
+// Parse the AVI file with the native RIFF chunk walker.  Every audio and video stream of
+// the file is exposed as a separate track.
+class AVIFileParser
+{
+    public:
+        static HRESULT CreateInstance(const WCHAR* url, AviReader* pReader, 
+            AVIFileParser **ppParser);
+
+        HRESULT ParseHeader(void);
+        HRESULT GetMediaType(DWORD track, IMFMediaType** ppMediaType);
+        HRESULT GetNextSample(DWORD track, IMFSample** ppSample);
+        HRESULT SetOffset(const PROPVARIANT& varStart);
+
+        DWORD StreamCount(void) const           { return m_pDemuxer->StreamCount(); };
+        DWORD TrackCount(void) const            { return (DWORD)m_tracks.size(); };
+        bool IsSupportedFormat(void) const      { return true; };
+        bool IsVideoTrack(DWORD track) const    { return m_tracks[track]->isVideo; };
+        WORD GetTrackLanguage(DWORD track) const
+        { return m_tracks[track]->pStream->header.wLanguage; };
+        bool IsEndOfStream(DWORD track) const
+        { return (!IsGrowing() && m_tracks[track]->pendingSamples.empty() && 
+            IsDataExhausted(m_tracks[track])); };
+        LONGLONG Duration(void) const           { return m_duration; };
+
+        ~AVIFileParser(void);
+
+        void GetBufferPoolStatistics(BufferPoolStatistics* pStatistics);
+        void GetReadStatistics(DWORD track, LatencyHistogram* pReadTime, LONGLONG* pBytesRead);
+        void ResetReadStatistics(void);
+
+        void SetFileOrderReading(bool fileOrder)    { m_fileOrderReading = fileOrder; };
+        void SetAudioChunksPerSample(DWORD chunks)  { if(chunks > 0) m_audioChunksPerSample = chunks; };
+        void SetIndexCacheEnabled(bool enabled)     { m_indexCacheEnabled = enabled; };
+        void SetTailFollow(bool follow, DWORD idleTimeout);
+        bool IsGrowing(void) const      { return m_pDemuxer->IsGrowing() && !m_tailTimedOut; };
+        void ActivateTrack(DWORD track, bool active);
+        void SetKeyframesOnly(bool keyframesOnly);
+
+    protected:
+        AVIFileParser(const WCHAR* url);
+        HRESULT Init(AviReader* pReader);
+        HRESULT CreateVideoMediaType(AviTrack* pTrack, BITMAPINFOHEADER* pVideoFormat, 
+            BYTE* pUserData, DWORD dwUserData);
+        HRESULT CreateAudioMediaType(AviTrack* pTrack, BYTE* pUserData, DWORD dwUserData);
+        HRESULT AddTrack(DWORD streamId);
+        HRESULT ParseVideoStreamHeader(AviTrack* pTrack);
+        HRESULT ParseAudioStreamHeader(AviTrack* pTrack);
+        bool IsIntraOnlyVideo(const AviTrack* pTrack, const BITMAPINFOHEADER& videoFormat) const;
+
+        HRESULT ReadNextSample(DWORD track, IMFSample** ppSample);
+        HRESULT ReadVideoSample(AviTrack* pTrack, IMFSample** ppSample);
+        HRESULT ReadAudioSample(AviTrack* pTrack, IMFSample** ppSample);
+        HRESULT ReadInFileOrder(DWORD track, IMFSample** ppSample);
+        void FlushPendingSamples(AviTrack* pTrack);
+        void SkipEmptyChunks(AviTrack* pTrack);
+        ULONGLONG NextKeyframe(const AviTrack* pTrack, ULONGLONG chunk) const;
+        AviTrack* MainVideoTrack(void) const;
+        HRESULT RefreshTail(void);
+        void UpdateDuration(void);
+
+        bool IsDataExhausted(const AviTrack* pTrack) const
+        { return (pTrack->currentChunk >= pTrack->pStream->index.size()); };
+        ULONGLONG NextChunkOffset(const AviTrack* pTrack) const
+        { return pTrack->pStream->index[(size_t)pTrack->currentChunk].offset; };
+
+    private:
+        // local path of the file, or NULL if the file is read through a reader that is not
+        // backed by a local file
+        WCHAR* m_url;
+
+        AviReader* m_pReader;
+        AviDemuxer* m_pDemuxer;
+        MediaBufferPool* m_pBufferPool;
+        MappedFile* m_pMappedFile;
+
+        // audio and video tracks of the file, in the order of the streams in the file
+        std::vector<AviTrack*> m_tracks;
+
+        DWORD m_audioChunksPerSample;
+
+        // load the index from a sidecar cache file, and write the cache after parsing
+        bool m_indexCacheEnabled;
+        LONGLONG m_duration;
+
+        // in file order mode the chunks are read in the order in which they are stored in
+        // the file, and the samples of the other tracks read along the way are held in the
+        // pending queues of those tracks
+        bool m_fileOrderReading;
+
+        // deliver only the keyframes of the video tracks and skip the audio - used for fast
+        // playback
+        bool m_keyframesOnly;
+
+        // in tail-follow mode the file is still being recorded - the tracks that reach the
+        // end of the data wait for more instead of ending, until the writer finalizes the
+        // file or it does not grow for longer than the idle timeout (0 waits forever)
+        bool m_tailFollow;
+        DWORD m_tailIdleTimeout;
+        DWORD m_lastGrowthTime;
+        bool m_tailTimedOut;
+};
@@ -0,0 +1,191 @@
+#include "StdAfx.h"
+#include "AviIndexCache.h"
+
+
+//
+// Load the index of the specified AVI file from its sidecar cache file.  Fails if there is
+// no cache, or if the AVI file changed since the cache was written.
+//
+HRESULT AviIndexCache::Load(const WCHAR* path, AviDemuxer* pDemuxer)
+{
+    HRESULT hr = S_OK;
+    WCHAR cachePath[MAX_PATH];
+    ULONGLONG fileTime = 0;
+    LARGE_INTEGER cacheSize;
+    HANDLE hCache = INVALID_HANDLE_VALUE;
+    HANDLE hMapping = NULL;
+    BYTE* pView = NULL;
+
+    do
+    {
+        BREAK_ON_NULL(pDemuxer, E_POINTER);
+
+        hr = GetCachePath(path, cachePath, MAX_PATH);
+        BREAK_ON_FAIL(hr);
+
+        hr = GetLastWriteTime(path, &fileTime);
+        BREAK_ON_FAIL(hr);
+
+        hCache = CreateFileW(cachePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, NULL);
+        if(hCache == INVALID_HANDLE_VALUE)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+
+        if(!GetFileSizeEx(hCache, &cacheSize))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+
+        if(cacheSize.QuadPart == 0 || cacheSize.HighPart != 0)
+        {
+            hr = AVI_E_INVALID_FORMAT;
+            break;
+        }
+
+        // map the cache into memory - the tables are copied straight out of the view
+        hMapping = CreateFileMapping(hCache, NULL, PAGE_READONLY, 0, 0, NULL);
+        BREAK_ON_NULL(hMapping, HRESULT_FROM_WIN32(GetLastError()));
+
+        pView = (BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+        BREAK_ON_NULL(pView, HRESULT_FROM_WIN32(GetLastError()));
+
+        // the demuxer validates the cache against the size and time of the AVI file
+        hr = pDemuxer->LoadIndex(fileTime, pView, (size_t)cacheSize.QuadPart);
+    }
+    while(false);
+
+    if(pView != NULL)
+    {
+        UnmapViewOfFile(pView);
+    }
+
+    if(hMapping != NULL)
+    {
+        CloseHandle(hMapping);
+    }
+
+    if(hCache != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hCache);
+    }
+
+    return hr;
+}
+
+
+//
+// Write the index built by the demuxer into the sidecar cache file.  The cache is written
+// into a temporary file first and then renamed, so that a reader never sees a partially
+// written cache.
+//
+HRESULT AviIndexCache::Save(const WCHAR* path, const AviDemuxer* pDemuxer)
+{
+    HRESULT hr = S_OK;
+    WCHAR cachePath[MAX_PATH];
+    WCHAR tempPath[MAX_PATH];
+    ULONGLONG fileTime = 0;
+    std::vector<BYTE> cache;
+    DWORD cbWritten = 0;
+    HANDLE hCache = INVALID_HANDLE_VALUE;
+
+    do
+    {
+        BREAK_ON_NULL(pDemuxer, E_POINTER);
+
+        hr = GetCachePath(path, cachePath, MAX_PATH);
+        BREAK_ON_FAIL(hr);
+
+        // the cache path leaves room for the extension of the temporary file
+        wcscpy_s(tempPath, MAX_PATH, cachePath);
+        wcscat_s(tempPath, MAX_PATH, L".tmp");
+
+        hr = GetLastWriteTime(path, &fileTime);
+        BREAK_ON_FAIL(hr);
+
+        hr = pDemuxer->SaveIndex(fileTime, &cache);
+        BREAK_ON_FAIL(hr);
+
+        hCache = CreateFileW(tempPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 
+            FILE_ATTRIBUTE_NORMAL, NULL);
+        if(hCache == INVALID_HANDLE_VALUE)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+
+        if(!WriteFile(hCache, &cache[0], (DWORD)cache.size(), &cbWritten, NULL) ||
+            cbWritten != cache.size())
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+
+        CloseHandle(hCache);
+        hCache = INVALID_HANDLE_VALUE;
+
+        if(!MoveFileExW(tempPath, cachePath, MOVEFILE_REPLACE_EXISTING))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+    }
+    while(false);
+
+    if(hCache != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hCache);
+    }
+
+    if(FAILED(hr) && cache.size() > 0)
+    {
+        DeleteFileW(tempPath);
+    }
+
+    return hr;
+}
+
+
+//
+// Get the path of the sidecar cache file of the specified AVI file
+//
+HRESULT AviIndexCache::GetCachePath(const WCHAR* path, WCHAR* pCachePath, size_t cchCachePath)
+{
+    if(path == NULL || pCachePath == NULL)
+    {
+        return E_POINTER;
+    }
+
+    // make sure that there is also room for the extension of the temporary file
+    if(wcslen(path) + wcslen(AVI_INDEX_CACHE_EXTENSION) + wcslen(L".tmp") >= cchCachePath)
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILENAME_EXCED_RANGE);
+    }
+
+    wcscpy_s(pCachePath, cchCachePath, path);
+    wcscat_s(pCachePath, cchCachePath, AVI_INDEX_CACHE_EXTENSION);
+
+    return S_OK;
+}
+
+
+//
+// Get the last write time of the specified file
+//
+HRESULT AviIndexCache::GetLastWriteTime(const WCHAR* path, ULONGLONG* pFileTime)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+    if(!GetFileAttributesExW(path, GetFileExInfoStandard, &attributes))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    *pFileTime = ((ULONGLONG)attributes.ftLastWriteTime.dwHighDateTime << 32) | 
+        attributes.ftLastWriteTime.dwLowDateTime;
+
+    return S_OK;
+}
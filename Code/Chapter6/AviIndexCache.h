@@ -0,0 +1,24 @@
+#pragma once
+
+#include "AviDemuxer.h"
+
+
+// extension appended to the name of the AVI file to get the name of its index cache
+#define AVI_INDEX_CACHE_EXTENSION   L".avfidx"
+
+
+//
+// Persistent index cache stored in a sidecar file next to the AVI file.  The cache holds
+// the headers, sample index and keyframe tables built by AviDemuxer, and is tagged with the
+// size and last write time of the AVI file, so that a stale cache is never used.
+//
+class AviIndexCache
+{
+    public:
+        static HRESULT Load(const WCHAR* path, AviDemuxer* pDemuxer);
+        static HRESULT Save(const WCHAR* path, const AviDemuxer* pDemuxer);
+
+    private:
+        static HRESULT GetCachePath(const WCHAR* path, WCHAR* pCachePath, size_t cchCachePath);
+        static HRESULT GetLastWriteTime(const WCHAR* path, ULONGLONG* pFileTime);
+};
@@ -0,0 +1,234 @@
+#include "AviProbe.h"
+
+#include <new>
+#include <string.h>
+
+
+//
+// Get the basic properties of the specified AVI file from its headers
+//
+HRESULT AviProbe::ProbeFile(const WCHAR* path, AviProbeInfo* pInfo)
+{
+    HRESULT hr = S_OK;
+    AviFileReader* pReader = NULL;
+    AviDemuxer* pDemuxer = NULL;
+
+    do
+    {
+        BREAK_ON_NULL(path, E_POINTER);
+        BREAK_ON_NULL(pInfo, E_POINTER);
+
+        memset(pInfo, 0, sizeof(AviProbeInfo));
+
+        hr = AviFileReader::CreateInstance(path, &pReader);
+        BREAK_ON_FAIL(hr);
+
+        pDemuxer = new (std::nothrow) AviDemuxer(pReader);
+        BREAK_ON_NULL(pDemuxer, E_OUTOFMEMORY);
+
+        // read only the header list - the movie data and the index are never touched
+        hr = pDemuxer->ParseHeaders();
+        BREAK_ON_FAIL(hr);
+
+        GetInfo(*pDemuxer, pInfo);
+    }
+    while(false);
+
+    if(pDemuxer != NULL)
+    {
+        delete pDemuxer;
+    }
+
+    if(pReader != NULL)
+    {
+        delete pReader;
+    }
+
+    return hr;
+}
+
+
+//
+// Probe a list of files, several of them at a time.  The result of each probe is stored
+// in the matching entry of pResults - the function itself fails only if the batch could
+// not be processed at all.
+//
+HRESULT AviProbe::ProbeFiles(const WCHAR* const* paths, DWORD fileCount, 
+    DWORD parallelFiles, AviProbeInfo* pInfos, HRESULT* pResults)
+{
+    HRESULT hr = S_OK;
+    ProbeBatch batch;
+
+    do
+    {
+        BREAK_ON_NULL(paths, E_POINTER);
+        BREAK_ON_NULL(pInfos, E_POINTER);
+        BREAK_ON_NULL(pResults, E_POINTER);
+
+        if(parallelFiles == 0)
+        {
+            parallelFiles = AVI_PROBE_DEFAULT_PARALLEL_FILES;
+        }
+
+        if(parallelFiles > fileCount)
+        {
+            parallelFiles = fileCount;
+        }
+
+        batch.paths = paths;
+        batch.pInfos = pInfos;
+        batch.pResults = pResults;
+        batch.fileCount = fileCount;
+        batch.nextFile = 0;
+
+#ifdef _WIN32
+        // the calling thread is one of the workers - the rest run on the system thread pool
+        batch.workerCount = 1;
+        batch.hDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+        BREAK_ON_NULL(batch.hDone, HRESULT_FROM_WIN32(GetLastError()));
+
+        for(DWORD x = 1; x < parallelFiles; x++)
+        {
+            InterlockedIncrement(&batch.workerCount);
+
+            // if the thread pool refuses the work item, the remaining workers will just
+            // have to probe more files each
+            if(!QueueUserWorkItem(ProbeWorker, &batch, WT_EXECUTELONGFUNCTION))
+            {
+                InterlockedDecrement(&batch.workerCount);
+                break;
+            }
+        }
+
+        ProbeWorker(&batch);
+
+        // wait until the pool workers are done with the batch before it goes away
+        WaitForSingleObject(batch.hDone, INFINITE);
+        CloseHandle(batch.hDone);
+#else
+        // without a thread pool just probe the files one at a time
+        batch.workerCount = 1;
+        ProbeBatchFiles(&batch);
+#endif
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Keep probing the files of a batch until all of them have been claimed by the workers
+//
+void AviProbe::ProbeBatchFiles(ProbeBatch* pBatch)
+{
+    while(true)
+    {
+#ifdef _WIN32
+        long file = InterlockedIncrement(&pBatch->nextFile) - 1;
+#else
+        long file = pBatch->nextFile++;
+#endif
+
+        if(file >= (long)pBatch->fileCount)
+        {
+            break;
+        }
+
+        pBatch->pResults[file] = ProbeFile(pBatch->paths[file], &pBatch->pInfos[file]);
+    }
+}
+
+
+#ifdef _WIN32
+
+//
+// Thread pool callback probing the files of a batch
+//
+DWORD WINAPI AviProbe::ProbeWorker(void* pContext)
+{
+    ProbeBatch* pBatch = (ProbeBatch*)pContext;
+
+    ProbeBatchFiles(pBatch);
+
+    // the last worker to finish releases the caller
+    if(InterlockedDecrement(&pBatch->workerCount) == 0)
+    {
+        SetEvent(pBatch->hDone);
+    }
+
+    return 0;
+}
+
+#endif
+
+
+//
+// Fill in the probe information from the parsed headers
+//
+void AviProbe::GetInfo(const AviDemuxer& demuxer, AviProbeInfo* pInfo)
+{
+    pInfo->streamCount = demuxer.StreamCount();
+
+    for(DWORD x = 0; x < demuxer.StreamCount(); x++)
+    {
+        const AviStream* pStream = demuxer.GetStream(x);
+        LONGLONG duration = StreamDuration(demuxer, *pStream);
+
+        if(duration > pInfo->duration)
+        {
+            pInfo->duration = duration;
+        }
+
+        if(pStream->IsVideo())
+        {
+            if(pInfo->videoStreamCount++ == 0 && pStream->format.size() >= sizeof(AviVideoFormat))
+            {
+                const AviVideoFormat* pFormat = (const AviVideoFormat*)&pStream->format[0];
+
+                pInfo->videoCodec = pFormat->biCompression;
+                pInfo->width = pFormat->biWidth;
+                pInfo->height = pFormat->biHeight < 0 ? -pFormat->biHeight : pFormat->biHeight;
+                pInfo->frameRateNumerator = pStream->header.dwRate;
+                pInfo->frameRateDenominator = pStream->header.dwScale;
+            }
+        }
+        else if(pStream->IsAudio())
+        {
+            if(pInfo->audioStreamCount++ == 0 && pStream->format.size() >= sizeof(AviAudioFormat))
+            {
+                const AviAudioFormat* pFormat = (const AviAudioFormat*)&pStream->format[0];
+
+                pInfo->audioFormatTag = pFormat->wFormatTag;
+                pInfo->audioChannels = pFormat->nChannels;
+                pInfo->audioSampleRate = pFormat->nSamplesPerSec;
+            }
+        }
+    }
+}
+
+
+//
+// Figure out the duration of a stream from its headers.  The OpenDML super index knows the
+// number of ticks in every RIFF chunk of the file, while the stream header only counts the
+// first RIFF chunk - for video the OpenDML header also has the frame count of the whole file.
+//
+LONGLONG AviProbe::StreamDuration(const AviDemuxer& demuxer, const AviStream& stream)
+{
+    ULONGLONG length = stream.header.dwLength;
+
+    if(!stream.superIndex.empty())
+    {
+        length = 0;
+        for(size_t x = 0; x < stream.superIndex.size(); x++)
+        {
+            length += stream.superIndex[x].dwDuration;
+        }
+    }
+    else if(stream.IsVideo() && demuxer.TotalFrames() > length)
+    {
+        length = demuxer.TotalFrames();
+    }
+
+    return stream.SampleTime(length) - stream.SampleTime(0);
+}
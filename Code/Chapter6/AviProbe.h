@@ -0,0 +1,68 @@
+#pragma once
+
+#include "AviDefs.h"
+#include "AviReader.h"
+#include "AviDemuxer.h"
+
+
+// number of files probed at the same time if the caller does not specify it - probing is
+// bound by the latency of the storage, so this is not tied to the number of processors
+#define AVI_PROBE_DEFAULT_PARALLEL_FILES    8
+
+
+// Basic properties of an AVI file, gathered from its headers only
+struct AviProbeInfo
+{
+    LONGLONG duration;          // duration of the longest stream in 100 ns units
+    DWORD streamCount;          // number of streams of any type
+    DWORD videoStreamCount;     // number of video streams
+    DWORD audioStreamCount;     // number of audio streams
+
+    // properties of the first video stream
+    DWORD videoCodec;           // FourCC of the video compression, 0 for uncompressed RGB
+    LONG width;                 // frame width in pixels
+    LONG height;                // frame height in pixels
+    DWORD frameRateNumerator;   // frame rate - dwRate of the stream header
+    DWORD frameRateDenominator; // frame rate - dwScale of the stream header
+
+    // properties of the first audio stream
+    WORD audioFormatTag;        // WAVE_FORMAT_* tag of the audio format
+    WORD audioChannels;         // number of channels
+    DWORD audioSampleRate;      // number of samples per second
+};
+
+
+//
+// Lightweight probe that reads only the header list of an AVI file.  No sample index,
+// media types or streams are created, so probing costs a few small reads per file.  Many
+// files can be probed in parallel, which hides the latency of slow or remote storage.
+//
+class AviProbe
+{
+    public:
+        static HRESULT ProbeFile(const WCHAR* path, AviProbeInfo* pInfo);
+        static HRESULT ProbeFiles(const WCHAR* const* paths, DWORD fileCount, 
+            DWORD parallelFiles, AviProbeInfo* pInfos, HRESULT* pResults);
+
+    private:
+        // state shared by the workers probing a batch of files
+        struct ProbeBatch
+        {
+            const WCHAR* const* paths;
+            AviProbeInfo* pInfos;
+            HRESULT* pResults;
+            DWORD fileCount;
+            volatile long nextFile;     // index of the next file to be probed
+            volatile long workerCount;  // number of workers still running
+#ifdef _WIN32
+            HANDLE hDone;               // signaled when the last worker is done
+#endif
+        };
+
+        static void GetInfo(const AviDemuxer& demuxer, AviProbeInfo* pInfo);
+        static LONGLONG StreamDuration(const AviDemuxer& demuxer, const AviStream& stream);
+        static void ProbeBatchFiles(ProbeBatch* pBatch);
+#ifdef _WIN32
+        static DWORD WINAPI ProbeWorker(void* pContext);
+#endif
+};
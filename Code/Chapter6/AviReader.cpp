@@ -0,0 +1,377 @@
+#include "AviReader.h"
+
+#include <new>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <vector>
+#endif
+
+
+//
+// Create a reader for the specified local file
+//
+HRESULT AviFileReader::CreateInstance(const WCHAR* path, AviFileReader** ppReader)
+{
+    HRESULT hr = S_OK;
+    AviFileReader* pReader = NULL;
+
+    do
+    {
+        BREAK_ON_NULL(path, E_POINTER);
+        BREAK_ON_NULL(ppReader, E_POINTER);
+
+        pReader = new (std::nothrow) AviFileReader();
+        BREAK_ON_NULL(pReader, E_OUTOFMEMORY);
+
+        hr = pReader->Open(path);
+        BREAK_ON_FAIL(hr);
+
+        *ppReader = pReader;
+    }
+    while(false);
+
+    if(FAILED(hr) && pReader != NULL)
+    {
+        delete pReader;
+    }
+
+    return hr;
+}
+
+
+#ifdef _WIN32
+
+AviFileReader::AviFileReader(void) :
+    m_hFile(INVALID_HANDLE_VALUE)
+{
+}
+
+
+AviFileReader::~AviFileReader(void)
+{
+    if(m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+    }
+}
+
+
+//
+// Open the file for reading - allow other processes to keep writing to it
+//
+HRESULT AviFileReader::Open(const WCHAR* path)
+{
+    m_hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if(m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return S_OK;
+}
+
+
+//
+// Read data at the specified offset - the offset is passed in with the OVERLAPPED
+// structure, so the call does not depend on the current file pointer
+//
+HRESULT AviFileReader::ReadAt(ULONGLONG offset, BYTE* pBuffer, DWORD cbToRead, DWORD* pcbRead)
+{
+    HRESULT hr = S_OK;
+    DWORD totalRead = 0;
+
+    do
+    {
+        BREAK_ON_NULL(pBuffer, E_POINTER);
+        BREAK_ON_NULL(pcbRead, E_POINTER);
+
+        // ReadFile may return fewer bytes than requested - loop until we get all of the
+        // data or hit the end of the file
+        while(totalRead < cbToRead)
+        {
+            OVERLAPPED overlapped = {};
+            DWORD cbRead = 0;
+            ULONGLONG position = offset + totalRead;
+
+            overlapped.Offset = (DWORD)(position & 0xFFFFFFFF);
+            overlapped.OffsetHigh = (DWORD)(position >> 32);
+
+            if(!ReadFile(m_hFile, pBuffer + totalRead, cbToRead - totalRead, &cbRead,
+                &overlapped))
+            {
+                DWORD error = GetLastError();
+                if(error != ERROR_HANDLE_EOF)
+                {
+                    hr = HRESULT_FROM_WIN32(error);
+                }
+                break;
+            }
+
+            // zero bytes means that we reached the end of the file
+            if(cbRead == 0)
+            {
+                break;
+            }
+
+            totalRead += cbRead;
+        }
+
+        *pcbRead = totalRead;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Get the current size of the file
+//
+HRESULT AviFileReader::GetSize(ULONGLONG* pSize)
+{
+    LARGE_INTEGER size;
+
+    if(pSize == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if(!GetFileSizeEx(m_hFile, &size))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    *pSize = (ULONGLONG)size.QuadPart;
+
+    return S_OK;
+}
+
+#else
+
+AviFileReader::AviFileReader(void) :
+    m_file(-1)
+{
+}
+
+
+AviFileReader::~AviFileReader(void)
+{
+    if(m_file >= 0)
+    {
+        close(m_file);
+    }
+}
+
+
+//
+// Open the file for reading - the wide character path is converted to the multibyte
+// encoding of the current locale
+//
+HRESULT AviFileReader::Open(const WCHAR* path)
+{
+    size_t length = wcstombs(NULL, path, 0);
+    if(length == (size_t)-1)
+    {
+        return E_INVALIDARG;
+    }
+
+    std::vector<char> narrowPath(length + 1);
+    wcstombs(&narrowPath[0], path, length + 1);
+
+    m_file = open(&narrowPath[0], O_RDONLY);
+    if(m_file < 0)
+    {
+        return E_FAIL;
+    }
+
+    return S_OK;
+}
+
+
+//
+// Read data at the specified offset without moving the file pointer
+//
+HRESULT AviFileReader::ReadAt(ULONGLONG offset, BYTE* pBuffer, DWORD cbToRead, DWORD* pcbRead)
+{
+    HRESULT hr = S_OK;
+    DWORD totalRead = 0;
+
+    do
+    {
+        BREAK_ON_NULL(pBuffer, E_POINTER);
+        BREAK_ON_NULL(pcbRead, E_POINTER);
+
+        while(totalRead < cbToRead)
+        {
+            ssize_t cbRead = pread(m_file, pBuffer + totalRead, cbToRead - totalRead,
+                (off_t)(offset + totalRead));
+
+            if(cbRead < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+
+                hr = E_FAIL;
+                break;
+            }
+
+            // zero bytes means that we reached the end of the file
+            if(cbRead == 0)
+            {
+                break;
+            }
+
+            totalRead += (DWORD)cbRead;
+        }
+
+        *pcbRead = totalRead;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Get the current size of the file
+//
+HRESULT AviFileReader::GetSize(ULONGLONG* pSize)
+{
+    struct stat fileInfo;
+
+    if(pSize == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if(fstat(m_file, &fileInfo) != 0)
+    {
+        return E_FAIL;
+    }
+
+    *pSize = (ULONGLONG)fileInfo.st_size;
+
+    return S_OK;
+}
+
+#endif
+
+
+
+//
+// Create a reader over a copy of the specified data - the data may be empty, and added
+// later with Append()
+//
+HRESULT AviMemoryReader::CreateInstance(const BYTE* pData, size_t cbData, 
+    AviMemoryReader** ppReader)
+{
+    HRESULT hr = S_OK;
+    AviMemoryReader* pReader = NULL;
+
+    do
+    {
+        BREAK_ON_NULL(ppReader, E_POINTER);
+
+        pReader = new (std::nothrow) AviMemoryReader();
+        BREAK_ON_NULL(pReader, E_OUTOFMEMORY);
+
+        hr = pReader->Append(pData, cbData);
+        BREAK_ON_FAIL(hr);
+
+        *ppReader = pReader;
+    }
+    while(false);
+
+    if(FAILED(hr) && pReader != NULL)
+    {
+        delete pReader;
+    }
+
+    return hr;
+}
+
+
+//
+// Add data to the end of the file held in memory - fails with AVI_E_TOO_LARGE, without
+// adding anything, if the data would go past the limit
+//
+HRESULT AviMemoryReader::Append(const BYTE* pData, size_t cbData)
+{
+    if(cbData == 0)
+    {
+        return S_OK;
+    }
+
+    if(pData == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if(m_maxSize != 0 && m_data.size() + (ULONGLONG)cbData > m_maxSize)
+    {
+        return AVI_E_TOO_LARGE;
+    }
+
+    // the vector throws if it runs out of memory - convert that into an error
+    try
+    {
+        m_data.insert(m_data.end(), pData, pData + cbData);
+    }
+    catch(...)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    return S_OK;
+}
+
+
+//
+// Copy data at the specified offset out of memory
+//
+HRESULT AviMemoryReader::ReadAt(ULONGLONG offset, BYTE* pBuffer, DWORD cbToRead, 
+    DWORD* pcbRead)
+{
+    if(pBuffer == NULL || pcbRead == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *pcbRead = 0;
+
+    if(offset < m_data.size())
+    {
+        ULONGLONG available = m_data.size() - offset;
+
+        *pcbRead = (available < cbToRead) ? (DWORD)available : cbToRead;
+        memcpy(pBuffer, &m_data[(size_t)offset], *pcbRead);
+    }
+
+    return S_OK;
+}
+
+
+//
+// Get the number of bytes held in memory
+//
+HRESULT AviMemoryReader::GetSize(ULONGLONG* pSize)
+{
+    if(pSize == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *pSize = m_data.size();
+
+    return S_OK;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "AviDefs.h"
+
+#include <vector>
+
+
+//
+// Abstract random-access reader used by the native AVI parser to get at the bytes of
+// the file.  Reads are positional, so the parser never depends on a shared file pointer.
+//
+class AviReader
+{
+    public:
+        virtual ~AviReader(void) {};
+
+        // Read up to cbToRead bytes at the specified offset - fewer bytes are returned
+        // only at the end of the data.
+        virtual HRESULT ReadAt(ULONGLONG offset, BYTE* pBuffer, DWORD cbToRead,
+            DWORD* pcbRead) = 0;
+
+        // Get the total number of bytes available to the reader
+        virtual HRESULT GetSize(ULONGLONG* pSize) = 0;
+};
+
+
+//
+// AviReader implementation that reads a file on the local file system.
+//
+class AviFileReader : public AviReader
+{
+    public:
+        static HRESULT CreateInstance(const WCHAR* path, AviFileReader** ppReader);
+
+        ~AviFileReader(void);
+
+        // AviReader interface implementation
+        HRESULT ReadAt(ULONGLONG offset, BYTE* pBuffer, DWORD cbToRead, DWORD* pcbRead);
+        HRESULT GetSize(ULONGLONG* pSize);
+
+    protected:
+        AviFileReader(void);
+        HRESULT Open(const WCHAR* path);
+
+    private:
+#ifdef _WIN32
+        HANDLE m_hFile;
+#else
+        int m_file;
+#endif
+};
+
+
+//
+// AviReader implementation that reads a copy of the file held in memory.  The data can be
+// passed in all at once, or appended piece by piece - for example while a stream that
+// cannot seek is read to its end.  An optional limit caps the memory used by the copy.
+//
+class AviMemoryReader : public AviReader
+{
+    public:
+        static HRESULT CreateInstance(const BYTE* pData, size_t cbData, 
+            AviMemoryReader** ppReader);
+
+        // Limit the number of bytes held in memory - 0 for no limit
+        void SetMaxSize(ULONGLONG maxSize)          { m_maxSize = maxSize; };
+        HRESULT Append(const BYTE* pData, size_t cbData);
+
+        // AviReader interface implementation
+        HRESULT ReadAt(ULONGLONG offset, BYTE* pBuffer, DWORD cbToRead, DWORD* pcbRead);
+        HRESULT GetSize(ULONGLONG* pSize);
+
+    protected:
+        AviMemoryReader(void) : m_maxSize(0) {};
+
+    private:
+        std::vector<BYTE> m_data;
+        ULONGLONG m_maxSize;
+};
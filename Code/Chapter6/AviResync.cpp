@@ -0,0 +1,118 @@
+#include "AviResync.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define AVI_RESYNC_SSE2
+#include <emmintrin.h>
+#endif
+
+
+//
+// Check a single position for a chunk FourCC - two hexadecimal digits followed by 'dc',
+// 'db' or 'wb', or 'LIST'
+//
+static bool IsChunkCandidate(const BYTE* p)
+{
+    if(p[0] == 'L' && p[1] == 'I' && p[2] == 'S' && p[3] == 'T')
+    {
+        return true;
+    }
+
+    if(AviHexDigitValue(p[0]) == 0xFF || AviHexDigitValue(p[1]) == 0xFF)
+    {
+        return false;
+    }
+
+    return (p[2] == 'd' && (p[3] == 'c' || p[3] == 'b')) || (p[2] == 'w' && p[3] == 'b');
+}
+
+
+#ifdef AVI_RESYNC_SSE2
+
+//
+// Get a mask of the bytes of the vector that are hexadecimal digits
+//
+static __m128i HexDigitMask(__m128i bytes)
+{
+    __m128i digitOffset = _mm_sub_epi8(bytes, _mm_set1_epi8('0'));
+
+    // setting bit 5 turns 'A'-'F' into 'a'-'f', and leaves 'a'-'f' as they are
+    __m128i letterOffset = _mm_sub_epi8(_mm_or_si128(bytes, _mm_set1_epi8(0x20)),
+        _mm_set1_epi8('a'));
+
+    // unsigned offset <= 9 or <= 5 - bytes below '0' or 'a' wrap around to large values
+    return _mm_or_si128(
+        _mm_cmpeq_epi8(_mm_min_epu8(digitOffset, _mm_set1_epi8(9)), digitOffset),
+        _mm_cmpeq_epi8(_mm_min_epu8(letterOffset, _mm_set1_epi8(5)), letterOffset));
+}
+
+#endif
+
+
+size_t AviFindChunkCandidate(const BYTE* pData, size_t cbData)
+{
+    size_t position = 0;
+
+    if(pData == NULL || cbData < sizeof(DWORD))
+    {
+        return cbData;
+    }
+
+#ifdef AVI_RESYNC_SSE2
+    // Test 16 consecutive positions at once.  Each of the four loads holds byte n of the
+    // FourCC for all 16 positions, so the loads read up to position + 19, which must still
+    // be inside of the block.
+    const __m128i charD = _mm_set1_epi8('d');
+    const __m128i charW = _mm_set1_epi8('w');
+    const __m128i charC = _mm_set1_epi8('c');
+    const __m128i charB = _mm_set1_epi8('b');
+    const __m128i charL = _mm_set1_epi8('L');
+    const __m128i charI = _mm_set1_epi8('I');
+    const __m128i charS = _mm_set1_epi8('S');
+    const __m128i charT = _mm_set1_epi8('T');
+
+    for(; position + 16 + sizeof(DWORD) - 1 <= cbData; position += 16)
+    {
+        __m128i byte0 = _mm_loadu_si128((const __m128i*)(pData + position));
+        __m128i byte1 = _mm_loadu_si128((const __m128i*)(pData + position + 1));
+        __m128i byte2 = _mm_loadu_si128((const __m128i*)(pData + position + 2));
+        __m128i byte3 = _mm_loadu_si128((const __m128i*)(pData + position + 3));
+
+        // '##dc', '##db' and '##wb'
+        __m128i type = _mm_or_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(byte2, charD),
+                _mm_or_si128(_mm_cmpeq_epi8(byte3, charC), _mm_cmpeq_epi8(byte3, charB))),
+            _mm_and_si128(_mm_cmpeq_epi8(byte2, charW), _mm_cmpeq_epi8(byte3, charB)));
+        __m128i dataChunk = _mm_and_si128(type,
+            _mm_and_si128(HexDigitMask(byte0), HexDigitMask(byte1)));
+
+        // 'LIST'
+        __m128i list = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(byte0, charL), _mm_cmpeq_epi8(byte1, charI)),
+            _mm_and_si128(_mm_cmpeq_epi8(byte2, charS), _mm_cmpeq_epi8(byte3, charT)));
+
+        int mask = _mm_movemask_epi8(_mm_or_si128(dataChunk, list));
+        if(mask != 0)
+        {
+            // the lowest set bit is the first candidate
+            size_t first = 0;
+            while((mask & (1 << first)) == 0)
+            {
+                first++;
+            }
+
+            return position + first;
+        }
+    }
+#endif
+
+    // the tail of the block, or the whole block without SSE2
+    for(; position + sizeof(DWORD) <= cbData; position++)
+    {
+        if(IsChunkCandidate(pData + position))
+        {
+            return position;
+        }
+    }
+
+    return cbData;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "AviDefs.h"
+
+
+//
+// Search a block of movie data for the first position that may hold the header of a data
+// chunk ('##dc', '##db' or '##wb', with a hexadecimal stream number) or of a 'LIST'.  Used to resynchronize with the chunk
+// structure after a damaged chunk header.  Only the FourCC is matched - the caller has to
+// check the size and the stream number of every candidate.  Returns the offset of the
+// candidate in the block, or cbData if there is none.  Every candidate has at least a full
+// FourCC available in the block.
+//
+// The search compares 16 positions at a time with SSE2 where it is available, so that
+// multi-gigabyte files can be scanned at close to memory speed.
+//
+size_t AviFindChunkCandidate(const BYTE* pData, size_t cbData);
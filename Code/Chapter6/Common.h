@@ -1,11 +1,68 @@
-#pragma once
-
-enum SourceState
-{
-    SourceStateUninitialized,
-    SourceStateOpening,
-    SourceStateStopped,
-    SourceStatePaused,
-    SourceStateStarted,
-    SourceStateShutdown
-};
+#pragma once
+
+enum SourceState
+{
+    SourceStateUninitialized,
+    SourceStateOpening,
+    SourceStateStopped,
+    SourceStatePaused,
+    SourceStateStarted,
+    SourceStateShutdown
+};
+
+
+//
+// Configuration properties that can be passed to the source in the IPropertyStore
+// parameter of IMFByteStreamHandler::BeginCreateObject() or IMFSourceResolver methods.
+// {8F1C2E6A-3B7D-4E59-A1C4-5D2E9B0F7A31}
+//
+
+// VT_BOOL - read samples ahead of time on a background work queue.  Default: off.
+const PROPERTYKEY AVFPKEY_PrefetchEnabled = 
+    { { 0x8f1c2e6a, 0x3b7d, 0x4e59, { 0xa1, 0xc4, 0x5d, 0x2e, 0x9b, 0xf, 0x7a, 0x31 } }, 1 };
+
+// VT_UI4 - maximum number of bytes read ahead for each stream.  Default: 8 MB.
+const PROPERTYKEY AVFPKEY_PrefetchBufferBytes = 
+    { { 0x8f1c2e6a, 0x3b7d, 0x4e59, { 0xa1, 0xc4, 0x5d, 0x2e, 0x9b, 0xf, 0x7a, 0x31 } }, 2 };
+
+// VT_BOOL - read the data chunks in the order in which they are stored in the file, instead
+// of reading each stream separately.  Default: off.
+const PROPERTYKEY AVFPKEY_FileOrderReading = 
+    { { 0x8f1c2e6a, 0x3b7d, 0x4e59, { 0xa1, 0xc4, 0x5d, 0x2e, 0x9b, 0xf, 0x7a, 0x31 } }, 3 };
+
+// VT_UI4 - number of audio data chunks delivered in each audio sample.  Default: 1.
+const PROPERTYKEY AVFPKEY_AudioChunksPerSample = 
+    { { 0x8f1c2e6a, 0x3b7d, 0x4e59, { 0xa1, 0xc4, 0x5d, 0x2e, 0x9b, 0xf, 0x7a, 0x31 } }, 4 };
+
+// VT_BOOL - load the file index from a sidecar cache file next to the AVI file, and create
+// the cache if it is missing or out of date.  Default: off.
+const PROPERTYKEY AVFPKEY_IndexCacheEnabled = 
+    { { 0x8f1c2e6a, 0x3b7d, 0x4e59, { 0xa1, 0xc4, 0x5d, 0x2e, 0x9b, 0xf, 0x7a, 0x31 } }, 5 };
+
+// VT_R4 - fastest playback rate supported without thinning.  Faster rates need thinned
+// playback, which delivers only the video keyframes and skips the audio.  Default: 4.0.
+const PROPERTYKEY AVFPKEY_ThinningRate = 
+    { { 0x8f1c2e6a, 0x3b7d, 0x4e59, { 0xa1, 0xc4, 0x5d, 0x2e, 0x9b, 0xf, 0x7a, 0x31 } }, 6 };
+
+// VT_BOOL - follow a file that is still being recorded: new data appended to the file is
+// picked up during playback, and the streams wait for it instead of ending.  Default: off.
+const PROPERTYKEY AVFPKEY_TailFollow = 
+    { { 0x8f1c2e6a, 0x3b7d, 0x4e59, { 0xa1, 0xc4, 0x5d, 0x2e, 0x9b, 0xf, 0x7a, 0x31 } }, 7 };
+
+// VT_UI4 - in tail-follow mode, number of milliseconds without new data after which the
+// recording is assumed to be over and the streams end.  Default: 0 - wait until the writer
+// finalizes the file.
+const PROPERTYKEY AVFPKEY_TailIdleTimeout = 
+    { { 0x8f1c2e6a, 0x3b7d, 0x4e59, { 0xa1, 0xc4, 0x5d, 0x2e, 0x9b, 0xf, 0x7a, 0x31 } }, 8 };
+
+// VT_UI4 - write the delivery statistics of every stream to the debugger output this often,
+// in milliseconds.  Default: 0 - never.  The statistics can also be queried at any time
+// through the IAVFSourceStatistics interface of the source.
+const PROPERTYKEY AVFPKEY_StatisticsDumpInterval = 
+    { { 0x8f1c2e6a, 0x3b7d, 0x4e59, { 0xa1, 0xc4, 0x5d, 0x2e, 0x9b, 0xf, 0x7a, 0x31 } }, 9 };
+
+// VT_UI8 - maximum number of bytes held in memory for a byte stream that cannot be read in
+// place, because it cannot seek or does not know its length.  Opening a longer stream fails
+// with AVI_E_TOO_LARGE.  Default: 512 MB.
+const PROPERTYKEY AVFPKEY_ByteStreamMaxMemory = 
+    { { 0x8f1c2e6a, 0x3b7d, 0x4e59, { 0xa1, 0xc4, 0x5d, 0x2e, 0x9b, 0xf, 0x7a, 0x31 } }, 10 };
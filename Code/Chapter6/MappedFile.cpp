@@ -0,0 +1,395 @@
+#include "StdAfx.h"
+#include "MappedFile.h"
+
+
+MappedFileWindow::MappedFileWindow(BYTE* pView, ULONGLONG offset, DWORD cbView) :
+    m_cRef(1),
+    m_pView(pView),
+    m_offset(offset),
+    m_cbView(cbView)
+{
+}
+
+
+MappedFileWindow::~MappedFileWindow(void)
+{
+    UnmapViewOfFile(m_pView);
+}
+
+
+ULONG MappedFileWindow::AddRef(void)
+{
+    return InterlockedIncrement(&m_cRef);
+}
+
+
+ULONG MappedFileWindow::Release(void)
+{
+    ULONG refCount = InterlockedDecrement(&m_cRef);
+    if (refCount == 0)
+    {
+        delete this;
+    }
+    
+    return refCount;
+}
+
+
+
+
+//
+// Map the specified file into memory
+//
+HRESULT MappedFile::CreateInstance(const WCHAR* path, MappedFile** ppMappedFile)
+{
+    HRESULT hr = S_OK;
+    MappedFile* pMappedFile = NULL;
+
+    do
+    {
+        BREAK_ON_NULL(path, E_POINTER);
+        BREAK_ON_NULL(ppMappedFile, E_POINTER);
+
+        pMappedFile = new (std::nothrow) MappedFile();
+        BREAK_ON_NULL(pMappedFile, E_OUTOFMEMORY);
+
+        hr = pMappedFile->Open(path);
+        BREAK_ON_FAIL(hr);
+
+        *ppMappedFile = pMappedFile;
+    }
+    while(false);
+
+    if(FAILED(hr) && pMappedFile != NULL)
+    {
+        pMappedFile->Release();
+    }
+
+    return hr;
+}
+
+
+MappedFile::MappedFile(void) :
+    m_cRef(1),
+    m_hFile(INVALID_HANDLE_VALUE),
+    m_hMapping(NULL),
+    m_fileSize(0),
+    m_allocationGranularity(0),
+    m_pWindow(NULL)
+{
+    SYSTEM_INFO systemInfo;
+
+    // views of the file must start at a multiple of the allocation granularity
+    GetSystemInfo(&systemInfo);
+    m_allocationGranularity = systemInfo.dwAllocationGranularity;
+}
+
+
+//
+// Release the file - the views still used by media buffers stay mapped until the buffers
+// are released, since a view keeps the mapping object alive on its own
+//
+MappedFile::~MappedFile(void)
+{
+    if(m_pWindow != NULL)
+    {
+        m_pWindow->Release();
+    }
+
+    if(m_hMapping != NULL)
+    {
+        CloseHandle(m_hMapping);
+    }
+
+    if(m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+    }
+}
+
+
+ULONG MappedFile::AddRef(void)
+{
+    return InterlockedIncrement(&m_cRef);
+}
+
+
+ULONG MappedFile::Release(void)
+{
+    ULONG refCount = InterlockedDecrement(&m_cRef);
+    if (refCount == 0)
+    {
+        delete this;
+    }
+    
+    return refCount;
+}
+
+
+//
+// Open the file and create a copy-on-write mapping object for it
+//
+HRESULT MappedFile::Open(const WCHAR* path)
+{
+    HRESULT hr = S_OK;
+    LARGE_INTEGER fileSize;
+
+    do
+    {
+        m_hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(m_hFile == INVALID_HANDLE_VALUE)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+
+        if(!GetFileSizeEx(m_hFile, &fileSize))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+
+        // an empty file cannot be mapped
+        if(fileSize.QuadPart == 0)
+        {
+            hr = E_FAIL;
+            break;
+        }
+
+        m_fileSize = (ULONGLONG)fileSize.QuadPart;
+
+        // the mapping covers the file as it is right now - chunks appended to the file
+        // later are not visible through it
+        m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        BREAK_ON_NULL(m_hMapping, HRESULT_FROM_WIN32(GetLastError()));
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Get a media buffer pointing at the specified data in the file
+//
+HRESULT MappedFile::GetBuffer(ULONGLONG offset, DWORD cbData, IMFMediaBuffer** ppBuffer)
+{
+    HRESULT hr = S_OK;
+    MappedMediaBuffer* pBuffer = NULL;
+
+    do
+    {
+        BREAK_ON_NULL(ppBuffer, E_POINTER);
+
+        if(offset + cbData > m_fileSize)
+        {
+            hr = MF_E_INVALIDREQUEST;
+            break;
+        }
+
+        // map a new view if the data is not in the current one
+        if(m_pWindow == NULL || !m_pWindow->Contains(offset, cbData))
+        {
+            hr = MapWindow(offset, cbData);
+            BREAK_ON_FAIL(hr);
+        }
+
+        pBuffer = new (std::nothrow) MappedMediaBuffer(m_pWindow, 
+            m_pWindow->GetPointer(offset), cbData);
+        BREAK_ON_NULL(pBuffer, E_OUTOFMEMORY);
+
+        *ppBuffer = pBuffer;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Map a view of the file that starts at or before the specified offset, and covers at least
+// cbData bytes after it
+//
+HRESULT MappedFile::MapWindow(ULONGLONG offset, DWORD cbData)
+{
+    HRESULT hr = S_OK;
+    ULONGLONG viewOffset = offset - (offset % m_allocationGranularity);
+    ULONGLONG viewSize = MAPPED_FILE_WINDOW_SIZE;
+    BYTE* pView = NULL;
+    MappedFileWindow* pWindow = NULL;
+
+    do
+    {
+        // make the view large enough for the data, but do not go past the end of the file
+        if(viewSize < (offset - viewOffset) + cbData)
+        {
+            viewSize = (offset - viewOffset) + cbData;
+        }
+
+        if(viewOffset + viewSize > m_fileSize)
+        {
+            viewSize = m_fileSize - viewOffset;
+        }
+
+        pView = (BYTE*)MapViewOfFile(m_hMapping, FILE_MAP_COPY, (DWORD)(viewOffset >> 32),
+            (DWORD)(viewOffset & 0xFFFFFFFF), (SIZE_T)viewSize);
+        BREAK_ON_NULL(pView, HRESULT_FROM_WIN32(GetLastError()));
+
+        pWindow = new (std::nothrow) MappedFileWindow(pView, viewOffset, (DWORD)viewSize);
+        if(pWindow == NULL)
+        {
+            UnmapViewOfFile(pView);
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        // replace the current view - buffers pointing into the old view keep it mapped
+        // until they are released
+        if(m_pWindow != NULL)
+        {
+            m_pWindow->Release();
+        }
+
+        m_pWindow = pWindow;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+
+
+MappedMediaBuffer::MappedMediaBuffer(MappedFileWindow* pWindow, BYTE* pData, DWORD cbData) :
+    m_cRef(1),
+    m_pWindow(pWindow),
+    m_pData(pData),
+    m_cbData(cbData),
+    m_cbCurrentLength(cbData)
+{
+    m_pWindow->AddRef();
+}
+
+
+MappedMediaBuffer::~MappedMediaBuffer(void)
+{
+    m_pWindow->Release();
+}
+
+
+//
+// IUnknown interface implementation
+//
+ULONG MappedMediaBuffer::AddRef()
+{
+    return InterlockedIncrement(&m_cRef);
+}
+
+ULONG MappedMediaBuffer::Release()
+{
+    ULONG refCount = InterlockedDecrement(&m_cRef);
+    if (refCount == 0)
+    {
+        delete this;
+    }
+    
+    return refCount;
+}
+
+HRESULT MappedMediaBuffer::QueryInterface(REFIID riid, void** ppv)
+{
+    HRESULT hr = S_OK;
+
+    if (ppv == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (riid == IID_IUnknown)
+    {
+        *ppv = static_cast<IUnknown*>(this);
+    }
+    else if (riid == IID_IMFMediaBuffer)
+    {
+        *ppv = static_cast<IMFMediaBuffer*>(this);
+    }
+    else
+    {
+        *ppv = NULL;
+        hr = E_NOINTERFACE;
+    }
+
+    if(SUCCEEDED(hr))
+        AddRef();
+
+    return hr;
+}
+
+
+//
+// IMFMediaBuffer interface implementation - the data is already in memory, so locking
+// the buffer just returns the pointer into the view
+//
+HRESULT MappedMediaBuffer::Lock(BYTE** ppbBuffer, DWORD* pcbMaxLength, DWORD* pcbCurrentLength)
+{
+    if (ppbBuffer == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *ppbBuffer = m_pData;
+
+    if (pcbMaxLength != NULL)
+    {
+        *pcbMaxLength = m_cbData;
+    }
+
+    if (pcbCurrentLength != NULL)
+    {
+        *pcbCurrentLength = m_cbCurrentLength;
+    }
+
+    return S_OK;
+}
+
+HRESULT MappedMediaBuffer::Unlock(void)
+{
+    return S_OK;
+}
+
+HRESULT MappedMediaBuffer::GetCurrentLength(DWORD* pcbCurrentLength)
+{
+    if (pcbCurrentLength == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *pcbCurrentLength = m_cbCurrentLength;
+
+    return S_OK;
+}
+
+HRESULT MappedMediaBuffer::SetCurrentLength(DWORD cbCurrentLength)
+{
+    if (cbCurrentLength > m_cbData)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_cbCurrentLength = cbCurrentLength;
+
+    return S_OK;
+}
+
+HRESULT MappedMediaBuffer::GetMaxLength(DWORD* pcbMaxLength)
+{
+    if (pcbMaxLength == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *pcbMaxLength = m_cbData;
+
+    return S_OK;
+}
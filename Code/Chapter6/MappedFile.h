@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atlbase.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <Mferror.h>
+
+
+// size of the views of the file mapped at a time
+#define MAPPED_FILE_WINDOW_SIZE     (32 * 1024 * 1024)
+
+
+//
+// A single view of the mapped file.  The window is reference counted - it is unmapped once
+// the file and all of the media buffers pointing into it have released it.
+//
+class MappedFileWindow
+{
+    public:
+        MappedFileWindow(BYTE* pView, ULONGLONG offset, DWORD cbView);
+
+        ULONG AddRef(void);
+        ULONG Release(void);
+
+        bool Contains(ULONGLONG offset, DWORD cbData) const
+        { return offset >= m_offset && offset + cbData <= m_offset + m_cbView; };
+        BYTE* GetPointer(ULONGLONG offset) const    { return m_pView + (offset - m_offset); };
+
+    private:
+        ~MappedFileWindow(void);
+
+        volatile long m_cRef;
+        BYTE* m_pView;
+        ULONGLONG m_offset;
+        DWORD m_cbView;
+};
+
+
+//
+// Read-only memory mapping of the AVI file.  Hands out media buffers that point straight
+// into mapped views of the file, so the sample data never has to be copied.  The views are
+// mapped copy-on-write, so a downstream component writing into a buffer never modifies the
+// file.
+//
+class MappedFile
+{
+    public:
+        static HRESULT CreateInstance(const WCHAR* path, MappedFile** ppMappedFile);
+
+        ULONG AddRef(void);
+        ULONG Release(void);
+
+        HRESULT GetBuffer(ULONGLONG offset, DWORD cbData, IMFMediaBuffer** ppBuffer);
+
+    private:
+        MappedFile(void);
+        ~MappedFile(void);
+
+        HRESULT Open(const WCHAR* path);
+        HRESULT MapWindow(ULONGLONG offset, DWORD cbData);
+
+        volatile long m_cRef;
+
+        HANDLE m_hFile;
+        HANDLE m_hMapping;
+        ULONGLONG m_fileSize;
+        DWORD m_allocationGranularity;
+
+        // the most recently mapped view - samples are usually requested in file order, so
+        // most of the requests are served out of this view
+        MappedFileWindow* m_pWindow;
+};
+
+
+//
+// IMFMediaBuffer implementation pointing into a view of the mapped file.  The buffer holds
+// a reference to the view, which keeps it mapped as long as the buffer is alive.
+//
+class MappedMediaBuffer : public IMFMediaBuffer
+{
+    public:
+        MappedMediaBuffer(MappedFileWindow* pWindow, BYTE* pData, DWORD cbData);
+
+        // IUnknown interface implementation
+        virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject);
+        virtual ULONG STDMETHODCALLTYPE AddRef(void);
+        virtual ULONG STDMETHODCALLTYPE Release(void);
+
+        // IMFMediaBuffer interface implementation
+        STDMETHODIMP Lock(BYTE** ppbBuffer, DWORD* pcbMaxLength, DWORD* pcbCurrentLength);
+        STDMETHODIMP Unlock(void);
+        STDMETHODIMP GetCurrentLength(DWORD* pcbCurrentLength);
+        STDMETHODIMP SetCurrentLength(DWORD cbCurrentLength);
+        STDMETHODIMP GetMaxLength(DWORD* pcbMaxLength);
+
+    private:
+        ~MappedMediaBuffer(void);
+
+        volatile long m_cRef;
+        MappedFileWindow* m_pWindow;
+        BYTE* m_pData;
+        DWORD m_cbData;
+        DWORD m_cbCurrentLength;
+};
@@ -0,0 +1,337 @@
+#include "StdAfx.h"
+#include "MediaBufferPool.h"
+
+
+// alignment of the memory blocks handed out by the pool
+#define BUFFER_POOL_ALIGNMENT   64
+
+
+//
+// Create a new, empty buffer pool
+//
+HRESULT MediaBufferPool::CreateInstance(MediaBufferPool** ppPool)
+{
+    HRESULT hr = S_OK;
+    MediaBufferPool* pPool = NULL;
+
+    do
+    {
+        BREAK_ON_NULL(ppPool, E_POINTER);
+
+        pPool = new (std::nothrow) MediaBufferPool();
+        BREAK_ON_NULL(pPool, E_OUTOFMEMORY);
+
+        *ppPool = pPool;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+MediaBufferPool::MediaBufferPool(void) :
+    m_cRef(1),
+    m_freeBytes(0),
+    m_hits(0),
+    m_misses(0),
+    m_returned(0),
+    m_discarded(0)
+{
+    ZeroMemory(m_pFreeBlocks, sizeof(m_pFreeBlocks));
+    ZeroMemory(m_freeCount, sizeof(m_freeCount));
+}
+
+
+MediaBufferPool::~MediaBufferPool(void)
+{
+    for(int x = 0; x < BUFFER_POOL_SIZE_CLASSES; x++)
+    {
+        for(DWORD y = 0; y < m_freeCount[x]; y++)
+        {
+            _aligned_free(m_pFreeBlocks[x][y]);
+        }
+    }
+}
+
+
+ULONG MediaBufferPool::AddRef(void)
+{
+    return InterlockedIncrement(&m_cRef);
+}
+
+
+ULONG MediaBufferPool::Release(void)
+{
+    ULONG refCount = InterlockedDecrement(&m_cRef);
+    if (refCount == 0)
+    {
+        delete this;
+    }
+    
+    return refCount;
+}
+
+
+//
+// Get a media buffer that can hold at least cbSize bytes - reuse a free memory block of the
+// right size class if there is one, or allocate a new block
+//
+HRESULT MediaBufferPool::GetBuffer(DWORD cbSize, IMFMediaBuffer** ppBuffer)
+{
+    HRESULT hr = S_OK;
+    BYTE* pMemory = NULL;
+    DWORD cbMemory = cbSize;
+    PooledMediaBuffer* pBuffer = NULL;
+    int sizeClass = GetSizeClass(cbSize);
+
+    do
+    {
+        BREAK_ON_NULL(ppBuffer, E_POINTER);
+
+        if(sizeClass >= 0)
+        {
+            cbMemory = 1 << (sizeClass + BUFFER_POOL_MIN_CLASS_SHIFT);
+
+            CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+            if(m_freeCount[sizeClass] > 0)
+            {
+                m_freeCount[sizeClass]--;
+                pMemory = m_pFreeBlocks[sizeClass][m_freeCount[sizeClass]];
+                m_freeBytes -= cbMemory;
+            }
+        }
+
+        if(pMemory != NULL)
+        {
+            InterlockedIncrement(&m_hits);
+        }
+        else
+        {
+            InterlockedIncrement(&m_misses);
+
+            pMemory = (BYTE*)_aligned_malloc(cbMemory, BUFFER_POOL_ALIGNMENT);
+            BREAK_ON_NULL(pMemory, E_OUTOFMEMORY);
+        }
+
+        // the buffer takes ownership of the memory block, and holds a reference to the pool
+        pBuffer = new (std::nothrow) PooledMediaBuffer(this, pMemory, cbMemory);
+        if(pBuffer == NULL)
+        {
+            ReturnMemory(pMemory, cbMemory);
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        *ppBuffer = pBuffer;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Get a snapshot of the pool statistics
+//
+void MediaBufferPool::GetStatistics(BufferPoolStatistics* pStatistics)
+{
+    if(pStatistics != NULL)
+    {
+        pStatistics->hits = m_hits;
+        pStatistics->misses = m_misses;
+        pStatistics->returned = m_returned;
+        pStatistics->discarded = m_discarded;
+    }
+}
+
+
+//
+// Put a memory block back into the pool, or free it if the pool is full or if the block
+// is not of one of the pooled sizes
+//
+void MediaBufferPool::ReturnMemory(BYTE* pMemory, DWORD cbMemory)
+{
+    int sizeClass = GetSizeClass(cbMemory);
+    bool pooled = false;
+
+    InterlockedIncrement(&m_returned);
+
+    if(sizeClass >= 0 && cbMemory == (DWORD)(1 << (sizeClass + BUFFER_POOL_MIN_CLASS_SHIFT)))
+    {
+        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+        if(m_freeCount[sizeClass] < BUFFER_POOL_MAX_FREE_PER_CLASS &&
+            m_freeBytes + cbMemory <= BUFFER_POOL_MAX_FREE_BYTES)
+        {
+            m_pFreeBlocks[sizeClass][m_freeCount[sizeClass]] = pMemory;
+            m_freeCount[sizeClass]++;
+            m_freeBytes += cbMemory;
+            pooled = true;
+        }
+    }
+
+    if(!pooled)
+    {
+        InterlockedIncrement(&m_discarded);
+        _aligned_free(pMemory);
+    }
+}
+
+
+//
+// Get the index of the smallest size class that can hold cbSize bytes, or -1 if the size
+// is too large to be pooled
+//
+int MediaBufferPool::GetSizeClass(DWORD cbSize)
+{
+    for(int x = 0; x < BUFFER_POOL_SIZE_CLASSES; x++)
+    {
+        if(cbSize <= (DWORD)(1 << (x + BUFFER_POOL_MIN_CLASS_SHIFT)))
+        {
+            return x;
+        }
+    }
+
+    return -1;
+}
+
+
+
+
+PooledMediaBuffer::PooledMediaBuffer(MediaBufferPool* pPool, BYTE* pMemory, DWORD cbMemory) :
+    m_cRef(1),
+    m_pPool(pPool),
+    m_pMemory(pMemory),
+    m_cbMemory(cbMemory),
+    m_cbCurrentLength(0)
+{
+    m_pPool->AddRef();
+}
+
+
+//
+// Give the memory back to the pool once the last reference to the buffer is gone
+//
+PooledMediaBuffer::~PooledMediaBuffer(void)
+{
+    m_pPool->ReturnMemory(m_pMemory, m_cbMemory);
+    m_pPool->Release();
+}
+
+
+//
+// IUnknown interface implementation
+//
+ULONG PooledMediaBuffer::AddRef()
+{
+    return InterlockedIncrement(&m_cRef);
+}
+
+ULONG PooledMediaBuffer::Release()
+{
+    ULONG refCount = InterlockedDecrement(&m_cRef);
+    if (refCount == 0)
+    {
+        delete this;
+    }
+    
+    return refCount;
+}
+
+HRESULT PooledMediaBuffer::QueryInterface(REFIID riid, void** ppv)
+{
+    HRESULT hr = S_OK;
+
+    if (ppv == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (riid == IID_IUnknown)
+    {
+        *ppv = static_cast<IUnknown*>(this);
+    }
+    else if (riid == IID_IMFMediaBuffer)
+    {
+        *ppv = static_cast<IMFMediaBuffer*>(this);
+    }
+    else
+    {
+        *ppv = NULL;
+        hr = E_NOINTERFACE;
+    }
+
+    if(SUCCEEDED(hr))
+        AddRef();
+
+    return hr;
+}
+
+
+//
+// IMFMediaBuffer interface implementation - the memory is always contiguous, so locking
+// the buffer just returns the pointer to it
+//
+HRESULT PooledMediaBuffer::Lock(BYTE** ppbBuffer, DWORD* pcbMaxLength, DWORD* pcbCurrentLength)
+{
+    if (ppbBuffer == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *ppbBuffer = m_pMemory;
+
+    if (pcbMaxLength != NULL)
+    {
+        *pcbMaxLength = m_cbMemory;
+    }
+
+    if (pcbCurrentLength != NULL)
+    {
+        *pcbCurrentLength = m_cbCurrentLength;
+    }
+
+    return S_OK;
+}
+
+HRESULT PooledMediaBuffer::Unlock(void)
+{
+    return S_OK;
+}
+
+HRESULT PooledMediaBuffer::GetCurrentLength(DWORD* pcbCurrentLength)
+{
+    if (pcbCurrentLength == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *pcbCurrentLength = m_cbCurrentLength;
+
+    return S_OK;
+}
+
+HRESULT PooledMediaBuffer::SetCurrentLength(DWORD cbCurrentLength)
+{
+    if (cbCurrentLength > m_cbMemory)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_cbCurrentLength = cbCurrentLength;
+
+    return S_OK;
+}
+
+HRESULT PooledMediaBuffer::GetMaxLength(DWORD* pcbMaxLength)
+{
+    if (pcbMaxLength == NULL)
+    {
+        return E_POINTER;
+    }
+
+    *pcbMaxLength = m_cbMemory;
+
+    return S_OK;
+}
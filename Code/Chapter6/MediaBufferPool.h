@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atlbase.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <Mferror.h>
+
+
+// the smallest size class is 4 KB, the largest is 256 MB - each class is twice the size of
+// the previous one
+#define BUFFER_POOL_MIN_CLASS_SHIFT     12
+#define BUFFER_POOL_SIZE_CLASSES        17
+
+// maximum number of free buffers kept in each size class
+#define BUFFER_POOL_MAX_FREE_PER_CLASS  8
+
+// maximum number of bytes held by all of the free buffers in the pool
+#define BUFFER_POOL_MAX_FREE_BYTES      (256 * 1024 * 1024)
+
+
+// statistics collected by the buffer pool
+struct BufferPoolStatistics
+{
+    LONG hits;                  // requests served with a recycled buffer
+    LONG misses;                // requests that had to allocate new memory
+    LONG returned;              // buffers returned to the pool by downstream components
+    LONG discarded;             // returned buffers freed because the pool was full
+};
+
+
+//
+// Pool of memory blocks used to back the media buffers of the samples produced by the
+// parser.  The blocks are grouped into power of two size classes.  A block goes back into
+// the pool when the last reference to the media buffer that uses it is released - i.e. once
+// the sample holding the buffer has been released by the downstream components.  The pool
+// is reference counted, since the buffers may outlive the parser that created them.
+//
+class MediaBufferPool
+{
+    public:
+        static HRESULT CreateInstance(MediaBufferPool** ppPool);
+
+        ULONG AddRef(void);
+        ULONG Release(void);
+
+        HRESULT GetBuffer(DWORD cbSize, IMFMediaBuffer** ppBuffer);
+        void GetStatistics(BufferPoolStatistics* pStatistics);
+
+        // called by the pooled buffers when they are destroyed
+        void ReturnMemory(BYTE* pMemory, DWORD cbMemory);
+
+    private:
+        MediaBufferPool(void);
+        ~MediaBufferPool(void);
+
+        static int GetSizeClass(DWORD cbSize);
+
+        volatile long m_cRef;
+        CComAutoCriticalSection m_critSec;
+
+        BYTE* m_pFreeBlocks[BUFFER_POOL_SIZE_CLASSES][BUFFER_POOL_MAX_FREE_PER_CLASS];
+        DWORD m_freeCount[BUFFER_POOL_SIZE_CLASSES];
+        DWORD m_freeBytes;
+
+        volatile LONG m_hits;
+        volatile LONG m_misses;
+        volatile LONG m_returned;
+        volatile LONG m_discarded;
+};
+
+
+//
+// IMFMediaBuffer implementation that uses a memory block from the MediaBufferPool, and
+// gives it back to the pool when the buffer is destroyed.
+//
+class PooledMediaBuffer : public IMFMediaBuffer
+{
+    public:
+        PooledMediaBuffer(MediaBufferPool* pPool, BYTE* pMemory, DWORD cbMemory);
+
+        // IUnknown interface implementation
+        virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject);
+        virtual ULONG STDMETHODCALLTYPE AddRef(void);
+        virtual ULONG STDMETHODCALLTYPE Release(void);
+
+        // IMFMediaBuffer interface implementation
+        STDMETHODIMP Lock(BYTE** ppbBuffer, DWORD* pcbMaxLength, DWORD* pcbCurrentLength);
+        STDMETHODIMP Unlock(void);
+        STDMETHODIMP GetCurrentLength(DWORD* pcbCurrentLength);
+        STDMETHODIMP SetCurrentLength(DWORD cbCurrentLength);
+        STDMETHODIMP GetMaxLength(DWORD* pcbMaxLength);
+
+    private:
+        ~PooledMediaBuffer(void);
+
+        volatile long m_cRef;
+        MediaBufferPool* m_pPool;
+        BYTE* m_pMemory;
+        DWORD m_cbMemory;
+        DWORD m_cbCurrentLength;
+};
@@ -0,0 +1,601 @@
+#include "StdAfx.h"
+#include "SamplePrefetcher.h"
+
+
+//
+// Create a new prefetcher reading from the specified parser
+//
+HRESULT SamplePrefetcher::CreateInstance(AVIFileParser* pParser, DWORD bufferBytes, 
+    IMFAsyncCallback* pNotifyCallback, IUnknown* pNotifyState, SamplePrefetcher** ppPrefetcher)
+{
+    HRESULT hr = S_OK;
+    SamplePrefetcher* pPrefetcher = NULL;
+
+    do
+    {
+        BREAK_ON_NULL(pParser, E_POINTER);
+        BREAK_ON_NULL(pNotifyCallback, E_POINTER);
+        BREAK_ON_NULL(ppPrefetcher, E_POINTER);
+
+        pPrefetcher = new (std::nothrow) SamplePrefetcher(pParser, bufferBytes, 
+            pNotifyCallback, pNotifyState);
+        BREAK_ON_NULL(pPrefetcher, E_OUTOFMEMORY);
+
+        hr = pPrefetcher->Init();
+        BREAK_ON_FAIL(hr);
+
+        *ppPrefetcher = pPrefetcher;
+    }
+    while(false);
+
+    if(FAILED(hr))
+    {
+        SafeRelease(pPrefetcher);
+    }
+
+    return hr;
+}
+
+
+SamplePrefetcher::SamplePrefetcher(AVIFileParser* pParser, DWORD bufferBytes,
+    IMFAsyncCallback* pNotifyCallback, IUnknown* pNotifyState) :
+    m_cRef(1),
+    m_pParser(pParser),
+    m_bufferBytes(bufferBytes),
+    m_workQueue(0),
+    m_pNotifyCallback(pNotifyCallback),
+    m_pNotifyState(pNotifyState),
+    m_sampleWanted(false),
+    m_fillScheduled(false),
+    m_isShutdown(false),
+    m_keyframesOnly(false)
+{
+    if(m_bufferBytes == 0)
+    {
+        m_bufferBytes = PREFETCH_DEFAULT_BUFFER_BYTES;
+    }
+}
+
+
+SamplePrefetcher::~SamplePrefetcher(void)
+{
+    ClearRings();
+
+    if(m_workQueue != 0)
+    {
+        MFUnlockWorkQueue(m_workQueue);
+    }
+}
+
+
+//
+// Allocate the private work queue used to read the samples
+//
+HRESULT SamplePrefetcher::Init(void)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        // create a ring for every track - all of the tracks are read until the source
+        // deselects them
+        m_rings.resize(m_pParser->TrackCount());
+        ClearRings();
+
+        for(DWORD x = 0; x < m_rings.size(); x++)
+        {
+            m_rings[x].active = true;
+        }
+
+        // allocate a private worker queue so that the disk reads never block the
+        // standard MF work queue used by the source
+        hr = MFAllocateWorkQueue(&m_workQueue);
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// IUnknown interface implementation
+//
+ULONG SamplePrefetcher::AddRef()
+{
+    return InterlockedIncrement(&m_cRef);
+}
+
+ULONG SamplePrefetcher::Release()
+{
+    ULONG refCount = InterlockedDecrement(&m_cRef);
+    if (refCount == 0)
+    {
+        delete this;
+    }
+    
+    return refCount;
+}
+
+HRESULT SamplePrefetcher::QueryInterface(REFIID riid, void** ppv)
+{
+    HRESULT hr = S_OK;
+
+    if (ppv == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (riid == IID_IUnknown)
+    {
+        *ppv = static_cast<IUnknown*>(this);
+    }
+    else if (riid == IID_IMFAsyncCallback)
+    {
+        *ppv = static_cast<IMFAsyncCallback*>(this);
+    }
+    else
+    {
+        *ppv = NULL;
+        hr = E_NOINTERFACE;
+    }
+
+    if(SUCCEEDED(hr))
+        AddRef();
+
+    return hr;
+}
+
+
+//
+// Get the behavior information (duration, etc.) of the asynchronous callback operation - 
+// not implemented.
+//
+HRESULT SamplePrefetcher::GetParameters(DWORD*, DWORD*)
+{
+    return E_NOTIMPL;
+}
+
+
+//
+// Fill the sample rings on the private work queue - keep reading until every ring is either
+// full or has reached the end of its stream
+//
+HRESULT SamplePrefetcher::Invoke(IMFAsyncResult* pResult)
+{
+    while(true)
+    {
+        // hold the parser lock for the whole read, so that a seek cannot move the parser
+        // while a sample is being read and added to a ring
+        CComCritSecLock<CComAutoCriticalSection> parserLock(m_parserLock);
+        int track = -1;
+
+        {
+            CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+            if(!m_isShutdown)
+            {
+                track = FindStreamToFill();
+            }
+
+            // nothing left to do - clear the scheduled flag in the same locked section in
+            // which we made that decision, so that no fill request is lost
+            if(track < 0)
+            {
+                m_fillScheduled = false;
+                break;
+            }
+        }
+
+        // errors are stored in the ring of the track, and reported to the source when it
+        // asks for the next sample
+        ReadSample((DWORD)track);
+    }
+
+    return S_OK;
+}
+
+
+//
+// Seek the parser to the specified position and drop all of the samples buffered so far.
+// If this is not a seek, just make sure the rings are being filled.
+//
+HRESULT SamplePrefetcher::SetOffset(const PROPVARIANT& varStart)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        if (varStart.vt == VT_I8)
+        {
+            // wait for any read in progress to complete before touching the parser
+            CComCritSecLock<CComAutoCriticalSection> parserLock(m_parserLock);
+            CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+            if(m_isShutdown)
+            {
+                hr = MF_E_SHUTDOWN;
+                break;
+            }
+
+            ClearRings();
+
+            hr = m_pParser->SetOffset(varStart);
+            BREAK_ON_FAIL(hr);
+        }
+
+        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+        hr = ScheduleFill();
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Get the next sample of the specified track out of its ring.  If the ring is empty, the
+// read is scheduled on the work queue and E_PENDING is returned - the source is notified
+// when the read completes, and asks again then.  This never blocks the caller, which holds
+// the lock of the source.
+//
+HRESULT SamplePrefetcher::GetNextSample(DWORD track, IMFSample** ppSample, bool* pEndOfStream)
+{
+    HRESULT hr = S_OK;
+
+    if(ppSample == NULL || pEndOfStream == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if(track >= m_rings.size())
+    {
+        return E_INVALIDARG;
+    }
+
+    do
+    {
+        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+        SampleRing& ring = m_rings[track];
+
+        if(m_isShutdown)
+        {
+            hr = MF_E_SHUTDOWN;
+            break;
+        }
+
+        if(ring.count > 0)
+        {
+            // pass the reference held by the ring to the caller
+            *ppSample = ring.pSamples[ring.head];
+            ring.pSamples[ring.head] = NULL;
+            ring.bytes -= ring.sampleBytes[ring.head];
+            ring.head = (ring.head + 1) % PREFETCH_RING_CAPACITY;
+            ring.count--;
+
+            *pEndOfStream = (ring.count == 0 && ring.endOfStream);
+
+            // there is space in the ring now - make sure it gets refilled
+            ScheduleFill();
+            break;
+        }
+
+        if(FAILED(ring.hrError))
+        {
+            hr = ring.hrError;
+            break;
+        }
+
+        if(ring.endOfStream)
+        {
+            hr = MF_E_END_OF_STREAM;
+            break;
+        }
+
+        // the track caught up with the writer of a file that is still being recorded -
+        // let the source ask again later, which schedules another read
+        if(ring.tailReached)
+        {
+            ring.tailReached = false;
+            hr = E_PENDING;
+            break;
+        }
+
+        // a track that is not read has nothing to wait for
+        if(!ring.active || (m_keyframesOnly && !m_pParser->IsVideoTrack(track)))
+        {
+            hr = E_PENDING;
+            break;
+        }
+
+        // the ring is empty - read the sample on the work queue, and tell the source when
+        // it is there.  The empty ring of a track that is read is always filled eventually.
+        hr = ScheduleFill();
+        BREAK_ON_FAIL(hr);
+
+        m_sampleWanted = true;
+        hr = E_PENDING;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Select or deselect a track.  The samples buffered for a deselected track are released,
+// and its chunks are skipped from then on.
+//
+HRESULT SamplePrefetcher::ActivateTrack(DWORD track, bool active)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        // wait for any read in progress - the parser drops the samples of the track as well
+        CComCritSecLock<CComAutoCriticalSection> parserLock(m_parserLock);
+        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+        if(m_isShutdown)
+        {
+            hr = MF_E_SHUTDOWN;
+            break;
+        }
+
+        if(track >= m_rings.size())
+        {
+            hr = E_INVALIDARG;
+            break;
+        }
+
+        if(!active)
+        {
+            ClearRing(track);
+        }
+
+        m_rings[track].active = active;
+        m_pParser->ActivateTrack(track, active);
+
+        hr = ScheduleFill();
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Switch the parser between normal and keyframe-only playback.  The audio read so far is
+// dropped either way - it is not needed while only keyframes are shown, and it is behind
+// the video once normal playback resumes.  The video already buffered is still delivered.
+//
+HRESULT SamplePrefetcher::SetKeyframesOnly(bool keyframesOnly)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        CComCritSecLock<CComAutoCriticalSection> parserLock(m_parserLock);
+        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+        if(m_isShutdown)
+        {
+            hr = MF_E_SHUTDOWN;
+            break;
+        }
+
+        for(DWORD x = 0; x < m_rings.size(); x++)
+        {
+            if(!m_pParser->IsVideoTrack(x))
+            {
+                ClearRing(x);
+            }
+        }
+
+        m_keyframesOnly = keyframesOnly;
+        m_pParser->SetKeyframesOnly(keyframesOnly);
+
+        hr = ScheduleFill();
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Stop reading samples and release everything buffered so far
+//
+HRESULT SamplePrefetcher::Shutdown(void)
+{
+    // wait for any read in progress - after this the parser is never touched again
+    CComCritSecLock<CComAutoCriticalSection> parserLock(m_parserLock);
+    CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+    m_isShutdown = true;
+    m_pParser = NULL;
+    m_sampleWanted = false;
+
+    ClearRings();
+
+    // the source holds a reference to the prefetcher - break the cycle
+    m_pNotifyCallback.Release();
+    m_pNotifyState.Release();
+
+    return S_OK;
+}
+
+
+//
+// Queue a fill operation on the private work queue, unless one is already pending.  Must
+// be called with the m_critSec held.
+//
+HRESULT SamplePrefetcher::ScheduleFill(void)
+{
+    HRESULT hr = S_OK;
+
+    if(!m_fillScheduled && !m_isShutdown)
+    {
+        hr = MFPutWorkItem(m_workQueue, this, NULL);
+        if(SUCCEEDED(hr))
+        {
+            m_fillScheduled = true;
+        }
+    }
+
+    return hr;
+}
+
+
+//
+// Post the notification work item if the source is waiting for a read, so that it asks for
+// its samples again.  Must be called with the m_critSec held.
+//
+void SamplePrefetcher::NotifySampleReady(void)
+{
+    if(m_sampleWanted && m_pNotifyCallback != NULL)
+    {
+        m_sampleWanted = false;
+        MFPutWorkItem(MFASYNC_CALLBACK_QUEUE_STANDARD, m_pNotifyCallback, m_pNotifyState);
+    }
+}
+
+
+//
+// Read the next sample of the specified track from the parser and add it to the ring.
+// Must be called with the m_parserLock held.
+//
+HRESULT SamplePrefetcher::ReadSample(DWORD track)
+{
+    HRESULT hr = S_OK;
+    CComPtr<IMFSample> pSample;
+    DWORD sampleBytes = 0;
+    LONGLONG sampleTime = 0;
+    bool endOfStream = false;
+
+    // read the sample from the file - this is the part that may block on the disk, so it
+    // is done without holding the lock that protects the rings
+    hr = m_pParser->GetNextSample(track, &pSample);
+    endOfStream = m_pParser->IsEndOfStream(track);
+
+    if(SUCCEEDED(hr))
+    {
+        pSample->GetTotalLength(&sampleBytes);
+        pSample->GetSampleTime(&sampleTime);
+    }
+
+    {
+        CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+        SampleRing& ring = m_rings[track];
+
+        if(hr == E_PENDING)
+        {
+            // there is no new data in the file yet - stop reading the track until the
+            // source asks for it again
+            ring.tailReached = true;
+        }
+        else if(hr == MF_E_END_OF_STREAM)
+        {
+            // the file stopped growing after the last sample of the track was read
+            ring.endOfStream = true;
+        }
+        else if(FAILED(hr))
+        {
+            // remember the error - it will be reported when the source asks for the sample
+            ring.hrError = hr;
+        }
+        else
+        {
+            DWORD tail = (ring.head + ring.count) % PREFETCH_RING_CAPACITY;
+
+            ring.pSamples[tail] = pSample.Detach();
+            ring.sampleBytes[tail] = sampleBytes;
+            ring.bytes += sampleBytes;
+            ring.count++;
+            ring.lastSampleTime = sampleTime;
+            ring.endOfStream = endOfStream;
+        }
+
+        // wake up the source if it is waiting for a sample - an error or the end of a
+        // stream is news for it as well
+        NotifySampleReady();
+    }
+
+    return hr;
+}
+
+
+//
+// Find the track whose ring should be filled next.  Of the rings of the selected tracks
+// that still have room, pick the one that is furthest behind in time, so that the file is
+// read roughly in the order in which the chunks are interleaved.  Returns -1 if all of the
+// rings are done.
+// Must be called with the m_critSec held.
+//
+int SamplePrefetcher::FindStreamToFill(void)
+{
+    int track = -1;
+
+    for(int x = 0; x < (int)m_rings.size(); x++)
+    {
+        const SampleRing& ring = m_rings[x];
+
+        if(!ring.active || ring.endOfStream || FAILED(ring.hrError) || ring.tailReached ||
+            ring.count >= PREFETCH_RING_CAPACITY)
+        {
+            continue;
+        }
+
+        // the audio is not played while only keyframes are shown
+        if(m_keyframesOnly && !m_pParser->IsVideoTrack(x))
+        {
+            continue;
+        }
+
+        // always allow one sample in the ring, even if it is larger than the budget
+        if(ring.count > 0 && ring.bytes >= m_bufferBytes)
+        {
+            continue;
+        }
+
+        if(track < 0 || ring.lastSampleTime < m_rings[track].lastSampleTime)
+        {
+            track = x;
+        }
+    }
+
+    return track;
+}
+
+
+//
+// Release all of the samples in the rings and reset the per-track state - the selection of
+// the tracks is kept.  Must be called with the m_critSec held.
+//
+void SamplePrefetcher::ClearRings(void)
+{
+    for(DWORD x = 0; x < m_rings.size(); x++)
+    {
+        ClearRing(x);
+    }
+}
+
+
+//
+// Release the samples in the ring of one track and reset its state - the selection of the
+// track is kept.  Must be called with the m_critSec held.
+//
+void SamplePrefetcher::ClearRing(DWORD track)
+{
+    SampleRing& ring = m_rings[track];
+    bool active = ring.active;
+
+    for(DWORD y = 0; y < ring.count; y++)
+    {
+        SafeRelease(ring.pSamples[(ring.head + y) % PREFETCH_RING_CAPACITY]);
+    }
+
+    ZeroMemory(&ring, sizeof(ring));
+    ring.active = active;
+}
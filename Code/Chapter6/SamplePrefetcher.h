@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atlbase.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <Mferror.h>
+
+#include "AviFileParser.h"
+
+
+// maximum number of samples buffered for each track, regardless of their size
+#define PREFETCH_RING_CAPACITY          64
+
+// default number of bytes buffered for each track
+#define PREFETCH_DEFAULT_BUFFER_BYTES   (8 * 1024 * 1024)
+
+
+//
+// Reads samples from the AVI file parser ahead of time on a private work queue, and keeps
+// them in a bounded ring for each track of the file.  The ring of each track is limited both by the
+// number of samples and by the number of bytes buffered.  The source then pulls the samples
+// out of memory instead of blocking on the disk every time a stream needs data.  Only the
+// tracks that are selected are read.  When the source asks for a sample that is not read
+// yet, it gets E_PENDING, and the notification work item is posted to the source once the
+// read completes.
+//
+class SamplePrefetcher : public IMFAsyncCallback
+{
+    public:
+        static HRESULT CreateInstance(AVIFileParser* pParser, DWORD bufferBytes, 
+            IMFAsyncCallback* pNotifyCallback, IUnknown* pNotifyState,
+            SamplePrefetcher** ppPrefetcher);
+
+        // IUnknown interface implementation
+        virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject);
+        virtual ULONG STDMETHODCALLTYPE AddRef(void);
+        virtual ULONG STDMETHODCALLTYPE Release(void);
+
+        // IMFAsyncCallback interface implementation
+        STDMETHODIMP GetParameters(DWORD* pdwFlags, DWORD* pdwQueue);
+        STDMETHODIMP Invoke(IMFAsyncResult* pResult);
+
+        HRESULT SetOffset(const PROPVARIANT& varStart);
+        HRESULT GetNextSample(DWORD track, IMFSample** ppSample, bool* pEndOfStream);
+        HRESULT ActivateTrack(DWORD track, bool active);
+        HRESULT SetKeyframesOnly(bool keyframesOnly);
+        HRESULT Shutdown(void);
+
+    private:
+        // ring of samples buffered for a single track
+        struct SampleRing
+        {
+            IMFSample* pSamples[PREFETCH_RING_CAPACITY];
+            DWORD sampleBytes[PREFETCH_RING_CAPACITY];
+            DWORD head;                     // index of the oldest sample in the ring
+            DWORD count;                    // number of samples in the ring
+            DWORD bytes;                    // number of bytes held by the samples in the ring
+            LONGLONG lastSampleTime;        // time stamp of the last sample added to the ring
+            bool endOfStream;               // the last sample of the stream is in the ring
+            HRESULT hrError;                // error that stopped the reads for the stream
+            bool tailReached;               // the reads caught up with a growing file
+            bool active;                    // the track is selected and should be read
+        };
+
+        SamplePrefetcher(AVIFileParser* pParser, DWORD bufferBytes,
+            IMFAsyncCallback* pNotifyCallback, IUnknown* pNotifyState);
+        ~SamplePrefetcher(void);
+
+        HRESULT Init(void);
+        HRESULT ScheduleFill(void);
+        void NotifySampleReady(void);
+        HRESULT ReadSample(DWORD track);
+        int FindStreamToFill(void);
+        void ClearRings(void);
+        void ClearRing(DWORD track);
+
+        volatile long m_cRef;
+        CComAutoCriticalSection m_critSec;          // protects the rings and state variables
+        CComAutoCriticalSection m_parserLock;       // held while the parser is in use
+
+        AVIFileParser* m_pParser;
+        DWORD m_bufferBytes;
+        DWORD m_workQueue;
+
+        // work item posted to the source when a sample it asked for has been read
+        CComPtr<IMFAsyncCallback> m_pNotifyCallback;
+        CComPtr<IUnknown> m_pNotifyState;
+        bool m_sampleWanted;                        // the source is waiting for a read
+
+        bool m_fillScheduled;
+        bool m_isShutdown;
+        bool m_keyframesOnly;                       // only the video tracks are read
+        std::vector<SampleRing> m_rings;            // one ring for every track of the parser
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <windows.h>
+
+
+//
+// Bounded lock-free queue of COM interface pointers with a single producer and a single
+// consumer.  The producer only ever writes the tail counter, and the consumer only ever
+// writes the head counter, so neither side needs a lock.  The counters run freely and are
+// mapped to a slot with the capacity mask, which is why the capacity must be a power of
+// two.  The ring holds a reference to every item in it - NULL items are allowed.  Every
+// item can carry a timestamp from the producer to the consumer.
+//
+// The counters are published with interlocked operations, which are full barriers, and
+// read through volatile accesses, which have acquire semantics with the MS compilers - a
+// slot is therefore always written before it becomes visible to the other side.
+//
+template <class T, DWORD Capacity>
+class SpscRing
+{
+    public:
+        SpscRing(void) :
+            m_head(0),
+            m_tail(0)
+        {
+            C_ASSERT((Capacity & (Capacity - 1)) == 0);
+            ZeroMemory(m_items, sizeof(m_items));
+            ZeroMemory(m_stamps, sizeof(m_stamps));
+        }
+
+        ~SpscRing(void)
+        {
+            T* pItem = NULL;
+
+            while(Pop(&pItem))
+            {
+                if(pItem != NULL)
+                {
+                    pItem->Release();
+                }
+            }
+        }
+
+        //
+        // Add an item to the tail of the ring - called only by the producer.  Returns false
+        // if the ring is full.
+        //
+        bool Push(T* pItem, LONGLONG stamp = 0)
+        {
+            LONG tail = m_tail;
+
+            if((DWORD)(tail - m_head) >= Capacity)
+            {
+                return false;
+            }
+
+            if(pItem != NULL)
+            {
+                pItem->AddRef();
+            }
+
+            m_items[tail & (Capacity - 1)] = pItem;
+            m_stamps[tail & (Capacity - 1)] = stamp;
+
+            // publish the slot to the consumer
+            InterlockedExchange(&m_tail, tail + 1);
+
+            return true;
+        }
+
+        //
+        // Remove the item at the head of the ring and pass its reference to the caller -
+        // called only by the consumer.  Returns false if the ring is empty.
+        //
+        bool Pop(T** ppItem, LONGLONG* pStamp = NULL)
+        {
+            LONG head = m_head;
+
+            if(head == m_tail)
+            {
+                return false;
+            }
+
+            *ppItem = m_items[head & (Capacity - 1)];
+            m_items[head & (Capacity - 1)] = NULL;
+
+            if(pStamp != NULL)
+            {
+                *pStamp = m_stamps[head & (Capacity - 1)];
+            }
+
+            // hand the slot back to the producer
+            InterlockedExchange(&m_head, head + 1);
+
+            return true;
+        }
+
+        // number of items in the ring - exact only when called by the producer or consumer
+        DWORD Count(void) const     { return (DWORD)(m_tail - m_head); }
+        bool IsEmpty(void) const    { return (m_tail == m_head); }
+
+    private:
+        T* m_items[Capacity];
+        LONGLONG m_stamps[Capacity];    // timestamp passed with each item
+        volatile LONG m_head;           // number of items ever removed - consumer side
+        volatile LONG m_tail;           // number of items ever added - producer side
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <windows.h>
+#include <mfapi.h>
+
+
+// Every value below HISTOGRAM_LINEAR_LIMIT has its own bucket.  Above it every power of two
+// is split into HISTOGRAM_SUB_BUCKETS linear buckets, so that the bucket of any value is at
+// most 1/8 wider than the value, which covers 32-bit values with 240 buckets.
+#define HISTOGRAM_SUB_BUCKET_BITS   3
+#define HISTOGRAM_SUB_BUCKETS       (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_LINEAR_LIMIT      (2 * HISTOGRAM_SUB_BUCKETS)
+#define HISTOGRAM_BUCKET_COUNT      (HISTOGRAM_LINEAR_LIMIT + \
+                                     (32 - HISTOGRAM_SUB_BUCKET_BITS - 1) * HISTOGRAM_SUB_BUCKETS)
+
+
+//
+// Histogram with logarithmic buckets of bounded relative width, in the style of an HDR
+// histogram - cheap enough to record every request, while keeping the tail percentiles of
+// latencies that range from microseconds to seconds.  Values are recorded with interlocked
+// operations, so several threads can record into the same histogram without a lock.  A
+// copy taken while values are recorded may be off by the values recorded during the copy.
+//
+struct LatencyHistogram
+{
+    LONG buckets[HISTOGRAM_BUCKET_COUNT];
+    LONGLONG count;                 // number of recorded values
+    LONGLONG sum;                   // sum of the recorded values
+    LONGLONG maximum;               // largest recorded value
+
+    void Reset(void)
+    {
+        ZeroMemory(this, sizeof(*this));
+    }
+
+    void Record(ULONGLONG value)
+    {
+        if(value > MAXDWORD)
+        {
+            value = MAXDWORD;
+        }
+
+        InterlockedIncrement(&buckets[BucketIndex((DWORD)value)]);
+        InterlockedIncrement64(&count);
+        InterlockedExchangeAdd64(&sum, (LONGLONG)value);
+
+        // raise the maximum unless another thread recorded a larger value in the meantime
+        LONGLONG current = maximum;
+        while((LONGLONG)value > current)
+        {
+            LONGLONG previous = InterlockedCompareExchange64(&maximum, (LONGLONG)value,
+                current);
+            if(previous == current)
+            {
+                break;
+            }
+            current = previous;
+        }
+    }
+
+    LONGLONG Mean(void) const
+    {
+        return (count > 0) ? (sum / count) : 0;
+    }
+
+    //
+    // Get the value below which the specified percentage of the recorded values falls.  The
+    // result is the upper bound of the bucket that holds the percentile, but never more than
+    // the largest recorded value.
+    //
+    LONGLONG Percentile(double percent) const
+    {
+        LONGLONG threshold = (LONGLONG)(count * percent / 100.0 + 0.5);
+        LONGLONG seen = 0;
+
+        if(count == 0)
+        {
+            return 0;
+        }
+
+        if(threshold < 1)
+        {
+            threshold = 1;
+        }
+
+        for(DWORD bucket = 0; bucket < HISTOGRAM_BUCKET_COUNT; bucket++)
+        {
+            seen += buckets[bucket];
+            if(seen >= threshold)
+            {
+                LONGLONG upperBound = BucketUpperBound(bucket);
+                return (upperBound < maximum) ? upperBound : maximum;
+            }
+        }
+
+        return maximum;
+    }
+
+    static DWORD BucketIndex(DWORD value)
+    {
+        if(value < HISTOGRAM_LINEAR_LIMIT)
+        {
+            return value;
+        }
+
+        // position of the highest set bit - at least HISTOGRAM_SUB_BUCKET_BITS + 1 here
+        DWORD exponent = 0;
+        for(DWORD rest = value; rest > 1; rest >>= 1)
+        {
+            exponent++;
+        }
+
+        // the bits right below the highest one select the linear bucket within the power
+        DWORD shift = exponent - HISTOGRAM_SUB_BUCKET_BITS;
+        DWORD subBucket = (value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1);
+
+        return HISTOGRAM_LINEAR_LIMIT + (shift - 1) * HISTOGRAM_SUB_BUCKETS + subBucket;
+    }
+
+    static LONGLONG BucketUpperBound(DWORD bucket)
+    {
+        if(bucket < HISTOGRAM_LINEAR_LIMIT)
+        {
+            return bucket;
+        }
+
+        DWORD shift = (bucket - HISTOGRAM_LINEAR_LIMIT) / HISTOGRAM_SUB_BUCKETS + 1;
+        DWORD subBucket = (bucket - HISTOGRAM_LINEAR_LIMIT) % HISTOGRAM_SUB_BUCKETS;
+
+        return ((LONGLONG)(HISTOGRAM_SUB_BUCKETS + subBucket + 1) << shift) - 1;
+    }
+};
+
+
+//
+// Delivery statistics of one of the streams of the source, collected from the moment the
+// source is opened.  All of the times are in microseconds.
+//
+struct AVFStreamStatistics
+{
+    DWORD streamId;                     // identifier of the stream descriptor
+    LONGLONG samplesRequested;          // number of RequestSample() calls accepted
+    LONGLONG samplesDelivered;          // number of samples sent out with MEMediaSample
+    LONGLONG starvationEvents;          // requests that found no sample buffered
+    LONGLONG bytesRead;                 // sample data read from the file for the stream
+    LatencyHistogram requestToDelivery; // time from RequestSample() to MEMediaSample
+    LatencyHistogram parserRead;        // time spent reading each sample from the file
+    LatencyHistogram queueDepth;        // samples buffered in the stream at each request
+};
+
+
+// IAVFSourceStatistics COM IID.
+// {4C7A1B2E-9D3F-4E85-B6A0-2F8E7D1C5A94}
+DEFINE_GUID(IID_IAVFSourceStatistics, 0x4c7a1b2e, 0x9d3f, 0x4e85, 0xb6, 0xa0, 0x2f, 0x8e,
+    0x7d, 0x1c, 0x5a, 0x94);
+
+//
+// Interface exposed by the source for querying the delivery statistics of its streams -
+// QueryInterface() the media source for it.  Stutter can be attributed to the file reads
+// (parser read time) or to the scheduling of the requests (request to delivery time
+// without a matching read time, starvation).
+//
+struct IAVFSourceStatistics : public IUnknown
+{
+    public:
+        virtual HRESULT STDMETHODCALLTYPE GetStreamCount(DWORD* pcStreams) = 0;
+        virtual HRESULT STDMETHODCALLTYPE GetStreamStatistics(DWORD index,
+            AVFStreamStatistics* pStatistics) = 0;
+        virtual HRESULT STDMETHODCALLTYPE ResetStatistics(void) = 0;
+};
+
+
+// current time in microseconds - used to time the requests and the reads
+inline LONGLONG StatisticsTimestamp(void)
+{
+    return MFGetSystemTime() / 10;
+}
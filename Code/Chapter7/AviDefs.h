@@ -0,0 +1,248 @@
+#pragma once
+
+//
+// On-disk AVI/RIFF structures and helper definitions shared by the native AVI writing
+// code.  Everything in this file (and in the AviOutput/AviMuxer classes that use it) is
+// deliberately independent of Media Foundation so that the muxer can be compiled and
+// benchmarked outside of the sink DLL.
+//
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else
+
+#include <stdint.h>
+#include <wchar.h>
+
+typedef int32_t     HRESULT;
+typedef int32_t     LONG;
+typedef uint8_t     BYTE;
+typedef uint16_t    WORD;
+typedef uint32_t    DWORD;
+typedef int64_t     LONGLONG;
+typedef uint64_t    ULONGLONG;
+typedef wchar_t     WCHAR;
+
+#define S_OK                    ((HRESULT)0L)
+#define S_FALSE                 ((HRESULT)1L)
+#define E_NOTIMPL               ((HRESULT)0x80004001L)
+#define E_POINTER               ((HRESULT)0x80004003L)
+#define E_FAIL                  ((HRESULT)0x80004005L)
+#define E_UNEXPECTED            ((HRESULT)0x8000FFFFL)
+#define E_OUTOFMEMORY           ((HRESULT)0x8007000EL)
+#define E_INVALIDARG            ((HRESULT)0x80070057L)
+
+#define SEVERITY_ERROR          1
+#define FACILITY_ITF            4
+#define MAKE_HRESULT(sev,fac,code) \
+    ((HRESULT) (((uint32_t)(sev)<<31) | ((uint32_t)(fac)<<16) | ((uint32_t)(code))) )
+
+#define SUCCEEDED(hr)           (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)              (((HRESULT)(hr)) < 0)
+
+#endif
+
+
+#ifndef BREAK_ON_FAIL
+#define BREAK_ON_FAIL(value)            if(FAILED(value)) break;
+#endif
+
+#ifndef BREAK_ON_NULL
+#define BREAK_ON_NULL(value, newHr)     if(value == NULL) { hr = newHr; break; }
+#endif
+
+
+// errors reported by the native AVI writer
+#define AVI_E_WRITE_FAILED      MAKE_HRESULT(SEVERITY_ERROR, FACILITY_ITF, 0x0A11)
+#define AVI_E_FILE_TOO_LARGE    MAKE_HRESULT(SEVERITY_ERROR, FACILITY_ITF, 0x0A12)
+#define AVI_E_INVALID_STATE     MAKE_HRESULT(SEVERITY_ERROR, FACILITY_ITF, 0x0A13)
+
+
+// build a FourCC code out of four characters
+#define AVI_FOURCC(a, b, c, d) \
+    ((DWORD)(BYTE)(a) | ((DWORD)(BYTE)(b) << 8) | ((DWORD)(BYTE)(c) << 16) | ((DWORD)(BYTE)(d) << 24))
+
+const DWORD AVI_FCC_RIFF = AVI_FOURCC('R', 'I', 'F', 'F');
+const DWORD AVI_FCC_AVI  = AVI_FOURCC('A', 'V', 'I', ' ');
+const DWORD AVI_FCC_LIST = AVI_FOURCC('L', 'I', 'S', 'T');
+const DWORD AVI_FCC_JUNK = AVI_FOURCC('J', 'U', 'N', 'K');
+const DWORD AVI_FCC_HDRL = AVI_FOURCC('h', 'd', 'r', 'l');
+const DWORD AVI_FCC_AVIH = AVI_FOURCC('a', 'v', 'i', 'h');
+const DWORD AVI_FCC_STRL = AVI_FOURCC('s', 't', 'r', 'l');
+const DWORD AVI_FCC_STRH = AVI_FOURCC('s', 't', 'r', 'h');
+const DWORD AVI_FCC_STRF = AVI_FOURCC('s', 't', 'r', 'f');
+const DWORD AVI_FCC_MOVI = AVI_FOURCC('m', 'o', 'v', 'i');
+const DWORD AVI_FCC_IDX1 = AVI_FOURCC('i', 'd', 'x', '1');
+
+// OpenDML (AVI 2.0) extensions
+const DWORD AVI_FCC_AVIX = AVI_FOURCC('A', 'V', 'I', 'X');
+const DWORD AVI_FCC_INDX = AVI_FOURCC('i', 'n', 'd', 'x');
+const DWORD AVI_FCC_ODML = AVI_FOURCC('o', 'd', 'm', 'l');
+const DWORD AVI_FCC_DMLH = AVI_FOURCC('d', 'm', 'l', 'h');
+
+// stream types stored in AviStreamHeader::fccType
+const DWORD AVI_FCC_VIDS = AVI_FOURCC('v', 'i', 'd', 's');
+const DWORD AVI_FCC_AUDS = AVI_FOURCC('a', 'u', 'd', 's');
+
+// flags stored in AviMainHeader::dwFlags
+const DWORD AVI_FLAG_HAS_INDEX      = 0x00000010;
+const DWORD AVI_FLAG_IS_INTERLEAVED = 0x00000100;
+
+// flags stored in the idx1 index entries
+const DWORD AVI_INDEX_KEYFRAME = 0x00000010;
+
+// index types stored in the OpenDML 'indx' and 'ix##' chunks
+const BYTE AVI_INDEX_OF_INDEXES = 0x00;
+const BYTE AVI_INDEX_OF_CHUNKS  = 0x01;
+
+// bit set in the size of an OpenDML standard index entry for chunks that are not keyframes
+const DWORD AVI_INDEX_DELTA_FRAME = 0x80000000;
+
+
+#pragma pack(push, 1)
+
+// header of every RIFF chunk
+struct AviChunkHeader
+{
+    DWORD fcc;
+    DWORD cb;
+};
+
+// header of a RIFF or LIST chunk, followed by the list type
+struct AviListHeader
+{
+    DWORD fcc;
+    DWORD cb;
+    DWORD fccListType;
+};
+
+// contents of the 'avih' chunk
+struct AviMainHeader
+{
+    DWORD dwMicroSecPerFrame;
+    DWORD dwMaxBytesPerSec;
+    DWORD dwPaddingGranularity;
+    DWORD dwFlags;
+    DWORD dwTotalFrames;
+    DWORD dwInitialFrames;
+    DWORD dwStreams;
+    DWORD dwSuggestedBufferSize;
+    DWORD dwWidth;
+    DWORD dwHeight;
+    DWORD dwReserved[4];
+};
+
+// contents of the 'strh' chunk
+struct AviStreamHeader
+{
+    DWORD fccType;
+    DWORD fccHandler;
+    DWORD dwFlags;
+    WORD wPriority;
+    WORD wLanguage;
+    DWORD dwInitialFrames;
+    DWORD dwScale;
+    DWORD dwRate;
+    DWORD dwStart;
+    DWORD dwLength;
+    DWORD dwSuggestedBufferSize;
+    DWORD dwQuality;
+    DWORD dwSampleSize;
+    struct
+    {
+        short left;
+        short top;
+        short right;
+        short bottom;
+    } rcFrame;
+};
+
+// a single entry of the legacy 'idx1' index
+struct AviOldIndexEntry
+{
+    DWORD dwChunkId;
+    DWORD dwFlags;
+    DWORD dwOffset;
+    DWORD dwSize;
+};
+
+// header shared by the OpenDML super index ('indx') and standard index ('ix##') chunks
+struct AviIndexHeader
+{
+    WORD wLongsPerEntry;
+    BYTE bIndexSubType;
+    BYTE bIndexType;
+    DWORD nEntriesInUse;
+    DWORD dwChunkId;
+};
+
+// header of an OpenDML super index - the index entries follow it
+struct AviSuperIndexHeader
+{
+    AviIndexHeader header;
+    DWORD dwReserved[3];
+};
+
+// a single entry of an OpenDML super index, pointing at a standard index chunk
+struct AviSuperIndexEntry
+{
+    ULONGLONG qwOffset;         // file offset of the 'ix##' chunk header
+    DWORD dwSize;               // size of the 'ix##' chunk, including the chunk header
+    DWORD dwDuration;           // number of stream ticks covered by the standard index
+};
+
+// header of an OpenDML standard index - the index entries follow it
+struct AviStandardIndexHeader
+{
+    AviIndexHeader header;
+    ULONGLONG qwBaseOffset;     // base for the offsets stored in the entries
+    DWORD dwReserved;
+};
+
+// a single entry of an OpenDML standard index
+struct AviStandardIndexEntry
+{
+    DWORD dwOffset;             // offset of the chunk data relative to qwBaseOffset
+    DWORD dwSize;               // size of the chunk data, with AVI_INDEX_DELTA_FRAME
+};
+
+// contents of the OpenDML 'dmlh' chunk
+struct AviExtendedHeader
+{
+    DWORD dwGrandFrames;        // number of frames in the whole file
+    DWORD dwFuture[61];
+};
+
+#pragma pack(pop)
+
+
+//
+// Get the hexadecimal digit of a chunk ID for a value of 0 to 15
+//
+inline char AviHexDigit(DWORD value)
+{
+    return (char)((value > 9) ? ('A' + value - 10) : ('0' + value));
+}
+
+
+//
+// Build the chunk ID of the data chunks of a stream, such as '00dc' or '01wb', out of the
+// stream number and the two character chunk type.  Like MAKEAVICKID(), the stream number is
+// stored in hexadecimal - the eleventh stream has chunks such as '0Adc'.
+//
+inline DWORD AviChunkId(DWORD stream, char type1, char type2)
+{
+    return AVI_FOURCC(AviHexDigit((stream >> 4) & 0xF), AviHexDigit(stream & 0xF),
+        type1, type2);
+}
+
+
+//
+// Build the chunk ID of the OpenDML standard index chunks of a stream, such as 'ix00'
+//
+inline DWORD AviIndexChunkId(DWORD stream)
+{
+    return AVI_FOURCC('i', 'x', AviHexDigit((stream >> 4) & 0xF), AviHexDigit(stream & 0xF));
+}
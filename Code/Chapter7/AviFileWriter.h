@@ -1,40 +1,53 @@
-#pragma once
-
-#include <Vfw.h>
-#include <Mfobjects.h>
-#include <mfidl.h>
-#include <Mferror.h>
-#include <mfapi.h>
-
-#include <hash_map>
-using namespace std;
-
-#ifndef MF_MT_BITCOUNT
-DEFINE_GUID(MF_MT_BITCOUNT, 0xc496f370, 0x2f8b, 0x4f51, 0xae, 0x46, 0x9c, 0xfc, 0x1b, 0xc8, 0x2a, 0x47);
-#endif
-
-class CAviFileWriter
-{
-    public:
-        CAviFileWriter(const WCHAR* pFilename);
-        ~CAviFileWriter(void);
-
-        HRESULT AddStream(IMFMediaType* pMediaType, DWORD id);
-        HRESULT WriteSample(BYTE* pData, DWORD dataLength, DWORD streamId, bool isKeyframe = false);
-
-    private:
-        struct AviStreamData
-        {
-            IAVIStream* pStream;
-            ULONG nNextSample;
-            bool isAudio;
-        };
-
-        IAVIFile* m_pAviFile;        
-        hash_map<DWORD, AviStreamData*> m_streamHash;
-        WAVEFORMATEX*  m_pAudioFormat;
-
-        HRESULT AddAudioStream(IMFMediaType* pMT, IAVIStream** pStream);
-        HRESULT AddVideoStream(IMFMediaType* pMT, IAVIStream** pStream);
-};
-
+#pragma once
+
+#include <Mfobjects.h>
+#include <mfidl.h>
+#include <Mferror.h>
+#include <mfapi.h>
+#include <mmsystem.h>
+#include <mmreg.h>
+
+#include "AviMuxer.h"
+#include "AviWriteBehind.h"
+
+#include <hash_map>
+using namespace std;
+
+#ifndef MF_MT_BITCOUNT
+DEFINE_GUID(MF_MT_BITCOUNT, 0xc496f370, 0x2f8b, 0x4f51, 0xae, 0x46, 0x9c, 0xfc, 0x1b, 0xc8, 0x2a, 0x47);
+#endif
+
+//
+// Write the samples of the sink streams into an AVI file.  The media types of the streams
+// are converted to AVI stream headers and formats here, and the file itself is written by
+// the native AviMuxer - in the OpenDML layout, so the length of a recording is not limited
+// by the 4 GB size of a RIFF chunk.  With a non-zero queue depth the writes go through an
+// AviWriteBehindOutput, so the caller does not wait for the disk unless it falls behind.
+//
+class CAviFileWriter
+{
+    public:
+        static HRESULT CreateInstance(const WCHAR* pFilename, DWORD queueDepth,
+            ULONGLONG memoryCap, CAviFileWriter** ppWriter);
+        ~CAviFileWriter(void);
+
+        HRESULT AddStream(IMFMediaType* pMediaType, DWORD id);
+        HRESULT WriteSample(const AviDataSegment* pSegments, DWORD segmentCount, DWORD streamId,
+            bool isKeyframe = false);
+        HRESULT Finalize(void);
+
+        void GetWriteStatistics(AviWriteBehindStatistics* pStatistics);
+        void ResetWriteStatistics(void);
+
+    private:
+        CAviFileWriter(void);
+
+        AviMuxer* m_pMuxer;
+        AviWriteBehindOutput* m_pWriteBehind;     // owned by the muxer, NULL if not used
+
+        // number of the muxer stream of every sink stream ID
+        hash_map<DWORD, DWORD> m_streamHash;
+
+        HRESULT AddAudioStream(IMFMediaType* pMT, DWORD* pStream);
+        HRESULT AddVideoStream(IMFMediaType* pMT, DWORD* pStream);
+};
@@ -0,0 +1,945 @@
+#include "AviMuxer.h"
+
+#include <new>
+#include <string.h>
+
+
+//
+// Create a muxer writing into the specified output - the muxer takes ownership of the
+// output, and deletes it when it is deleted
+//
+AviMuxer::AviMuxer(AviOutput* pOutput) :
+    m_pOutput(pOutput),
+    m_pBlock(NULL),
+    m_blockUsed(0),
+    m_blockOffset(0),
+    m_mainHeaderOffset(0),
+    m_extendedHeaderOffset(0),
+    m_segment(0),
+    m_riffOffset(0),
+    m_movieListOffset(0),
+    m_firstSegmentFrames(0),
+    m_headersWritten(false),
+    m_finalized(false)
+{
+}
+
+
+AviMuxer::~AviMuxer(void)
+{
+    delete [] m_pBlock;
+    delete m_pOutput;
+}
+
+
+//
+// Add a stream to the file.  The length and the suggested buffer size in the header are
+// filled in by the muxer.  Returns the number of the stream, which is passed to
+// WriteChunk().
+//
+HRESULT AviMuxer::AddStream(const AviStreamHeader& header, const BYTE* pFormat, DWORD cbFormat,
+    DWORD* pStream)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        BREAK_ON_NULL(pStream, E_POINTER);
+
+        if(pFormat == NULL && cbFormat > 0)
+        {
+            hr = E_POINTER;
+            break;
+        }
+
+        // the stream headers are written in front of the movie data
+        if(m_headersWritten)
+        {
+            hr = AVI_E_INVALID_STATE;
+            break;
+        }
+
+        // chunk IDs have room for two hexadecimal digits of the stream number
+        if(m_streams.size() >= 256)
+        {
+            hr = E_INVALIDARG;
+            break;
+        }
+
+        AviMuxerStream stream;
+        stream.header = header;
+        stream.header.dwLength = 0;
+        stream.header.dwSuggestedBufferSize = 0;
+        stream.chunks = 0;
+        stream.bytes = 0;
+        stream.maxChunkSize = 0;
+        stream.headerOffset = 0;
+        stream.superIndexOffset = 0;
+        stream.segmentStart = 0;
+
+        if(header.fccType == AVI_FCC_AUDS)
+        {
+            stream.chunkId = AviChunkId((DWORD)m_streams.size(), 'w', 'b');
+        }
+        else
+        {
+            stream.chunkId = AviChunkId((DWORD)m_streams.size(), 'd', 'c');
+        }
+
+        try
+        {
+            stream.format.assign(pFormat, pFormat + cbFormat);
+            m_streams.push_back(stream);
+        }
+        catch(...)
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        *pStream = (DWORD)m_streams.size() - 1;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Write a data chunk of the specified stream from a single buffer
+//
+HRESULT AviMuxer::WriteChunk(DWORD stream, const BYTE* pData, DWORD cbData, bool isKeyframe)
+{
+    AviDataSegment segment;
+
+    segment.pData = pData;
+    segment.cbData = cbData;
+
+    return WriteChunk(stream, &segment, 1, isKeyframe);
+}
+
+
+//
+// Write a data chunk of the specified stream, with the chunk data gathered from several
+// segments, and add it to the indexes.  A new RIFF chunk is started first if the data
+// chunk does not fit into the current one.  Large segments are written straight from the
+// caller's memory, so the memory only has to stay valid for the duration of the call.
+//
+HRESULT AviMuxer::WriteChunk(DWORD stream, const AviDataSegment* pSegments,
+    DWORD segmentCount, bool isKeyframe)
+{
+    HRESULT hr = S_OK;
+    static const BYTE padding = 0;
+    DWORD cbData = 0;
+
+    do
+    {
+        if(pSegments == NULL && segmentCount > 0)
+        {
+            hr = E_POINTER;
+            break;
+        }
+
+        // the chunk size is the total size of the segments
+        for(DWORD x = 0; x < segmentCount; x++)
+        {
+            if(pSegments[x].pData == NULL && pSegments[x].cbData > 0)
+            {
+                hr = E_POINTER;
+                break;
+            }
+
+            if(pSegments[x].cbData > AVI_INDEX_DELTA_FRAME - 1 - cbData)
+            {
+                hr = E_INVALIDARG;
+                break;
+            }
+
+            cbData += pSegments[x].cbData;
+        }
+        BREAK_ON_FAIL(hr);
+
+        if(stream >= m_streams.size())
+        {
+            hr = E_INVALIDARG;
+            break;
+        }
+
+        if(m_finalized)
+        {
+            hr = AVI_E_INVALID_STATE;
+            break;
+        }
+
+        if(!m_headersWritten)
+        {
+            hr = WriteHeaders();
+            BREAK_ON_FAIL(hr);
+        }
+
+        // the chunk, the padding, and the indexes written when the RIFF chunk is closed
+        // have to fit into the current RIFF chunk - otherwise close it and start a new one
+        ULONGLONG cbChunk = sizeof(AviChunkHeader) + cbData + (cbData & 1);
+
+        if(BytesWritten() + cbChunk + SegmentTrailerSize(stream) - m_riffOffset >
+            AVI_MUXER_SEGMENT_SIZE)
+        {
+            // a chunk that does not even fit into an empty RIFF chunk cannot be written,
+            // and neither can a RIFF chunk that has no room in the super indexes
+            if(BytesWritten() == m_movieListOffset + sizeof(AviListHeader) ||
+                m_segment + 1 >= AVI_MUXER_SUPER_INDEX_SIZE)
+            {
+                hr = AVI_E_FILE_TOO_LARGE;
+                break;
+            }
+
+            hr = CloseSegment();
+            BREAK_ON_FAIL(hr);
+
+            hr = OpenSegment();
+            BREAK_ON_FAIL(hr);
+        }
+
+        ULONGLONG chunkOffset = BytesWritten();
+        AviMuxerStream& muxerStream = m_streams[stream];
+
+        // the standard index offsets point at the chunk data, relative to the 'movi' list
+        AviStandardIndexEntry entry;
+        entry.dwOffset = (DWORD)(chunkOffset + sizeof(AviChunkHeader) - m_movieListOffset);
+        entry.dwSize = cbData | (isKeyframe ? 0 : AVI_INDEX_DELTA_FRAME);
+
+        // the idx1 offsets point at the chunk header, relative to the 'movi' list type
+        AviOldIndexEntry legacyEntry;
+        legacyEntry.dwChunkId = muxerStream.chunkId;
+        legacyEntry.dwFlags = isKeyframe ? AVI_INDEX_KEYFRAME : 0;
+        legacyEntry.dwOffset =
+            (DWORD)(chunkOffset - (m_movieListOffset + sizeof(AviChunkHeader)));
+        legacyEntry.dwSize = cbData;
+
+        try
+        {
+            muxerStream.segmentIndex.push_back(entry);
+
+            // only the first RIFF chunk has an idx1 index
+            if(m_segment == 0)
+            {
+                m_index.push_back(legacyEntry);
+            }
+        }
+        catch(...)
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        hr = AppendChunkHeader(muxerStream.chunkId, cbData);
+        BREAK_ON_FAIL(hr);
+
+        for(DWORD x = 0; x < segmentCount; x++)
+        {
+            hr = Append(pSegments[x].pData, pSegments[x].cbData);
+            BREAK_ON_FAIL(hr);
+        }
+        BREAK_ON_FAIL(hr);
+
+        // RIFF chunks start at even offsets
+        if((cbData & 1) != 0)
+        {
+            hr = Append(&padding, 1);
+            BREAK_ON_FAIL(hr);
+        }
+
+        muxerStream.chunks++;
+        muxerStream.bytes += cbData;
+        if(cbData > muxerStream.maxChunkSize)
+        {
+            muxerStream.maxChunkSize = cbData;
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Complete the file - close the last RIFF chunk, write whatever is left in the block
+// buffer, and then patch the sizes, counters and super indexes in the headers
+//
+HRESULT AviMuxer::Finalize(void)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        if(m_finalized)
+        {
+            break;
+        }
+
+        // a file without any data still gets its headers
+        if(!m_headersWritten)
+        {
+            hr = WriteHeaders();
+            BREAK_ON_FAIL(hr);
+        }
+
+        hr = CloseSegment();
+        BREAK_ON_FAIL(hr);
+
+        hr = FlushBlock();
+        BREAK_ON_FAIL(hr);
+
+        hr = PatchHeaders();
+        BREAK_ON_FAIL(hr);
+
+        hr = m_pOutput->Flush();
+        BREAK_ON_FAIL(hr);
+
+        m_finalized = true;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Write the RIFF header, the 'hdrl' list with the main and stream headers, and the header
+// of the first 'movi' list.  Every stream header list gets an 'indx' super index with room
+// for AVI_MUXER_SUPER_INDEX_SIZE entries, and the header list gets the OpenDML 'odml' list.
+// The sizes and indexes that are not known yet are patched by Finalize().
+//
+HRESULT AviMuxer::WriteHeaders(void)
+{
+    HRESULT hr = S_OK;
+    AviMainHeader mainHeader;
+    AviSuperIndexHeader superIndexHeader;
+    AviSuperIndexEntry superIndexEntry;
+    AviExtendedHeader extendedHeader;
+    static const BYTE padding = 0;
+
+    const DWORD cbSuperIndex = sizeof(AviSuperIndexHeader) +
+        AVI_MUXER_SUPER_INDEX_SIZE * sizeof(AviSuperIndexEntry);
+
+    do
+    {
+        // an output with buffers of its own gets the data directly
+        if(!m_pOutput->IsBuffered())
+        {
+            m_pBlock = new (std::nothrow) BYTE[AVI_MUXER_BLOCK_SIZE];
+            BREAK_ON_NULL(m_pBlock, E_OUTOFMEMORY);
+        }
+
+        // the size of the header list can be computed up front
+        DWORD cbHeaderList = sizeof(DWORD) + sizeof(AviChunkHeader) + sizeof(AviMainHeader);
+        for(size_t i = 0; i < m_streams.size(); i++)
+        {
+            DWORD cbFormat = (DWORD)m_streams[i].format.size();
+
+            cbHeaderList += sizeof(AviListHeader) +
+                sizeof(AviChunkHeader) + sizeof(AviStreamHeader) +
+                sizeof(AviChunkHeader) + cbFormat + (cbFormat & 1) +
+                sizeof(AviChunkHeader) + cbSuperIndex;
+        }
+        cbHeaderList += sizeof(AviListHeader) +
+            sizeof(AviChunkHeader) + sizeof(AviExtendedHeader);
+
+        hr = AppendListHeader(AVI_FCC_RIFF, 0, AVI_FCC_AVI);
+        BREAK_ON_FAIL(hr);
+
+        hr = AppendListHeader(AVI_FCC_LIST, cbHeaderList, AVI_FCC_HDRL);
+        BREAK_ON_FAIL(hr);
+
+        hr = AppendChunkHeader(AVI_FCC_AVIH, sizeof(AviMainHeader));
+        BREAK_ON_FAIL(hr);
+
+        m_mainHeaderOffset = BytesWritten();
+        FillMainHeader(&mainHeader);
+
+        hr = Append(&mainHeader, sizeof(mainHeader));
+        BREAK_ON_FAIL(hr);
+
+        for(size_t i = 0; i < m_streams.size(); i++)
+        {
+            AviMuxerStream& stream = m_streams[i];
+            DWORD cbFormat = (DWORD)stream.format.size();
+
+            hr = AppendListHeader(AVI_FCC_LIST, sizeof(DWORD) +
+                sizeof(AviChunkHeader) + sizeof(AviStreamHeader) +
+                sizeof(AviChunkHeader) + cbFormat + (cbFormat & 1) +
+                sizeof(AviChunkHeader) + cbSuperIndex, AVI_FCC_STRL);
+            BREAK_ON_FAIL(hr);
+
+            hr = AppendChunkHeader(AVI_FCC_STRH, sizeof(AviStreamHeader));
+            BREAK_ON_FAIL(hr);
+
+            stream.headerOffset = BytesWritten();
+
+            hr = Append(&stream.header, sizeof(AviStreamHeader));
+            BREAK_ON_FAIL(hr);
+
+            hr = AppendChunkHeader(AVI_FCC_STRF, cbFormat);
+            BREAK_ON_FAIL(hr);
+
+            if(cbFormat > 0)
+            {
+                hr = Append(&stream.format[0], cbFormat);
+                BREAK_ON_FAIL(hr);
+            }
+
+            if((cbFormat & 1) != 0)
+            {
+                hr = Append(&padding, 1);
+                BREAK_ON_FAIL(hr);
+            }
+
+            // the super index starts out empty, with all of its entries reserved
+            hr = AppendChunkHeader(AVI_FCC_INDX, cbSuperIndex);
+            BREAK_ON_FAIL(hr);
+
+            stream.superIndexOffset = BytesWritten();
+
+            memset(&superIndexHeader, 0, sizeof(superIndexHeader));
+            superIndexHeader.header.wLongsPerEntry = sizeof(AviSuperIndexEntry) / sizeof(DWORD);
+            superIndexHeader.header.bIndexType = AVI_INDEX_OF_INDEXES;
+            superIndexHeader.header.dwChunkId = stream.chunkId;
+
+            hr = Append(&superIndexHeader, sizeof(superIndexHeader));
+            BREAK_ON_FAIL(hr);
+
+            memset(&superIndexEntry, 0, sizeof(superIndexEntry));
+            for(DWORD entry = 0; entry < AVI_MUXER_SUPER_INDEX_SIZE; entry++)
+            {
+                hr = Append(&superIndexEntry, sizeof(superIndexEntry));
+                BREAK_ON_FAIL(hr);
+            }
+            BREAK_ON_FAIL(hr);
+        }
+        BREAK_ON_FAIL(hr);
+
+        hr = AppendListHeader(AVI_FCC_LIST, sizeof(DWORD) +
+            sizeof(AviChunkHeader) + sizeof(AviExtendedHeader), AVI_FCC_ODML);
+        BREAK_ON_FAIL(hr);
+
+        hr = AppendChunkHeader(AVI_FCC_DMLH, sizeof(AviExtendedHeader));
+        BREAK_ON_FAIL(hr);
+
+        m_extendedHeaderOffset = BytesWritten();
+        memset(&extendedHeader, 0, sizeof(extendedHeader));
+
+        hr = Append(&extendedHeader, sizeof(extendedHeader));
+        BREAK_ON_FAIL(hr);
+
+        m_riffOffset = 0;
+        m_movieListOffset = BytesWritten();
+
+        hr = AppendListHeader(AVI_FCC_LIST, 0, AVI_FCC_MOVI);
+        BREAK_ON_FAIL(hr);
+
+        m_headersWritten = true;
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Start a new 'RIFF AVIX' chunk with its own 'movi' list
+//
+HRESULT AviMuxer::OpenSegment(void)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        m_segment++;
+        m_riffOffset = BytesWritten();
+
+        hr = AppendListHeader(AVI_FCC_RIFF, 0, AVI_FCC_AVIX);
+        BREAK_ON_FAIL(hr);
+
+        m_movieListOffset = BytesWritten();
+
+        hr = AppendListHeader(AVI_FCC_LIST, 0, AVI_FCC_MOVI);
+        BREAK_ON_FAIL(hr);
+
+        // the standard indexes of the new RIFF chunk cover the stream from here on
+        for(size_t i = 0; i < m_streams.size(); i++)
+        {
+            m_streams[i].segmentStart = m_streams[i].Length();
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Close the current RIFF chunk - write the standard indexes of its chunks at the end of its
+// 'movi' list, and the idx1 index after the first 'movi' list, and then store the final
+// sizes of the list and of the RIFF chunk.  The idx1 index is written when the first RIFF
+// chunk is closed, which is at the first rollover of a long recording - it does not mean
+// that the file is complete.
+//
+HRESULT AviMuxer::CloseSegment(void)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        for(DWORD i = 0; i < m_streams.size(); i++)
+        {
+            if(!m_streams[i].segmentIndex.empty())
+            {
+                hr = WriteStandardIndex(i);
+                BREAK_ON_FAIL(hr);
+            }
+        }
+        BREAK_ON_FAIL(hr);
+
+        DWORD cbMovieList = (DWORD)(BytesWritten() - m_movieListOffset -
+            sizeof(AviChunkHeader));
+
+        hr = Patch(m_movieListOffset + sizeof(DWORD), &cbMovieList, sizeof(cbMovieList));
+        BREAK_ON_FAIL(hr);
+
+        if(m_segment == 0)
+        {
+            hr = WriteLegacyIndex();
+            BREAK_ON_FAIL(hr);
+
+            // the frame count in the main header only covers the first RIFF chunk
+            for(size_t i = 0; i < m_streams.size(); i++)
+            {
+                if(m_streams[i].header.fccType == AVI_FCC_VIDS)
+                {
+                    m_firstSegmentFrames = (DWORD)m_streams[i].chunks;
+                    break;
+                }
+            }
+        }
+
+        DWORD cbRiff = (DWORD)(BytesWritten() - m_riffOffset - sizeof(AviChunkHeader));
+
+        hr = Patch(m_riffOffset + sizeof(DWORD), &cbRiff, sizeof(cbRiff));
+        BREAK_ON_FAIL(hr);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Compute the size of the indexes that are written when the current RIFF chunk is closed,
+// including an entry for one more chunk of the specified stream
+//
+ULONGLONG AviMuxer::SegmentTrailerSize(DWORD stream) const
+{
+    ULONGLONG cbTrailer = 0;
+
+    for(DWORD i = 0; i < m_streams.size(); i++)
+    {
+        ULONGLONG entries = m_streams[i].segmentIndex.size() + ((i == stream) ? 1 : 0);
+
+        if(entries > 0)
+        {
+            cbTrailer += sizeof(AviChunkHeader) + sizeof(AviStandardIndexHeader) +
+                entries * sizeof(AviStandardIndexEntry);
+        }
+    }
+
+    if(m_segment == 0)
+    {
+        cbTrailer += sizeof(AviChunkHeader) + (m_index.size() + 1) * sizeof(AviOldIndexEntry);
+    }
+
+    return cbTrailer;
+}
+
+
+//
+// Write the 'ix##' standard index of the chunks that the specified stream has in the
+// current RIFF chunk, and remember its location for the super index of the stream
+//
+HRESULT AviMuxer::WriteStandardIndex(DWORD stream)
+{
+    HRESULT hr = S_OK;
+    AviMuxerStream& muxerStream = m_streams[stream];
+    AviStandardIndexHeader header;
+    AviSuperIndexEntry superIndexEntry;
+    DWORD cbEntries = (DWORD)(muxerStream.segmentIndex.size() * sizeof(AviStandardIndexEntry));
+
+    do
+    {
+        memset(&header, 0, sizeof(header));
+        header.header.wLongsPerEntry = sizeof(AviStandardIndexEntry) / sizeof(DWORD);
+        header.header.bIndexType = AVI_INDEX_OF_CHUNKS;
+        header.header.nEntriesInUse = (DWORD)muxerStream.segmentIndex.size();
+        header.header.dwChunkId = muxerStream.chunkId;
+        header.qwBaseOffset = m_movieListOffset;
+
+        superIndexEntry.qwOffset = BytesWritten();
+        superIndexEntry.dwSize = sizeof(AviChunkHeader) + sizeof(header) + cbEntries;
+        superIndexEntry.dwDuration = (DWORD)(muxerStream.Length() - muxerStream.segmentStart);
+
+        try
+        {
+            muxerStream.superIndex.push_back(superIndexEntry);
+        }
+        catch(...)
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        hr = AppendChunkHeader(AviIndexChunkId(stream), sizeof(header) + cbEntries);
+        BREAK_ON_FAIL(hr);
+
+        hr = Append(&header, sizeof(header));
+        BREAK_ON_FAIL(hr);
+
+        hr = Append(&muxerStream.segmentIndex[0], cbEntries);
+        BREAK_ON_FAIL(hr);
+
+        // the entries are on disk now - the memory is reused for the next RIFF chunk
+        muxerStream.segmentIndex.clear();
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Write the 'idx1' chunk after the first 'movi' list, and release its entries
+//
+HRESULT AviMuxer::WriteLegacyIndex(void)
+{
+    HRESULT hr = S_OK;
+    DWORD cbIndex = (DWORD)(m_index.size() * sizeof(AviOldIndexEntry));
+
+    do
+    {
+        hr = AppendChunkHeader(AVI_FCC_IDX1, cbIndex);
+        BREAK_ON_FAIL(hr);
+
+        if(cbIndex > 0)
+        {
+            hr = Append(&m_index[0], cbIndex);
+            BREAK_ON_FAIL(hr);
+        }
+
+        std::vector<AviOldIndexEntry>().swap(m_index);
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Store the final main, stream and extended headers, and the super indexes of the streams.
+// Called after all of the data is written to the output.  The entry counts of the super
+// indexes are patched last - a reader that follows the file while it is recorded takes a
+// super index that points into the last RIFF chunk as the sign that the file is complete,
+// so everything else has to be in place by then.
+//
+HRESULT AviMuxer::PatchHeaders(void)
+{
+    HRESULT hr = S_OK;
+    AviMainHeader mainHeader;
+    AviIndexHeader superIndexHeader;
+    AviExtendedHeader extendedHeader;
+
+    memset(&extendedHeader, 0, sizeof(extendedHeader));
+
+    do
+    {
+        FillMainHeader(&mainHeader);
+
+        hr = Patch(m_mainHeaderOffset, &mainHeader, sizeof(mainHeader));
+        BREAK_ON_FAIL(hr);
+
+        for(size_t i = 0; i < m_streams.size(); i++)
+        {
+            AviMuxerStream& stream = m_streams[i];
+
+            // the stream length covers all of the RIFF chunks
+            stream.header.dwLength = (DWORD)stream.Length();
+            stream.header.dwSuggestedBufferSize = stream.maxChunkSize;
+
+            hr = Patch(stream.headerOffset, &stream.header, sizeof(AviStreamHeader));
+            BREAK_ON_FAIL(hr);
+
+            if(!stream.superIndex.empty())
+            {
+                hr = Patch(stream.superIndexOffset + sizeof(AviSuperIndexHeader),
+                    &stream.superIndex[0],
+                    (DWORD)(stream.superIndex.size() * sizeof(AviSuperIndexEntry)));
+                BREAK_ON_FAIL(hr);
+            }
+
+            if(extendedHeader.dwGrandFrames == 0 && stream.header.fccType == AVI_FCC_VIDS)
+            {
+                extendedHeader.dwGrandFrames = (DWORD)stream.chunks;
+            }
+        }
+        BREAK_ON_FAIL(hr);
+
+        hr = Patch(m_extendedHeaderOffset, &extendedHeader, sizeof(extendedHeader));
+        BREAK_ON_FAIL(hr);
+
+        for(size_t i = 0; i < m_streams.size(); i++)
+        {
+            const AviMuxerStream& stream = m_streams[i];
+
+            memset(&superIndexHeader, 0, sizeof(superIndexHeader));
+            superIndexHeader.wLongsPerEntry = sizeof(AviSuperIndexEntry) / sizeof(DWORD);
+            superIndexHeader.bIndexType = AVI_INDEX_OF_INDEXES;
+            superIndexHeader.nEntriesInUse = (DWORD)stream.superIndex.size();
+            superIndexHeader.dwChunkId = stream.chunkId;
+
+            hr = Patch(stream.superIndexOffset, &superIndexHeader, sizeof(superIndexHeader));
+            BREAK_ON_FAIL(hr);
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Fill in the main header from the stream headers and from the data written so far - the
+// frame rate, frame size and frame count come from the first video stream
+//
+void AviMuxer::FillMainHeader(AviMainHeader* pMainHeader) const
+{
+    const AviMuxerStream* pVideo = NULL;
+    ULONGLONG totalBytes = 0;
+    DWORD maxChunkSize = 0;
+
+    memset(pMainHeader, 0, sizeof(AviMainHeader));
+
+    for(size_t i = 0; i < m_streams.size(); i++)
+    {
+        if(pVideo == NULL && m_streams[i].header.fccType == AVI_FCC_VIDS)
+        {
+            pVideo = &m_streams[i];
+        }
+
+        totalBytes += m_streams[i].bytes;
+        if(m_streams[i].maxChunkSize > maxChunkSize)
+        {
+            maxChunkSize = m_streams[i].maxChunkSize;
+        }
+    }
+
+    pMainHeader->dwFlags = AVI_FLAG_HAS_INDEX | AVI_FLAG_IS_INTERLEAVED;
+    pMainHeader->dwStreams = (DWORD)m_streams.size();
+    pMainHeader->dwSuggestedBufferSize = maxChunkSize + sizeof(AviChunkHeader);
+
+    if(pVideo != NULL && pVideo->header.dwRate > 0)
+    {
+        const AviStreamHeader& video = pVideo->header;
+
+        pMainHeader->dwMicroSecPerFrame =
+            (DWORD)((ULONGLONG)video.dwScale * 1000000 / video.dwRate);
+        pMainHeader->dwTotalFrames = m_firstSegmentFrames;
+        pMainHeader->dwWidth = video.rcFrame.right - video.rcFrame.left;
+        pMainHeader->dwHeight = video.rcFrame.bottom - video.rcFrame.top;
+
+        // average data rate over the duration of the video
+        ULONGLONG duration = pVideo->chunks * video.dwScale;
+        if(duration > 0)
+        {
+            pMainHeader->dwMaxBytesPerSec = (DWORD)(totalBytes * video.dwRate / duration);
+        }
+    }
+}
+
+
+//
+// Overwrite data that was already added to the file.  The part of the data that is still
+// in the block buffer is changed there, and the rest is written to the output.
+//
+HRESULT AviMuxer::Patch(ULONGLONG offset, const void* pData, DWORD cbData)
+{
+    HRESULT hr = S_OK;
+    const BYTE* pBytes = (const BYTE*)pData;
+
+    if(offset + cbData > m_blockOffset)
+    {
+        ULONGLONG start = (offset > m_blockOffset) ? offset : m_blockOffset;
+
+        memcpy(m_pBlock + (DWORD)(start - m_blockOffset), pBytes + (DWORD)(start - offset),
+            (DWORD)(offset + cbData - start));
+    }
+
+    if(offset < m_blockOffset)
+    {
+        DWORD cbOutput = cbData;
+        if(offset + cbOutput > m_blockOffset)
+        {
+            cbOutput = (DWORD)(m_blockOffset - offset);
+        }
+
+        hr = m_pOutput->WriteAt(offset, pBytes, cbOutput);
+    }
+
+    return hr;
+}
+
+
+//
+// Add data to the end of the file.  Small data is collected in the block buffer, which is
+// written out whenever it fills up.  Large data that reaches past the end of the block
+// buffer is not copied - the part of it that completes the last whole block is written
+// straight from the caller's buffer, together with whatever is in the block buffer, in a
+// single gather write, and only the rest goes into the block buffer.  Either way, every
+// write starts at a multiple of the block size and covers whole blocks.  Without a block
+// buffer the output buffers the data itself, and gets it directly.
+//
+HRESULT AviMuxer::Append(const void* pData, DWORD cbData)
+{
+    HRESULT hr = S_OK;
+    const BYTE* pBytes = (const BYTE*)pData;
+
+    if(m_pBlock == NULL)
+    {
+        hr = m_pOutput->WriteAt(m_blockOffset, pBytes, cbData);
+
+        if(SUCCEEDED(hr))
+        {
+            m_blockOffset += cbData;
+        }
+
+        return hr;
+    }
+
+    if(cbData >= AVI_MUXER_DIRECT_WRITE_SIZE &&
+        m_blockUsed + (ULONGLONG)cbData >= AVI_MUXER_BLOCK_SIZE)
+    {
+        AviDataSegment segments[2];
+        DWORD segmentCount = 0;
+        ULONGLONG cbWrite = (m_blockUsed + (ULONGLONG)cbData) / AVI_MUXER_BLOCK_SIZE *
+            AVI_MUXER_BLOCK_SIZE;
+        DWORD cbDirect = (DWORD)(cbWrite - m_blockUsed);
+
+        if(m_blockUsed > 0)
+        {
+            segments[segmentCount].pData = m_pBlock;
+            segments[segmentCount].cbData = m_blockUsed;
+            segmentCount++;
+        }
+
+        segments[segmentCount].pData = pBytes;
+        segments[segmentCount].cbData = cbDirect;
+        segmentCount++;
+
+        hr = m_pOutput->WriteGatherAt(m_blockOffset, segments, segmentCount);
+        if(FAILED(hr))
+        {
+            return hr;
+        }
+
+        m_blockOffset += cbWrite;
+        m_blockUsed = 0;
+
+        // the rest is smaller than a block
+        pBytes += cbDirect;
+        cbData -= cbDirect;
+    }
+
+    while(cbData > 0)
+    {
+        DWORD cbCopy = AVI_MUXER_BLOCK_SIZE - m_blockUsed;
+        if(cbCopy > cbData)
+        {
+            cbCopy = cbData;
+        }
+
+        memcpy(m_pBlock + m_blockUsed, pBytes, cbCopy);
+        m_blockUsed += cbCopy;
+        pBytes += cbCopy;
+        cbData -= cbCopy;
+
+        if(m_blockUsed == AVI_MUXER_BLOCK_SIZE)
+        {
+            hr = FlushBlock();
+            BREAK_ON_FAIL(hr);
+        }
+    }
+
+    return hr;
+}
+
+
+//
+// Add the header of a chunk to the end of the file
+//
+HRESULT AviMuxer::AppendChunkHeader(DWORD fcc, DWORD cb)
+{
+    AviChunkHeader header;
+
+    header.fcc = fcc;
+    header.cb = cb;
+
+    return Append(&header, sizeof(header));
+}
+
+
+//
+// Add the header of a RIFF chunk or of a list to the end of the file
+//
+HRESULT AviMuxer::AppendListHeader(DWORD fcc, DWORD cb, DWORD fccListType)
+{
+    AviListHeader header;
+
+    header.fcc = fcc;
+    header.cb = cb;
+    header.fccListType = fccListType;
+
+    return Append(&header, sizeof(header));
+}
+
+
+//
+// Write the contents of the block buffer to the output
+//
+HRESULT AviMuxer::FlushBlock(void)
+{
+    HRESULT hr = S_OK;
+
+    if(m_blockUsed > 0)
+    {
+        hr = m_pOutput->WriteAt(m_blockOffset, m_pBlock, m_blockUsed);
+
+        if(SUCCEEDED(hr))
+        {
+            m_blockOffset += m_blockUsed;
+            m_blockUsed = 0;
+        }
+    }
+
+    return hr;
+}
+
+
+//
+// Length of the stream in the units of its header - streams with a fixed sample size
+// count their length in samples, the rest in chunks
+//
+ULONGLONG AviMuxerStream::Length(void) const
+{
+    if(header.dwSampleSize > 0)
+    {
+        return bytes / header.dwSampleSize;
+    }
+
+    return chunks;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "AviDefs.h"
+#include "AviOutput.h"
+
+#include <vector>
+
+
+// size of the block buffer in which the headers and the small data chunks are collected
+// before they are written to the output
+#define AVI_MUXER_BLOCK_SIZE        (1024 * 1024)
+
+// data at least this large is not copied into the block buffer when it fills the buffer
+// up - the whole blocks are written straight from the caller's memory, in a single gather
+// write with the contents of the block buffer, and only the rest is copied
+#define AVI_MUXER_DIRECT_WRITE_SIZE (256 * 1024)
+
+// size at which the current RIFF chunk is closed and a new 'AVIX' RIFF chunk is started -
+// well below the 4 GB limit of the 32-bit chunk sizes, and at the 1 GB size that older
+// readers of the first RIFF chunk expect
+#ifndef AVI_MUXER_SEGMENT_SIZE
+#define AVI_MUXER_SEGMENT_SIZE      (1024ULL * 1024 * 1024)
+#endif
+
+// number of entries reserved in the 'indx' super index of every stream - every RIFF chunk
+// uses at most one entry per stream, so this limits the file to 256 segments of 1 GB
+#define AVI_MUXER_SUPER_INDEX_SIZE  256
+
+
+// State of one of the streams written into the AVI file
+struct AviMuxerStream
+{
+    AviStreamHeader header;         // contents of the 'strh' chunk - patched at the end
+    std::vector<BYTE> format;       // contents of the 'strf' chunk
+    DWORD chunkId;                  // ID of the data chunks, such as '00dc' or '01wb'
+    ULONGLONG chunks;               // number of data chunks written
+    ULONGLONG bytes;                // number of payload bytes written
+    DWORD maxChunkSize;             // size of the largest data chunk payload
+    ULONGLONG headerOffset;         // file offset of the 'strh' payload
+    ULONGLONG superIndexOffset;     // file offset of the 'indx' payload
+
+    ULONGLONG segmentStart;         // stream length at the start of the current RIFF chunk
+    std::vector<AviStandardIndexEntry> segmentIndex;    // chunks of the current RIFF chunk
+    std::vector<AviSuperIndexEntry> superIndex;         // 'ix##' chunks of closed RIFF chunks
+
+    ULONGLONG Length(void) const;
+};
+
+
+//
+// Native RIFF/AVI writer.  The headers and the small data chunks are collected in a large
+// block buffer that is written to the output whenever it fills up, so the file is written
+// in a few large sequential writes instead of one small write per sample.  Every write
+// starts at a multiple of the block size and covers whole blocks, except for the last one
+// and the header patches.  Most of the payload of large chunks is never copied - it is
+// passed to the output as part of a gather write.
+// An output that buffers the data itself, such as the write-behind stage, gets every write
+// directly instead, so the data is not copied twice.
+//
+// Files are written in the OpenDML (AVI 2.0) layout, so that their length is not limited
+// by the 32-bit RIFF sizes.  Once the current RIFF chunk reaches AVI_MUXER_SEGMENT_SIZE it
+// is closed, and the data continues in a new 'RIFF AVIX' chunk.  When a RIFF chunk is
+// closed an 'ix##' standard index of its chunks is written for every stream at the end of
+// its 'movi' list, and only the location of that index is kept for the 'indx' super index
+// in the stream header.  The first RIFF chunk also gets the legacy 'idx1' index for
+// readers that do not understand OpenDML.  This way the index memory never grows beyond
+// the index of a single RIFF chunk.  The sizes, counters and super indexes in the headers
+// are patched in place when the file is finalized, and the entry counts of the super
+// indexes go last, so a reader following the recording can tell when the file is complete.
+//
+// All streams have to be added before the first data chunk is written.
+//
+class AviMuxer
+{
+    public:
+        AviMuxer(AviOutput* pOutput);
+        ~AviMuxer(void);
+
+        HRESULT AddStream(const AviStreamHeader& header, const BYTE* pFormat, DWORD cbFormat,
+            DWORD* pStream);
+        HRESULT WriteChunk(DWORD stream, const BYTE* pData, DWORD cbData, bool isKeyframe);
+        HRESULT WriteChunk(DWORD stream, const AviDataSegment* pSegments, DWORD segmentCount,
+            bool isKeyframe);
+        HRESULT Finalize(void);
+
+        DWORD StreamCount(void) const               { return (DWORD)m_streams.size(); };
+        ULONGLONG BytesWritten(void) const          { return m_blockOffset + m_blockUsed; };
+        bool IsFinalized(void) const                { return m_finalized; };
+
+    private:
+        HRESULT WriteHeaders(void);
+        HRESULT WriteLegacyIndex(void);
+        HRESULT WriteStandardIndex(DWORD stream);
+        HRESULT OpenSegment(void);
+        HRESULT CloseSegment(void);
+        ULONGLONG SegmentTrailerSize(DWORD stream) const;
+        HRESULT PatchHeaders(void);
+        HRESULT Patch(ULONGLONG offset, const void* pData, DWORD cbData);
+        HRESULT Append(const void* pData, DWORD cbData);
+        HRESULT AppendChunkHeader(DWORD fcc, DWORD cb);
+        HRESULT AppendListHeader(DWORD fcc, DWORD cb, DWORD fccListType);
+        HRESULT FlushBlock(void);
+        void FillMainHeader(AviMainHeader* pMainHeader) const;
+
+        AviOutput* m_pOutput;
+
+        std::vector<AviMuxerStream> m_streams;
+        std::vector<AviOldIndexEntry> m_index;      // 'idx1' entries of the first RIFF chunk
+
+        // block buffer - holds the data that follows the last write to the output, NULL if
+        // the output is buffered
+        BYTE* m_pBlock;
+        DWORD m_blockUsed;
+        ULONGLONG m_blockOffset;        // file offset of the first byte of the block
+
+        ULONGLONG m_mainHeaderOffset;   // file offset of the 'avih' payload
+        ULONGLONG m_extendedHeaderOffset;   // file offset of the 'dmlh' payload
+
+        DWORD m_segment;                // number of the current RIFF chunk
+        ULONGLONG m_riffOffset;         // file offset of the current RIFF chunk header
+        ULONGLONG m_movieListOffset;    // file offset of the current 'movi' list header
+        DWORD m_firstSegmentFrames;     // number of video frames in the first RIFF chunk
+
+        bool m_headersWritten;
+        bool m_finalized;
+};
@@ -0,0 +1,297 @@
+#include "AviOutput.h"
+
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <vector>
+#endif
+
+
+//
+// Write the segments back to back, one WriteAt() call per segment
+//
+HRESULT AviOutput::WriteGatherAt(ULONGLONG offset, const AviDataSegment* pSegments,
+    DWORD segmentCount)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        BREAK_ON_NULL(pSegments, E_POINTER);
+
+        for(DWORD x = 0; x < segmentCount; x++)
+        {
+            hr = WriteAt(offset, pSegments[x].pData, pSegments[x].cbData);
+            BREAK_ON_FAIL(hr);
+
+            offset += pSegments[x].cbData;
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Create an output for the specified local file
+//
+HRESULT AviFileOutput::CreateInstance(const WCHAR* path, AviFileOutput** ppOutput)
+{
+    HRESULT hr = S_OK;
+    AviFileOutput* pOutput = NULL;
+
+    do
+    {
+        BREAK_ON_NULL(path, E_POINTER);
+        BREAK_ON_NULL(ppOutput, E_POINTER);
+
+        pOutput = new (std::nothrow) AviFileOutput();
+        BREAK_ON_NULL(pOutput, E_OUTOFMEMORY);
+
+        hr = pOutput->Open(path);
+        BREAK_ON_FAIL(hr);
+
+        *ppOutput = pOutput;
+    }
+    while(false);
+
+    if(FAILED(hr) && pOutput != NULL)
+    {
+        delete pOutput;
+    }
+
+    return hr;
+}
+
+
+#ifdef _WIN32
+
+AviFileOutput::AviFileOutput(void) :
+    m_hFile(INVALID_HANDLE_VALUE)
+{
+}
+
+
+AviFileOutput::~AviFileOutput(void)
+{
+    if(m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+    }
+}
+
+
+//
+// Create the file for writing - other processes may read the file while it is recorded
+//
+HRESULT AviFileOutput::Open(const WCHAR* path)
+{
+    m_hFile = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if(m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return S_OK;
+}
+
+
+//
+// Write data at the specified offset - the offset is passed in with the OVERLAPPED
+// structure, so the call does not depend on the current file pointer
+//
+HRESULT AviFileOutput::WriteAt(ULONGLONG offset, const BYTE* pData, DWORD cbData)
+{
+    HRESULT hr = S_OK;
+    DWORD totalWritten = 0;
+
+    do
+    {
+        BREAK_ON_NULL(pData, E_POINTER);
+
+        while(totalWritten < cbData)
+        {
+            OVERLAPPED overlapped = {};
+            DWORD cbWritten = 0;
+            ULONGLONG position = offset + totalWritten;
+
+            overlapped.Offset = (DWORD)(position & 0xFFFFFFFF);
+            overlapped.OffsetHigh = (DWORD)(position >> 32);
+
+            if(!WriteFile(m_hFile, pData + totalWritten, cbData - totalWritten, &cbWritten,
+                &overlapped))
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+                break;
+            }
+
+            if(cbWritten == 0)
+            {
+                hr = AVI_E_WRITE_FAILED;
+                break;
+            }
+
+            totalWritten += cbWritten;
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+#else
+
+AviFileOutput::AviFileOutput(void) :
+    m_file(-1)
+{
+}
+
+
+AviFileOutput::~AviFileOutput(void)
+{
+    if(m_file >= 0)
+    {
+        close(m_file);
+    }
+}
+
+
+//
+// Create the file for writing - the wide character path is converted to the multibyte
+// encoding of the current locale
+//
+HRESULT AviFileOutput::Open(const WCHAR* path)
+{
+    size_t length = wcstombs(NULL, path, 0);
+    if(length == (size_t)-1)
+    {
+        return E_INVALIDARG;
+    }
+
+    std::vector<char> narrowPath(length + 1);
+    wcstombs(&narrowPath[0], path, length + 1);
+
+    m_file = open(&narrowPath[0], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(m_file < 0)
+    {
+        return E_FAIL;
+    }
+
+    return S_OK;
+}
+
+
+//
+// Write data at the specified offset without moving the file pointer
+//
+HRESULT AviFileOutput::WriteAt(ULONGLONG offset, const BYTE* pData, DWORD cbData)
+{
+    HRESULT hr = S_OK;
+    DWORD totalWritten = 0;
+
+    do
+    {
+        BREAK_ON_NULL(pData, E_POINTER);
+
+        while(totalWritten < cbData)
+        {
+            ssize_t cbWritten = pwrite(m_file, pData + totalWritten, cbData - totalWritten,
+                (off_t)(offset + totalWritten));
+
+            if(cbWritten < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+
+                hr = AVI_E_WRITE_FAILED;
+                break;
+            }
+
+            totalWritten += (DWORD)cbWritten;
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Write the segments back to back with as few pwritev() calls as possible - the data goes
+// straight from the segments to the kernel, without being gathered into a single buffer
+//
+HRESULT AviFileOutput::WriteGatherAt(ULONGLONG offset, const AviDataSegment* pSegments,
+    DWORD segmentCount)
+{
+    HRESULT hr = S_OK;
+    struct iovec vectors[64];
+    DWORD segment = 0;
+    DWORD segmentWritten = 0;
+
+    do
+    {
+        BREAK_ON_NULL(pSegments, E_POINTER);
+
+        while(segment < segmentCount)
+        {
+            // describe the rest of the data, starting with the unwritten part of the
+            // current segment
+            int vectorCount = 0;
+            for(DWORD x = segment; x < segmentCount && vectorCount < 64 &&
+                vectorCount < IOV_MAX; x++)
+            {
+                DWORD skip = (x == segment) ? segmentWritten : 0;
+
+                vectors[vectorCount].iov_base = (void*)(pSegments[x].pData + skip);
+                vectors[vectorCount].iov_len = pSegments[x].cbData - skip;
+                vectorCount++;
+            }
+
+            ssize_t cbWritten = pwritev(m_file, vectors, vectorCount, (off_t)offset);
+            if(cbWritten < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+
+                hr = AVI_E_WRITE_FAILED;
+                break;
+            }
+
+            if(cbWritten == 0 && vectors[0].iov_len > 0)
+            {
+                hr = AVI_E_WRITE_FAILED;
+                break;
+            }
+
+            // skip the segments that were written completely - a short write leaves the
+            // current segment partially written
+            offset += cbWritten;
+            while(segment < segmentCount &&
+                (ULONGLONG)cbWritten >= pSegments[segment].cbData - segmentWritten)
+            {
+                cbWritten -= pSegments[segment].cbData - segmentWritten;
+                segmentWritten = 0;
+                segment++;
+            }
+            segmentWritten += (DWORD)cbWritten;
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+#endif
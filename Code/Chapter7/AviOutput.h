@@ -0,0 +1,72 @@
+#pragma once
+
+#include "AviDefs.h"
+
+
+// One piece of the data of a gather write
+struct AviDataSegment
+{
+    const BYTE* pData;
+    DWORD cbData;
+};
+
+
+//
+// Abstract random-access output used by the native AVI muxer to store the bytes of the
+// file.  Writes are positional, so the muxer can go back and patch the headers once the
+// sizes are known without disturbing the sequential write of the movie data.
+//
+class AviOutput
+{
+    public:
+        virtual ~AviOutput(void) {};
+
+        // Write all of the data at the specified offset
+        virtual HRESULT WriteAt(ULONGLONG offset, const BYTE* pData, DWORD cbData) = 0;
+
+        // Write the segments back to back, starting at the specified offset - by default
+        // every segment is written with a separate WriteAt() call
+        virtual HRESULT WriteGatherAt(ULONGLONG offset, const AviDataSegment* pSegments,
+            DWORD segmentCount);
+
+        // Wait until all of the data written so far has reached its destination
+        virtual HRESULT Flush(void)                 { return S_OK; };
+
+        // Whether the output collects the data in buffers of its own - small writes are
+        // cheap then, and the caller does not need to gather them first
+        virtual bool IsBuffered(void) const         { return false; };
+};
+
+
+//
+// AviOutput implementation that writes a file on the local file system.  An existing file
+// is overwritten.  A gather write goes straight from the segments to the file - with
+// pwritev() on POSIX, and with one overlapped WriteFile() per segment at its running offset
+// on Windows, where WriteFileGather() would need an unbuffered handle and page sized
+// segments.
+//
+class AviFileOutput : public AviOutput
+{
+    public:
+        static HRESULT CreateInstance(const WCHAR* path, AviFileOutput** ppOutput);
+
+        ~AviFileOutput(void);
+
+        // AviOutput interface implementation
+        HRESULT WriteAt(ULONGLONG offset, const BYTE* pData, DWORD cbData);
+#ifndef _WIN32
+        HRESULT WriteGatherAt(ULONGLONG offset, const AviDataSegment* pSegments,
+            DWORD segmentCount);
+#endif
+
+    protected:
+        AviFileOutput(void);
+        HRESULT Open(const WCHAR* path);
+
+    private:
+#ifdef _WIN32
+        HANDLE m_hFile;
+#else
+        int m_file;
+#endif
+};
@@ -1,100 +1,257 @@
-#pragma once
-
-#include <atlbase.h>
-
-#include <Mfobjects.h>
-#include <mfidl.h>
-#include <Mferror.h>
-
-#include <vector>
-using namespace std;
-
-#include <strsafe.h>
-
-
-#include "AviStream.h"
-#include "AviFileWriter.h"
-
-
-
-
-class CAviSink :
-    public IMFFinalizableMediaSink,
-    public IMFClockStateSink,
-    public IMFAsyncCallback
-{
-    public:
-
-        //CAviSink(void);
-        CAviSink(const WCHAR* pFilename, HRESULT* pHr);
-        ~CAviSink(void);
-
-        // IUnknown interface implementation
-        STDMETHODIMP QueryInterface(REFIID riid, void **ppvObject);
-        virtual ULONG STDMETHODCALLTYPE AddRef(void);
-        virtual ULONG STDMETHODCALLTYPE Release(void);
-
-
-        // IMFMediaSink interface implementation
-        STDMETHODIMP GetCharacteristics(DWORD *pdwCharacteristics);
-        STDMETHODIMP AddStreamSink(DWORD dwStreamSinkIdentifier, IMFMediaType* pMediaType, IMFStreamSink** ppStreamSink);
-        STDMETHODIMP RemoveStreamSink(DWORD dwStreamSinkIdentifier);
-        STDMETHODIMP GetStreamSinkCount(DWORD* pcStreamSinkCount);
-        STDMETHODIMP GetStreamSinkByIndex(DWORD dwIndex, IMFStreamSink** ppStreamSink);
-        STDMETHODIMP GetStreamSinkById(DWORD dwStreamSinkIdentifier, IMFStreamSink** ppStreamSink);
-        STDMETHODIMP SetPresentationClock(IMFPresentationClock* pPresentationClock);
-        STDMETHODIMP GetPresentationClock(IMFPresentationClock** ppPresentationClock);
-        STDMETHODIMP Shutdown(void);
-
-        // IMFClockStateSink interface implementation
-        STDMETHODIMP OnClockStart(MFTIME hnsSystemTime, LONGLONG llClockStartOffset);
-        STDMETHODIMP OnClockStop(MFTIME hnsSystemTime);
-        STDMETHODIMP OnClockPause(MFTIME hnsSystemTime);
-        STDMETHODIMP OnClockRestart(MFTIME hnsSystemTime);
-        STDMETHODIMP OnClockSetRate(MFTIME hnsSystemTime, float flRate);
-
-        // IMFFinalizableMediaSink interface implementation
-        STDMETHODIMP BeginFinalize(IMFAsyncCallback* pCallback, IUnknown* punkState);
-        STDMETHODIMP EndFinalize(IMFAsyncResult* pResult);
-
-        // IMFAsyncCallback interface implementation
-        STDMETHODIMP GetParameters(DWORD *pdwFlags, DWORD *pdwQueue);
-        STDMETHODIMP Invoke(IMFAsyncResult* pAsyncResult);
-
-        HRESULT ScheduleNewSampleProcessing(void);
-
-    private:
-
-        enum SinkState
-        {
-            SinkStarted,
-            SinkPaused,
-            SinkStopped,
-            SinkShutdown
-        };
-
-
-        volatile long m_cRef;                       // reference count
-        CComAutoCriticalSection m_critSec;          // critical section
-
-        WCHAR* m_pFilename;
-        BYTE* m_pSampleData;
-        DWORD m_dwSampleData;
-
-        SinkState m_sinkState;
-        HANDLE m_unpauseEvent;
-
-        CComPtr<IMFPresentationClock> m_pClock;     // pointer to the presentation clock
-
-        vector<CAviStream*> m_streamSinks;
-
-        CAviFileWriter* m_pFileWriter;
-
-        HRESULT ProcessStreamSamples(void);
-        HRESULT GetEarliestSampleStream(int* pEarliestStream);
-        HRESULT WriteSampleFromStream(DWORD nEarliestSampleStream);
-                
-        HRESULT CheckBufferSize(DWORD streamId);
-        HRESULT CheckShutdown(void);
-};
-
+#pragma once
+
+#include <atlbase.h>
+
+#include <Mfobjects.h>
+#include <mfidl.h>
+#include <Mferror.h>
+
+#include <vector>
+#include <queue>
+#include <functional>
+using namespace std;
+
+#include <strsafe.h>
+
+
+#include "AviStream.h"
+#include "AviFileWriter.h"
+#include "AviSinkStatistics.h"
+
+
+//
+// Configuration attributes that can be set on the sink through its IMFAttributes interface.
+// They are read when the presentation clock starts.
+//
+
+// UINT64 - length of the interleave window in 100-ns units.  The samples of every stream
+// that fall into the same window are written as a single block, one stream after another,
+// which gives fewer and larger runs of data in the file.  For example 5000000 writes
+// 500 ms of video followed by 500 ms of audio.  Default: 0 - the samples of all streams are
+// interleaved one at a time, in time stamp order.
+// {2B6E8D41-7C3A-4F95-9E12-A4D07B5C3E86}
+DEFINE_GUID(AVISINK_INTERLEAVE_WINDOW, 0x2b6e8d41, 0x7c3a, 0x4f95, 0x9e, 0x12, 0xa4, 0xd0, 0x7b, 0x5c, 0x3e, 0x86);
+
+// UINT32 - number of full write-behind buffers that may wait for the writer thread of the
+// sink.  The samples are copied into large buffers that a dedicated thread writes to the
+// disk, so the sink only waits for the disk when all of the buffers are full.  0 writes the
+// file directly on the sink work queue, with large samples written from their media buffers
+// without a copy.
+// Default: 0 - see AviWriteBehindOutput for when the extra copy pays off.
+// {C4A7F1E2-5D38-4B6C-A091-7E2F3B8D4C15}
+DEFINE_GUID(AVISINK_WRITE_BEHIND_DEPTH, 0xc4a7f1e2, 0x5d38, 0x4b6c, 0xa0, 0x91, 0x7e, 0x2f, 0x3b, 0x8d, 0x4c, 0x15);
+
+// UINT64 - memory cap in bytes for all of the write-behind buffers together, which limits
+// the queue depth.  At least two buffers are always used.
+// Default: AVI_WRITE_BEHIND_DEFAULT_MEMORY.
+// {6F1B2D93-E847-4A2C-B5D6-0C93A8E17F42}
+DEFINE_GUID(AVISINK_WRITE_BEHIND_MEMORY, 0x6f1b2d93, 0xe847, 0x4a2c, 0xb5, 0xd6, 0xc, 0x93, 0xa8, 0xe1, 0x7f, 0x42);
+
+// UINT32 - number of samples every stream keeps in flight, counting both the samples it
+// requested from the pipeline and the samples waiting in its queue.  Streams with small
+// samples, such as audio, need a deep queue to keep the interleaver fed while the samples
+// of the other streams are written.  Default: AVISTREAM_DEFAULT_MAX_SAMPLES.
+// {8A3E5F17-B92C-4D06-9F48-21C7E6D0B3A9}
+DEFINE_GUID(AVISINK_STREAM_MAX_SAMPLES, 0x8a3e5f17, 0xb92c, 0x4d06, 0x9f, 0x48, 0x21, 0xc7, 0xe6, 0xd0, 0xb3, 0xa9);
+
+// UINT32 - budget in bytes for the samples queued in every stream.  Streams with large
+// samples, such as high bitrate video, stop requesting samples when they reach it, but
+// always keep at least one sample in flight.  Default: AVISTREAM_DEFAULT_MAX_BYTES.
+// {D52C8B40-1E6F-4A97-83B5-F4096A2E7C1D}
+DEFINE_GUID(AVISINK_STREAM_MAX_BYTES, 0xd52c8b40, 0x1e6f, 0x4a97, 0x83, 0xb5, 0xf4, 0x9, 0x6a, 0x2e, 0x7c, 0x1d);
+
+// UINT32 - when non-zero, the sink writes the statistics collected since the clock was
+// started to the debugger output every time the clock stops.  The same numbers are always
+// available through IAviSinkStatistics.  Default: 0.
+// {3E9A6C52-0B7D-4F18-A6E3-5D21C8F04B97}
+DEFINE_GUID(AVISINK_STATISTICS_DUMP, 0x3e9a6c52, 0xb7d, 0x4f18, 0xa6, 0xe3, 0x5d, 0x21, 0xc8, 0xf0, 0x4b, 0x97);
+
+
+class CAviSink :
+    public IMFFinalizableMediaSink,
+    public IMFClockStateSink,
+    public IMFAsyncCallback,
+    public IMFAttributes,
+    public IAviSinkStatistics
+{
+    public:
+
+        //CAviSink(void);
+        CAviSink(const WCHAR* pFilename, HRESULT* pHr);
+        ~CAviSink(void);
+
+        // IUnknown interface implementation
+        STDMETHODIMP QueryInterface(REFIID riid, void **ppvObject);
+        virtual ULONG STDMETHODCALLTYPE AddRef(void);
+        virtual ULONG STDMETHODCALLTYPE Release(void);
+
+
+        // IMFMediaSink interface implementation
+        STDMETHODIMP GetCharacteristics(DWORD *pdwCharacteristics);
+        STDMETHODIMP AddStreamSink(DWORD dwStreamSinkIdentifier, IMFMediaType* pMediaType, IMFStreamSink** ppStreamSink);
+        STDMETHODIMP RemoveStreamSink(DWORD dwStreamSinkIdentifier);
+        STDMETHODIMP GetStreamSinkCount(DWORD* pcStreamSinkCount);
+        STDMETHODIMP GetStreamSinkByIndex(DWORD dwIndex, IMFStreamSink** ppStreamSink);
+        STDMETHODIMP GetStreamSinkById(DWORD dwStreamSinkIdentifier, IMFStreamSink** ppStreamSink);
+        STDMETHODIMP SetPresentationClock(IMFPresentationClock* pPresentationClock);
+        STDMETHODIMP GetPresentationClock(IMFPresentationClock** ppPresentationClock);
+        STDMETHODIMP Shutdown(void);
+
+        // IMFClockStateSink interface implementation
+        STDMETHODIMP OnClockStart(MFTIME hnsSystemTime, LONGLONG llClockStartOffset);
+        STDMETHODIMP OnClockStop(MFTIME hnsSystemTime);
+        STDMETHODIMP OnClockPause(MFTIME hnsSystemTime);
+        STDMETHODIMP OnClockRestart(MFTIME hnsSystemTime);
+        STDMETHODIMP OnClockSetRate(MFTIME hnsSystemTime, float flRate);
+
+        // IMFFinalizableMediaSink interface implementation
+        STDMETHODIMP BeginFinalize(IMFAsyncCallback* pCallback, IUnknown* punkState);
+        STDMETHODIMP EndFinalize(IMFAsyncResult* pResult);
+
+        // IMFAsyncCallback interface implementation
+        STDMETHODIMP GetParameters(DWORD *pdwFlags, DWORD *pdwQueue);
+        STDMETHODIMP Invoke(IMFAsyncResult* pAsyncResult);
+
+        // IMFAttributes interface implementation - forwarded to the attribute store
+        STDMETHODIMP GetItem(REFGUID guidKey, PROPVARIANT* pValue)
+            { return m_pAttributes->GetItem(guidKey, pValue); }
+        STDMETHODIMP GetItemType(REFGUID guidKey, MF_ATTRIBUTE_TYPE* pType)
+            { return m_pAttributes->GetItemType(guidKey, pType); }
+        STDMETHODIMP CompareItem(REFGUID guidKey, REFPROPVARIANT Value, BOOL* pbResult)
+            { return m_pAttributes->CompareItem(guidKey, Value, pbResult); }
+        STDMETHODIMP Compare(IMFAttributes* pTheirs, MF_ATTRIBUTES_MATCH_TYPE MatchType,
+            BOOL* pbResult)
+            { return m_pAttributes->Compare(pTheirs, MatchType, pbResult); }
+        STDMETHODIMP GetUINT32(REFGUID guidKey, UINT32* punValue)
+            { return m_pAttributes->GetUINT32(guidKey, punValue); }
+        STDMETHODIMP GetUINT64(REFGUID guidKey, UINT64* punValue)
+            { return m_pAttributes->GetUINT64(guidKey, punValue); }
+        STDMETHODIMP GetDouble(REFGUID guidKey, double* pfValue)
+            { return m_pAttributes->GetDouble(guidKey, pfValue); }
+        STDMETHODIMP GetGUID(REFGUID guidKey, GUID* pguidValue)
+            { return m_pAttributes->GetGUID(guidKey, pguidValue); }
+        STDMETHODIMP GetStringLength(REFGUID guidKey, UINT32* pcchLength)
+            { return m_pAttributes->GetStringLength(guidKey, pcchLength); }
+        STDMETHODIMP GetString(REFGUID guidKey, LPWSTR pwszValue, UINT32 cchBufSize,
+            UINT32* pcchLength)
+            { return m_pAttributes->GetString(guidKey, pwszValue, cchBufSize, pcchLength); }
+        STDMETHODIMP GetAllocatedString(REFGUID guidKey, LPWSTR* ppwszValue, UINT32* pcchLength)
+            { return m_pAttributes->GetAllocatedString(guidKey, ppwszValue, pcchLength); }
+        STDMETHODIMP GetBlobSize(REFGUID guidKey, UINT32* pcbBlobSize)
+            { return m_pAttributes->GetBlobSize(guidKey, pcbBlobSize); }
+        STDMETHODIMP GetBlob(REFGUID guidKey, UINT8* pBuf, UINT32 cbBufSize, UINT32* pcbBlobSize)
+            { return m_pAttributes->GetBlob(guidKey, pBuf, cbBufSize, pcbBlobSize); }
+        STDMETHODIMP GetAllocatedBlob(REFGUID guidKey, UINT8** ppBuf, UINT32* pcbSize)
+            { return m_pAttributes->GetAllocatedBlob(guidKey, ppBuf, pcbSize); }
+        STDMETHODIMP GetUnknown(REFGUID guidKey, REFIID riid, LPVOID* ppv)
+            { return m_pAttributes->GetUnknown(guidKey, riid, ppv); }
+        STDMETHODIMP SetItem(REFGUID guidKey, REFPROPVARIANT Value)
+            { return m_pAttributes->SetItem(guidKey, Value); }
+        STDMETHODIMP DeleteItem(REFGUID guidKey)
+            { return m_pAttributes->DeleteItem(guidKey); }
+        STDMETHODIMP DeleteAllItems(void)
+            { return m_pAttributes->DeleteAllItems(); }
+        STDMETHODIMP SetUINT32(REFGUID guidKey, UINT32 unValue)
+            { return m_pAttributes->SetUINT32(guidKey, unValue); }
+        STDMETHODIMP SetUINT64(REFGUID guidKey, UINT64 unValue)
+            { return m_pAttributes->SetUINT64(guidKey, unValue); }
+        STDMETHODIMP SetDouble(REFGUID guidKey, double fValue)
+            { return m_pAttributes->SetDouble(guidKey, fValue); }
+        STDMETHODIMP SetGUID(REFGUID guidKey, REFGUID guidValue)
+            { return m_pAttributes->SetGUID(guidKey, guidValue); }
+        STDMETHODIMP SetString(REFGUID guidKey, LPCWSTR wszValue)
+            { return m_pAttributes->SetString(guidKey, wszValue); }
+        STDMETHODIMP SetBlob(REFGUID guidKey, const UINT8* pBuf, UINT32 cbBufSize)
+            { return m_pAttributes->SetBlob(guidKey, pBuf, cbBufSize); }
+        STDMETHODIMP SetUnknown(REFGUID guidKey, IUnknown* pUnknown)
+            { return m_pAttributes->SetUnknown(guidKey, pUnknown); }
+        STDMETHODIMP LockStore(void)
+            { return m_pAttributes->LockStore(); }
+        STDMETHODIMP UnlockStore(void)
+            { return m_pAttributes->UnlockStore(); }
+        STDMETHODIMP GetCount(UINT32* pcItems)
+            { return m_pAttributes->GetCount(pcItems); }
+        STDMETHODIMP GetItemByIndex(UINT32 unIndex, GUID* pguidKey, PROPVARIANT* pValue)
+            { return m_pAttributes->GetItemByIndex(unIndex, pguidKey, pValue); }
+        STDMETHODIMP CopyAllItems(IMFAttributes* pDest)
+            { return m_pAttributes->CopyAllItems(pDest); }
+
+        // IAviSinkStatistics interface implementation
+        STDMETHODIMP GetStatistics(AviSinkStatistics* pStatistics);
+        STDMETHODIMP ResetStatistics(void);
+
+        HRESULT ScheduleNewSampleProcessing(void);
+
+    private:
+
+        enum SinkState
+        {
+            SinkStarted,
+            SinkPaused,
+            SinkStopped,
+            SinkShutdown
+        };
+
+        // next sample time of a stream, ordered so that the earliest time is at the top of
+        // the scheduler heap
+        struct StreamSampleTime
+        {
+            LONGLONG time;
+            DWORD stream;
+
+            bool operator>(const StreamSampleTime& other) const
+            {
+                return (time != other.time) ? (time > other.time) : (stream > other.stream);
+            }
+        };
+
+
+        volatile long m_cRef;                       // reference count
+        CComAutoCriticalSection m_critSec;          // critical section
+
+        WCHAR* m_pFilename;
+
+        // buffers of the sample that is being written, locked for the duration of the
+        // write, and the I/O vector that describes their data
+        vector<IMFMediaBuffer*> m_lockedBuffers;
+        vector<AviDataSegment> m_sampleSegments;
+
+        SinkState m_sinkState;
+        HANDLE m_unpauseEvent;
+
+        CComPtr<IMFPresentationClock> m_pClock;     // pointer to the presentation clock
+
+        vector<CAviStream*> m_streamSinks;
+
+        CAviFileWriter* m_pFileWriter;
+
+        CComPtr<IMFAttributes> m_pAttributes;      // configuration attributes of the sink
+
+        // private serialized work queue that writes the samples, and a flag that is set
+        // while a work item is queued on it
+        DWORD m_workQueueId;
+        volatile LONG m_processingScheduled;
+
+        AviSinkStatistics m_statistics;
+
+        // Interleaving scheduler.  Streams with a known next sample time are kept in a
+        // min-heap, and the streams that have no samples queued are kept in the idle list,
+        // so only the stream that was just written and the idle streams are queried for
+        // their next sample on every pass, instead of all of the streams.
+        priority_queue<StreamSampleTime, vector<StreamSampleTime>,
+            greater<StreamSampleTime> > m_readyStreams;
+        vector<DWORD> m_idleStreams;
+        int m_currentStream;                        // stream written in the current window
+        LONGLONG m_windowEnd;                       // end time of the current window
+        LONGLONG m_interleaveWindow;                // window length from the attributes
+
+        HRESULT ProcessStreamSamples(void);
+        HRESULT GetNextWriteStream(int* pStream);
+        HRESULT RefreshIdleStreams(bool* pStreamsPending);
+        HRESULT ResetScheduler(void);
+        void DumpStatistics(void);
+        HRESULT WriteSampleFromStream(DWORD nEarliestSampleStream);
+
+        HRESULT CheckShutdown(void);
+};
+
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <windows.h>
+#include <unknwn.h>
+
+#include "AviWriteBehind.h"
+
+
+// number of buckets in the batch size histogram - bucket 0 counts the wake-ups that found
+// nothing to write, and bucket n the wake-ups that wrote between 2^(n-1) and 2^n - 1 samples
+#define AVISINK_BATCH_BUCKETS       16
+
+
+//
+// Write statistics of the sink, collected from the moment the presentation clock starts
+//
+struct AviSinkStatistics
+{
+    LONGLONG wakeups;                   // work items executed on the sink work queue
+    LONGLONG coalescedRequests;         // sample notifications that found a work item queued
+    LONGLONG samplesWritten;            // samples written into the file
+    LONGLONG bytesWritten;              // sample data written into the file
+    LONGLONG maxBatchSize;              // most samples written in a single wake-up
+    LONGLONG batchSizes[AVISINK_BATCH_BUCKETS];     // wake-ups by number of samples written
+    AviWriteBehindStatistics writeBehind;           // disk writes and stalls of the sink
+
+    //
+    // Get the histogram bucket for a wake-up that wrote the specified number of samples
+    //
+    static DWORD BatchBucket(LONGLONG batchSize)
+    {
+        DWORD bucket = 0;
+
+        while(batchSize > 0 && bucket < AVISINK_BATCH_BUCKETS - 1)
+        {
+            batchSize >>= 1;
+            bucket++;
+        }
+
+        return bucket;
+    }
+};
+
+
+// IAviSinkStatistics COM IID.
+// {9E3D5C27-1A4B-4F68-8B7E-3C2D1F0A6B59}
+DEFINE_GUID(IID_IAviSinkStatistics, 0x9e3d5c27, 0x1a4b, 0x4f68, 0x8b, 0x7e, 0x3c, 0x2d,
+    0x1f, 0xa, 0x6b, 0x59);
+
+//
+// Interface exposed by the sink for querying its write statistics - QueryInterface() the
+// media sink for it.  Small batches with many wake-ups mean that the sink keeps up with the
+// samples one at a time, while large batches show that samples pile up between wake-ups.
+// Write-behind stalls mean that the disk does not keep up with the recording.
+//
+struct IAviSinkStatistics : public IUnknown
+{
+    public:
+        virtual HRESULT STDMETHODCALLTYPE GetStatistics(AviSinkStatistics* pStatistics) = 0;
+        virtual HRESULT STDMETHODCALLTYPE ResetStatistics(void) = 0;
+};
@@ -0,0 +1,675 @@
+#include "AviWriteBehind.h"
+
+#include <new>
+#include <string.h>
+
+#ifndef _WIN32
+#include <stdlib.h>
+#include <time.h>
+#endif
+
+
+//
+// Create a write-behind stage in front of the specified output.  The number of buffers is
+// the queue depth plus the buffer being filled, limited by the memory cap - but never less
+// than two, so that one buffer can be filled while the other one is written.  On success
+// the stage takes ownership of the output, and deletes it when it is deleted.
+//
+HRESULT AviWriteBehindOutput::CreateInstance(AviOutput* pOutput, DWORD queueDepth,
+    ULONGLONG memoryCap, AviWriteBehindOutput** ppOutput)
+{
+    HRESULT hr = S_OK;
+    AviWriteBehindOutput* pWriteBehind = NULL;
+
+    do
+    {
+        BREAK_ON_NULL(pOutput, E_POINTER);
+        BREAK_ON_NULL(ppOutput, E_POINTER);
+
+        if(queueDepth == 0)
+        {
+            hr = E_INVALIDARG;
+            break;
+        }
+
+        ULONGLONG bufferCount = (ULONGLONG)queueDepth + 1;
+        if(bufferCount > memoryCap / AVI_WRITE_BEHIND_BUFFER_SIZE)
+        {
+            bufferCount = memoryCap / AVI_WRITE_BEHIND_BUFFER_SIZE;
+        }
+        if(bufferCount < 2)
+        {
+            bufferCount = 2;
+        }
+
+        pWriteBehind = new (std::nothrow) AviWriteBehindOutput(pOutput);
+        BREAK_ON_NULL(pWriteBehind, E_OUTOFMEMORY);
+
+        hr = pWriteBehind->Init((DWORD)bufferCount);
+        BREAK_ON_FAIL(hr);
+
+        *ppOutput = pWriteBehind;
+    }
+    while(false);
+
+    if(FAILED(hr) && pWriteBehind != NULL)
+    {
+        // the caller keeps the output if the stage could not be created
+        pWriteBehind->m_pOutput = NULL;
+        delete pWriteBehind;
+    }
+
+    return hr;
+}
+
+
+AviWriteBehindOutput::AviWriteBehindOutput(AviOutput* pOutput) :
+    m_pOutput(pOutput),
+    m_pBuffer(NULL),
+    m_bufferUsed(0),
+    m_bufferOffset(0),
+    m_writing(false),
+    m_stopping(false),
+    m_writeResult(S_OK)
+{
+    memset(&m_statistics, 0, sizeof(m_statistics));
+
+#ifdef _WIN32
+    m_hThread = NULL;
+    InitializeCriticalSection(&m_lock);
+    InitializeConditionVariable(&m_requestQueued);
+    InitializeConditionVariable(&m_requestCompleted);
+#else
+    m_threadStarted = false;
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_requestQueued, NULL);
+    pthread_cond_init(&m_requestCompleted, NULL);
+#endif
+}
+
+
+//
+// Write out everything that is still buffered, stop the writer thread, and delete the
+// wrapped output
+//
+AviWriteBehindOutput::~AviWriteBehindOutput(void)
+{
+    Flush();
+
+    Lock();
+    m_stopping = true;
+    SignalRequest();
+    Unlock();
+
+#ifdef _WIN32
+    if(m_hThread != NULL)
+    {
+        WaitForSingleObject(m_hThread, INFINITE);
+        CloseHandle(m_hThread);
+    }
+
+    DeleteCriticalSection(&m_lock);
+#else
+    if(m_threadStarted)
+    {
+        pthread_join(m_thread, NULL);
+    }
+
+    pthread_cond_destroy(&m_requestCompleted);
+    pthread_cond_destroy(&m_requestQueued);
+    pthread_mutex_destroy(&m_lock);
+#endif
+
+    for(size_t i = 0; i < m_buffers.size(); i++)
+    {
+        FreeBuffer(m_buffers[i]);
+    }
+
+    delete m_pOutput;
+}
+
+
+//
+// Allocate the buffers, and start the writer thread
+//
+HRESULT AviWriteBehindOutput::Init(DWORD bufferCount)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        // reserve the room up front, so that returning a buffer never allocates
+        try
+        {
+            m_buffers.reserve(bufferCount);
+            m_freeBuffers.reserve(bufferCount);
+        }
+        catch(...)
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        for(DWORD x = 0; x < bufferCount; x++)
+        {
+            BYTE* pBuffer = AllocateBuffer();
+            BREAK_ON_NULL(pBuffer, E_OUTOFMEMORY);
+
+            m_buffers.push_back(pBuffer);
+            m_freeBuffers.push_back(pBuffer);
+        }
+        BREAK_ON_FAIL(hr);
+
+        m_pBuffer = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+
+#ifdef _WIN32
+        m_hThread = CreateThread(NULL, 0, WriterThreadProc, this, 0, NULL);
+        if(m_hThread == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+#else
+        if(pthread_create(&m_thread, NULL, WriterThreadProc, this) != 0)
+        {
+            hr = E_FAIL;
+            break;
+        }
+        m_threadStarted = true;
+#endif
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Add data to the file.  Data that continues the current buffer is copied into it, and
+// every buffer that fills up is queued for the writer thread.  Data at an earlier offset
+// changes the current buffer in place where it overlaps it - the rest is queued as a patch
+// behind the buffers that were queued before it.
+//
+HRESULT AviWriteBehindOutput::WriteAt(ULONGLONG offset, const BYTE* pData, DWORD cbData)
+{
+    HRESULT hr = S_OK;
+
+    do
+    {
+        BREAK_ON_NULL(pData, E_POINTER);
+
+        // report the failures of the writer thread
+        Lock();
+        hr = m_writeResult;
+        Unlock();
+        BREAK_ON_FAIL(hr);
+
+        ULONGLONG bufferEnd = m_bufferOffset + m_bufferUsed;
+
+        if(offset < m_bufferOffset)
+        {
+            DWORD cbPatch = cbData;
+            if(offset + cbPatch > m_bufferOffset)
+            {
+                cbPatch = (DWORD)(m_bufferOffset - offset);
+            }
+
+            hr = QueuePatch(offset, pData, cbPatch);
+            BREAK_ON_FAIL(hr);
+
+            offset += cbPatch;
+            pData += cbPatch;
+            cbData -= cbPatch;
+        }
+
+        if(offset < bufferEnd && cbData > 0)
+        {
+            DWORD cbOverwrite = cbData;
+            if(offset + cbOverwrite > bufferEnd)
+            {
+                cbOverwrite = (DWORD)(bufferEnd - offset);
+            }
+
+            memcpy(m_pBuffer + (DWORD)(offset - m_bufferOffset), pData, cbOverwrite);
+
+            offset += cbOverwrite;
+            pData += cbOverwrite;
+            cbData -= cbOverwrite;
+        }
+
+        if(cbData == 0)
+        {
+            break;
+        }
+
+        // data that does not continue the current buffer starts a new one
+        if(offset != bufferEnd)
+        {
+            if(m_bufferUsed > 0)
+            {
+                hr = SubmitBuffer();
+                BREAK_ON_FAIL(hr);
+            }
+
+            m_bufferOffset = offset;
+        }
+
+        while(cbData > 0)
+        {
+            DWORD cbCopy = AVI_WRITE_BEHIND_BUFFER_SIZE - m_bufferUsed;
+            if(cbCopy > cbData)
+            {
+                cbCopy = cbData;
+            }
+
+            memcpy(m_pBuffer + m_bufferUsed, pData, cbCopy);
+            m_bufferUsed += cbCopy;
+            pData += cbCopy;
+            cbData -= cbCopy;
+
+            if(m_bufferUsed == AVI_WRITE_BEHIND_BUFFER_SIZE)
+            {
+                hr = SubmitBuffer();
+                BREAK_ON_FAIL(hr);
+            }
+        }
+    }
+    while(false);
+
+    return hr;
+}
+
+
+//
+// Queue the partially filled buffer, and wait until the writer thread has written
+// everything that was queued.  Returns the first error of the writer thread.
+//
+HRESULT AviWriteBehindOutput::Flush(void)
+{
+    HRESULT hr = S_OK;
+
+    if(m_bufferUsed > 0)
+    {
+        hr = SubmitBuffer();
+    }
+
+    Lock();
+
+    while(!m_requests.empty() || m_writing)
+    {
+        WaitForCompletion();
+    }
+
+    if(SUCCEEDED(hr))
+    {
+        hr = m_writeResult;
+    }
+
+    Unlock();
+
+    return hr;
+}
+
+
+//
+// Get a copy of the statistics of the write-behind stage
+//
+void AviWriteBehindOutput::GetStatistics(AviWriteBehindStatistics* pStatistics)
+{
+    Lock();
+    *pStatistics = m_statistics;
+    Unlock();
+}
+
+
+//
+// Clear the statistics of the write-behind stage
+//
+void AviWriteBehindOutput::ResetStatistics(void)
+{
+    Lock();
+    memset(&m_statistics, 0, sizeof(m_statistics));
+    Unlock();
+}
+
+
+//
+// Queue the current buffer for the writer thread and continue with a free buffer.  If
+// there is no free buffer the caller is stalled until the writer thread returns one.
+//
+HRESULT AviWriteBehindOutput::SubmitBuffer(void)
+{
+    HRESULT hr = S_OK;
+    WriteRequest request;
+
+    request.offset = m_bufferOffset;
+    request.pData = m_pBuffer;
+    request.cbData = m_bufferUsed;
+    request.isBuffer = true;
+
+    Lock();
+
+    do
+    {
+        try
+        {
+            m_requests.push_back(request);
+        }
+        catch(...)
+        {
+            hr = E_OUTOFMEMORY;
+            break;
+        }
+
+        m_pBuffer = NULL;
+        m_bufferOffset += m_bufferUsed;
+        m_bufferUsed = 0;
+
+        LONGLONG queuedBuffers = (LONGLONG)(m_buffers.size() - m_freeBuffers.size());
+        if(queuedBuffers > m_statistics.maxQueuedBuffers)
+        {
+            m_statistics.maxQueuedBuffers = queuedBuffers;
+        }
+
+        SignalRequest();
+
+        if(m_freeBuffers.empty())
+        {
+            LONGLONG stallStart = CurrentMicroseconds();
+
+            while(m_freeBuffers.empty())
+            {
+                WaitForCompletion();
+            }
+
+            LONGLONG stallTime = CurrentMicroseconds() - stallStart;
+
+            m_statistics.stalls++;
+            m_statistics.stallTime += stallTime;
+            if(stallTime > m_statistics.maxStallTime)
+            {
+                m_statistics.maxStallTime = stallTime;
+            }
+        }
+
+        m_pBuffer = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+
+        hr = m_writeResult;
+    }
+    while(false);
+
+    Unlock();
+
+    return hr;
+}
+
+
+//
+// Queue a copy of data that changes bytes which may already be queued for the writer
+// thread.  Patches are small - the sizes and indexes in the headers of the file - so they
+// are not taken out of the buffer memory.
+//
+HRESULT AviWriteBehindOutput::QueuePatch(ULONGLONG offset, const BYTE* pData, DWORD cbData)
+{
+    HRESULT hr = S_OK;
+    WriteRequest request;
+
+    do
+    {
+        request.offset = offset;
+        request.pData = new (std::nothrow) BYTE[cbData];
+        request.cbData = cbData;
+        request.isBuffer = false;
+        BREAK_ON_NULL(request.pData, E_OUTOFMEMORY);
+
+        memcpy(request.pData, pData, cbData);
+
+        Lock();
+
+        try
+        {
+            m_requests.push_back(request);
+            request.pData = NULL;
+
+            SignalRequest();
+        }
+        catch(...)
+        {
+            hr = E_OUTOFMEMORY;
+        }
+
+        Unlock();
+    }
+    while(false);
+
+    delete [] request.pData;
+
+    return hr;
+}
+
+
+//
+// Body of the writer thread - execute the queued writes in order until the stage is
+// deleted.  After the first failure the remaining writes are only dequeued, so that the
+// buffers still return to the caller.
+//
+void AviWriteBehindOutput::WriterThread(void)
+{
+    Lock();
+
+    while(true)
+    {
+        while(m_requests.empty() && !m_stopping)
+        {
+            WaitForRequest();
+        }
+
+        if(m_requests.empty())
+        {
+            break;
+        }
+
+        WriteRequest request = m_requests.front();
+        m_requests.pop_front();
+        m_writing = true;
+
+        HRESULT hr = m_writeResult;
+
+        Unlock();
+
+        LONGLONG writeTime = 0;
+        if(SUCCEEDED(hr))
+        {
+            LONGLONG writeStart = CurrentMicroseconds();
+            hr = m_pOutput->WriteAt(request.offset, request.pData, request.cbData);
+            writeTime = CurrentMicroseconds() - writeStart;
+        }
+
+        Lock();
+
+        if(FAILED(hr))
+        {
+            if(SUCCEEDED(m_writeResult))
+            {
+                m_writeResult = hr;
+            }
+        }
+        else
+        {
+            m_statistics.writes++;
+            m_statistics.bytesWritten += request.cbData;
+            m_statistics.writeTime += writeTime;
+            if(writeTime > m_statistics.maxWriteTime)
+            {
+                m_statistics.maxWriteTime = writeTime;
+            }
+        }
+
+        if(request.isBuffer)
+        {
+            m_freeBuffers.push_back(request.pData);
+        }
+        else
+        {
+            delete [] request.pData;
+        }
+
+        m_writing = false;
+        SignalCompletion();
+    }
+
+    Unlock();
+}
+
+
+#ifdef _WIN32
+
+DWORD WINAPI AviWriteBehindOutput::WriterThreadProc(LPVOID pParam)
+{
+    ((AviWriteBehindOutput*)pParam)->WriterThread();
+    return 0;
+}
+
+
+void AviWriteBehindOutput::Lock(void)
+{
+    EnterCriticalSection(&m_lock);
+}
+
+
+void AviWriteBehindOutput::Unlock(void)
+{
+    LeaveCriticalSection(&m_lock);
+}
+
+
+void AviWriteBehindOutput::WaitForRequest(void)
+{
+    SleepConditionVariableCS(&m_requestQueued, &m_lock, INFINITE);
+}
+
+
+void AviWriteBehindOutput::WaitForCompletion(void)
+{
+    SleepConditionVariableCS(&m_requestCompleted, &m_lock, INFINITE);
+}
+
+
+void AviWriteBehindOutput::SignalRequest(void)
+{
+    WakeConditionVariable(&m_requestQueued);
+}
+
+
+void AviWriteBehindOutput::SignalCompletion(void)
+{
+    WakeAllConditionVariable(&m_requestCompleted);
+}
+
+
+LONGLONG AviWriteBehindOutput::CurrentMicroseconds(void)
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    // split the conversion so that the multiplication cannot overflow
+    return (counter.QuadPart / frequency.QuadPart) * 1000000 +
+        (counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+
+//
+// Buffers are allocated with VirtualAlloc(), which returns page aligned memory
+//
+BYTE* AviWriteBehindOutput::AllocateBuffer(void)
+{
+    return (BYTE*)VirtualAlloc(NULL, AVI_WRITE_BEHIND_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE,
+        PAGE_READWRITE);
+}
+
+
+void AviWriteBehindOutput::FreeBuffer(BYTE* pBuffer)
+{
+    VirtualFree(pBuffer, 0, MEM_RELEASE);
+}
+
+#else
+
+void* AviWriteBehindOutput::WriterThreadProc(void* pParam)
+{
+    ((AviWriteBehindOutput*)pParam)->WriterThread();
+    return NULL;
+}
+
+
+void AviWriteBehindOutput::Lock(void)
+{
+    pthread_mutex_lock(&m_lock);
+}
+
+
+void AviWriteBehindOutput::Unlock(void)
+{
+    pthread_mutex_unlock(&m_lock);
+}
+
+
+void AviWriteBehindOutput::WaitForRequest(void)
+{
+    pthread_cond_wait(&m_requestQueued, &m_lock);
+}
+
+
+void AviWriteBehindOutput::WaitForCompletion(void)
+{
+    pthread_cond_wait(&m_requestCompleted, &m_lock);
+}
+
+
+void AviWriteBehindOutput::SignalRequest(void)
+{
+    pthread_cond_signal(&m_requestQueued);
+}
+
+
+void AviWriteBehindOutput::SignalCompletion(void)
+{
+    pthread_cond_broadcast(&m_requestCompleted);
+}
+
+
+LONGLONG AviWriteBehindOutput::CurrentMicroseconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (LONGLONG)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+BYTE* AviWriteBehindOutput::AllocateBuffer(void)
+{
+    void* pBuffer = NULL;
+
+    if(posix_memalign(&pBuffer, AVI_WRITE_BEHIND_BUFFER_ALIGNMENT,
+        AVI_WRITE_BEHIND_BUFFER_SIZE) != 0)
+    {
+        return NULL;
+    }
+
+    return (BYTE*)pBuffer;
+}
+
+
+void AviWriteBehindOutput::FreeBuffer(BYTE* pBuffer)
+{
+    free(pBuffer);
+}
+
+#endif
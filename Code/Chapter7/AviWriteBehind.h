@@ -0,0 +1,138 @@
+#pragma once
+
+#include "AviDefs.h"
+#include "AviOutput.h"
+
+#include <vector>
+#include <deque>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+
+// size of the write-behind buffers - every full buffer is handed to the writer thread as a
+// single write, at a file offset that is a multiple of the buffer size
+#define AVI_WRITE_BEHIND_BUFFER_SIZE        (4 * 1024 * 1024)
+
+// alignment of the write-behind buffers in memory
+#define AVI_WRITE_BEHIND_BUFFER_ALIGNMENT   4096
+
+// defaults for the number of full buffers waiting for the writer thread, and for the
+// memory of all of the buffers together - the stage is off unless a depth is configured
+#define AVI_WRITE_BEHIND_DEFAULT_DEPTH      0
+#define AVI_WRITE_BEHIND_DEFAULT_MEMORY     (32ULL * 1024 * 1024)
+
+
+//
+// Statistics of the write-behind stage.  Times are in microseconds.  A stall is a write
+// that had to wait for the writer thread because all of the buffers were full - the total
+// stall time is the time the caller was blocked by the storage.
+//
+struct AviWriteBehindStatistics
+{
+    LONGLONG writes;                    // writes completed by the writer thread
+    LONGLONG bytesWritten;              // bytes written by the writer thread
+    LONGLONG writeTime;                 // time the writer thread spent writing
+    LONGLONG maxWriteTime;              // longest single write
+    LONGLONG stalls;                    // writes that waited for a free buffer
+    LONGLONG stallTime;                 // time spent waiting for free buffers
+    LONGLONG maxStallTime;              // longest single wait for a free buffer
+    LONGLONG maxQueuedBuffers;          // most buffers waiting for the writer thread at once
+};
+
+
+//
+// AviOutput decorator that moves the writes off the calling thread.  The data is copied
+// into large aligned buffers, and every full buffer is queued for a dedicated writer thread
+// that writes it to the wrapped output, while the caller continues with the next buffer.
+// The caller only blocks when all of the buffers are waiting for the writer thread.
+//
+// The stage trades a copy for latency.  Without it the muxer writes large payloads straight
+// from the locked media buffers, and the sink waits for each write.  With it every payload
+// is copied once more, into the write-behind buffers, and the sink only waits when the
+// storage falls behind by more than the queue depth.  The copy is the better deal for
+// storage with long or uneven write times, such as network shares, and a waste for a local
+// disk that keeps up with the stream - which is why the sink does not use the stage unless
+// AVISINK_WRITE_BEHIND_DEPTH asks for it.
+//
+// Writes at offsets before the current buffer - the header patches of the muxer - are
+// queued behind the buffers that may still hold those bytes, so the writer thread applies
+// them in the order in which they were made.  Errors of the writer thread are returned
+// by the next call.
+//
+class AviWriteBehindOutput : public AviOutput
+{
+    public:
+        static HRESULT CreateInstance(AviOutput* pOutput, DWORD queueDepth,
+            ULONGLONG memoryCap, AviWriteBehindOutput** ppOutput);
+        ~AviWriteBehindOutput(void);
+
+        // AviOutput interface implementation
+        HRESULT WriteAt(ULONGLONG offset, const BYTE* pData, DWORD cbData);
+        HRESULT Flush(void);
+        bool IsBuffered(void) const                 { return true; };
+
+        void GetStatistics(AviWriteBehindStatistics* pStatistics);
+        void ResetStatistics(void);
+
+    private:
+        // a write waiting for the writer thread
+        struct WriteRequest
+        {
+            ULONGLONG offset;
+            BYTE* pData;
+            DWORD cbData;
+            bool isBuffer;              // pData is a write-behind buffer, not a patch copy
+        };
+
+        AviWriteBehindOutput(AviOutput* pOutput);
+        HRESULT Init(DWORD bufferCount);
+        HRESULT SubmitBuffer(void);
+        HRESULT QueuePatch(ULONGLONG offset, const BYTE* pData, DWORD cbData);
+        void WriterThread(void);
+
+        void Lock(void);
+        void Unlock(void);
+        void WaitForRequest(void);
+        void WaitForCompletion(void);
+        void SignalRequest(void);
+        void SignalCompletion(void);
+
+        static LONGLONG CurrentMicroseconds(void);
+        static BYTE* AllocateBuffer(void);
+        static void FreeBuffer(BYTE* pBuffer);
+
+        AviOutput* m_pOutput;
+
+        // buffer being filled by the caller - only touched by the calling thread
+        BYTE* m_pBuffer;
+        DWORD m_bufferUsed;
+        ULONGLONG m_bufferOffset;       // file offset of the first byte of the buffer
+
+        // state shared with the writer thread, protected by the lock
+        std::vector<BYTE*> m_buffers;           // every buffer, for freeing
+        std::vector<BYTE*> m_freeBuffers;
+        std::deque<WriteRequest> m_requests;
+        bool m_writing;                 // the writer thread is executing a request
+        bool m_stopping;
+        HRESULT m_writeResult;          // first error of the writer thread
+        AviWriteBehindStatistics m_statistics;
+
+#ifdef _WIN32
+        static DWORD WINAPI WriterThreadProc(LPVOID pParam);
+
+        HANDLE m_hThread;
+        CRITICAL_SECTION m_lock;
+        CONDITION_VARIABLE m_requestQueued;
+        CONDITION_VARIABLE m_requestCompleted;
+#else
+        static void* WriterThreadProc(void* pParam);
+
+        pthread_t m_thread;
+        bool m_threadStarted;
+        pthread_mutex_t m_lock;
+        pthread_cond_t m_requestQueued;
+        pthread_cond_t m_requestCompleted;
+#endif
+};
@@ -0,0 +1,741 @@
+#include "AviDemuxer.h"
+#include "AviProbe.h"
+#include "AviReader.h"
+#include "AviResync.h"
+
+#include "AviTest.h"
+#include "AviTestFile.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+
+
+//
+// Count the OpenDML 'RIFF AVIX' chunks of a file
+//
+static size_t CountExtendedSegments(const vector<BYTE>& file)
+{
+    size_t segments = 0;
+
+    for(size_t x = 0; x + 12 <= file.size(); x++)
+    {
+        if(memcmp(&file[x], "RIFF", 4) == 0 && memcmp(&file[x + 8], "AVIX", 4) == 0)
+        {
+            segments++;
+        }
+    }
+
+    return segments;
+}
+
+
+//
+// Check that the payload of a data chunk is the one the test writer stored
+//
+static bool CheckPayload(AviDemuxer* pDemuxer, DWORD stream, size_t chunk,
+    const AviIndexEntry& entry)
+{
+    vector<BYTE> payload(entry.size);
+
+    AVI_TEST_CHECK(SUCCEEDED(pDemuxer->ReadData(entry.offset, &payload[0], entry.size)));
+
+    for(DWORD x = 0; x < entry.size; x++)
+    {
+        AVI_TEST_CHECK(payload[x] == AviTestPayloadByte(stream, chunk, x));
+    }
+
+    return true;
+}
+
+
+//
+// Check the streams, the sample indexes, the keyframes and every payload byte of a parsed
+// test file against the options it was written with.  A sample index that was built by
+// walking movie data without any index chunks only knows the first frame as a keyframe.
+//
+static bool CheckTestFile(AviDemuxer* pDemuxer, const AviTestFileOptions& options,
+    bool flagsUnknown)
+{
+    const AviStream* pVideo = pDemuxer->GetStream(AVI_TEST_VIDEO_STREAM);
+    size_t keyframes = 0;
+
+    AVI_TEST_CHECK(pDemuxer->StreamCount() == (options.audioChunkSize > 0 ? 2u : 1u));
+    AVI_TEST_CHECK(pDemuxer->TotalFrames() == options.videoFrames);
+    AVI_TEST_CHECK(pDemuxer->MainHeader().dwWidth == 640);
+    AVI_TEST_CHECK(pDemuxer->MainHeader().dwHeight == 480);
+
+    AVI_TEST_CHECK(pVideo != NULL && pVideo->IsVideo());
+    AVI_TEST_CHECK(pVideo->header.dwLength == options.videoFrames);
+    AVI_TEST_CHECK(pVideo->format.size() == 40);
+    AVI_TEST_CHECK(pVideo->index.size() == options.videoFrames);
+
+    for(size_t x = 0; x < pVideo->index.size(); x++)
+    {
+        const AviIndexEntry& entry = pVideo->index[x];
+        bool isKeyframe = flagsUnknown ? (x == 0) : (x % options.keyframeInterval == 0);
+
+        AVI_TEST_CHECK(entry.size == AviTestVideoFrameSize(options, (unsigned int)x));
+        AVI_TEST_CHECK(((entry.flags & AVI_INDEX_KEYFRAME) != 0) == isKeyframe);
+        if(!CheckPayload(pDemuxer, AVI_TEST_VIDEO_STREAM, x, entry))
+        {
+            return false;
+        }
+
+        keyframes += isKeyframe ? 1 : 0;
+    }
+
+    AVI_TEST_CHECK(pVideo->keyframes.size() == keyframes);
+    for(size_t x = 0; x < pVideo->keyframes.size(); x++)
+    {
+        AVI_TEST_CHECK(pVideo->keyframes[x].sample == x * options.keyframeInterval);
+    }
+
+    if(options.audioChunkSize > 0)
+    {
+        const AviStream* pAudio = pDemuxer->GetStream(AVI_TEST_AUDIO_STREAM);
+
+        AVI_TEST_CHECK(pAudio != NULL && pAudio->IsAudio());
+        AVI_TEST_CHECK(pAudio->index.size() == options.videoFrames);
+        AVI_TEST_CHECK(pAudio->totalBytes ==
+            (ULONGLONG)options.videoFrames * options.audioChunkSize);
+        AVI_TEST_CHECK(pAudio->header.dwLength == pAudio->totalBytes / 4);
+
+        for(size_t x = 0; x < pAudio->index.size(); x++)
+        {
+            AVI_TEST_CHECK(pAudio->index[x].streamBytes == x * options.audioChunkSize);
+            if(!CheckPayload(pDemuxer, AVI_TEST_AUDIO_STREAM, x, pAudio->index[x]))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+//
+// Find the payload of the first chunk with the specified FourCC at or after an offset
+//
+static size_t FindChunk(const vector<BYTE>& file, const char* fcc, size_t offset)
+{
+    for(size_t x = offset; x + 8 <= file.size(); x++)
+    {
+        if(memcmp(&file[x], fcc, 4) == 0)
+        {
+            return x + 8;
+        }
+    }
+
+    return file.size();
+}
+
+
+//
+// Empty the 'indx' super indexes of the streams, so that the demuxer has to use 'idx1'
+//
+static bool RemoveSuperIndexes(vector<BYTE>* pFile, unsigned int streams = 2)
+{
+    size_t offset = 0;
+
+    for(unsigned int stream = 0; stream < streams; stream++)
+    {
+        offset = FindChunk(*pFile, "indx", offset);
+        AVI_TEST_CHECK(offset + 8 <= pFile->size());
+
+        // nEntriesInUse follows wLongsPerEntry, bIndexSubType and bIndexType
+        memset(&(*pFile)[offset + 4], 0, 4);
+    }
+
+    return true;
+}
+
+
+//
+// Parse a test file held in memory and check it against the options it was written with
+//
+static bool ParseAndCheck(const vector<BYTE>& file, const AviTestFileOptions& options,
+    bool flagsUnknown = false)
+{
+    AviMemoryReader* pReader = NULL;
+    bool succeeded = false;
+
+    AVI_TEST_CHECK(SUCCEEDED(AviMemoryReader::CreateInstance(&file[0], file.size(), &pReader)));
+
+    {
+        AviDemuxer demuxer(pReader);
+
+        if(SUCCEEDED(demuxer.Parse()))
+        {
+            succeeded = CheckTestFile(&demuxer, options, flagsUnknown);
+        }
+        else
+        {
+            printf("    the file could not be parsed\n");
+        }
+    }
+
+    delete pReader;
+
+    return succeeded;
+}
+
+
+//
+// A file that fits into a single RIFF chunk
+//
+bool TestRoundTrip(void)
+{
+    AviTestFileOptions options = { 60, 5000, 10, 6400, false, 0 };
+    vector<BYTE> file;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &file, NULL));
+    AVI_TEST_CHECK(file.size() < AVI_TEST_SEGMENT_SIZE);
+    AVI_TEST_CHECK(CountExtendedSegments(file) == 0);
+
+    return ParseAndCheck(file, options);
+}
+
+
+//
+// A file that is continued in OpenDML 'AVIX' RIFF chunks
+//
+bool TestRoundTripSegments(void)
+{
+    AviTestFileOptions options = { 300, 20000, 10, 6400, false, 0 };
+    vector<BYTE> file;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &file, NULL));
+    AVI_TEST_CHECK(CountExtendedSegments(file) >= 4);
+
+    return ParseAndCheck(file, options);
+}
+
+
+//
+// Video frames large enough to be written straight from the caller's memory
+//
+bool TestRoundTripLargeChunks(void)
+{
+    AviTestFileOptions options = { 40, 300000, 5, 0, false, 0 };
+    vector<BYTE> file;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &file, NULL));
+    AVI_TEST_CHECK(CountExtendedSegments(file) >= 4);
+
+    return ParseAndCheck(file, options);
+}
+
+
+//
+// Every write that adds to the end of the file starts at a multiple of the block size of
+// the muxer and covers whole blocks, except for the last one - with chunks that are copied
+// into the block buffer, and with chunks that are written straight from the caller's memory
+//
+bool TestBlockAlignedWrites(void)
+{
+    AviTestFileOptions options = { 60, 300001, 5, 6400, false, 0 };
+    ULONGLONG blockSize = AviTestMuxerBlockSize();
+    vector<BYTE> file;
+    vector<AviTestWrite> writes;
+    ULONGLONG fileEnd = 0;
+    size_t appends = 0;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &file, &writes));
+
+    for(size_t x = 0; x < writes.size(); x++)
+    {
+        const AviTestWrite& write = writes[x];
+
+        // header patches go back into data that was already written
+        if(write.offset < fileEnd)
+        {
+            AVI_TEST_CHECK(write.offset + write.data.size() <= fileEnd);
+            continue;
+        }
+
+        AVI_TEST_CHECK(write.offset == fileEnd);
+        AVI_TEST_CHECK(write.offset % blockSize == 0);
+
+        fileEnd += write.data.size();
+        if(fileEnd < file.size())
+        {
+            AVI_TEST_CHECK(write.data.size() % blockSize == 0);
+        }
+
+        appends++;
+    }
+
+    AVI_TEST_CHECK(fileEnd == file.size());
+    AVI_TEST_CHECK(appends > 10);
+
+    return ParseAndCheck(file, options);
+}
+
+
+//
+// The write-behind stage has to produce exactly the same file as the direct writes
+//
+bool TestWriteBehind(void)
+{
+    AviTestFileOptions options = { 300, 50001, 10, 6400, false, 0 };
+    vector<BYTE> direct;
+    vector<BYTE> behind;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &direct, NULL));
+
+    options.writeBehind = true;
+    AVI_TEST_CHECK(AviTestWriteFile(options, &behind, NULL));
+
+    AVI_TEST_CHECK(direct.size() == behind.size());
+    AVI_TEST_CHECK(memcmp(&direct[0], &behind[0], direct.size()) == 0);
+
+    return ParseAndCheck(behind, options);
+}
+
+
+//
+// The index saved to the index cache has to load back into the same sample index, and
+// only for the same file
+//
+bool TestIndexCache(void)
+{
+    AviTestFileOptions options = { 300, 20000, 10, 6400, false, 0 };
+    vector<BYTE> file;
+    vector<BYTE> cache;
+    AviMemoryReader* pReader = NULL;
+    bool succeeded = false;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &file, NULL));
+    AVI_TEST_CHECK(SUCCEEDED(AviMemoryReader::CreateInstance(&file[0], file.size(), &pReader)));
+
+    do
+    {
+        AviDemuxer parsed(pReader);
+        AviDemuxer loaded(pReader);
+        AviDemuxer stale(pReader);
+        AviDemuxer truncated(pReader);
+        vector<BYTE> unaligned;
+
+        if(FAILED(parsed.Parse()) || FAILED(parsed.SaveIndex(1234, &cache)))
+        {
+            printf("    the index could not be saved\n");
+            break;
+        }
+
+        // the cache may be mapped at any address, so load it from an odd one
+        unaligned.resize(cache.size() + 1);
+        memcpy(&unaligned[1], &cache[0], cache.size());
+        if(FAILED(loaded.LoadIndex(1234, &unaligned[1], cache.size())))
+        {
+            printf("    the index could not be loaded\n");
+            break;
+        }
+
+        // a cache that ends partway through the tables must leave nothing behind that
+        // would get in the way of parsing the file instead
+        if(SUCCEEDED(truncated.LoadIndex(1234, &unaligned[1], cache.size() / 2)))
+        {
+            printf("    a truncated index was loaded\n");
+            break;
+        }
+
+        if(FAILED(truncated.Parse()) || !CheckTestFile(&truncated, options, false))
+        {
+            printf("    the file could not be parsed after a truncated index\n");
+            break;
+        }
+
+        if(SUCCEEDED(stale.LoadIndex(1235, &cache[0], cache.size())))
+        {
+            printf("    the index of a modified file was loaded\n");
+            break;
+        }
+
+        if(!loaded.IsIndexStored())
+        {
+            printf("    the loaded index does not come from the indexes of the file\n");
+            break;
+        }
+
+        succeeded = CheckTestFile(&loaded, options, false);
+    }
+    while(false);
+
+    delete pReader;
+
+    return succeeded;
+}
+
+
+//
+// The probe gets the basic properties of a file on disk from its headers
+//
+bool TestProbe(void)
+{
+    AviTestFileOptions options = { 60, 5000, 10, 6400, false, 0 };
+    const wchar_t* path = L"AviTestProbe.avi";
+    AviProbeInfo info;
+    HRESULT hr = S_OK;
+
+    AVI_TEST_CHECK(AviTestWriteDiskFile(options, path));
+
+    hr = AviProbe::ProbeFile(path, &info);
+    remove("AviTestProbe.avi");
+
+    AVI_TEST_CHECK(SUCCEEDED(hr));
+    AVI_TEST_CHECK(info.streamCount == 2);
+    AVI_TEST_CHECK(info.videoStreamCount == 1);
+    AVI_TEST_CHECK(info.audioStreamCount == 1);
+    AVI_TEST_CHECK(info.videoCodec == AVI_FOURCC('M', 'J', 'P', 'G'));
+    AVI_TEST_CHECK(info.width == 640 && info.height == 480);
+    AVI_TEST_CHECK(info.frameRateNumerator == 30 && info.frameRateDenominator == 1);
+    AVI_TEST_CHECK(info.audioFormatTag == 1);
+    AVI_TEST_CHECK(info.audioChannels == 2);
+    AVI_TEST_CHECK(info.audioSampleRate == 48000);
+    AVI_TEST_CHECK(info.duration == 20000000);
+
+    return true;
+}
+
+
+//
+// Without the OpenDML index, the legacy 'idx1' index is used - with its keyframe flags
+//
+bool TestLegacyIndex(void)
+{
+    AviTestFileOptions options = { 60, 5000, 10, 6400, false, 0 };
+    vector<BYTE> file;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &file, NULL));
+    AVI_TEST_CHECK(RemoveSuperIndexes(&file));
+
+    return ParseAndCheck(file, options);
+}
+
+
+//
+// An 'idx1' index with an entry that does not match the file is dropped, and the movie
+// list is walked instead - the walk takes the flags from the 'ix##' standard indexes
+//
+bool TestDamagedLegacyIndex(void)
+{
+    AviTestFileOptions options = { 60, 5000, 10, 6400, false, 0 };
+    vector<BYTE> file;
+    vector<BYTE> damaged;
+    size_t index = 0;
+    DWORD value = 0;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &file, NULL));
+    AVI_TEST_CHECK(RemoveSuperIndexes(&file));
+
+    index = FindChunk(file, "idx1", 0);
+    AVI_TEST_CHECK(index + 2 * options.videoFrames * 16 <= file.size());
+
+    // a chunk in the middle that extends past the end of the movie list
+    damaged = file;
+    value = 0x10000000;
+    memcpy(&damaged[index + 50 * 16 + 12], &value, sizeof(value));
+    if(!ParseAndCheck(damaged, options))
+    {
+        return false;
+    }
+
+    // a chunk in the middle that starts before the movie list
+    damaged = file;
+    value = 0;
+    memcpy(&damaged[index + 50 * 16 + 8], &value, sizeof(value));
+    if(!ParseAndCheck(damaged, options))
+    {
+        return false;
+    }
+
+    // the last chunk moved by a few bytes, inside the movie list
+    damaged = file;
+    memcpy(&value, &damaged[index + (2 * options.videoFrames - 1) * 16 + 8], sizeof(value));
+    value += 2;
+    memcpy(&damaged[index + (2 * options.videoFrames - 1) * 16 + 8], &value, sizeof(value));
+
+    return ParseAndCheck(damaged, options);
+}
+
+
+//
+// Without the 'ix##' standard indexes, the walk takes the flags from the chunks that a
+// damaged 'idx1' index still matches - and without any index, only the first video frame
+// is known to be a keyframe
+//
+bool TestWalkedKeyframes(void)
+{
+    static const char* standardIndexes[] = { "ix00", "ix01" };
+    AviTestFileOptions options = { 60, 5000, 10, 6400, false, 0 };
+    vector<BYTE> file;
+    size_t offset = 0;
+    size_t index = 0;
+    DWORD value = 0x10000000;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &file, NULL));
+    AVI_TEST_CHECK(RemoveSuperIndexes(&file));
+
+    for(int x = 0; x < 2; x++)
+    {
+        offset = FindChunk(file, standardIndexes[x], 0);
+        AVI_TEST_CHECK(offset < file.size());
+
+        memcpy(&file[offset - 8], "JUNK", 4);
+    }
+
+    // the damaged entry is a delta frame, which the walk does not take for a keyframe
+    index = FindChunk(file, "idx1", 0);
+    AVI_TEST_CHECK(index + 2 * options.videoFrames * 16 <= file.size());
+    AVI_TEST_CHECK(memcmp(&file[index + 50 * 16], "00dc", 4) == 0);
+
+    memcpy(&file[index + 50 * 16 + 12], &value, sizeof(value));
+    if(!ParseAndCheck(file, options))
+    {
+        return false;
+    }
+
+    memcpy(&file[index - 8], "JUNK", 4);
+
+    return ParseAndCheck(file, options, true);
+}
+
+
+//
+// Load a file into memory block by block, up to the memory limit, the way a byte stream that
+// cannot be read in place is loaded
+//
+static HRESULT LoadInBlocks(const vector<BYTE>& file, ULONGLONG maxSize,
+    AviMemoryReader** ppReader)
+{
+    const size_t blockSize = 64 * 1024;
+    AviMemoryReader* pReader = NULL;
+    HRESULT hr = AviMemoryReader::CreateInstance(NULL, 0, &pReader);
+
+    if(FAILED(hr))
+    {
+        return hr;
+    }
+
+    pReader->SetMaxSize(maxSize);
+
+    for(size_t offset = 0; offset < file.size() && SUCCEEDED(hr); offset += blockSize)
+    {
+        hr = pReader->Append(&file[offset], min(blockSize, file.size() - offset));
+    }
+
+    *ppReader = pReader;
+
+    return hr;
+}
+
+
+//
+// A file loaded into memory has to parse like the original, and a file that does not fit
+// into the memory limit has to fail with a clear error instead of growing the memory
+//
+bool TestMemoryLoad(void)
+{
+    AviTestFileOptions options = { 300, 20000, 10, 6400, false, 0 };
+    vector<BYTE> file;
+    AviMemoryReader* pReader = NULL;
+    ULONGLONG size = 0;
+    bool succeeded = false;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &file, NULL));
+
+    // one byte too many - the block that crosses the limit is not added
+    AVI_TEST_CHECK(LoadInBlocks(file, file.size() - 1, &pReader) == AVI_E_TOO_LARGE);
+    AVI_TEST_CHECK(SUCCEEDED(pReader->GetSize(&size)));
+    delete pReader;
+    AVI_TEST_CHECK(size < file.size() - 1);
+
+    // no limit, then a limit that the file just fits into
+    AVI_TEST_CHECK(SUCCEEDED(LoadInBlocks(file, 0, &pReader)));
+    delete pReader;
+
+    AVI_TEST_CHECK(SUCCEEDED(LoadInBlocks(file, file.size(), &pReader)));
+
+    {
+        AviDemuxer demuxer(pReader);
+
+        if(SUCCEEDED(demuxer.Parse()))
+        {
+            succeeded = CheckTestFile(&demuxer, options, false);
+        }
+        else
+        {
+            printf("    the file loaded into memory could not be parsed\n");
+        }
+    }
+
+    delete pReader;
+
+    return succeeded;
+}
+
+
+//
+// Check every audio stream of a file with extra audio streams.  The first chunk of the
+// damaged stream, if there is one, is missing.
+//
+static bool CheckAudioStreams(AviDemuxer* pDemuxer, const AviTestFileOptions& options,
+    DWORD damagedStream)
+{
+    AVI_TEST_CHECK(pDemuxer->StreamCount() == 2 + options.extraAudioStreams);
+
+    for(DWORD stream = AVI_TEST_AUDIO_STREAM; stream < pDemuxer->StreamCount(); stream++)
+    {
+        const AviStream* pAudio = pDemuxer->GetStream(stream);
+        size_t missing = (stream == damagedStream) ? 1 : 0;
+
+        AVI_TEST_CHECK(pAudio->IsAudio());
+        AVI_TEST_CHECK(pAudio->index.size() == options.videoFrames - missing);
+
+        for(size_t x = 0; x < pAudio->index.size(); x++)
+        {
+            AVI_TEST_CHECK(pAudio->index[x].size == options.audioChunkSize);
+            if(!CheckPayload(pDemuxer, stream, x + missing, pAudio->index[x]))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+//
+// Parse a test file with extra audio streams held in memory, and check its audio streams
+//
+static bool ParseAndCheckAudioStreams(const vector<BYTE>& file,
+    const AviTestFileOptions& options, DWORD damagedStream)
+{
+    AviMemoryReader* pReader = NULL;
+    bool succeeded = false;
+
+    AVI_TEST_CHECK(SUCCEEDED(AviMemoryReader::CreateInstance(&file[0], file.size(), &pReader)));
+
+    {
+        AviDemuxer demuxer(pReader);
+
+        if(SUCCEEDED(demuxer.Parse()))
+        {
+            succeeded = CheckAudioStreams(&demuxer, options, damagedStream);
+        }
+        else
+        {
+            printf("    the file could not be parsed\n");
+        }
+    }
+
+    delete pReader;
+
+    return succeeded;
+}
+
+
+//
+// The chunk IDs of the streams past the tenth have hexadecimal stream numbers, such as
+// '0Awb' - the indexes, the walk of the movie data, and the search for the next intact
+// chunk header after a damaged one all have to find them
+//
+bool TestManyStreams(void)
+{
+    AviTestFileOptions options = { 30, 5000, 10, 640, false, 11 };
+    vector<BYTE> file;
+    size_t offset = 0;
+    DWORD value = 0x10000000;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &file, NULL));
+    AVI_TEST_CHECK(FindChunk(file, "0Cwb", 0) < file.size());
+
+    if(!ParseAndCheckAudioStreams(file, options, AVI_NO_STREAM))
+    {
+        return false;
+    }
+
+    // without the indexes, the movie list is walked
+    AVI_TEST_CHECK(RemoveSuperIndexes(&file, 2 + options.extraAudioStreams));
+
+    offset = FindChunk(file, "idx1", 0);
+    AVI_TEST_CHECK(offset < file.size());
+    memcpy(&file[offset - 8], "JUNK", 4);
+
+    if(!ParseAndCheckAudioStreams(file, options, AVI_NO_STREAM))
+    {
+        return false;
+    }
+
+    // the walk has to resume at the '0Cwb' chunk that follows a damaged '0Bwb' header -
+    // the index headers in front of the movie data hold the chunk IDs as well
+    offset = FindChunk(file, "0Bwb", FindChunk(file, "movi", 0));
+    AVI_TEST_CHECK(offset < file.size());
+    memcpy(&file[offset - 4], &value, sizeof(value));
+
+    return ParseAndCheckAudioStreams(file, options, 11);
+}
+
+
+//
+// The search for chunk headers finds hexadecimal stream numbers in either case, both in
+// the vectorized part of a block and in its tail
+//
+bool TestChunkCandidates(void)
+{
+    static const char* chunkIds[] = { "0Adc", "0bwb", "1Fdb", "LIST" };
+    BYTE block[64];
+
+    for(int x = 0; x < 4; x++)
+    {
+        for(size_t position = 0; position + 4 <= sizeof(block); position++)
+        {
+            memset(block, 'x', sizeof(block));
+            memcpy(&block[position], chunkIds[x], 4);
+
+            AVI_TEST_CHECK(AviFindChunkCandidate(block, sizeof(block)) == position);
+        }
+    }
+
+    // 'G' is not a hexadecimal digit
+    memset(block, 'x', sizeof(block));
+    memcpy(&block[20], "0Gdc", 4);
+    AVI_TEST_CHECK(AviFindChunkCandidate(block, sizeof(block)) == sizeof(block));
+
+    AVI_TEST_CHECK(AviStreamFromChunkId(AVI_FOURCC('0', 'A', 'd', 'c')) == 10);
+    AVI_TEST_CHECK(AviStreamFromChunkId(AVI_FOURCC('1', 'f', 'w', 'b')) == 31);
+    AVI_TEST_CHECK(AviStreamFromChunkId(AVI_FOURCC('0', 'G', 'd', 'c')) == AVI_NO_STREAM);
+
+    return true;
+}
+
+
+//
+// Sample times of long streams with large rates, whose frame number * dwScale * 10^7 product
+// does not fit into 64 bits
+//
+bool TestSampleTime(void)
+{
+    AviStream stream;
+
+    memset(&stream.header, 0, sizeof(stream.header));
+    stream.header.dwScale = 1000000;
+    stream.header.dwRate = 29970000;
+
+    AVI_TEST_CHECK(stream.SampleTime(0) == 0);
+    AVI_TEST_CHECK(stream.SampleTime(2997) == 1000000000);
+    AVI_TEST_CHECK(stream.SampleTime(2997000000ULL) == 1000000000000000LL);
+    AVI_TEST_CHECK(stream.SampleTime(1) == 333667);
+
+    stream.header.dwScale = 0xFFFFFFFF;
+    stream.header.dwRate = 0xFFFFFFFE;
+    stream.header.dwStart = 0xFFFFFFFE;
+    AVI_TEST_CHECK(stream.SampleTime(0) == 10000000LL * 0xFFFFFFFF);
+
+    return true;
+}
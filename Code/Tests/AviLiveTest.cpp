@@ -0,0 +1,212 @@
+#include "AviDemuxer.h"
+#include "AviReader.h"
+
+#include "AviTest.h"
+#include "AviTestFile.h"
+
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+
+
+//
+// AviReader implementation that exposes a file the way another process sees it while the
+// file is recorded - the writes of the muxer are applied one at a time, in order, including
+// the patches of data that was written earlier
+//
+class AviTestGrowingReader : public AviReader
+{
+    public:
+        void Apply(const AviTestWrite& write)
+        {
+            if(write.offset + write.data.size() > m_data.size())
+            {
+                m_data.resize((size_t)(write.offset + write.data.size()));
+            }
+
+            if(!write.data.empty())
+            {
+                memcpy(&m_data[(size_t)write.offset], &write.data[0], write.data.size());
+            }
+        };
+
+        void Truncate(size_t cbData)                { m_data.resize(cbData); };
+
+        HRESULT ReadAt(ULONGLONG offset, BYTE* pBuffer, DWORD cbToRead, DWORD* pcbRead)
+        {
+            *pcbRead = 0;
+            if(offset < m_data.size())
+            {
+                *pcbRead = (DWORD)min((ULONGLONG)cbToRead, m_data.size() - offset);
+                memcpy(pBuffer, &m_data[(size_t)offset], *pcbRead);
+            }
+
+            return S_OK;
+        };
+
+        HRESULT GetSize(ULONGLONG* pSize)
+        {
+            *pSize = m_data.size();
+            return S_OK;
+        };
+
+    private:
+        vector<BYTE> m_data;
+};
+
+
+//
+// Check that the keyframe table of the video stream holds only real keyframes, and with
+// complete, all of them.  While the file is recorded, the walk knows the keyframes of the
+// chunks that an index it went past covers.
+//
+static bool CheckLiveKeyframes(AviDemuxer* pDemuxer, const AviTestFileOptions& options,
+    bool complete)
+{
+    const AviStream* pVideo = pDemuxer->GetStream(AVI_TEST_VIDEO_STREAM);
+
+    for(size_t x = 0; x < pVideo->keyframes.size(); x++)
+    {
+        AVI_TEST_CHECK(pVideo->keyframes[x].sample % options.keyframeInterval == 0);
+        AVI_TEST_CHECK(!complete || pVideo->keyframes[x].sample == x * options.keyframeInterval);
+    }
+
+    AVI_TEST_CHECK(!complete || pVideo->keyframes.size() ==
+        (pVideo->index.size() + options.keyframeInterval - 1) / options.keyframeInterval);
+
+    return true;
+}
+
+
+//
+// Check the sample index that the walk of a complete live file found - it has to find every
+// chunk with its payload, and the keyframes from the indexes of the file
+//
+static bool CheckLiveIndex(AviDemuxer* pDemuxer, const AviTestFileOptions& options)
+{
+    AVI_TEST_CHECK(pDemuxer->StreamCount() == 2);
+
+    for(DWORD stream = 0; stream < 2; stream++)
+    {
+        const AviStream* pStream = pDemuxer->GetStream(stream);
+        vector<BYTE> payload;
+
+        AVI_TEST_CHECK(pStream->index.size() == options.videoFrames);
+
+        for(size_t x = 0; x < pStream->index.size(); x++)
+        {
+            const AviIndexEntry& entry = pStream->index[x];
+
+            AVI_TEST_CHECK(entry.size == ((stream == AVI_TEST_VIDEO_STREAM) ?
+                AviTestVideoFrameSize(options, (unsigned int)x) : options.audioChunkSize));
+            AVI_TEST_CHECK(((entry.flags & AVI_INDEX_KEYFRAME) != 0) ==
+                (stream != AVI_TEST_VIDEO_STREAM || x % options.keyframeInterval == 0));
+
+            payload.resize(entry.size);
+            AVI_TEST_CHECK(SUCCEEDED(pDemuxer->ReadData(entry.offset, &payload[0], entry.size)));
+            for(DWORD y = 0; y < entry.size; y++)
+            {
+                AVI_TEST_CHECK(payload[y] == AviTestPayloadByte(stream, x, y));
+            }
+        }
+    }
+
+    return CheckLiveKeyframes(pDemuxer, options, true);
+}
+
+
+//
+// Follow a recording of several RIFF chunks write by write - the file has to keep growing
+// past the 'idx1' index of the first RIFF chunk, and end only when the muxer patches the
+// super indexes, which are its last writes
+//
+static bool FollowRecording(bool writeBehind)
+{
+    AviTestFileOptions options = { 300, 20000, 10, 6400, writeBehind, 0 };
+    vector<BYTE> file;
+    vector<AviTestWrite> writes;
+    AviTestGrowingReader reader;
+    AviDemuxer demuxer(&reader);
+    size_t write = 0;
+    size_t lastGrowingWrite = 0;
+    bool grew = false;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &file, &writes));
+
+    // the first write holds all of the headers
+    reader.Apply(writes[write++]);
+    demuxer.SetLiveMode(true);
+    AVI_TEST_CHECK(SUCCEEDED(demuxer.Parse()));
+    AVI_TEST_CHECK(demuxer.IsGrowing());
+
+    while(write < writes.size())
+    {
+        reader.Apply(writes[write++]);
+
+        AVI_TEST_CHECK(SUCCEEDED(demuxer.Refresh(&grew)));
+        if(demuxer.IsGrowing())
+        {
+            lastGrowingWrite = write;
+        }
+
+        if(!CheckLiveKeyframes(&demuxer, options, false))
+        {
+            return false;
+        }
+    }
+
+    // only the entry counts of the super indexes of the two streams come after the data
+    AVI_TEST_CHECK(!demuxer.IsGrowing());
+    AVI_TEST_CHECK(lastGrowingWrite >= writes.size() - 2);
+
+    return CheckLiveIndex(&demuxer, options);
+}
+
+
+bool TestLiveSegments(void)
+{
+    return FollowRecording(false);
+}
+
+
+bool TestLiveWriteBehind(void)
+{
+    return FollowRecording(true);
+}
+
+
+//
+// A complete file that is still being copied, or was truncated, must not end at the point
+// where its data ends - its super indexes point past that point
+//
+bool TestLiveTruncated(void)
+{
+    AviTestFileOptions options = { 300, 20000, 10, 6400, false, 0 };
+    vector<BYTE> file;
+    AviTestWrite whole;
+    AviTestGrowingReader reader;
+    AviDemuxer demuxer(&reader);
+    bool grew = false;
+
+    AVI_TEST_CHECK(AviTestWriteFile(options, &file, NULL));
+
+    whole.offset = 0;
+    whole.data = file;
+    reader.Apply(whole);
+    reader.Truncate(file.size() / 2);
+
+    demuxer.SetLiveMode(true);
+    AVI_TEST_CHECK(SUCCEEDED(demuxer.Parse()));
+    AVI_TEST_CHECK(demuxer.IsGrowing());
+
+    AVI_TEST_CHECK(SUCCEEDED(demuxer.Refresh(&grew)));
+    AVI_TEST_CHECK(demuxer.IsGrowing());
+
+    reader.Apply(whole);
+    AVI_TEST_CHECK(SUCCEEDED(demuxer.Refresh(&grew)));
+    AVI_TEST_CHECK(grew);
+    AVI_TEST_CHECK(!demuxer.IsGrowing());
+
+    return CheckLiveIndex(&demuxer, options);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdio.h>
+
+
+//
+// Minimal test harness for the portable AVI code.  Every test is a function that returns
+// false on the first failed check, after printing the failed condition and its location.
+//
+
+#define AVI_TEST_CHECK(condition)                                                   \
+    if(!(condition))                                                                \
+    {                                                                               \
+        printf("    %s(%d): check failed: %s\n", __FILE__, __LINE__, #condition);  \
+        return false;                                                               \
+    }
+
+
+typedef bool (*AviTestFunction)(void);
+
+struct AviTestCase
+{
+    const char* name;
+    AviTestFunction function;
+};
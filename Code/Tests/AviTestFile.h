@@ -0,0 +1,69 @@
+#pragma once
+
+//
+// Test files written by the native AVI muxer of the sink (Chapter 7) and parsed by the
+// native AVI demuxer of the source (Chapter 6).  The two chapters have their own AviDefs.h,
+// so the writer side and the reader side of the tests are compiled as separate translation
+// units - this header is the only thing they share, and it uses standard types only.
+//
+
+#include <vector>
+
+
+// One write made by the muxer, in the order in which it reached the output
+struct AviTestWrite
+{
+    unsigned long long offset;
+    std::vector<unsigned char> data;
+};
+
+
+// Contents of a test file - a 30 fps MJPG video stream of 640x480 frames, and optionally a
+// 48 kHz stereo PCM audio stream with one audio chunk after every video frame.  Any extra
+// audio streams are copies of the first one, each with its own chunk after every frame.
+struct AviTestFileOptions
+{
+    unsigned int videoFrames;           // number of video frames
+    unsigned int videoFrameSize;        // payload size of the first video frame
+    unsigned int keyframeInterval;      // every n-th video frame is a keyframe
+    unsigned int audioChunkSize;        // payload size of the audio chunks, 0 for no audio
+    bool writeBehind;                   // write through the write-behind stage
+    unsigned int extraAudioStreams;     // number of audio streams after the first one
+};
+
+
+// size of the RIFF chunks of the test muxer - small, so that the tests get OpenDML 'AVIX'
+// segments without writing gigabytes
+#define AVI_TEST_SEGMENT_SIZE       (1024ULL * 1024)
+
+// number of the video and the audio stream in the test files
+#define AVI_TEST_VIDEO_STREAM       0
+#define AVI_TEST_AUDIO_STREAM       1
+
+
+// payload size of the specified video frame - the sizes vary, so that some of the chunks
+// need a padding byte
+inline unsigned int AviTestVideoFrameSize(const AviTestFileOptions& options, unsigned int frame)
+{
+    return options.videoFrameSize + frame % 3;
+}
+
+
+// value of the specified byte of the payload of a data chunk
+inline unsigned char AviTestPayloadByte(unsigned int stream, unsigned long long chunk,
+    unsigned int position)
+{
+    return (unsigned char)(stream * 97 + chunk * 31 + position);
+}
+
+
+// Write a test file in memory.  pWrites, if not NULL, receives every write of the muxer in
+// order, so that a file that is still being recorded can be replayed step by step.
+bool AviTestWriteFile(const AviTestFileOptions& options, std::vector<unsigned char>* pFile,
+    std::vector<AviTestWrite>* pWrites);
+
+// Write a test file to disk with the file output of the sink
+bool AviTestWriteDiskFile(const AviTestFileOptions& options, const wchar_t* path);
+
+// Size of the block buffer of the muxer
+unsigned int AviTestMuxerBlockSize(void);
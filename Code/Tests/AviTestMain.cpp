@@ -0,0 +1,80 @@
+#include "AviTest.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+bool TestRoundTrip(void);
+bool TestRoundTripSegments(void);
+bool TestRoundTripLargeChunks(void);
+bool TestBlockAlignedWrites(void);
+bool TestWriteBehind(void);
+bool TestIndexCache(void);
+bool TestProbe(void);
+bool TestMemoryLoad(void);
+bool TestLegacyIndex(void);
+bool TestDamagedLegacyIndex(void);
+bool TestWalkedKeyframes(void);
+bool TestManyStreams(void);
+bool TestChunkCandidates(void);
+bool TestSampleTime(void);
+bool TestLiveSegments(void);
+bool TestLiveWriteBehind(void);
+bool TestLiveTruncated(void);
+
+
+static const AviTestCase g_tests[] =
+{
+    { "RoundTrip",              TestRoundTrip },
+    { "RoundTripSegments",      TestRoundTripSegments },
+    { "RoundTripLargeChunks",   TestRoundTripLargeChunks },
+    { "BlockAlignedWrites",     TestBlockAlignedWrites },
+    { "WriteBehind",            TestWriteBehind },
+    { "IndexCache",             TestIndexCache },
+    { "Probe",                  TestProbe },
+    { "MemoryLoad",             TestMemoryLoad },
+    { "LegacyIndex",            TestLegacyIndex },
+    { "DamagedLegacyIndex",     TestDamagedLegacyIndex },
+    { "WalkedKeyframes",        TestWalkedKeyframes },
+    { "ManyStreams",            TestManyStreams },
+    { "ChunkCandidates",        TestChunkCandidates },
+    { "SampleTime",             TestSampleTime },
+    { "LiveSegments",           TestLiveSegments },
+    { "LiveWriteBehind",        TestLiveWriteBehind },
+    { "LiveTruncated",          TestLiveTruncated },
+};
+
+
+//
+// Run all of the tests, or only the ones whose names are passed on the command line
+//
+int main(int argc, char** argv)
+{
+    int failed = 0;
+    int run = 0;
+
+    for(size_t x = 0; x < sizeof(g_tests) / sizeof(g_tests[0]); x++)
+    {
+        bool selected = (argc < 2);
+
+        for(int arg = 1; arg < argc; arg++)
+        {
+            selected = selected || (strcmp(argv[arg], g_tests[x].name) == 0);
+        }
+
+        if(!selected)
+        {
+            continue;
+        }
+
+        bool passed = g_tests[x].function();
+        printf("%-24s %s\n", g_tests[x].name, passed ? "passed" : "FAILED");
+
+        run++;
+        failed += passed ? 0 : 1;
+    }
+
+    printf("%d of %d tests passed\n", run - failed, run);
+
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+#include "AviMuxer.h"
+#include "AviOutput.h"
+#include "AviWriteBehind.h"
+
+#include "AviTestFile.h"
+
+#include <string.h>
+
+using namespace std;
+
+
+//
+// AviOutput implementation that builds the file in memory, and optionally records every
+// write in the order in which it was made
+//
+class AviTestMemoryOutput : public AviOutput
+{
+    public:
+        AviTestMemoryOutput(vector<BYTE>* pFile, vector<AviTestWrite>* pWrites) :
+            m_pFile(pFile), m_pWrites(pWrites) {};
+
+        HRESULT WriteAt(ULONGLONG offset, const BYTE* pData, DWORD cbData)
+        {
+            if(offset + cbData > m_pFile->size())
+            {
+                m_pFile->resize((size_t)(offset + cbData));
+            }
+
+            if(cbData > 0)
+            {
+                memcpy(&(*m_pFile)[(size_t)offset], pData, cbData);
+            }
+
+            if(m_pWrites != NULL)
+            {
+                AviTestWrite write;
+                write.offset = offset;
+                write.data.assign(pData, pData + cbData);
+                m_pWrites->push_back(write);
+            }
+
+            return S_OK;
+        };
+
+        // a gather write reaches the file as a single write
+        HRESULT WriteGatherAt(ULONGLONG offset, const AviDataSegment* pSegments,
+            DWORD segmentCount)
+        {
+            vector<BYTE> data;
+
+            for(DWORD x = 0; x < segmentCount; x++)
+            {
+                data.insert(data.end(), pSegments[x].pData,
+                    pSegments[x].pData + pSegments[x].cbData);
+            }
+
+            return WriteAt(offset, data.empty() ? NULL : &data[0], (DWORD)data.size());
+        };
+
+    private:
+        vector<BYTE>* m_pFile;
+        vector<AviTestWrite>* m_pWrites;
+};
+
+
+//
+// Add the streams and write all of the chunks of a test file with the specified muxer
+//
+static bool WriteChunks(const AviTestFileOptions& options, AviMuxer* pMuxer)
+{
+    AviStreamHeader video = {};
+    AviStreamHeader audio = {};
+    BYTE bitmapInfo[40] = {};
+    BYTE waveFormat[18] = {};
+    DWORD videoStream = 0;
+    DWORD audioStream = 0;
+    vector<DWORD> audioStreams;
+    vector<BYTE> payload;
+
+    video.fccType = AVI_FCC_VIDS;
+    video.fccHandler = AVI_FOURCC('M', 'J', 'P', 'G');
+    video.dwScale = 1;
+    video.dwRate = 30;
+    video.rcFrame.right = 640;
+    video.rcFrame.bottom = 480;
+
+    // BITMAPINFOHEADER - 640x480, 24 bits, MJPG
+    *(DWORD*)&bitmapInfo[0] = sizeof(bitmapInfo);
+    *(LONG*)&bitmapInfo[4] = 640;
+    *(LONG*)&bitmapInfo[8] = 480;
+    *(WORD*)&bitmapInfo[12] = 1;
+    *(WORD*)&bitmapInfo[14] = 24;
+    *(DWORD*)&bitmapInfo[16] = AVI_FOURCC('M', 'J', 'P', 'G');
+
+    if(FAILED(pMuxer->AddStream(video, bitmapInfo, sizeof(bitmapInfo), &videoStream)) ||
+        videoStream != AVI_TEST_VIDEO_STREAM)
+    {
+        return false;
+    }
+
+    if(options.audioChunkSize > 0)
+    {
+        // PCM WAVEFORMATEX - 48 kHz, 2 channels, 16 bits
+        *(WORD*)&waveFormat[0] = 1;
+        *(WORD*)&waveFormat[2] = 2;
+        *(DWORD*)&waveFormat[4] = 48000;
+        *(DWORD*)&waveFormat[8] = 192000;
+        *(WORD*)&waveFormat[12] = 4;
+        *(WORD*)&waveFormat[14] = 16;
+
+        audio.fccType = AVI_FCC_AUDS;
+        audio.dwScale = 4;
+        audio.dwRate = 192000;
+        audio.dwSampleSize = 4;
+
+        if(FAILED(pMuxer->AddStream(audio, waveFormat, sizeof(waveFormat), &audioStream)) ||
+            audioStream != AVI_TEST_AUDIO_STREAM)
+        {
+            return false;
+        }
+
+        audioStreams.push_back(audioStream);
+
+        for(unsigned int x = 0; x < options.extraAudioStreams; x++)
+        {
+            if(FAILED(pMuxer->AddStream(audio, waveFormat, sizeof(waveFormat), &audioStream)))
+            {
+                return false;
+            }
+
+            audioStreams.push_back(audioStream);
+        }
+    }
+
+    for(unsigned int frame = 0; frame < options.videoFrames; frame++)
+    {
+        payload.resize(AviTestVideoFrameSize(options, frame));
+        for(unsigned int x = 0; x < payload.size(); x++)
+        {
+            payload[x] = AviTestPayloadByte(videoStream, frame, x);
+        }
+
+        if(FAILED(pMuxer->WriteChunk(videoStream, &payload[0], (DWORD)payload.size(),
+            frame % options.keyframeInterval == 0)))
+        {
+            return false;
+        }
+
+        for(size_t stream = 0; stream < audioStreams.size(); stream++)
+        {
+            payload.resize(options.audioChunkSize);
+            for(unsigned int x = 0; x < payload.size(); x++)
+            {
+                payload[x] = AviTestPayloadByte(audioStreams[stream], frame, x);
+            }
+
+            if(FAILED(pMuxer->WriteChunk(audioStreams[stream], &payload[0],
+                (DWORD)payload.size(), true)))
+            {
+                return false;
+            }
+        }
+    }
+
+    return SUCCEEDED(pMuxer->Finalize());
+}
+
+
+//
+// Write the test file through the specified output, optionally behind the write-behind
+// stage.  The output is deleted with the muxer.
+//
+static bool WriteOutput(const AviTestFileOptions& options, AviOutput* pOutput)
+{
+    AviWriteBehindOutput* pWriteBehind = NULL;
+    bool succeeded = false;
+
+    if(options.writeBehind)
+    {
+        // a small memory cap, so that the caller has to wait for the writer thread
+        if(FAILED(AviWriteBehindOutput::CreateInstance(pOutput, 2,
+            3 * AVI_WRITE_BEHIND_BUFFER_SIZE, &pWriteBehind)))
+        {
+            delete pOutput;
+            return false;
+        }
+
+        pOutput = pWriteBehind;
+    }
+
+    AviMuxer muxer(pOutput);
+    succeeded = WriteChunks(options, &muxer);
+
+    return succeeded;
+}
+
+
+bool AviTestWriteFile(const AviTestFileOptions& options, vector<BYTE>* pFile,
+    vector<AviTestWrite>* pWrites)
+{
+    pFile->clear();
+    if(pWrites != NULL)
+    {
+        pWrites->clear();
+    }
+
+    return WriteOutput(options, new AviTestMemoryOutput(pFile, pWrites));
+}
+
+
+bool AviTestWriteDiskFile(const AviTestFileOptions& options, const wchar_t* path)
+{
+    AviFileOutput* pOutput = NULL;
+
+    if(FAILED(AviFileOutput::CreateInstance(path, &pOutput)))
+    {
+        return false;
+    }
+
+    return WriteOutput(options, pOutput);
+}
+
+
+unsigned int AviTestMuxerBlockSize(void)
+{
+    return AVI_MUXER_BLOCK_SIZE;
+}
@@ -0,0 +1,217 @@
+#include "AviMuxer.h"
+#include "AviOutput.h"
+#include "AviWriteBehind.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+
+
+//
+// Write throughput benchmark of the native AVI muxer - records a capture of one video and
+// two PCM audio streams to a file, and reports the throughput and the writes that reached
+// the file.
+//
+//   AviWriteBench [megabytes] [video frame size] [write-behind depth, 0 for none]
+//
+
+
+//
+// AviOutput decorator that counts the writes that reach the wrapped output
+//
+class AviBenchOutput : public AviOutput
+{
+    public:
+        AviBenchOutput(AviOutput* pOutput) :
+            m_writes(0), m_bytes(0), m_patches(0), m_unalignedWrites(0), m_end(0),
+            m_pOutput(pOutput) {};
+        ~AviBenchOutput(void)                       { delete m_pOutput; };
+
+        HRESULT WriteAt(ULONGLONG offset, const BYTE* pData, DWORD cbData)
+        {
+            Count(offset, cbData);
+            return m_pOutput->WriteAt(offset, pData, cbData);
+        };
+
+        HRESULT WriteGatherAt(ULONGLONG offset, const AviDataSegment* pSegments,
+            DWORD segmentCount)
+        {
+            ULONGLONG cbData = 0;
+
+            for(DWORD x = 0; x < segmentCount; x++)
+            {
+                cbData += pSegments[x].cbData;
+            }
+
+            Count(offset, cbData);
+            return m_pOutput->WriteGatherAt(offset, pSegments, segmentCount);
+        };
+
+        ULONGLONG m_writes;
+        ULONGLONG m_bytes;
+        ULONGLONG m_patches;            // writes into data that was already written
+        ULONGLONG m_unalignedWrites;    // other writes that do not start on a 4 KB boundary
+        ULONGLONG m_end;
+
+    private:
+        void Count(ULONGLONG offset, ULONGLONG cbData)
+        {
+            m_writes++;
+            m_bytes += cbData;
+
+            if(offset < m_end)
+            {
+                m_patches++;
+                return;
+            }
+
+            m_unalignedWrites += (offset % 4096 != 0) ? 1 : 0;
+            m_end = offset + cbData;
+        };
+
+        AviOutput* m_pOutput;
+};
+
+
+static double CurrentSeconds(void)
+{
+    timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char** argv)
+{
+    ULONGLONG megabytes = (argc > 1) ? strtoull(argv[1], NULL, 10) : 1024;
+    DWORD frameSize = (argc > 2) ? (DWORD)strtoul(argv[2], NULL, 10) : 1000001;
+    DWORD queueDepth = (argc > 3) ? (DWORD)strtoul(argv[3], NULL, 10) : 0;
+    const DWORD audioChunkSize = 6400;
+
+    AviFileOutput* pFile = NULL;
+    AviBenchOutput* pCounter = NULL;
+    AviWriteBehindOutput* pWriteBehind = NULL;
+    AviOutput* pOutput = NULL;
+    HRESULT hr = S_OK;
+
+    if(FAILED(AviFileOutput::CreateInstance(L"AviWriteBench.avi", &pFile)))
+    {
+        printf("the output file could not be created\n");
+        return 1;
+    }
+
+    pCounter = new AviBenchOutput(pFile);
+    pOutput = pCounter;
+
+    if(queueDepth > 0)
+    {
+        if(FAILED(AviWriteBehindOutput::CreateInstance(pCounter, queueDepth,
+            AVI_WRITE_BEHIND_DEFAULT_MEMORY, &pWriteBehind)))
+        {
+            printf("the write-behind stage could not be created\n");
+            delete pCounter;
+            return 1;
+        }
+
+        pOutput = pWriteBehind;
+    }
+
+    AviMuxer* pMuxer = new AviMuxer(pOutput);
+    AviStreamHeader video = {};
+    AviStreamHeader audio = {};
+    BYTE bitmapInfo[40] = {};
+    BYTE waveFormat[18] = {};
+    DWORD streams[3] = {};
+
+    video.fccType = AVI_FCC_VIDS;
+    video.fccHandler = AVI_FOURCC('M', 'J', 'P', 'G');
+    video.dwScale = 1;
+    video.dwRate = 30;
+    video.rcFrame.right = 3840;
+    video.rcFrame.bottom = 2160;
+
+    *(DWORD*)&bitmapInfo[0] = sizeof(bitmapInfo);
+    *(LONG*)&bitmapInfo[4] = 3840;
+    *(LONG*)&bitmapInfo[8] = 2160;
+    *(WORD*)&bitmapInfo[12] = 1;
+    *(WORD*)&bitmapInfo[14] = 24;
+    *(DWORD*)&bitmapInfo[16] = AVI_FOURCC('M', 'J', 'P', 'G');
+
+    *(WORD*)&waveFormat[0] = 1;
+    *(WORD*)&waveFormat[2] = 2;
+    *(DWORD*)&waveFormat[4] = 48000;
+    *(DWORD*)&waveFormat[8] = 192000;
+    *(WORD*)&waveFormat[12] = 4;
+    *(WORD*)&waveFormat[14] = 16;
+
+    audio.fccType = AVI_FCC_AUDS;
+    audio.dwScale = 4;
+    audio.dwRate = 192000;
+    audio.dwSampleSize = 4;
+
+    pMuxer->AddStream(video, bitmapInfo, sizeof(bitmapInfo), &streams[0]);
+    pMuxer->AddStream(audio, waveFormat, sizeof(waveFormat), &streams[1]);
+    pMuxer->AddStream(audio, waveFormat, sizeof(waveFormat), &streams[2]);
+
+    vector<BYTE> videoData(frameSize + 2, 0x11);
+    vector<BYTE> audioData(audioChunkSize, 0x22);
+    ULONGLONG target = megabytes * 1024 * 1024;
+    ULONGLONG frames = 0;
+    double start = CurrentSeconds();
+
+    while(SUCCEEDED(hr) && pMuxer->BytesWritten() < target)
+    {
+        // the frame sizes vary a little, like those of compressed video
+        hr = pMuxer->WriteChunk(streams[0], &videoData[0], frameSize + (DWORD)(frames % 3),
+            frames % 30 == 0);
+        for(int x = 1; x < 3 && SUCCEEDED(hr); x++)
+        {
+            hr = pMuxer->WriteChunk(streams[x], &audioData[0], audioChunkSize, true);
+        }
+
+        frames++;
+    }
+
+    if(SUCCEEDED(hr))
+    {
+        hr = pMuxer->Finalize();
+    }
+
+    ULONGLONG bytesWritten = pMuxer->BytesWritten();
+    double seconds = CurrentSeconds() - start;
+
+    if(pWriteBehind != NULL)
+    {
+        AviWriteBehindStatistics statistics;
+
+        pWriteBehind->GetStatistics(&statistics);
+        printf("write-behind: %lld stalls, %.1f ms stalled, at most %lld queued buffers\n",
+            (long long)statistics.stalls, statistics.stallTime / 1000.0,
+            (long long)statistics.maxQueuedBuffers);
+    }
+
+    printf("%llu frames, %.1f MB in %.2f s: %.1f MB/s\n", (unsigned long long)frames,
+        bytesWritten / 1048576.0, seconds, bytesWritten / 1048576.0 / seconds);
+    printf("%llu writes of %.1f KB on average - %llu header patches, %llu other writes "
+        "not 4 KB aligned\n", (unsigned long long)pCounter->m_writes,
+        pCounter->m_bytes / 1024.0 / pCounter->m_writes,
+        (unsigned long long)pCounter->m_patches,
+        (unsigned long long)pCounter->m_unalignedWrites);
+
+    // deletes the outputs as well
+    delete pMuxer;
+    remove("AviWriteBench.avi");
+
+    if(FAILED(hr))
+    {
+        printf("writing failed: 0x%08x\n", (unsigned int)hr);
+        return 1;
+    }
+
+    return 0;
+}